@@ -0,0 +1,319 @@
+/************************************************************************
+*    FILE NAME:       affinebatch2d.cpp
+*
+*    DESCRIPTION:     Batch of 2D sprite transforms in structure of
+*                     arrays form. Composes the size, scaled matrix and
+*                     projection of several sprites at a time with SIMD.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/affinebatch2d.h>
+
+// Standard lib dependencies
+#include <algorithm>
+
+// SIMD lib dependencies
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// GCC and Clang only allow AVX in functions built for it. The rest of
+// the file stays SSE2, GetBestSimdPath keeps the AVX path from running
+// on CPUs without it. MSVC allows it anywhere
+#if defined(_MSC_VER)
+#define AVX_TARGET
+#else
+#define AVX_TARGET __attribute__((target("avx")))
+#endif
+
+// The path Transform uses. Picked once when the program starts
+static CAffineBatch2D::ESimdPath activeSimdPath = CAffineBatch2D::GetBestSimdPath();
+
+/************************************************************************
+*    desc:  Check if a row major scaled matrix only rotates around z.
+*           The quad's vertices have a z of 0, so only those matrices
+*           can be composed with the batch's shortened math
+*
+*	 param:	const float * pMatrix - 16 floats of a row major matrix
+*
+*	 ret:	bool - true if the matrix can be batched
+************************************************************************/
+bool CAffineBatch2D::IsAffine( const float * pMatrix )
+{
+    return (pMatrix[2] == 0.f) && (pMatrix[3] == 0.f) &&
+           (pMatrix[6] == 0.f) && (pMatrix[7] == 0.f) &&
+           (pMatrix[8] == 0.f) && (pMatrix[9] == 0.f) && (pMatrix[11] == 0.f) &&
+           (pMatrix[15] == 1.f);
+
+}	// IsAffine
+
+
+/************************************************************************
+*    desc:  Set the inputs of a sprite
+*
+*	 param:	size_t index          - index of the sprite in the batch
+*			float width, height   - size of the sprite's visual
+*			const float * pMatrix - row major scaled matrix with the translation
+*			bool orthographic     - whether the orthographic projection is used
+************************************************************************/
+void CAffineBatch2D::Set( size_t index, float _width, float _height, const float * pMatrix, bool orthographic )
+{
+    width[index] = _width;
+    height[index] = _height;
+    m11[index] = pMatrix[0];
+    m12[index] = pMatrix[1];
+    m21[index] = pMatrix[4];
+    m22[index] = pMatrix[5];
+    m33[index] = pMatrix[10];
+    m41[index] = pMatrix[12];
+    m42[index] = pMatrix[13];
+    m43[index] = pMatrix[14];
+    projMask[index] = orthographic ? 0xFFFFFFFF : 0;
+
+}	// Set
+
+
+/************************************************************************
+*    desc:  Compose the clip space matrices of the first count sprites.
+*           The result is the same as size * scaled * projection, with
+*           the terms that are always zero left out. The products are
+*           added in the same order, so the paths agree with each other.
+*           The SIMD paths work on whole groups of lanes, so the lanes
+*           past the last sprite are zeroed first instead of being read
+*           uninitialized
+*
+*	 param:	size_t count               - amount of sprites to transform
+*			const float * pPerspective - row major perspective projection
+*			const float * pOrthographic - row major orthographic projection
+************************************************************************/
+void CAffineBatch2D::Transform( size_t count, const float * pPerspective, const float * pOrthographic )
+{
+    const size_t paddedCount = std::min( (count + 7) & ~static_cast<size_t>(7), AFFINE_BATCH_SIZE );
+
+    for( size_t i = count; i < paddedCount; ++i )
+    {
+        width[i] = 0.f;
+        height[i] = 0.f;
+        m11[i] = 0.f;
+        m12[i] = 0.f;
+        m21[i] = 0.f;
+        m22[i] = 0.f;
+        m33[i] = 0.f;
+        m41[i] = 0.f;
+        m42[i] = 0.f;
+        m43[i] = 0.f;
+        projMask[i] = 0;
+    }
+
+    if( activeSimdPath == ESP_AVX )
+        TransformAVX( count, pPerspective, pOrthographic );
+
+    else if( activeSimdPath == ESP_SSE2 )
+        TransformSSE2( count, pPerspective, pOrthographic );
+
+    else
+        TransformScalar( count, pPerspective, pOrthographic );
+
+}	// Transform
+
+
+/************************************************************************
+*    desc:  Transform one sprite at a time
+************************************************************************/
+void CAffineBatch2D::TransformScalar( size_t count, const float * pPerspective, const float * pOrthographic )
+{
+    for( size_t i = 0; i < count; ++i )
+    {
+        const float * pProj = projMask[i] ? pOrthographic : pPerspective;
+
+        const float wa = width[i] * m11[i];
+        const float wb = width[i] * m12[i];
+        const float hc = height[i] * m21[i];
+        const float hd = height[i] * m22[i];
+
+        for( int j = 0; j < 4; ++j )
+        {
+            result[j][i]      = wa * pProj[j] + wb * pProj[4 + j];
+            result[4 + j][i]  = hc * pProj[j] + hd * pProj[4 + j];
+            result[8 + j][i]  = m33[i] * pProj[8 + j];
+            result[12 + j][i] = m41[i] * pProj[j] + m42[i] * pProj[4 + j] + m43[i] * pProj[8 + j] + pProj[12 + j];
+        }
+    }
+
+}	// TransformScalar
+
+
+/************************************************************************
+*    desc:  Transform four sprites at a time. The count is rounded up,
+*           the extra lanes were zeroed and their results are never read
+************************************************************************/
+void CAffineBatch2D::TransformSSE2( size_t count, const float * pPerspective, const float * pOrthographic )
+{
+    // Hoist the projections into registers
+    __m128 persp[16], ortho[16];
+
+    for( int j = 0; j < 16; ++j )
+    {
+        persp[j] = _mm_set1_ps( pPerspective[j] );
+        ortho[j] = _mm_set1_ps( pOrthographic[j] );
+    }
+
+    for( size_t i = 0; i < count; i += 4 )
+    {
+        const __m128 mask = _mm_castsi128_ps( _mm_loadu_si128( reinterpret_cast<const __m128i *>(&projMask[i]) ) );
+
+        const __m128 w = _mm_loadu_ps( &width[i] );
+        const __m128 h = _mm_loadu_ps( &height[i] );
+        const __m128 wa = _mm_mul_ps( w, _mm_loadu_ps( &m11[i] ) );
+        const __m128 wb = _mm_mul_ps( w, _mm_loadu_ps( &m12[i] ) );
+        const __m128 hc = _mm_mul_ps( h, _mm_loadu_ps( &m21[i] ) );
+        const __m128 hd = _mm_mul_ps( h, _mm_loadu_ps( &m22[i] ) );
+        const __m128 sz = _mm_loadu_ps( &m33[i] );
+        const __m128 tx = _mm_loadu_ps( &m41[i] );
+        const __m128 ty = _mm_loadu_ps( &m42[i] );
+        const __m128 tz = _mm_loadu_ps( &m43[i] );
+
+        for( int j = 0; j < 4; ++j )
+        {
+            // Pick the projection of each lane
+            const __m128 p0 = _mm_or_ps( _mm_and_ps( mask, ortho[j] ),      _mm_andnot_ps( mask, persp[j] ) );
+            const __m128 p1 = _mm_or_ps( _mm_and_ps( mask, ortho[4 + j] ),  _mm_andnot_ps( mask, persp[4 + j] ) );
+            const __m128 p2 = _mm_or_ps( _mm_and_ps( mask, ortho[8 + j] ),  _mm_andnot_ps( mask, persp[8 + j] ) );
+            const __m128 p3 = _mm_or_ps( _mm_and_ps( mask, ortho[12 + j] ), _mm_andnot_ps( mask, persp[12 + j] ) );
+
+            _mm_storeu_ps( &result[j][i],     _mm_add_ps( _mm_mul_ps( wa, p0 ), _mm_mul_ps( wb, p1 ) ) );
+            _mm_storeu_ps( &result[4 + j][i], _mm_add_ps( _mm_mul_ps( hc, p0 ), _mm_mul_ps( hd, p1 ) ) );
+            _mm_storeu_ps( &result[8 + j][i], _mm_mul_ps( sz, p2 ) );
+            _mm_storeu_ps( &result[12 + j][i],
+                _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, p0 ), _mm_mul_ps( ty, p1 ) ), _mm_mul_ps( tz, p2 ) ), p3 ) );
+        }
+    }
+
+}	// TransformSSE2
+
+
+/************************************************************************
+*    desc:  Transform eight sprites at a time. The count is rounded up,
+*           the extra lanes were zeroed and their results are never read
+************************************************************************/
+AVX_TARGET void CAffineBatch2D::TransformAVX( size_t count, const float * pPerspective, const float * pOrthographic )
+{
+    // Hoist the projections into registers
+    __m256 persp[16], ortho[16];
+
+    for( int j = 0; j < 16; ++j )
+    {
+        persp[j] = _mm256_set1_ps( pPerspective[j] );
+        ortho[j] = _mm256_set1_ps( pOrthographic[j] );
+    }
+
+    for( size_t i = 0; i < count; i += 8 )
+    {
+        const __m256 mask = _mm256_loadu_ps( reinterpret_cast<const float *>(&projMask[i]) );
+
+        const __m256 w = _mm256_loadu_ps( &width[i] );
+        const __m256 h = _mm256_loadu_ps( &height[i] );
+        const __m256 wa = _mm256_mul_ps( w, _mm256_loadu_ps( &m11[i] ) );
+        const __m256 wb = _mm256_mul_ps( w, _mm256_loadu_ps( &m12[i] ) );
+        const __m256 hc = _mm256_mul_ps( h, _mm256_loadu_ps( &m21[i] ) );
+        const __m256 hd = _mm256_mul_ps( h, _mm256_loadu_ps( &m22[i] ) );
+        const __m256 sz = _mm256_loadu_ps( &m33[i] );
+        const __m256 tx = _mm256_loadu_ps( &m41[i] );
+        const __m256 ty = _mm256_loadu_ps( &m42[i] );
+        const __m256 tz = _mm256_loadu_ps( &m43[i] );
+
+        for( int j = 0; j < 4; ++j )
+        {
+            // Pick the projection of each lane
+            const __m256 p0 = _mm256_blendv_ps( persp[j],      ortho[j],      mask );
+            const __m256 p1 = _mm256_blendv_ps( persp[4 + j],  ortho[4 + j],  mask );
+            const __m256 p2 = _mm256_blendv_ps( persp[8 + j],  ortho[8 + j],  mask );
+            const __m256 p3 = _mm256_blendv_ps( persp[12 + j], ortho[12 + j], mask );
+
+            _mm256_storeu_ps( &result[j][i],     _mm256_add_ps( _mm256_mul_ps( wa, p0 ), _mm256_mul_ps( wb, p1 ) ) );
+            _mm256_storeu_ps( &result[4 + j][i], _mm256_add_ps( _mm256_mul_ps( hc, p0 ), _mm256_mul_ps( hd, p1 ) ) );
+            _mm256_storeu_ps( &result[8 + j][i], _mm256_mul_ps( sz, p2 ) );
+            _mm256_storeu_ps( &result[12 + j][i],
+                _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( tx, p0 ), _mm256_mul_ps( ty, p1 ) ), _mm256_mul_ps( tz, p2 ) ), p3 ) );
+        }
+    }
+
+}	// TransformAVX
+
+
+/************************************************************************
+*    desc:  Set-Get the clip space matrix of a sprite
+*
+*	 param:	size_t index  - index of the sprite in the batch
+*			float * pMatrix - 16 floats of a row major matrix
+************************************************************************/
+void CAffineBatch2D::SetMatrix( size_t index, const float * pMatrix )
+{
+    for( int j = 0; j < 16; ++j )
+        result[j][index] = pMatrix[j];
+
+}	// SetMatrix
+
+void CAffineBatch2D::GetMatrix( size_t index, float * pMatrix ) const
+{
+    for( int j = 0; j < 16; ++j )
+        pMatrix[j] = result[j][index];
+
+}	// GetMatrix
+
+
+/************************************************************************
+*    desc:  Get the fastest path the CPU supports. AVX needs the OS to
+*           save the upper halves of the registers as well
+*
+*	 ret:	ESimdPath - fastest path
+************************************************************************/
+CAffineBatch2D::ESimdPath CAffineBatch2D::GetBestSimdPath()
+{
+#if defined(_MSC_VER)
+    int cpuInfo[4];
+    __cpuid( cpuInfo, 1 );
+
+    const int AVX_BITS = (1 << 27) | (1 << 28);
+
+    // OSXSAVE and AVX, then the OS has to have enabled the XMM and YMM state
+    if( ((cpuInfo[2] & AVX_BITS) == AVX_BITS) && ((_xgetbv( 0 ) & 6) == 6) )
+        return ESP_AVX;
+
+    if( cpuInfo[3] & (1 << 26) )
+        return ESP_SSE2;
+#else
+    // This runs from a static initializer, so the CPU model may not be set up yet.
+    // The AVX check includes the OS saving the YMM state
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports( "avx" ) )
+        return ESP_AVX;
+
+    if( __builtin_cpu_supports( "sse2" ) )
+        return ESP_SSE2;
+#endif
+
+    return ESP_SCALAR;
+
+}	// GetBestSimdPath
+
+
+/************************************************************************
+*    desc:  Set-Get the path Transform uses. Setting a path the CPU
+*           doesn't support will crash, so only set paths up to the
+*           one GetBestSimdPath returns
+************************************************************************/
+void CAffineBatch2D::SetSimdPath( ESimdPath path )
+{
+    activeSimdPath = path;
+
+}	// SetSimdPath
+
+CAffineBatch2D::ESimdPath CAffineBatch2D::GetSimdPath()
+{
+    return activeSimdPath;
+
+}	// GetSimdPath
@@ -0,0 +1,77 @@
+/************************************************************************
+*    FILE NAME:       affinebatch2d.h
+*
+*    DESCRIPTION:     Batch of 2D sprite transforms in structure of
+*                     arrays form. Composes the size, scaled matrix and
+*                     projection of several sprites at a time with SIMD.
+************************************************************************/
+
+#ifndef __affine_batch_2d_h__
+#define __affine_batch_2d_h__
+
+// Standard lib dependencies
+#include <cstddef>
+
+// Game lib dependencies
+#include <common/defs.h>
+
+// Number of sprites in a batch. A multiple of 8 so the AVX path has no remainder
+const size_t AFFINE_BATCH_SIZE = 64;
+
+class CAffineBatch2D
+{
+public:
+
+    // The instruction sets the batch can be transformed with
+    enum ESimdPath
+    {
+        ESP_SCALAR,
+        ESP_SSE2,
+        ESP_AVX
+    };
+
+    // Check if a row major scaled matrix only rotates around z. Only those can be batched
+    static bool IsAffine( const float * pMatrix );
+
+    // Set the inputs of a sprite. The scaled matrix is row major and has to be affine
+    void Set( size_t index, float width, float height, const float * pMatrix, bool orthographic );
+
+    // Compose the clip space matrices of the first count sprites. The projections are row major
+    void Transform( size_t count, const float * pPerspective, const float * pOrthographic );
+
+    // Set-Get the clip space matrix of a sprite, row major. Set is for sprites that aren't affine
+    void SetMatrix( size_t index, const float * pMatrix );
+    void GetMatrix( size_t index, float * pMatrix ) const;
+
+    // Get the fastest path the CPU supports
+    static ESimdPath GetBestSimdPath();
+
+    // Set-Get the path Transform uses. Set is for comparing the paths
+    static void SetSimdPath( ESimdPath path );
+    static ESimdPath GetSimdPath();
+
+private:
+
+    // Transform with each instruction set
+    void TransformScalar( size_t count, const float * pPerspective, const float * pOrthographic );
+    void TransformSSE2( size_t count, const float * pPerspective, const float * pOrthographic );
+    void TransformAVX( size_t count, const float * pPerspective, const float * pOrthographic );
+
+private:
+
+    // The inputs. Rows one and two of the scaled matrix only have x and y, row three only z
+    float width[AFFINE_BATCH_SIZE];
+    float height[AFFINE_BATCH_SIZE];
+    float m11[AFFINE_BATCH_SIZE], m12[AFFINE_BATCH_SIZE];
+    float m21[AFFINE_BATCH_SIZE], m22[AFFINE_BATCH_SIZE];
+    float m33[AFFINE_BATCH_SIZE];
+    float m41[AFFINE_BATCH_SIZE], m42[AFFINE_BATCH_SIZE], m43[AFFINE_BATCH_SIZE];
+
+    // All bits set when the sprite uses the orthographic projection
+    uint projMask[AFFINE_BATCH_SIZE];
+
+    // The clip space matrices. One array per element of the matrix
+    float result[16][AFFINE_BATCH_SIZE];
+};
+
+#endif  // __affine_batch_2d_h__
@@ -0,0 +1,835 @@
+/************************************************************************
+*    FILE NAME:       atlaspacker.cpp
+*
+*    DESCRIPTION:     Packers that place rectangles into an atlas. The
+*                     mega texture packs its components with them. Only
+*                     plain numbers go in and out, so they run without
+*                     a device.
+************************************************************************/
+
+// Physical component dependency
+#include <common/atlaspacker.h>
+
+// Standard lib dependencies
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+
+// A bin that's too low grows by this fraction of its height before the rectangles are packed again
+const int HEIGHT_GROWTH_DIVISOR = 16;
+
+// Names of the packers and the sorts, for the logs
+const char * PACKER_NAME[] = { "MaxRects short side", "MaxRects area", "MaxRects contact point", "skyline" };
+const char * SORT_NAME[] = { "height", "width", "area", "perimeter", "long side" };
+
+// Orders the indexes of the rectangles biggest first. Ties go to the taller rectangle, then the
+// wider one, and the sort is stable, so the order only depends on the sizes
+class CAtlasSortCompare
+{
+public:
+
+    CAtlasSortCompare( const std::vector< CSize<int> > & _sizeVec, EAtlasSort _sort )
+        : sizeVec(_sizeVec), sort(_sort)
+    {}
+
+    bool operator()( size_t a, size_t b ) const
+    {
+        const int keyA = GetKey( sizeVec[a] );
+        const int keyB = GetKey( sizeVec[b] );
+
+        if( keyA != keyB )
+            return keyA > keyB;
+
+        if( sizeVec[a].h != sizeVec[b].h )
+            return sizeVec[a].h > sizeVec[b].h;
+
+        return sizeVec[a].w > sizeVec[b].w;
+    }
+
+private:
+
+    int GetKey( const CSize<int> & size ) const
+    {
+        switch( sort )
+        {
+            case EAS_WIDTH:     return size.w;
+            case EAS_AREA:      return size.w * size.h;
+            case EAS_PERIMETER: return size.w + size.h;
+            case EAS_LONG_SIDE: return std::max( size.w, size.h );
+            default:            return size.h;
+        }
+    }
+
+    const std::vector< CSize<int> > & sizeVec;
+    EAtlasSort sort;
+};
+
+/************************************************************************
+*    desc:  Get the length two ranges share
+************************************************************************/
+static int GetCommonLength( int begin1, int end1, int begin2, int end2 )
+{
+    if( (end1 < begin2) || (end2 < begin1) )
+        return 0;
+
+    return std::min( end1, end2 ) - std::max( begin1, begin2 );
+
+}	// GetCommonLength
+
+
+/************************************************************************
+*    desc:  Check if two rectangles overlap. Touching edges don't
+************************************************************************/
+static bool Intersects( const CAtlasRect & a, const CAtlasRect & b )
+{
+    return (a.x < b.x + b.w) && (b.x < a.x + a.w) && (a.y < b.y + b.h) && (b.y < a.y + a.h);
+
+}	// Intersects
+
+
+/************************************************************************
+*    desc:  Check if a rectangle holds another
+************************************************************************/
+static bool Contains( const CAtlasRect & outer, const CAtlasRect & inner )
+{
+    return (inner.x >= outer.x) && (inner.y >= outer.y) &&
+           (inner.x + inner.w <= outer.x + outer.w) && (inner.y + inner.h <= outer.y + outer.h);
+
+}	// Contains
+
+
+/************************************************************************
+*    desc:  Constructor
+*
+*	 param:	EAtlasPacker _heuristic - how the free rectangle is picked
+************************************************************************/
+CMaxRectsPacker::CMaxRectsPacker( EAtlasPacker _heuristic )
+               : heuristic(_heuristic),
+                 binWidth(0),
+                 binHeight(0)
+{
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Start over with an empty bin
+*
+*	 param:	int width, height - size of the bin
+************************************************************************/
+void CMaxRectsPacker::Reset( int width, int height )
+{
+    binWidth = width;
+    binHeight = height;
+
+    freeVec.clear();
+    freeVec.push_back( CAtlasRect( 0, 0, width, height ) );
+    usedVec.clear();
+
+}	// Reset
+
+
+/************************************************************************
+*    desc:  Place a rectangle in the free rectangle with the best score.
+*           Every placement is at the corner of a free rectangle
+*
+*	 param:	int width, height - size of the rectangle
+*			CPointInt & pos   - where it's placed
+*
+*	 ret:	bool - false if it doesn't fit anywhere
+************************************************************************/
+bool CMaxRectsPacker::Insert( int width, int height, CPointInt & pos )
+{
+    int bestPrimary = std::numeric_limits<int>::max();
+    int bestSecondary = std::numeric_limits<int>::max();
+    size_t bestIndex = freeVec.size();
+
+    for( size_t i = 0; i < freeVec.size(); ++i )
+    {
+        if( (width <= freeVec[i].w) && (height <= freeVec[i].h) )
+        {
+            int primary, secondary;
+            Score( freeVec[i], width, height, primary, secondary );
+
+            if( (primary < bestPrimary) || ((primary == bestPrimary) && (secondary < bestSecondary)) )
+            {
+                bestPrimary = primary;
+                bestSecondary = secondary;
+                bestIndex = i;
+            }
+        }
+    }
+
+    if( bestIndex == freeVec.size() )
+        return false;
+
+    const CAtlasRect placed( freeVec[bestIndex].x, freeVec[bestIndex].y, width, height );
+    Place( placed );
+
+    if( heuristic == EAP_MAXRECTS_CONTACT )
+        usedVec.push_back( placed );
+
+    pos.x = placed.x;
+    pos.y = placed.y;
+
+    return true;
+
+}	// Insert
+
+
+/************************************************************************
+*    desc:  Score a free rectangle for the placement. Lower is better
+*
+*	 param:	const CAtlasRect & freeRect - free rectangle the placement is in
+*			int width, height           - size of the rectangle placed
+*			int & primary, secondary    - the score and the tie breaker
+************************************************************************/
+void CMaxRectsPacker::Score( const CAtlasRect & freeRect, int width, int height, int & primary, int & secondary ) const
+{
+    const int leftoverWidth = freeRect.w - width;
+    const int leftoverHeight = freeRect.h - height;
+
+    switch( heuristic )
+    {
+        case EAP_MAXRECTS_AREA:
+            primary = (freeRect.w * freeRect.h) - (width * height);
+            secondary = std::min( leftoverWidth, leftoverHeight );
+            break;
+
+        case EAP_MAXRECTS_CONTACT:
+            primary = -GetContactScore( freeRect.x, freeRect.y, width, height );
+            secondary = freeRect.y;
+            break;
+
+        default:
+            primary = std::min( leftoverWidth, leftoverHeight );
+            secondary = std::max( leftoverWidth, leftoverHeight );
+            break;
+    }
+
+}	// Score
+
+
+/************************************************************************
+*    desc:  Get how much of a placement's edges touch the edges of the
+*           bin and the placed rectangles
+*
+*	 param:	int x, y, width, height - the placement
+*
+*	 ret:	int - length of the edges touching
+************************************************************************/
+int CMaxRectsPacker::GetContactScore( int x, int y, int width, int height ) const
+{
+    int score = 0;
+
+    if( (x == 0) || (x + width == binWidth) )
+        score += height;
+
+    if( (y == 0) || (y + height == binHeight) )
+        score += width;
+
+    for( size_t i = 0; i < usedVec.size(); ++i )
+    {
+        const CAtlasRect & used = usedVec[i];
+
+        if( (used.x == x + width) || (used.x + used.w == x) )
+            score += GetCommonLength( used.y, used.y + used.h, y, y + height );
+
+        if( (used.y == y + height) || (used.y + used.h == y) )
+            score += GetCommonLength( used.x, used.x + used.w, x, x + width );
+    }
+
+    return score;
+
+}	// GetContactScore
+
+
+/************************************************************************
+*    desc:  Take the placed rectangle out of the free rectangles. Each
+*           free rectangle it overlaps is replaced by the largest parts
+*           of it on each side of the placement. The new parts that
+*           another free rectangle holds are dropped. The old ones
+*           can't be inside a new one, since a new one is inside the
+*           rectangle it was split from
+*
+*	 param:	const CAtlasRect & placed - the placement
+************************************************************************/
+void CMaxRectsPacker::Place( const CAtlasRect & placed )
+{
+    splitVec.clear();
+
+    for( size_t i = 0; i < freeVec.size(); )
+    {
+        const CAtlasRect freeRect = freeVec[i];
+
+        if( !Intersects( freeRect, placed ) )
+        {
+            ++i;
+            continue;
+        }
+
+        if( placed.x > freeRect.x )
+            splitVec.push_back( CAtlasRect( freeRect.x, freeRect.y, placed.x - freeRect.x, freeRect.h ) );
+
+        if( placed.x + placed.w < freeRect.x + freeRect.w )
+            splitVec.push_back( CAtlasRect( placed.x + placed.w, freeRect.y, (freeRect.x + freeRect.w) - (placed.x + placed.w), freeRect.h ) );
+
+        if( placed.y > freeRect.y )
+            splitVec.push_back( CAtlasRect( freeRect.x, freeRect.y, freeRect.w, placed.y - freeRect.y ) );
+
+        if( placed.y + placed.h < freeRect.y + freeRect.h )
+            splitVec.push_back( CAtlasRect( freeRect.x, placed.y + placed.h, freeRect.w, (freeRect.y + freeRect.h) - (placed.y + placed.h) ) );
+
+        // The order of the free rectangles doesn't matter
+        freeVec[i] = freeVec.back();
+        freeVec.pop_back();
+    }
+
+    const size_t oldCount = freeVec.size();
+
+    for( size_t i = 0; i < splitVec.size(); ++i )
+    {
+        bool contained = false;
+
+        for( size_t j = 0; (j < oldCount) && !contained; ++j )
+            contained = Contains( freeVec[j], splitVec[i] );
+
+        // Of two equal parts, only the first is kept
+        for( size_t j = 0; (j < splitVec.size()) && !contained; ++j )
+            contained = (j != i) && Contains( splitVec[j], splitVec[i] ) && ((j < i) || !Contains( splitVec[i], splitVec[j] ));
+
+        if( !contained )
+            freeVec.push_back( splitVec[i] );
+    }
+
+}	// Place
+
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CSkylinePacker::CSkylinePacker()
+              : binWidth(0),
+                binHeight(0)
+{
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Start over with an empty bin
+*
+*	 param:	int width, height - size of the bin
+************************************************************************/
+void CSkylinePacker::Reset( int width, int height )
+{
+    binWidth = width;
+    binHeight = height;
+
+    skylineVec.clear();
+    skylineVec.push_back( CSkylineNode( 0, 0, width ) );
+
+}	// Reset
+
+
+/************************************************************************
+*    desc:  Place a rectangle where it reaches the least far into the
+*           bin. Ties go to the narrower level, so wide levels are left
+*           for wide rectangles
+*
+*	 param:	int width, height - size of the rectangle
+*			CPointInt & pos   - where it's placed
+*
+*	 ret:	bool - false if it doesn't fit anywhere
+************************************************************************/
+bool CSkylinePacker::Insert( int width, int height, CPointInt & pos )
+{
+    int bestBottom = std::numeric_limits<int>::max();
+    int bestWidth = std::numeric_limits<int>::max();
+    int bestY = 0;
+    size_t bestIndex = skylineVec.size();
+
+    for( size_t i = 0; i < skylineVec.size(); ++i )
+    {
+        int y;
+        if( Fit( i, width, height, y ) )
+        {
+            if( (y + height < bestBottom) || ((y + height == bestBottom) && (skylineVec[i].width < bestWidth)) )
+            {
+                bestBottom = y + height;
+                bestWidth = skylineVec[i].width;
+                bestY = y;
+                bestIndex = i;
+            }
+        }
+    }
+
+    if( bestIndex == skylineVec.size() )
+        return false;
+
+    pos.x = skylineVec[bestIndex].x;
+    pos.y = bestY;
+
+    // The rectangle becomes a level. The levels it covers are cut back or dropped
+    skylineVec.insert( skylineVec.begin() + bestIndex, CSkylineNode( pos.x, bestBottom, width ) );
+
+    for( size_t i = bestIndex + 1; i < skylineVec.size(); )
+    {
+        const int overlap = (skylineVec[i - 1].x + skylineVec[i - 1].width) - skylineVec[i].x;
+
+        if( overlap <= 0 )
+            break;
+
+        skylineVec[i].x += overlap;
+        skylineVec[i].width -= overlap;
+
+        if( skylineVec[i].width > 0 )
+            break;
+
+        skylineVec.erase( skylineVec.begin() + i );
+    }
+
+    // Join the levels next to each other at the same depth
+    for( size_t i = 0; i + 1 < skylineVec.size(); )
+    {
+        if( skylineVec[i].y == skylineVec[i + 1].y )
+        {
+            skylineVec[i].width += skylineVec[i + 1].width;
+            skylineVec.erase( skylineVec.begin() + i + 1 );
+        }
+        else
+            ++i;
+    }
+
+    return true;
+
+}	// Insert
+
+
+/************************************************************************
+*    desc:  Get where a rectangle would sit if its left edge were at the
+*           start of a level. It rests on the deepest level it spans
+*
+*	 param:	size_t index      - the level
+*			int width, height - size of the rectangle
+*			int & y           - where its top would be
+*
+*	 ret:	bool - false if it doesn't fit in the bin there
+************************************************************************/
+bool CSkylinePacker::Fit( size_t index, int width, int height, int & y ) const
+{
+    if( skylineVec[index].x + width > binWidth )
+        return false;
+
+    int widthLeft = width;
+    y = skylineVec[index].y;
+
+    for( size_t i = index; widthLeft > 0; ++i )
+    {
+        y = std::max( y, skylineVec[i].y );
+
+        if( y + height > binHeight )
+            return false;
+
+        widthLeft -= skylineVec[i].width;
+    }
+
+    return true;
+
+}	// Fit
+
+
+/************************************************************************
+*    desc:  Get the indexes of the rectangles in the order they're packed
+************************************************************************/
+static void SortRects( const std::vector< CSize<int> > & sizeVec, EAtlasSort sort, std::vector<size_t> & orderVec )
+{
+    orderVec.resize( sizeVec.size() );
+    for( size_t i = 0; i < orderVec.size(); ++i )
+        orderVec[i] = i;
+
+    std::stable_sort( orderVec.begin(), orderVec.end(), CAtlasSortCompare( sizeVec, sort ) );
+
+}	// SortRects
+
+
+// An edge of a rectangle the overlap sweep passes. The sweep goes page by page, left to right,
+// and takes the right edges before the left ones at the same x, so rectangles that only touch
+// never see each other
+class CSweepEvent
+{
+public:
+
+    CSweepEvent( uint _page, int _x, bool _start, size_t _index )
+        : page(_page), x(_x), start(_start), index(_index)
+    {}
+
+    bool operator<( const CSweepEvent & other ) const
+    {
+        if( page != other.page )
+            return page < other.page;
+
+        if( x != other.x )
+            return x < other.x;
+
+        if( start != other.start )
+            return !start;
+
+        return index < other.index;
+    }
+
+    uint page;
+    int x;
+    bool start;
+    size_t index;
+};
+
+// Interval tree of the y spans of the rectangles the sweep is in. The nodes are fixed ahead
+// of time, a balanced tree over every y edge, so only the spans in the nodes change. A span
+// sits in the highest node whose center it holds. Each node keeps its spans sorted by both
+// ends, so the spans holding a y are read off the ends of the sorted sets
+class CIntervalTree
+{
+public:
+
+    // A span sorted by one of its ends, with the index of its rectangle
+    typedef std::pair<int, size_t> CSpanEnd;
+    typedef std::set<CSpanEnd> SpanEndSet;
+
+    CIntervalTree( const std::vector<int> & _centerVec )
+        : centerVec(_centerVec), lowSetVec(_centerVec.size()), highSetVec(_centerVec.size())
+    {}
+
+    // Add or take out the span [low, high) of a rectangle. Both ends have to be centers
+    void Insert( int low, int high, size_t index )
+    {
+        const size_t node = FindNode( low, high );
+        lowSetVec[node].insert( CSpanEnd( low, index ) );
+        highSetVec[node].insert( CSpanEnd( high, index ) );
+    }
+
+    void Erase( int low, int high, size_t index )
+    {
+        const size_t node = FindNode( low, high );
+        lowSetVec[node].erase( CSpanEnd( low, index ) );
+        highSetVec[node].erase( CSpanEnd( high, index ) );
+    }
+
+    // Add the rectangles whose span holds y
+    void Stab( int y, std::vector<size_t> & indexVec ) const
+    {
+        size_t first = 0, last = centerVec.size();
+
+        while( first < last )
+        {
+            const size_t node = first + ((last - first) / 2);
+
+            if( y < centerVec[node] )
+            {
+                // Every span here ends past the center, so the ones starting at or before y hold it
+                for( SpanEndSet::const_iterator iter = lowSetVec[node].begin(); 
+                     (iter != lowSetVec[node].end()) && (iter->first <= y); ++iter )
+                    indexVec.push_back( iter->second );
+
+                last = node;
+            }
+            else
+            {
+                // Every span here starts at or before the center, so the ones ending past y hold it
+                for( SpanEndSet::const_reverse_iterator iter = highSetVec[node].rbegin(); 
+                     (iter != highSetVec[node].rend()) && (iter->first > y); ++iter )
+                    indexVec.push_back( iter->second );
+
+                first = node + 1;
+            }
+        }
+    }
+
+private:
+
+    // Get the node of a span. The search stops at the first center the span holds
+    size_t FindNode( int low, int high ) const
+    {
+        size_t first = 0, last = centerVec.size();
+        size_t node = first + ((last - first) / 2);
+
+        while( (centerVec[node] < low) || (centerVec[node] >= high) )
+        {
+            if( centerVec[node] >= high )
+                last = node;
+            else
+                first = node + 1;
+
+            node = first + ((last - first) / 2);
+        }
+
+        return node;
+    }
+
+private:
+
+    // The centers of the nodes in order. The root is in the middle
+    const std::vector<int> & centerVec;
+
+    // The spans of each node sorted by their start and by their end
+    std::vector<SpanEndSet> lowSetVec;
+    std::vector<SpanEndSet> highSetVec;
+};
+
+
+namespace NAtlasPacker
+{
+    /************************************************************************
+    *    desc:  Pack rectangles into the least height they fit in. The bin
+    *           starts at the height the rectangles' area needs and grows a
+    *           little each time they don't fit
+    *
+    *	 param:	EAtlasPacker packer                 - packer to place them with
+    *			EAtlasSort sort                     - order to place them in
+    *			int width                           - width of the bin
+    *			int maxHeight                       - most height of the bin
+    *			const vector< CSize<int> > & sizeVec - sizes of the rectangles
+    *			vector<CPointInt> & posVec           - where each one is placed
+    *			CSize<int> & usedSize               - how far the placements reach
+    *
+    *	 ret:	bool - false if they don't fit
+    ************************************************************************/
+    bool Pack( EAtlasPacker packer, EAtlasSort sort, int width, int maxHeight,
+               const std::vector< CSize<int> > & sizeVec,
+               std::vector<CPointInt> & posVec,
+               CSize<int> & usedSize )
+    {
+        posVec.assign( sizeVec.size(), CPointInt() );
+        usedSize = CSize<int>( 0, 0 );
+
+        if( sizeVec.empty() )
+            return true;
+
+        // The bin can't be lower than the tallest rectangle or than their area over the width
+        double area = 0;
+        int height = 0;
+
+        for( size_t i = 0; i < sizeVec.size(); ++i )
+        {
+            if( sizeVec[i].w > width )
+                return false;
+
+            area += static_cast<double>(sizeVec[i].w) * sizeVec[i].h;
+            height = std::max( height, sizeVec[i].h );
+        }
+
+        height = std::max( height, static_cast<int>(std::ceil( area / width )) );
+
+        if( height > maxHeight )
+            return false;
+
+        std::vector<size_t> orderVec;
+        SortRects( sizeVec, sort, orderVec );
+
+        CMaxRectsPacker maxRectsPacker( packer );
+        CSkylinePacker skylinePacker;
+        CAtlasPacker & atlasPacker = (packer == EAP_SKYLINE) ? static_cast<CAtlasPacker &>(skylinePacker) : maxRectsPacker;
+
+        for( ;; )
+        {
+            atlasPacker.Reset( width, height );
+
+            size_t placedCount = 0;
+            while( (placedCount < orderVec.size()) &&
+                   atlasPacker.Insert( sizeVec[orderVec[placedCount]].w, sizeVec[orderVec[placedCount]].h, posVec[orderVec[placedCount]] ) )
+            {
+                ++placedCount;
+            }
+
+            if( placedCount == orderVec.size() )
+                break;
+
+            if( height == maxHeight )
+                return false;
+
+            height = std::min( height + std::max( height / HEIGHT_GROWTH_DIVISOR, 1 ), maxHeight );
+        }
+
+        for( size_t i = 0; i < sizeVec.size(); ++i )
+        {
+            usedSize.w = std::max( usedSize.w, posVec[i].x + sizeVec[i].w );
+            usedSize.h = std::max( usedSize.h, posVec[i].y + sizeVec[i].h );
+        }
+
+        return true;
+
+    }	// Pack
+
+
+    /************************************************************************
+    *    desc:  Pack rectangles onto as many pages as they need. A failed
+    *           insert leaves the packer as it was, so packing a full page
+    *           again in the same order places the same rectangles
+    *
+    *	 param:	EAtlasPacker packer                      - packer to place them with
+    *			EAtlasSort sort                          - order to place them in
+    *			int width, maxHeight                     - most size of a page
+    *			const vector< CSize<int> > & sizeVec      - sizes of the rectangles
+    *			vector<CPointInt> & posVec                - where each one is placed
+    *			vector<uint> & pageVec                    - the page each one is on
+    *			vector< CSize<int> > & pageSizeVec        - how far the placements on
+    *                                                      each page reach
+    *
+    *	 ret:	bool - false if a rectangle doesn't fit on a page
+    ************************************************************************/
+    bool PackPages( EAtlasPacker packer, EAtlasSort sort, int width, int maxHeight,
+                    const std::vector< CSize<int> > & sizeVec,
+                    std::vector<CPointInt> & posVec,
+                    std::vector<uint> & pageVec,
+                    std::vector< CSize<int> > & pageSizeVec )
+    {
+        posVec.assign( sizeVec.size(), CPointInt() );
+        pageVec.assign( sizeVec.size(), 0 );
+        pageSizeVec.clear();
+
+        for( size_t i = 0; i < sizeVec.size(); ++i )
+            if( (sizeVec[i].w > width) || (sizeVec[i].h > maxHeight) )
+                return false;
+
+        std::vector<size_t> orderVec, leftVec, pageIndexVec;
+        SortRects( sizeVec, sort, orderVec );
+
+        CMaxRectsPacker maxRectsPacker( packer );
+        CSkylinePacker skylinePacker;
+        CAtlasPacker & atlasPacker = (packer == EAP_SKYLINE) ? static_cast<CAtlasPacker &>(skylinePacker) : maxRectsPacker;
+
+        std::vector< CSize<int> > pageRectVec;
+        std::vector<CPointInt> pagePosVec;
+
+        while( !orderVec.empty() )
+        {
+            // Fill a whole page with the rectangles that still fit. The first one always does
+            atlasPacker.Reset( width, maxHeight );
+            pageIndexVec.clear();
+            leftVec.clear();
+
+            for( size_t i = 0; i < orderVec.size(); ++i )
+            {
+                CPointInt pos;
+
+                if( atlasPacker.Insert( sizeVec[orderVec[i]].w, sizeVec[orderVec[i]].h, pos ) )
+                    pageIndexVec.push_back( orderVec[i] );
+                else
+                    leftVec.push_back( orderVec[i] );
+            }
+
+            // Pack the page again into the least height it takes
+            pageRectVec.resize( pageIndexVec.size() );
+            for( size_t i = 0; i < pageIndexVec.size(); ++i )
+                pageRectVec[i] = sizeVec[pageIndexVec[i]];
+
+            CSize<int> pageSize;
+            if( !Pack( packer, sort, width, maxHeight, pageRectVec, pagePosVec, pageSize ) )
+                return false;
+
+            for( size_t i = 0; i < pageIndexVec.size(); ++i )
+            {
+                posVec[pageIndexVec[i]] = pagePosVec[i];
+                pageVec[pageIndexVec[i]] = static_cast<uint>(pageSizeVec.size());
+            }
+
+            pageSizeVec.push_back( pageSize );
+            orderVec.swap( leftVec );
+        }
+
+        return true;
+
+    }	// PackPages
+
+
+    /************************************************************************
+    *    desc:  Find every pair of rectangles on the same page that overlap.
+    *           A sweep goes across x and keeps the rectangles it's in.
+    *           When it reaches a rectangle, the ones it's in that overlap
+    *           it on y either hold its top edge, read off the interval
+    *           tree, or start inside it, read off the spans sorted by
+    *           their start. The two never give the same rectangle, so
+    *           every pair comes up once, when the later one is reached
+    *
+    *	 param:	const vector<CAtlasRect> & rectVec  - rectangles to check
+    *			const vector<uint> & pageVec         - the page each one is on
+    *			vector< pair<size_t, size_t> > & overlapVec - the pairs that overlap
+    ************************************************************************/
+    void FindOverlaps( const std::vector<CAtlasRect> & rectVec,
+                       const std::vector<uint> & pageVec,
+                       std::vector< std::pair<size_t, size_t> > & overlapVec )
+    {
+        overlapVec.clear();
+
+        std::vector<CSweepEvent> eventVec;
+        std::vector<int> centerVec;
+        eventVec.reserve( rectVec.size() * 2 );
+        centerVec.reserve( rectVec.size() * 2 );
+
+        for( size_t i = 0; i < rectVec.size(); ++i )
+        {
+            const CAtlasRect & rect = rectVec[i];
+
+            if( (rect.w > 0) && (rect.h > 0) )
+            {
+                eventVec.push_back( CSweepEvent( pageVec[i], rect.x, true, i ) );
+                eventVec.push_back( CSweepEvent( pageVec[i], rect.x + rect.w, false, i ) );
+                centerVec.push_back( rect.y );
+                centerVec.push_back( rect.y + rect.h );
+            }
+        }
+
+        std::sort( eventVec.begin(), eventVec.end() );
+        std::sort( centerVec.begin(), centerVec.end() );
+        centerVec.erase( std::unique( centerVec.begin(), centerVec.end() ), centerVec.end() );
+
+        // The rectangles the sweep is in, in the tree and sorted by the top of their span.
+        // Every page ends with all of its rectangles taken out
+        CIntervalTree spanTree( centerVec );
+        CIntervalTree::SpanEndSet startSet;
+        std::vector<size_t> hitVec;
+
+        for( size_t i = 0; i < eventVec.size(); ++i )
+        {
+            const size_t index = eventVec[i].index;
+            const CAtlasRect & rect = rectVec[index];
+
+            if( !eventVec[i].start )
+            {
+                spanTree.Erase( rect.y, rect.y + rect.h, index );
+                startSet.erase( CIntervalTree::CSpanEnd( rect.y, index ) );
+                continue;
+            }
+
+            hitVec.clear();
+            spanTree.Stab( rect.y, hitVec );
+
+            for( CIntervalTree::SpanEndSet::const_iterator iter = startSet.upper_bound( CIntervalTree::CSpanEnd( rect.y, std::numeric_limits<size_t>::max() ) );
+                 (iter != startSet.end()) && (iter->first < rect.y + rect.h); ++iter )
+                hitVec.push_back( iter->second );
+
+            for( size_t j = 0; j < hitVec.size(); ++j )
+                overlapVec.push_back( std::make_pair( std::min( index, hitVec[j] ), std::max( index, hitVec[j] ) ) );
+
+            spanTree.Insert( rect.y, rect.y + rect.h, index );
+            startSet.insert( CIntervalTree::CSpanEnd( rect.y, index ) );
+        }
+
+    }	// FindOverlaps
+
+
+    /************************************************************************
+    *    desc:  Get the name of a packer and a sort, for the logs
+    ************************************************************************/
+    const char * GetPackerName( EAtlasPacker packer )
+    {
+        return PACKER_NAME[packer];
+
+    }	// GetPackerName
+
+    const char * GetSortName( EAtlasSort sort )
+    {
+        return SORT_NAME[sort];
+
+    }	// GetSortName
+
+}	// NAtlasPacker
@@ -0,0 +1,207 @@
+/************************************************************************
+*    FILE NAME:       atlaspacker.h
+*
+*    DESCRIPTION:     Packers that place rectangles into an atlas. The
+*                     mega texture packs its components with them. Only
+*                     plain numbers go in and out, so they run without
+*                     a device.
+************************************************************************/
+
+#ifndef __atlas_packer_h__
+#define __atlas_packer_h__
+
+// Standard lib dependencies
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Game lib dependencies
+#include <common/pointint.h>
+#include <common/size.h>
+#include <common/defs.h>
+
+// The packers and how they pick where a rectangle goes
+enum EAtlasPacker
+{
+    // MaxRects. The free rectangle that leaves the least room on its shorter side
+    EAP_MAXRECTS_SHORT_SIDE,
+
+    // MaxRects. The free rectangle that leaves the least area
+    EAP_MAXRECTS_AREA,
+
+    // MaxRects. The spot that touches the most edges of the atlas and of the rectangles
+    // already placed. The tightest, but the slowest with many rectangles
+    EAP_MAXRECTS_CONTACT,
+
+    // Skyline. The spot where the rectangle reaches the least far into the atlas. The fastest
+    EAP_SKYLINE
+};
+
+// The order the rectangles are packed in. Each one puts the biggest first
+enum EAtlasSort
+{
+    EAS_HEIGHT,
+    EAS_WIDTH,
+    EAS_AREA,
+    EAS_PERIMETER,
+    EAS_LONG_SIDE
+};
+
+// A rectangle of the atlas
+class CAtlasRect
+{
+public:
+
+    CAtlasRect()
+        : x(0), y(0), w(0), h(0)
+    {}
+
+    CAtlasRect( int _x, int _y, int _w, int _h )
+        : x(_x), y(_y), w(_w), h(_h)
+    {}
+
+    int x, y, w, h;
+};
+
+//////////////////////////////////////////////////////////////
+//	Base of the packers. A packer places rectangles one at a
+//  time into a bin of a fixed size and never moves them
+//////////////////////////////////////////////////////////////
+class CAtlasPacker
+{
+public:
+
+    // Destructor
+    virtual ~CAtlasPacker()
+    {}
+
+    // Start over with an empty bin
+    virtual void Reset( int width, int height ) = 0;
+
+    // Place a rectangle. Returns false if it doesn't fit anywhere
+    virtual bool Insert( int width, int height, CPointInt & pos ) = 0;
+};
+
+//////////////////////////////////////////////////////////////
+//	MaxRects packer. Keeps every largest free rectangle, so a
+//  placement can use any free space. The free rectangles
+//  overlap each other
+//////////////////////////////////////////////////////////////
+class CMaxRectsPacker : public CAtlasPacker
+{
+public:
+
+    // Constructor. The packer has to be one of the MaxRects ones
+    CMaxRectsPacker( EAtlasPacker heuristic );
+
+    // Start over with an empty bin
+    virtual void Reset( int width, int height );
+
+    // Place a rectangle. Returns false if it doesn't fit anywhere
+    virtual bool Insert( int width, int height, CPointInt & pos );
+
+private:
+
+    // Score a free rectangle for the placement. Lower is better
+    void Score( const CAtlasRect & freeRect, int width, int height, int & primary, int & secondary ) const;
+
+    // Get how much of a placement's edges touch the bin and the placed rectangles
+    int GetContactScore( int x, int y, int width, int height ) const;
+
+    // Take the placed rectangle out of the free rectangles
+    void Place( const CAtlasRect & placed );
+
+private:
+
+    // How the free rectangle is picked
+    EAtlasPacker heuristic;
+
+    // Size of the bin
+    int binWidth, binHeight;
+
+    // The largest free rectangles
+    std::vector<CAtlasRect> freeVec;
+
+    // Free rectangles split off by the last placement. Kept to reuse the memory
+    std::vector<CAtlasRect> splitVec;
+
+    // The placed rectangles. Only kept for the contact score
+    std::vector<CAtlasRect> usedVec;
+};
+
+//////////////////////////////////////////////////////////////
+//	Skyline packer. Keeps the far edge of what's been placed,
+//  so the rectangles stack up from the top of the bin. The
+//  space cut off by an overhang is lost
+//////////////////////////////////////////////////////////////
+class CSkylinePacker : public CAtlasPacker
+{
+public:
+
+    // Constructor
+    CSkylinePacker();
+
+    // Start over with an empty bin
+    virtual void Reset( int width, int height );
+
+    // Place a rectangle. Returns false if it doesn't fit anywhere
+    virtual bool Insert( int width, int height, CPointInt & pos );
+
+private:
+
+    // A level of the skyline
+    class CSkylineNode
+    {
+    public:
+
+        CSkylineNode( int _x, int _y, int _width )
+            : x(_x), y(_y), width(_width)
+        {}
+
+        int x, y, width;
+    };
+
+    // Get where a rectangle would sit if it started at a node. Returns false if it doesn't fit
+    bool Fit( size_t index, int width, int height, int & y ) const;
+
+private:
+
+    // Size of the bin
+    int binWidth, binHeight;
+
+    // The levels of the skyline from left to right
+    std::vector<CSkylineNode> skylineVec;
+};
+
+namespace NAtlasPacker
+{
+    // Pack rectangles into a bin of the width given and the least height it takes, up to the
+    // most height given. The positions are in the order of the sizes. Returns false if they
+    // don't fit. The used size is how far the placed rectangles reach
+    bool Pack( EAtlasPacker packer, EAtlasSort sort, int width, int maxHeight,
+               const std::vector< CSize<int> > & sizeVec,
+               std::vector<CPointInt> & posVec,
+               CSize<int> & usedSize );
+
+    // Pack rectangles onto as many pages of the width and height given as they need. Every
+    // page is filled in turn with the rectangles that still fit on it, then packed again into
+    // the least height it takes. Returns false if a rectangle doesn't fit on a page by itself
+    bool PackPages( EAtlasPacker packer, EAtlasSort sort, int width, int maxHeight,
+                    const std::vector< CSize<int> > & sizeVec,
+                    std::vector<CPointInt> & posVec,
+                    std::vector<uint> & pageVec,
+                    std::vector< CSize<int> > & pageSizeVec );
+
+    // Find every pair of rectangles on the same page that overlap, in O(n log n + k) for k
+    // pairs. Rectangles that only share an edge don't overlap and empty ones overlap nothing.
+    // Each pair is given once with the lower index first
+    void FindOverlaps( const std::vector<CAtlasRect> & rectVec,
+                       const std::vector<uint> & pageVec,
+                       std::vector< std::pair<size_t, size_t> > & overlapVec );
+
+    // Get the name of a packer and a sort, for the logs
+    const char * GetPackerName( EAtlasPacker packer );
+    const char * GetSortName( EAtlasSort sort );
+}
+
+#endif  // __atlas_packer_h__
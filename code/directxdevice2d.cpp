@@ -0,0 +1,287 @@
+/************************************************************************
+*    FILE NAME:       directxdevice2d.cpp
+*
+*    DESCRIPTION:     Sends the device calls of the 2D rendering to the
+*                     game's DirectX device.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/directxdevice2d.h>
+
+// Windows lib dependencies
+#include <atlbase.h>
+
+// DirectX lib dependencies
+#include <d3dx9.h>
+
+// Game lib dependencies
+#include <system/xdevice.h>
+#include <managers/shader.h>
+#include <managers/texturemanager.h>
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CDirectXDevice2D::CDirectXDevice2D()
+{
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Get the capabilities of the device
+*
+*	 param:	D3DCAPS9 * pCaps - filled with the capabilities
+************************************************************************/
+HRESULT CDirectXDevice2D::GetDeviceCaps( D3DCAPS9 * pCaps )
+{
+    return CXDevice::Instance().GetXDevice()->GetDeviceCaps( pCaps );
+
+}	// GetDeviceCaps
+
+
+/************************************************************************
+*    desc:  Ask the adapter if the vertex shader can read a texture format
+*
+*	 param:	D3DFORMAT format - format of the texture
+*
+*	 ret:	bool - true if vertex shaders can sample it
+************************************************************************/
+bool CDirectXDevice2D::CanReadVertexTexture( D3DFORMAT format )
+{
+    CComPtr<IDirect3D9> spD3D;
+    D3DDEVICE_CREATION_PARAMETERS creationParam;
+    D3DDISPLAYMODE displayMode;
+
+    if( FAILED( CXDevice::Instance().GetXDevice()->GetDirect3D( &spD3D ) ) ||
+        FAILED( CXDevice::Instance().GetXDevice()->GetCreationParameters( &creationParam ) ) ||
+        FAILED( CXDevice::Instance().GetXDevice()->GetDisplayMode( 0, &displayMode ) ) )
+    {
+        return false;
+    }
+
+    return SUCCEEDED( spD3D->CheckDeviceFormat( creationParam.AdapterOrdinal, creationParam.DeviceType, displayMode.Format,
+                                                D3DUSAGE_QUERY_VERTEXTEXTURE, D3DRTYPE_TEXTURE, format ) );
+
+}	// CanReadVertexTexture
+
+
+/************************************************************************
+*    desc:  Get the largest texture the device can make
+************************************************************************/
+uint CDirectXDevice2D::GetMaxTextureWidth()
+{
+    return CXDevice::Instance().GetMaxTextureWidth();
+
+}	// GetMaxTextureWidth
+
+uint CDirectXDevice2D::GetMaxTextureHeight()
+{
+    return CXDevice::Instance().GetMaxTextureHeight();
+
+}	// GetMaxTextureHeight
+
+
+/************************************************************************
+*    desc:  Get a projection matrix of the camera
+*
+*	 param:	CSettings::EProjectionType type - perspective or orthographic
+*
+*	 ret:	const float * - 16 floats of a row major matrix
+************************************************************************/
+const float * CDirectXDevice2D::GetProjectionMatrix( CSettings::EProjectionType type )
+{
+    return CXDevice::Instance().GetProjectionMatrix( type );
+
+}	// GetProjectionMatrix
+
+
+/************************************************************************
+*    desc:  Create the resources
+************************************************************************/
+HRESULT CDirectXDevice2D::CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration )
+{
+    return CXDevice::Instance().GetXDevice()->CreateVertexDeclaration( pElement, ppDeclaration );
+
+}	// CreateVertexDeclaration
+
+HRESULT CDirectXDevice2D::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer )
+{
+    return CXDevice::Instance().GetXDevice()->CreateVertexBuffer( length, usage, fvf, pool, ppBuffer, NULL );
+
+}	// CreateVertexBuffer
+
+HRESULT CDirectXDevice2D::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer )
+{
+    return CXDevice::Instance().GetXDevice()->CreateIndexBuffer( length, usage, format, pool, ppBuffer, NULL );
+
+}	// CreateIndexBuffer
+
+HRESULT CDirectXDevice2D::CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture )
+{
+    return CXDevice::Instance().GetXDevice()->CreateTexture( width, height, levels, usage, format, pool, ppTexture, NULL );
+
+}	// CreateTexture
+
+
+/************************************************************************
+*    desc:  Copy a rectangle of a texture into another with D3DX. There's
+*           no filter, so the rectangles have to be the same size
+************************************************************************/
+HRESULT CDirectXDevice2D::CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect )
+{
+    CComPtr< IDirect3DSurface9 > spSourceSurface, spDestSurface;
+    HRESULT hr;
+
+    if( FAILED( hr = pSource->GetSurfaceLevel( 0, &spSourceSurface ) ) || FAILED( hr = pDest->GetSurfaceLevel( 0, &spDestSurface ) ) )
+        return hr;
+
+    return D3DXLoadSurfaceFromSurface( spDestSurface, NULL, &destRect, spSourceSurface, NULL, &sourceRect, D3DX_FILTER_NONE, 0 );
+
+}	// CopyTexture
+
+
+/************************************************************************
+*    desc:  Bind the resources and states
+************************************************************************/
+HRESULT CDirectXDevice2D::SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration )
+{
+    return CXDevice::Instance().GetXDevice()->SetVertexDeclaration( pDeclaration );
+
+}	// SetVertexDeclaration
+
+HRESULT CDirectXDevice2D::SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride )
+{
+    return CXDevice::Instance().GetXDevice()->SetStreamSource( stream, pBuffer, offset, stride );
+
+}	// SetStreamSource
+
+HRESULT CDirectXDevice2D::SetStreamSourceFreq( UINT stream, UINT setting )
+{
+    return CXDevice::Instance().GetXDevice()->SetStreamSourceFreq( stream, setting );
+
+}	// SetStreamSourceFreq
+
+HRESULT CDirectXDevice2D::SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer )
+{
+    return CXDevice::Instance().GetXDevice()->SetIndices( pIndexBuffer );
+
+}	// SetIndices
+
+HRESULT CDirectXDevice2D::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    return CXDevice::Instance().GetXDevice()->SetRenderState( state, value );
+
+}	// SetRenderState
+
+HRESULT CDirectXDevice2D::GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue )
+{
+    return CXDevice::Instance().GetXDevice()->GetRenderState( state, pValue );
+
+}	// GetRenderState
+
+HRESULT CDirectXDevice2D::SelectTexture( IDirect3DBaseTexture9 * pTexture )
+{
+    CTextureMgr::Instance().SelectTexture( pTexture );
+
+    return D3D_OK;
+
+}	// SelectTexture
+
+
+/************************************************************************
+*    desc:  Set the effect and its values and run its passes. The values
+*           and passes go to the shader manager's active effect
+************************************************************************/
+HRESULT CDirectXDevice2D::SetEffectAndTechnique( const std::string & effect, const std::string & technique )
+{
+    CShader::Instance().SetEffectAndTechnique( effect, technique );
+
+    return D3D_OK;
+
+}	// SetEffectAndTechnique
+
+HRESULT CDirectXDevice2D::SetEffectFloat( const char * pName, float value )
+{
+    return CShader::Instance().GetActiveShader()->SetFloat( pName, value );
+
+}	// SetEffectFloat
+
+HRESULT CDirectXDevice2D::SetEffectFloatArray( const char * pName, const float * pValue, UINT count )
+{
+    return CShader::Instance().GetActiveShader()->SetFloatArray( pName, pValue, count );
+
+}	// SetEffectFloatArray
+
+HRESULT CDirectXDevice2D::SetEffectMatrix( const char * pName, const float * pMatrix )
+{
+    const D3DXMATRIX matrix( pMatrix );
+
+    return CShader::Instance().GetActiveShader()->SetMatrix( pName, &matrix );
+
+}	// SetEffectMatrix
+
+HRESULT CDirectXDevice2D::SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture )
+{
+    return CShader::Instance().GetActiveShader()->SetTexture( pName, pTexture );
+
+}	// SetEffectTexture
+
+HRESULT CDirectXDevice2D::BeginEffect( UINT * pPassCount )
+{
+    return CShader::Instance().GetActiveShader()->Begin( pPassCount, 0 );
+
+}	// BeginEffect
+
+HRESULT CDirectXDevice2D::BeginEffectPass( UINT pass )
+{
+    return CShader::Instance().GetActiveShader()->BeginPass( pass );
+
+}	// BeginEffectPass
+
+HRESULT CDirectXDevice2D::EndEffectPass()
+{
+    return CShader::Instance().GetActiveShader()->EndPass();
+
+}	// EndEffectPass
+
+HRESULT CDirectXDevice2D::EndEffect()
+{
+    return CShader::Instance().GetActiveShader()->End();
+
+}	// EndEffect
+
+
+/************************************************************************
+*    desc:  Draw
+************************************************************************/
+HRESULT CDirectXDevice2D::DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount )
+{
+    return CXDevice::Instance().GetXDevice()->DrawIndexedPrimitive( type, baseVertex, minVertex, vertexCount, startIndex, primitiveCount );
+
+}	// DrawIndexedPrimitive
+
+
+/************************************************************************
+*    desc:  Begin and end a scene
+************************************************************************/
+HRESULT CDirectXDevice2D::BeginScene()
+{
+    return CXDevice::Instance().GetXDevice()->BeginScene();
+
+}	// BeginScene
+
+HRESULT CDirectXDevice2D::EndScene()
+{
+    return CXDevice::Instance().GetXDevice()->EndScene();
+
+}	// EndScene
+
+
+/************************************************************************
+*    desc:  Create a query
+************************************************************************/
+HRESULT CDirectXDevice2D::CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery )
+{
+    return CXDevice::Instance().GetXDevice()->CreateQuery( type, ppQuery );
+
+}	// CreateQuery
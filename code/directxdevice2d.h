@@ -0,0 +1,70 @@
+/************************************************************************
+*    FILE NAME:       directxdevice2d.h
+*
+*    DESCRIPTION:     Sends the device calls of the 2D rendering to the
+*                     game's DirectX device.
+************************************************************************/
+
+#ifndef __directx_device_2d_h__
+#define __directx_device_2d_h__
+
+// Physical component dependency
+#include <2d/graphicsdevice2d.h>
+
+class CDirectXDevice2D : public CGraphicsDevice2D
+{
+public:
+
+    // Constructor
+    CDirectXDevice2D();
+
+    // What the device can do
+    virtual HRESULT GetDeviceCaps( D3DCAPS9 * pCaps );
+    virtual bool CanReadVertexTexture( D3DFORMAT format );
+    virtual uint GetMaxTextureWidth();
+    virtual uint GetMaxTextureHeight();
+
+    // Get a projection matrix of the camera
+    virtual const float * GetProjectionMatrix( CSettings::EProjectionType type );
+
+    // Create the resources
+    virtual HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration );
+    virtual HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture );
+
+    // Copy a texture with D3DX
+    virtual HRESULT CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect );
+
+    // Bind the resources and states
+    virtual HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration );
+    virtual HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride );
+    virtual HRESULT SetStreamSourceFreq( UINT stream, UINT setting );
+    virtual HRESULT SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer );
+    virtual HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+    virtual HRESULT GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue );
+    virtual HRESULT SelectTexture( IDirect3DBaseTexture9 * pTexture );
+
+    // Set the effect and its values and run its passes through the shader manager
+    virtual HRESULT SetEffectAndTechnique( const std::string & effect, const std::string & technique );
+    virtual HRESULT SetEffectFloat( const char * pName, float value );
+    virtual HRESULT SetEffectFloatArray( const char * pName, const float * pValue, UINT count );
+    virtual HRESULT SetEffectMatrix( const char * pName, const float * pMatrix );
+    virtual HRESULT SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture );
+    virtual HRESULT BeginEffect( UINT * pPassCount );
+    virtual HRESULT BeginEffectPass( UINT pass );
+    virtual HRESULT EndEffectPass();
+    virtual HRESULT EndEffect();
+
+    // Draw
+    virtual HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount );
+
+    // Begin and end a scene
+    virtual HRESULT BeginScene();
+    virtual HRESULT EndScene();
+
+    // Create a query
+    virtual HRESULT CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery );
+};
+
+#endif  // __directx_device_2d_h__
@@ -0,0 +1,105 @@
+/************************************************************************
+*    FILE NAME:       graphicsdevice2d.cpp
+*
+*    DESCRIPTION:     The device calls of the 2D rendering. The game's
+*                     device is behind it by default. A null or a
+*                     recording device can be set in its place to run
+*                     the rendering without a card.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/graphicsdevice2d.h>
+
+// Standard lib dependencies
+#include <algorithm>
+
+// Game lib dependencies
+#include <2d/directxdevice2d.h>
+#include <2d/renderstatecache2d.h>
+
+// The device set in place of the game's device
+CGraphicsDevice2D * CGraphicsDevice2D::pActiveDevice = NULL;
+
+// The resources that live in the default pool
+std::vector<CDeviceResource2D *> CGraphicsDevice2D::resourceVec;
+
+/************************************************************************
+*    desc:  Get the device the 2D rendering uses
+*
+*	 ret:	CGraphicsDevice2D & - the device set, or the game's device
+************************************************************************/
+CGraphicsDevice2D & CGraphicsDevice2D::Instance()
+{
+    if( pActiveDevice != NULL )
+        return *pActiveDevice;
+
+    static CDirectXDevice2D directXDevice;
+    return directXDevice;
+
+}	// Instance
+
+
+/************************************************************************
+*    desc:  Set the device the 2D rendering uses. The bindings the render
+*           state cache knows are the old device's, so they're forgotten
+*
+*	 param:	CGraphicsDevice2D * pDevice - device, or NULL for the game's device
+************************************************************************/
+void CGraphicsDevice2D::SetInstance( CGraphicsDevice2D * pDevice )
+{
+    pActiveDevice = pDevice;
+    CRenderStateCache2D::Instance().Invalidate();
+
+}	// SetInstance
+
+
+/************************************************************************
+*    desc:  Add a resource that lives in the default pool, so it's
+*           released and created again with the device
+*
+*	 param:	CDeviceResource2D * pResource - resource to add
+************************************************************************/
+void CGraphicsDevice2D::AddResource( CDeviceResource2D * pResource )
+{
+    resourceVec.push_back( pResource );
+
+}	// AddResource
+
+
+/************************************************************************
+*    desc:  Remove a resource. Call before it's destroyed
+*
+*	 param:	CDeviceResource2D * pResource - resource to remove
+************************************************************************/
+void CGraphicsDevice2D::RemoveResource( CDeviceResource2D * pResource )
+{
+    resourceVec.erase( std::remove( resourceVec.begin(), resourceVec.end(), pResource ), resourceVec.end() );
+
+}	// RemoveResource
+
+
+/************************************************************************
+*    desc:  Release the resources in the default pool. The device can't
+*           be reset while any of them is still around
+************************************************************************/
+void CGraphicsDevice2D::LostDevice()
+{
+    for( size_t i = 0; i < resourceVec.size(); ++i )
+        resourceVec[i]->OnLostDevice();
+
+}	// LostDevice
+
+
+/************************************************************************
+*    desc:  Create the resources in the default pool again. A reset
+*           device is back to its default states, so the render state
+*           cache forgets what it knew
+************************************************************************/
+void CGraphicsDevice2D::ResetDevice()
+{
+    CRenderStateCache2D::Instance().Invalidate();
+
+    for( size_t i = 0; i < resourceVec.size(); ++i )
+        resourceVec[i]->OnResetDevice();
+
+}	// ResetDevice
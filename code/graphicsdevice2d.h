@@ -0,0 +1,140 @@
+/************************************************************************
+*    FILE NAME:       graphicsdevice2d.h
+*
+*    DESCRIPTION:     The device calls of the 2D rendering. The game's
+*                     device is behind it by default. A null or a
+*                     recording device can be set in its place to run
+*                     the rendering without a card.
+************************************************************************/
+
+#ifndef __graphics_device_2d_h__
+#define __graphics_device_2d_h__
+
+// DirectX lib dependencies
+#include <d3d9.h>
+
+// Standard lib dependencies
+#include <string>
+#include <vector>
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <misc/settings.h>
+
+//////////////////////////////////////////////////////////////
+//	A resource of the 2D rendering that lives in the default
+//  pool. It's released when the device is lost and created
+//  again when the device is reset.
+//////////////////////////////////////////////////////////////
+class CDeviceResource2D
+{
+public:
+
+    // Release the resource before the device is reset
+    virtual void OnLostDevice() = 0;
+
+    // Create the resource again after the device is reset
+    virtual void OnResetDevice() = 0;
+
+protected:
+
+    // Destructor
+    ~CDeviceResource2D(){}
+};
+
+class CGraphicsDevice2D : public boost::noncopyable
+{
+public:
+
+    // Get the device the 2D rendering uses. The game's device unless another was set
+    static CGraphicsDevice2D & Instance();
+
+    // Set the device the 2D rendering uses. NULL goes back to the game's device. The caller
+    // keeps ownership. Set it before any mesh or mega texture creates its buffers
+    static void SetInstance( CGraphicsDevice2D * pDevice );
+
+    // Add-Remove a resource that lives in the default pool
+    static void AddResource( CDeviceResource2D * pResource );
+    static void RemoveResource( CDeviceResource2D * pResource );
+
+    // Release the resources in the default pool. Call from the game's lost device handling
+    static void LostDevice();
+
+    // Create the resources in the default pool again. Call after the device is reset
+    static void ResetDevice();
+
+    // Destructor
+    virtual ~CGraphicsDevice2D(){}
+
+    // What the device can do
+    virtual HRESULT GetDeviceCaps( D3DCAPS9 * pCaps ) = 0;
+    virtual bool CanReadVertexTexture( D3DFORMAT format ) = 0;
+    virtual uint GetMaxTextureWidth() = 0;
+    virtual uint GetMaxTextureHeight() = 0;
+
+    // Get a projection matrix of the camera. 16 floats, row major
+    virtual const float * GetProjectionMatrix( CSettings::EProjectionType type ) = 0;
+
+    // Create the resources
+    virtual HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration ) = 0;
+    virtual HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer ) = 0;
+    virtual HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer ) = 0;
+    virtual HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture ) = 0;
+
+    // Copy a rectangle of the top level of a texture into a rectangle of the same size of another.
+    // Used to put the textures of a mega texture on its pages
+    virtual HRESULT CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect ) = 0;
+
+    // Bind the resources and states
+    virtual HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration ) = 0;
+    virtual HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride ) = 0;
+    virtual HRESULT SetStreamSourceFreq( UINT stream, UINT setting ) = 0;
+    virtual HRESULT SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer ) = 0;
+    virtual HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value ) = 0;
+    virtual HRESULT GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue ) = 0;
+
+    // Select the texture the draws sample
+    virtual HRESULT SelectTexture( IDirect3DBaseTexture9 * pTexture ) = 0;
+
+    // Set the effect and technique the draws are shaded with, and the values of the effect.
+    // The matrix is 16 floats, row major
+    virtual HRESULT SetEffectAndTechnique( const std::string & effect, const std::string & technique ) = 0;
+    virtual HRESULT SetEffectFloat( const char * pName, float value ) = 0;
+    virtual HRESULT SetEffectFloatArray( const char * pName, const float * pValue, UINT count ) = 0;
+    virtual HRESULT SetEffectMatrix( const char * pName, const float * pMatrix ) = 0;
+    virtual HRESULT SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture ) = 0;
+
+    // Begin and end the technique and each of its passes
+    virtual HRESULT BeginEffect( UINT * pPassCount ) = 0;
+    virtual HRESULT BeginEffectPass( UINT pass ) = 0;
+    virtual HRESULT EndEffectPass() = 0;
+    virtual HRESULT EndEffect() = 0;
+
+    // Draw
+    virtual HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount ) = 0;
+
+    // Begin and end a scene, for draws made outside the game's frame
+    virtual HRESULT BeginScene() = 0;
+    virtual HRESULT EndScene() = 0;
+
+    // Create a query. D3DERR_NOTAVAILABLE when the device can't answer it
+    virtual HRESULT CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery ) = 0;
+
+protected:
+
+    // Constructor
+    CGraphicsDevice2D(){}
+
+private:
+
+    // The device set in place of the game's device
+    static CGraphicsDevice2D * pActiveDevice;
+
+    // The resources that live in the default pool
+    static std::vector<CDeviceResource2D *> resourceVec;
+};
+
+#endif  // __graphics_device_2d_h__
@@ -0,0 +1,745 @@
+/************************************************************************
+*    FILE NAME:       instancebench2d.cpp
+*
+*    DESCRIPTION:     Standalone benchmarks for the hot paths of the
+*                     2D instance rendering.
+************************************************************************/
+
+// Physical component dependency
+#include <utilities/instancebench2d.h>
+
+// Standard lib dependencies
+#include <map>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Boost lib dependencies
+#include <boost/chrono.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <common/worldpoint.h>
+#include <2d/renderqueue2d.h>
+#include <2d/affinebatch2d.h>
+#include <2d/instancemesh2d.h>
+#include <2d/nulldevice2d.h>
+#include <utilities/genfunc.h>
+
+// The sprite counts each benchmark is run with
+const int SPRITE_COUNT[] = { 1000, 10000, 100000 };
+const int SPRITE_COUNT_TOTAL = sizeof(SPRITE_COUNT) / sizeof(SPRITE_COUNT[0]);
+
+// Number of frames each benchmark is averaged over
+const int FRAME_COUNT = 30;
+
+// Depth range of the generated sprites
+const int DEPTH_MIN = -100;
+const int DEPTH_MAX = 100;
+
+// Largest error allowed between the affine batch and the full matrix multiplies,
+// relative to the largest element of the matrix
+const float MAX_AFFINE_ERROR = 0.0001f;
+
+// The sprite counts the instance mesh benchmark is run with and the frames it's averaged over.
+// Fewer frames than the others so the million sprite run stays short
+const int MESH_SPRITE_COUNT[] = { 1000, 10000, 100000, 1000000 };
+const int MESH_SPRITE_COUNT_TOTAL = sizeof(MESH_SPRITE_COUNT) / sizeof(MESH_SPRITE_COUNT[0]);
+const int MESH_FRAME_COUNT = 10;
+
+// Depth range of the sprites of the instance mesh benchmark, inside the perspective's near and far
+const float MESH_DEPTH_MIN = 10.f;
+const float MESH_DEPTH_MAX = 500.f;
+
+// Number of layers of the layered depth distribution
+const int DEPTH_LAYER_COUNT = 8;
+
+// The instance mesh benchmark's population changes between these shares of the sprites
+// every frame of the buffer churn
+const float CHURN_MIN_RATIO = 0.25f;
+const float CHURN_MAX_RATIO = 1.f;
+
+// Frames of the buffer churn
+const int CHURN_FRAME_COUNT = 100;
+
+// The benchmarks do their own matrix math instead of calling D3DX
+const float BENCH_PI = 3.14159265f;
+
+/************************************************************************
+*    desc:  Run the phases of an instance mesh one at a time. A friend
+*           of the mesh, so it can feed the phases without sprite groups
+************************************************************************/
+class CInstanceMeshBench2D
+{
+public:
+
+    // Time the phases with a population of the passed in size
+    static void Run( const NInstanceBench2D::CMeshBenchConfig & config, int spriteCount );
+
+private:
+
+    // A generated sprite: its instance source, depth and bounding sphere
+    class CMeshBenchSprite
+    {
+    public:
+
+        CInstanceMesh2D::CInstanceSource source;
+        CWorldValue depth;
+        float x, y, z, radius;
+        bool opaque;
+    };
+
+    // Generate the sprite population
+    static void GenerateSprites( const NInstanceBench2D::CMeshBenchConfig & config, int spriteCount, std::vector<CMeshBenchSprite> & spriteVec );
+
+    // Time the instance buffer growing and shrinking with the population
+    static void RunBufferChurn( CInstanceMesh2D & mesh, int spriteCount );
+};
+
+
+namespace NInstanceBench2D
+{
+    typedef boost::chrono::high_resolution_clock BenchClock;
+
+    /************************************************************************
+    *    desc:  Get the nanoseconds per sprite of a timed run
+    ************************************************************************/
+    double GetNsPerSprite( const BenchClock::duration & duration, int spriteCount, int frameCount = FRAME_COUNT )
+    {
+        double nanoSec = static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>( duration ).count());
+
+        return nanoSec / (static_cast<double>(spriteCount) * frameCount);
+
+    }	// GetNsPerSprite
+
+
+    /************************************************************************
+    *    desc:  Set a row major matrix that scales x and y and then rotates
+    *           around z, like D3DXMatrixScaling times D3DXMatrixRotationZ
+    ************************************************************************/
+    void SetScaledRotation( float * pMatrix, float scale, float angle )
+    {
+        const float cosAngle = std::cos( angle ) * scale;
+        const float sinAngle = std::sin( angle ) * scale;
+
+        std::memset( pMatrix, 0, sizeof(float) * 16 );
+        pMatrix[0] = cosAngle;
+        pMatrix[1] = sinAngle;
+        pMatrix[4] = -sinAngle;
+        pMatrix[5] = cosAngle;
+        pMatrix[10] = 1.f;
+        pMatrix[15] = 1.f;
+
+    }	// SetScaledRotation
+
+
+    /************************************************************************
+    *    desc:  Set the row major left handed projections the game uses,
+    *           like D3DXMatrixPerspectiveFovLH and D3DXMatrixOrthoLH
+    ************************************************************************/
+    void SetProjections( float * pPerspective, float * pOrthographic )
+    {
+        const float nearZ = 5.f;
+        const float farZ = 1000.f;
+        const float yScale = 1.f / std::tan( BENCH_PI / 8 );
+
+        std::memset( pPerspective, 0, sizeof(float) * 16 );
+        pPerspective[0] = yScale / (16.f / 9.f);
+        pPerspective[5] = yScale;
+        pPerspective[10] = farZ / (farZ - nearZ);
+        pPerspective[11] = 1.f;
+        pPerspective[14] = -nearZ * farZ / (farZ - nearZ);
+
+        std::memset( pOrthographic, 0, sizeof(float) * 16 );
+        pOrthographic[0] = 2.f / 1280.f;
+        pOrthographic[5] = 2.f / 720.f;
+        pOrthographic[10] = 1.f / (farZ - nearZ);
+        pOrthographic[14] = nearZ / (nearZ - farZ);
+        pOrthographic[15] = 1.f;
+
+    }	// SetProjections
+
+
+    /************************************************************************
+    *    desc:  Multiply two row major matrices
+    ************************************************************************/
+    void MultiplyMatrix( const float * pA, const float * pB, float * pResult )
+    {
+        for( int row = 0; row < 4; ++row )
+        {
+            for( int col = 0; col < 4; ++col )
+            {
+                pResult[(row * 4) + col] = (pA[row * 4] * pB[col]) + (pA[(row * 4) + 1] * pB[4 + col]) +
+                                           (pA[(row * 4) + 2] * pB[8 + col]) + (pA[(row * 4) + 3] * pB[12 + col]);
+            }
+        }
+
+    }	// MultiplyMatrix
+
+
+    /************************************************************************
+    *    desc:  Generate a random set of depths
+    ************************************************************************/
+    void GenerateDepths( std::vector<CWorldValue> & depthVec, int spriteCount )
+    {
+        boost::random::mt19937 generator( spriteCount );
+        boost::random::uniform_int_distribution<int> intDist( DEPTH_MIN, DEPTH_MAX );
+        boost::random::uniform_real_distribution<float> floatDist( 0.f, 1.f );
+
+        depthVec.resize( spriteCount );
+
+        for( int i = 0; i < spriteCount; ++i )
+        {
+            depthVec[i].i = intDist( generator );
+            depthVec[i].f = floatDist( generator );
+        }
+
+    }	// GenerateDepths
+
+
+    /************************************************************************
+    *    desc:  Time the radix sorted render queue against the multimap it
+    *           replaced. Both are used the way the instance mesh uses them:
+    *           cleared, filled, sorted and walked once per frame
+    ************************************************************************/
+    void RunRenderQueueBenchmark()
+    {
+        std::vector<CWorldValue> depthVec;
+
+        for( int countIndex = 0; countIndex < SPRITE_COUNT_TOTAL; ++countIndex )
+        {
+            const int spriteCount = SPRITE_COUNT[countIndex];
+            GenerateDepths( depthVec, spriteCount );
+
+            // The value summed up in the walks so the compiler can't throw them away
+            uint checkSum = 0;
+
+            // Time the multimap
+            std::multimap<CWorldValue, uint, std::greater<CWorldValue>> renderMultiMap;
+            BenchClock::time_point start = BenchClock::now();
+
+            for( int frame = 0; frame < FRAME_COUNT; ++frame )
+            {
+                renderMultiMap.clear();
+
+                for( int i = 0; i < spriteCount; ++i )
+                    renderMultiMap.insert( std::make_pair( depthVec[i], static_cast<uint>(i) ) );
+
+                std::multimap<CWorldValue, uint, std::greater<CWorldValue>>::iterator iter;
+                for( iter = renderMultiMap.begin(); iter != renderMultiMap.end(); ++iter )
+                    checkSum += iter->second;
+            }
+
+            BenchClock::duration multiMapTime = BenchClock::now() - start;
+
+            // Time the render queue
+            CRenderQueue2D renderQueue;
+            start = BenchClock::now();
+
+            for( int frame = 0; frame < FRAME_COUNT; ++frame )
+            {
+                renderQueue.Clear();
+
+                for( int i = 0; i < spriteCount; ++i )
+                    renderQueue.Add( CRenderQueue2D::GetDepthKey( depthVec[i] ) );
+
+                renderQueue.Sort();
+
+                for( size_t i = 0; i < renderQueue.GetCount(); ++i )
+                    checkSum += renderQueue.GetIndex( i );
+            }
+
+            BenchClock::duration queueTime = BenchClock::now() - start;
+
+            // Make sure the queue gives the same back to front order as the multimap. Depths that
+            // quantize to the same key are allowed to keep the order they were added in
+            bool ordered = true;
+            for( size_t i = 1; i < renderQueue.GetCount() && ordered; ++i )
+                ordered = ( renderQueue.GetKey(i) == renderQueue.GetKey(i - 1) ) ||
+                          !( depthVec[ renderQueue.GetIndex(i) ] > depthVec[ renderQueue.GetIndex(i - 1) ] );
+
+            NGenFunc::PostDebugMsg( "Render Queue Bench: %d sprites - multimap %.2f ns/sprite, radix queue %.2f ns/sprite, order %s (%u)",
+                                    spriteCount,
+                                    GetNsPerSprite( multiMapTime, spriteCount ),
+                                    GetNsPerSprite( queueTime, spriteCount ),
+                                    ordered ? "ok" : "FAILED",
+                                    checkSum );
+        }
+
+    }	// RunRenderQueueBenchmark
+
+
+    /************************************************************************
+    *    desc:  Sprite transform inputs the way the instance mesh sees them
+    ************************************************************************/
+    class CBenchSprite
+    {
+    public:
+        float scaledMatrix[16];
+        float width, height;
+        bool orthographic;
+    };
+
+
+    /************************************************************************
+    *    desc:  Generate a random set of sprites that rotate around z
+    ************************************************************************/
+    void GenerateSprites( std::vector<CBenchSprite> & spriteVec, int spriteCount )
+    {
+        boost::random::mt19937 generator( spriteCount );
+        boost::random::uniform_real_distribution<float> posDist( -1000.f, 1000.f );
+        boost::random::uniform_real_distribution<float> depthDist( 10.f, 500.f );
+        boost::random::uniform_real_distribution<float> rotDist( -BENCH_PI, BENCH_PI );
+        boost::random::uniform_real_distribution<float> scaleDist( 0.1f, 80.f );
+        boost::random::uniform_int_distribution<int> projDist( 0, 3 );
+
+        spriteVec.resize( spriteCount );
+
+        for( int i = 0; i < spriteCount; ++i )
+        {
+            float scale = scaleDist( generator );
+            SetScaledRotation( spriteVec[i].scaledMatrix, scale, rotDist( generator ) );
+
+            spriteVec[i].scaledMatrix[12] = posDist( generator );
+            spriteVec[i].scaledMatrix[13] = posDist( generator );
+            spriteVec[i].scaledMatrix[14] = depthDist( generator );
+            spriteVec[i].width = scaleDist( generator );
+            spriteVec[i].height = scaleDist( generator );
+
+            // Most sprites are in the perspective projection
+            spriteVec[i].orthographic = (projDist( generator ) == 0);
+        }
+
+    }	// GenerateSprites
+
+
+    /************************************************************************
+    *    desc:  Time the SIMD affine batch against the full matrix
+    *           multiplies the instance mesh used per sprite, and check
+    *           that every path gives the same matrices within tolerance
+    ************************************************************************/
+    void RunAffineTransformBenchmark()
+    {
+        const char * pathName[] = { "scalar", "sse2", "avx" };
+
+        float perspectiveMatrix[16], orthographicMatrix[16];
+        SetProjections( perspectiveMatrix, orthographicMatrix );
+
+        std::vector<CBenchSprite> spriteVec;
+        std::vector<float> referenceVec;
+
+        const CAffineBatch2D::ESimdPath activePath = CAffineBatch2D::GetSimdPath();
+        const CAffineBatch2D::ESimdPath bestPath = CAffineBatch2D::GetBestSimdPath();
+
+        for( int countIndex = 0; countIndex < SPRITE_COUNT_TOTAL; ++countIndex )
+        {
+            const int spriteCount = SPRITE_COUNT[countIndex];
+            GenerateSprites( spriteVec, spriteCount );
+            referenceVec.resize( spriteCount * 16 );
+
+            // Time the full matrix multiplies
+            BenchClock::time_point start = BenchClock::now();
+
+            for( int frame = 0; frame < FRAME_COUNT; ++frame )
+            {
+                for( int i = 0; i < spriteCount; ++i )
+                {
+                    const float sizeMatrix[16] = { spriteVec[i].width, 0, 0, 0,
+                                                   0, spriteVec[i].height, 0, 0,
+                                                   0, 0, 1, 0,
+                                                   0, 0, 0, 1 };
+                    float sizedMatrix[16];
+
+                    MultiplyMatrix( sizeMatrix, spriteVec[i].scaledMatrix, sizedMatrix );
+                    MultiplyMatrix( sizedMatrix, (spriteVec[i].orthographic ? orthographicMatrix : perspectiveMatrix), &referenceVec[i * 16] );
+                }
+            }
+
+            BenchClock::duration referenceTime = BenchClock::now() - start;
+
+            NGenFunc::PostDebugMsg( "Affine Transform Bench: %d sprites - matrix multiply %.2f ns/sprite",
+                                    spriteCount, GetNsPerSprite( referenceTime, spriteCount ) );
+
+            // Time each path the CPU supports
+            for( int path = CAffineBatch2D::ESP_SCALAR; path <= bestPath; ++path )
+            {
+                CAffineBatch2D::SetSimdPath( static_cast<CAffineBatch2D::ESimdPath>(path) );
+
+                CAffineBatch2D batch;
+                float maxError = 0.f;
+                start = BenchClock::now();
+
+                for( int frame = 0; frame < FRAME_COUNT; ++frame )
+                {
+                    for( int blockBegin = 0; blockBegin < spriteCount; blockBegin += static_cast<int>(AFFINE_BATCH_SIZE) )
+                    {
+                        const size_t blockCount = std::min( AFFINE_BATCH_SIZE, static_cast<size_t>(spriteCount - blockBegin) );
+
+                        for( size_t i = 0; i < blockCount; ++i )
+                        {
+                            const CBenchSprite & sprite = spriteVec[blockBegin + i];
+                            batch.Set( i, sprite.width, sprite.height, sprite.scaledMatrix, sprite.orthographic );
+                        }
+
+                        batch.Transform( blockCount, perspectiveMatrix, orthographicMatrix );
+
+                        // Only compare on the last frame so the check isn't timed with every frame
+                        if( frame == FRAME_COUNT - 1 )
+                        {
+                            for( size_t i = 0; i < blockCount; ++i )
+                            {
+                                float matrix[16];
+                                batch.GetMatrix( i, matrix );
+
+                                const float * pReference = &referenceVec[(blockBegin + i) * 16];
+                                float largest = 1.f;
+
+                                for( int j = 0; j < 16; ++j )
+                                    largest = std::max( largest, std::fabs( pReference[j] ) );
+
+                                for( int j = 0; j < 16; ++j )
+                                    maxError = std::max( maxError, std::fabs( matrix[j] - pReference[j] ) / largest );
+                            }
+                        }
+                    }
+                }
+
+                BenchClock::duration batchTime = BenchClock::now() - start;
+
+                NGenFunc::PostDebugMsg( "Affine Transform Bench: %d sprites - %s batch %.2f ns/sprite, %.2fx, max error %g %s",
+                                        spriteCount,
+                                        pathName[path],
+                                        GetNsPerSprite( batchTime, spriteCount ),
+                                        static_cast<double>(referenceTime.count()) / static_cast<double>(batchTime.count()),
+                                        maxError,
+                                        (maxError <= MAX_AFFINE_ERROR) ? "ok" : "FAILED" );
+            }
+        }
+
+        CAffineBatch2D::SetSimdPath( activePath );
+
+    }	// RunAffineTransformBenchmark
+
+
+    /************************************************************************
+    *    desc:  Time each phase of the instance mesh on a generated sprite
+    *           population. The sprite groups need the game's data to make,
+    *           so the instance sources are generated in their place and the
+    *           phases after them run on the null device
+    *
+    *	 param:	const CMeshBenchConfig & config - the population to generate
+    ************************************************************************/
+    void RunInstanceMeshBenchmark( const CMeshBenchConfig & config )
+    {
+        const char * distributionName[] = { "uniform", "layered", "front to back", "back to front" };
+
+        NGenFunc::PostDebugMsg( "Instance Mesh Bench: %s depths, %.0f%% orthographic, %.0f%% animated, %.0f%% opaque, %s layout, attributes %d",
+                                distributionName[config.depthDistribution],
+                                config.orthographicRatio * 100.f,
+                                config.animatedRatio * 100.f,
+                                config.opaqueRatio * 100.f,
+                                config.compactLayout ? "compact" : "full",
+                                config.attributes );
+
+        for( int countIndex = 0; countIndex < MESH_SPRITE_COUNT_TOTAL; ++countIndex )
+            CInstanceMeshBench2D::Run( config, MESH_SPRITE_COUNT[countIndex] );
+
+    }	// RunInstanceMeshBenchmark
+
+}	// NInstanceBench2D
+
+
+// UVs every generated sprite uses. Only their cost matters
+const float BENCH_SPRITE_UV[4] = { 0, 0, 1, 1 };
+
+/************************************************************************
+*    desc:  Generate the sprite population. The sprites rotate around z,
+*           so they can be built in either layout
+*
+*	 param:	const CMeshBenchConfig & config  - the population to generate
+*			int spriteCount                  - number of sprites
+*			vector<CMeshBenchSprite> & spriteVec - the generated sprites
+************************************************************************/
+void CInstanceMeshBench2D::GenerateSprites( const NInstanceBench2D::CMeshBenchConfig & config, int spriteCount, std::vector<CMeshBenchSprite> & spriteVec )
+{
+    boost::random::mt19937 generator( spriteCount );
+    boost::random::uniform_real_distribution<float> unitDist( 0.f, 1.f );
+    boost::random::uniform_real_distribution<float> rotDist( -BENCH_PI, BENCH_PI );
+    boost::random::uniform_real_distribution<float> scaleDist( 0.1f, 4.f );
+    boost::random::uniform_real_distribution<float> sizeDist( 8.f, 128.f );
+    boost::random::uniform_int_distribution<int> layerDist( 0, DEPTH_LAYER_COUNT - 1 );
+
+    spriteVec.resize( spriteCount );
+
+    for( int i = 0; i < spriteCount; ++i )
+    {
+        CMeshBenchSprite & sprite = spriteVec[i];
+        CInstanceMesh2D::CInstanceSource & source = sprite.source;
+
+        // Pick the depth the way the distribution spreads them
+        const float depthRange = MESH_DEPTH_MAX - MESH_DEPTH_MIN;
+        const float order = static_cast<float>(i) / static_cast<float>(spriteCount);
+        float z;
+
+        switch( config.depthDistribution )
+        {
+            case NInstanceBench2D::EDD_LAYERED:
+                z = MESH_DEPTH_MIN + (depthRange * layerDist( generator )) / (DEPTH_LAYER_COUNT - 1);
+                break;
+
+            case NInstanceBench2D::EDD_FRONT_TO_BACK:
+                z = MESH_DEPTH_MIN + (depthRange * order);
+                break;
+
+            case NInstanceBench2D::EDD_BACK_TO_FRONT:
+                z = MESH_DEPTH_MAX - (depthRange * order);
+                break;
+
+            default:
+                z = MESH_DEPTH_MIN + (depthRange * unitDist( generator ));
+                break;
+        }
+
+        sprite.depth.i = static_cast<int>(z);
+        sprite.depth.f = z - static_cast<float>(sprite.depth.i);
+
+        // Spread the sprites a bit past the view, so some of them are culled
+        const bool orthographic = (unitDist( generator ) < config.orthographicRatio);
+        const float halfWidth = orthographic ? 800.f : z;
+        const float halfHeight = orthographic ? 450.f : 0.6f * z;
+
+        sprite.x = halfWidth * (2.f * unitDist( generator ) - 1.f);
+        sprite.y = halfHeight * (2.f * unitDist( generator ) - 1.f);
+        sprite.z = z;
+
+        float scaledMatrix[16];
+        const float scale = scaleDist( generator );
+        NInstanceBench2D::SetScaledRotation( scaledMatrix, scale, rotDist( generator ) );
+
+        scaledMatrix[12] = sprite.x;
+        scaledMatrix[13] = sprite.y;
+        scaledMatrix[14] = sprite.z;
+        source.scaledMatrix = D3DXMATRIX( scaledMatrix );
+        source.size.w = sizeDist( generator );
+        source.size.h = sizeDist( generator );
+        source.projType = orthographic ? CSettings::EPT_ORTHOGRAPHIC : CSettings::EPT_PERSPECTIVE;
+        source.pUV = BENCH_SPRITE_UV;
+        source.page = 0;
+        source.hull = 0;
+        source.animation = CInstanceMesh2D::NO_ANIMATION;
+        source.animationPhase = 0;
+        source.animationRate = 0;
+
+        if( (unitDist( generator ) < config.animatedRatio) && (config.attributes & EIA_ANIMATION) )
+        {
+            source.animation = 0;
+            source.animationPhase = unitDist( generator );
+            source.animationRate = 12.f;
+        }
+
+        sprite.radius = 0.5f * scale * std::sqrt( source.size.w * source.size.w + source.size.h * source.size.h );
+        sprite.opaque = (unitDist( generator ) < config.opaqueRatio);
+    }
+
+}	// GenerateSprites
+
+
+/************************************************************************
+*    desc:  Time the phases with a population of the passed in size. The
+*           phases are the ones Render and ExtractRenderPacket go through
+*           each frame, minus the reads of the sprite groups
+*
+*	 param:	const CMeshBenchConfig & config - the population to generate
+*			int spriteCount                 - number of sprites
+************************************************************************/
+void CInstanceMeshBench2D::Run( const NInstanceBench2D::CMeshBenchConfig & config, int spriteCount )
+{
+    typedef NInstanceBench2D::BenchClock BenchClock;
+
+    std::vector<CMeshBenchSprite> spriteVec;
+    GenerateSprites( config, spriteCount, spriteVec );
+
+    // The null device holds the buffers in memory, so nothing waits on a card
+    CNullDevice2D device;
+
+    float perspectiveMatrix[16], orthographicMatrix[16];
+    NInstanceBench2D::SetProjections( perspectiveMatrix, orthographicMatrix );
+    device.SetProjectionMatrix( CSettings::EPT_PERSPECTIVE, perspectiveMatrix );
+    device.SetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC, orthographicMatrix );
+
+    CGraphicsDevice2D::SetInstance( &device );
+
+    {
+        CInstanceMesh2D mesh;
+        mesh.instanceLayout = config.compactLayout ? CInstanceMesh2D::EIL_COMPACT : CInstanceMesh2D::EIL_FULL;
+        mesh.instanceAttributes = config.attributes & EIA_ALL;
+
+        if( !config.compactLayout )
+            mesh.instanceBuffer.SetStride( sizeof( CInstanceMesh2D::CInstanceData ) );
+        else if( mesh.instanceAttributes & EIA_TINT )
+            mesh.instanceBuffer.SetStride( sizeof( CCompactInstance2D ) );
+        else
+            mesh.instanceBuffer.SetStride( sizeof( CUntintedInstance2D ) );
+
+        mesh.perspectiveFrustum.SetProjection( perspectiveMatrix );
+        mesh.orthographicFrustum.SetProjection( orthographicMatrix );
+
+        CInstanceMesh2D::CRenderPacket & packet = mesh.renderPacket[0];
+        const CInstanceMesh2D::CRenderPacket * pPacket = &packet;
+        const uint animationBase = 0;
+        const uint pageBase = 0;
+
+        BenchClock::duration cullTime(0), extractTime(0), sortTime(0), buildTime(0), uploadTime(0);
+        size_t uploadedBytes = 0;
+
+        for( int frame = 0; frame < MESH_FRAME_COUNT; ++frame )
+        {
+            // Cull the bounding spheres against the view of their projection
+            BenchClock::time_point start = BenchClock::now();
+
+            mesh.perspectiveCullSet.Clear();
+            mesh.orthographicCullSet.Clear();
+
+            for( int i = 0; i < spriteCount; ++i )
+            {
+                const CMeshBenchSprite & sprite = spriteVec[i];
+                CInstanceMesh2D::CCullSet & cullSet = (sprite.source.projType == CSettings::EPT_ORTHOGRAPHIC) ? mesh.orthographicCullSet : mesh.perspectiveCullSet;
+                cullSet.Add( sprite.x, sprite.y, sprite.z, sprite.radius, static_cast<uint>(i) );
+            }
+
+            mesh.perspectiveCullSet.Cull( mesh.perspectiveFrustum, mesh.spriteVisibleVec, spriteCount );
+            mesh.orthographicCullSet.Cull( mesh.orthographicFrustum, mesh.spriteVisibleVec, spriteCount );
+
+            BenchClock::time_point end = BenchClock::now();
+            cullTime += end - start;
+
+            // Copy the visible sprites into the render packet
+            start = end;
+
+            packet.sourceVec.clear();
+            packet.keyVec.clear();
+            packet.opaqueVec.clear();
+
+            for( int i = 0; i < spriteCount; ++i )
+            {
+                if( mesh.spriteVisibleVec[i] )
+                {
+                    packet.keyVec.push_back( CRenderQueue2D::GetDepthKey( spriteVec[i].depth ) );
+                    packet.opaqueVec.push_back( spriteVec[i].opaque );
+                    packet.sourceVec.push_back( spriteVec[i].source );
+                }
+            }
+
+            end = BenchClock::now();
+            extractTime += end - start;
+
+            // Sort the opaque sprites front to back and the translucent ones back to front
+            start = end;
+
+            mesh.renderQueue.Clear();
+            mesh.opaqueQueue.Clear();
+            mesh.QueuePacket( packet, 0 );
+            mesh.SortQueuedInstances( &pPacket, &animationBase, &pageBase );
+
+            end = BenchClock::now();
+            sortTime += end - start;
+
+            // Build the instances
+            start = end;
+
+            const size_t instanceCount = mesh.instanceSourceVec.size();
+            mesh.instanceStageVec.resize( instanceCount * mesh.instanceBuffer.GetStride() );
+
+            if( instanceCount > 0 )
+                mesh.BuildInstances( &mesh.instanceSourceVec[0], instanceCount, &mesh.instanceStageVec[0] );
+
+            end = BenchClock::now();
+            buildTime += end - start;
+
+            // Copy them into the instance buffer
+            start = end;
+
+            if( instanceCount > 0 )
+                mesh.UploadStagedInstances( false );
+
+            end = BenchClock::now();
+            uploadTime += end - start;
+
+            uploadedBytes += instanceCount * mesh.instanceBuffer.GetStride();
+        }
+
+        NGenFunc::PostDebugMsg( "Instance Mesh Bench: %d sprites, %u visible - cull %.2f, extract %.2f, sort %.2f, build %.2f, upload %.2f ns/sprite, %.1f KB uploaded per frame",
+                                spriteCount,
+                                static_cast<uint>(packet.sourceVec.size()),
+                                NInstanceBench2D::GetNsPerSprite( cullTime, spriteCount, MESH_FRAME_COUNT ),
+                                NInstanceBench2D::GetNsPerSprite( extractTime, spriteCount, MESH_FRAME_COUNT ),
+                                NInstanceBench2D::GetNsPerSprite( sortTime, spriteCount, MESH_FRAME_COUNT ),
+                                NInstanceBench2D::GetNsPerSprite( buildTime, spriteCount, MESH_FRAME_COUNT ),
+                                NInstanceBench2D::GetNsPerSprite( uploadTime, spriteCount, MESH_FRAME_COUNT ),
+                                static_cast<double>(uploadedBytes) / (1024.0 * MESH_FRAME_COUNT) );
+
+        RunBufferChurn( mesh, spriteCount );
+    }
+
+    CGraphicsDevice2D::SetInstance( NULL );
+
+}	// Run
+
+
+/************************************************************************
+*    desc:  Time the instance buffer growing and shrinking while the
+*           population changes every frame. Each frame reserves the
+*           population like ResetInstanceBuffer does and locks it like
+*           the upload does
+*
+*	 param:	CInstanceMesh2D & mesh - mesh whose instance buffer is churned
+*			int spriteCount        - largest population
+************************************************************************/
+void CInstanceMeshBench2D::RunBufferChurn( CInstanceMesh2D & mesh, int spriteCount )
+{
+    typedef NInstanceBench2D::BenchClock BenchClock;
+
+    boost::random::mt19937 generator( spriteCount );
+    boost::random::uniform_real_distribution<float> ratioDist( CHURN_MIN_RATIO, CHURN_MAX_RATIO );
+
+    mesh.instanceBuffer.Release();
+
+    size_t capacity = mesh.instanceBuffer.GetCapacity();
+    size_t lockedCount = 0;
+    int reallocCount = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+
+    for( int frame = 0; frame < CHURN_FRAME_COUNT; ++frame )
+    {
+        const size_t count = std::max( static_cast<size_t>(spriteCount * ratioDist( generator )), static_cast<size_t>(1) );
+
+        mesh.instanceBuffer.Reserve( count );
+
+        UINT offset;
+        mesh.instanceBuffer.Lock( count, offset );
+        mesh.instanceBuffer.Unlock();
+
+        if( mesh.instanceBuffer.GetCapacity() != capacity )
+        {
+            capacity = mesh.instanceBuffer.GetCapacity();
+            ++reallocCount;
+        }
+
+        lockedCount += count;
+    }
+
+    BenchClock::duration churnTime = BenchClock::now() - start;
+
+    NGenFunc::PostDebugMsg( "Instance Mesh Bench: %d sprites - buffer churn %.2f ns/sprite, %d reallocations in %d frames",
+                            spriteCount,
+                            static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>( churnTime ).count()) / static_cast<double>(lockedCount),
+                            reallocCount,
+                            CHURN_FRAME_COUNT );
+
+}	// RunBufferChurn
@@ -0,0 +1,65 @@
+/************************************************************************
+*    FILE NAME:       instancebench2d.h
+*
+*    DESCRIPTION:     Standalone benchmarks for the hot paths of the
+*                     2D instance rendering.
+************************************************************************/  
+
+#ifndef __instance_bench_2d_h__
+#define __instance_bench_2d_h__
+
+// Game lib dependencies
+#include <2d/instancelayout2d.h>
+
+namespace NInstanceBench2D
+{
+    // How the depths of the generated sprites are spread
+    enum EDepthDistribution
+    {
+        // Anywhere in the depth range
+        EDD_UNIFORM,
+
+        // On a few layers, so many sprites share a depth like a tile map does
+        EDD_LAYERED,
+
+        // Added nearest first or farthest first
+        EDD_FRONT_TO_BACK,
+        EDD_BACK_TO_FRONT
+    };
+
+    // The sprite population the instance mesh benchmark generates
+    class CMeshBenchConfig
+    {
+    public:
+
+        CMeshBenchConfig()
+            : depthDistribution(EDD_UNIFORM), orthographicRatio(0.25f), animatedRatio(0.25f), opaqueRatio(0.25f), compactLayout(true), attributes(EIA_ALL)
+        {}
+
+        EDepthDistribution depthDistribution;
+
+        // Share of the sprites in the orthographic projection, animated by the shader and opaque
+        float orthographicRatio;
+        float animatedRatio;
+        float opaqueRatio;
+
+        // Whether the instances are built in the compact layout or the full one
+        bool compactLayout;
+
+        // The EInstanceAttribute flags of the mesh. No sprites are animated without animation
+        uint attributes;
+    };
+
+    // Time the radix sorted render queue against the multimap it replaced
+    void RunRenderQueueBenchmark();
+
+    // Time the SIMD affine batch against the full matrix multiplies and compare the results
+    void RunAffineTransformBenchmark();
+
+    // Time each phase of the instance mesh on a generated sprite population: culling,
+    // extracting the render packet, sorting, building the instances, uploading them and
+    // the instance buffer churn when the population changes. Runs on the null device
+    void RunInstanceMeshBenchmark( const CMeshBenchConfig & config = CMeshBenchConfig() );
+}
+
+#endif  // __instance_bench_2d_h__
@@ -0,0 +1,301 @@
+/************************************************************************
+*    FILE NAME:       instancebuffer2d.cpp
+*
+*    DESCRIPTION:     Dynamic instance buffer used as a ring buffer.
+*                     Instance data is appended with no-overwrite locks
+*                     and the buffer is discarded when it wraps.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/instancebuffer2d.h>
+
+// Standard lib dependencies
+#include <algorithm>
+
+// Boost lib dependencies
+#include <boost/format.hpp>
+
+// Game lib dependencies
+#include <2d/instancestats2d.h>
+#include <utilities/exceptionhandling.h>
+
+// The smallest amount of instances the buffer is created with
+const size_t MIN_CAPACITY = 256;
+
+// The amount the capacity is multiplied by when the buffer grows
+const size_t GROWTH_FACTOR = 2;
+
+// The buffer counts as mostly empty when less than 1/SHRINK_RATIO of it is used
+const size_t SHRINK_RATIO = 4;
+
+// Default number of low usage locks in a row before the buffer shrinks
+const uint DEFAULT_SHRINK_FRAME_COUNT = 300;
+
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CInstanceBuffer2D::CInstanceBuffer2D()
+                 : stride(0),
+                   capacity(0),
+                   writePos(0),
+                   streamOffset(false),
+                   lowUsageCount(0),
+                   shrinkFrameCount(DEFAULT_SHRINK_FRAME_COUNT),
+                   lowUsagePeak(0),
+                   lostCapacity(0)
+{
+    CGraphicsDevice2D::AddResource( this );
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Destructor
+************************************************************************/
+CInstanceBuffer2D::~CInstanceBuffer2D()
+{
+    CGraphicsDevice2D::RemoveResource( this );
+
+}   // Destructor
+
+
+/************************************************************************
+*    desc:  Set the size of one instance. Releases the buffer if the
+*           size changes
+*
+*	 param:	UINT _stride - size of one instance
+************************************************************************/
+void CInstanceBuffer2D::SetStride( UINT _stride )
+{
+    if( stride != _stride )
+    {
+        Release();
+        stride = _stride;
+    }
+
+}	// SetStride
+
+
+/************************************************************************
+*    desc:  Make sure the buffer can hold the passed in amount of
+*           instances. The buffer grows geometrically so a steady rise
+*           in the instance count doesn't recreate it every frame
+*
+*	 param:	size_t count - amount of instances
+************************************************************************/
+void CInstanceBuffer2D::Reserve( size_t count )
+{
+    if( (spBuffer == NULL) || (count > capacity) )
+        Create( std::max( count, capacity * GROWTH_FACTOR ) );
+
+}	// Reserve
+
+
+/************************************************************************
+*    desc:  Lock space for the passed in amount of instances. The data
+*           is appended after the last lock with a no-overwrite lock so
+*           the GPU can keep reading what was written before. When the
+*           end of the buffer is reached, it's discarded and we start at
+*           the beginning again
+*
+*	 param:	size_t count - amount of instances to lock
+*			UINT & offset - instance the locked range starts at
+*
+*	 ret:	void * - locked instance data
+************************************************************************/
+void * CInstanceBuffer2D::Lock( size_t count, UINT & offset )
+{
+    Reserve( count );
+    CheckShrink( count );
+
+    // Without stream offsets every lock starts at the beginning and is a discard
+    if( !streamOffset )
+    {
+        writePos = 0;
+    }
+    // Start over at the beginning if we're out of room. The discard lock this causes is
+    // the only lock that can wait on the GPU, if the driver runs out of buffers to rename
+    else if( writePos + count > capacity )
+    {
+        writePos = 0;
+
+        CInstanceStats2D::Instance().IncInstanceStallLockCounter();
+    }
+
+    // The start of the buffer is always locked with discard so the GPU can keep
+    // reading the old contents while we write the new ones
+    DWORD flags = (writePos == 0) ? D3DLOCK_DISCARD : D3DLOCK_NOOVERWRITE;
+
+    void * pData;
+    HRESULT hr;
+
+    if( FAILED( hr = spBuffer->Lock( static_cast<UINT>(writePos * stride),
+                                     static_cast<UINT>(count * stride),
+                                     &pData,
+                                     flags ) ) )
+    {
+        DisplayError( hr, __FUNCTION__, __LINE__ );
+    }
+
+    offset = static_cast<UINT>(writePos);
+    writePos += count;
+
+    return pData;
+
+}	// Lock
+
+
+/************************************************************************
+*    desc:  Unlock the buffer
+************************************************************************/
+void CInstanceBuffer2D::Unlock()
+{
+    spBuffer->Unlock();
+
+}	// Unlock
+
+
+/************************************************************************
+*    desc:  Release the buffer. It's recreated on the next lock
+************************************************************************/
+void CInstanceBuffer2D::Release()
+{
+    spBuffer.Release();
+    capacity = 0;
+    writePos = 0;
+    lowUsageCount = 0;
+    lowUsagePeak = 0;
+
+}	// Release
+
+
+/************************************************************************
+*    desc:  Release the buffer when the device is lost. The capacity is
+*           kept so the buffer comes back at the same size
+************************************************************************/
+void CInstanceBuffer2D::OnLostDevice()
+{
+    lostCapacity = capacity;
+    Release();
+
+}	// OnLostDevice
+
+
+/************************************************************************
+*    desc:  Create the buffer again after the device is reset. Nothing
+*           is kept in it from frame to frame, so it starts out empty
+************************************************************************/
+void CInstanceBuffer2D::OnResetDevice()
+{
+    if( lostCapacity > 0 )
+        Create( lostCapacity );
+
+    lostCapacity = 0;
+
+}	// OnResetDevice
+
+
+/************************************************************************
+*    desc:  Recreate the buffer to hold the passed in amount of instances
+*
+*	 param:	size_t count - amount of instances
+************************************************************************/
+void CInstanceBuffer2D::Create( size_t count )
+{
+    if( stride == 0 )
+        throw NExcept::CCriticalException( "Instance Buffer Error!", 
+                boost::str( boost::format("The instance size was never set.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
+
+    Release();
+
+    // Appending only works if the instance stream can start at an offset
+    D3DCAPS9 caps;
+    CGraphicsDevice2D::Instance().GetDeviceCaps( &caps );
+    streamOffset = ((caps.DevCaps2 & D3DDEVCAPS2_STREAMOFFSET) != 0);
+
+    capacity = std::max( count, MIN_CAPACITY );
+
+    HRESULT hr;
+
+    if( FAILED( hr = CGraphicsDevice2D::Instance().CreateVertexBuffer( 
+                static_cast<UINT>(capacity * stride), 
+                D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+                0, 
+                D3DPOOL_DEFAULT, 
+                &spBuffer ) ) )
+    {
+        capacity = 0;
+        DisplayError( hr, __FUNCTION__, __LINE__ );
+    }
+
+    CInstanceStats2D::Instance().IncInstanceReallocCounter();
+
+}	// Create
+
+
+/************************************************************************
+*    desc:  Keep track of the usage and shrink the buffer if it's been
+*           mostly empty for a while
+*
+*	 param:	size_t count - amount of instances locked this frame
+************************************************************************/
+void CInstanceBuffer2D::CheckShrink( size_t count )
+{
+    if( (capacity > MIN_CAPACITY) && (count * SHRINK_RATIO < capacity) )
+    {
+        lowUsagePeak = std::max( lowUsagePeak, count );
+
+        // Shrink to leave room for the peak to grow before we have to reallocate again
+        if( ++lowUsageCount >= shrinkFrameCount )
+            Create( lowUsagePeak * GROWTH_FACTOR );
+    }
+    else
+    {
+        lowUsageCount = 0;
+        lowUsagePeak = 0;
+    }
+
+}	// CheckShrink
+
+
+/************************************************************************
+*    desc:  Display error information
+*
+*    param: HRESULT hr - return result from function call
+************************************************************************/
+void CInstanceBuffer2D::DisplayError( HRESULT hr, const std::string & functionStr, int lineValue )
+{
+    switch( hr )
+    {
+        case D3DERR_OUTOFVIDEOMEMORY:
+        {
+            throw NExcept::CCriticalException("Instance Buffer Error!", 
+                    boost::str( boost::format("Error creating instance buffer. Does not have enough display memory.\n\n%s\nLine: %d") % functionStr % lineValue ));
+    
+            break;
+        }
+        case D3DERR_INVALIDCALL:
+        {
+            throw NExcept::CCriticalException("Instance Buffer Error!", 
+                    boost::str( boost::format("Instance buffer error. The method call is invalid.\n\n%s\nLine: %d") % functionStr % lineValue ));
+    
+            break;
+        }
+        case E_OUTOFMEMORY:
+        {
+            throw NExcept::CCriticalException("Instance Buffer Error!", 
+                    boost::str( boost::format("Error creating instance buffer. Direct3D could not allocate sufficient memory.\n\n%s\nLine: %d") % functionStr % lineValue ));
+    
+            break;
+        }
+        default:
+        {
+            throw NExcept::CCriticalException("Instance Buffer Error!", 
+                    boost::str( boost::format("Instance buffer error. Unknow error.\n\n%s\nLine: %d") % functionStr % lineValue ));
+    
+            break;
+        }
+    }
+
+}	// DisplayError
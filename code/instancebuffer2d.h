@@ -0,0 +1,114 @@
+/************************************************************************
+*    FILE NAME:       instancebuffer2d.h
+*
+*    DESCRIPTION:     Dynamic instance buffer used as a ring buffer.
+*                     Instance data is appended with no-overwrite locks
+*                     and the buffer is discarded when it wraps.
+************************************************************************/
+
+#ifndef __instance_buffer_2d_h__
+#define __instance_buffer_2d_h__
+
+// Windows lib dependencies
+#include <atlbase.h>
+
+// DirectX lib dependencies
+#include <d3d9.h>
+
+// Standard lib dependencies
+#include <string>
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <2d/graphicsdevice2d.h>
+
+class CInstanceBuffer2D : public boost::noncopyable, public CDeviceResource2D
+{
+public:
+
+    // Constructor
+    CInstanceBuffer2D();
+
+    // Destructor
+    ~CInstanceBuffer2D();
+
+    // Set the size of one instance. Releases the buffer if the size changes
+    void SetStride( UINT _stride );
+
+    // Make sure the buffer can hold the passed in amount of instances
+    void Reserve( size_t count );
+
+    // Lock space for the passed in amount of instances. The offset is where the
+    // locked instances start in the buffer
+    void * Lock( size_t count, UINT & offset );
+
+    // Unlock the buffer
+    void Unlock();
+
+    // Get the vertex buffer and the size of one instance
+    IDirect3DVertexBuffer9 * GetBuffer() const
+    { return spBuffer; }
+
+    UINT GetStride() const
+    { return stride; }
+
+    // Get the amount of instances the buffer can hold
+    size_t GetCapacity() const
+    { return capacity; }
+
+    // Set the number of low usage locks in a row before the buffer shrinks
+    void SetShrinkFrameCount( uint count )
+    { shrinkFrameCount = count; }
+
+    // Release the buffer. It's recreated on the next lock
+    void Release();
+
+    // Dynamic buffers live in the default pool. The buffer is released when the device
+    // is lost and created again at the same size when it's reset
+    virtual void OnLostDevice();
+    virtual void OnResetDevice();
+
+private:
+
+    // Recreate the buffer to hold the passed in amount of instances
+    void Create( size_t count );
+
+    // Keep track of the usage and shrink the buffer if it's been mostly empty for a while
+    void CheckShrink( size_t count );
+
+    // Display error information
+    void DisplayError( HRESULT hr, const std::string & functionStr, int lineValue );
+
+private:
+
+    // The dynamic vertex buffer
+    CComPtr<IDirect3DVertexBuffer9> spBuffer;
+
+    // The size of one instance
+    UINT stride;
+
+    // The amount of instances the buffer can hold
+    size_t capacity;
+
+    // The instance the next lock starts at
+    size_t writePos;
+
+    // Whether the device can start a stream at an offset. Without it every lock starts at the beginning
+    bool streamOffset;
+
+    // Number of low usage locks in a row and how many it takes to shrink the buffer
+    uint lowUsageCount;
+    uint shrinkFrameCount;
+
+    // The largest lock seen while counting low usage locks
+    size_t lowUsagePeak;
+
+    // The amount of instances the buffer held when the device was lost
+    size_t lostCapacity;
+
+};
+
+#endif  // __instance_buffer_2d_h__
@@ -0,0 +1,124 @@
+/************************************************************************
+*    FILE NAME:       instancelayout2d.h
+*
+*    DESCRIPTION:     Compact instance layouts of the 2D instance mesh,
+*                     put together at compile time from the attributes
+*                     a mesh uses. The attributes pick the packed
+*                     instance and the vertex declaration that reads it.
+************************************************************************/
+
+#ifndef __instance_layout_2d_h__
+#define __instance_layout_2d_h__
+
+// Standard lib dependencies
+#include <cstddef>
+
+// DirectX lib dependencies
+#include <d3d9.h>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <2d/instancepack2d.h>
+
+// The attributes of an instance that a mesh can do without
+enum EInstanceAttribute
+{
+    // The sprites have their own color. Without it they're drawn white
+    EIA_TINT = 1,
+
+    // Some sprites are animated by the shader
+    EIA_ANIMATION = 2,
+
+    // Some sprites use the perspective projection. Without it they all use the orthographic one
+    EIA_PERSPECTIVE = 4,
+
+    EIA_ALL = EIA_TINT | EIA_ANIMATION | EIA_PERSPECTIVE
+};
+
+// Most elements a compact vertex declaration has, counting the end
+const size_t MAX_COMPACT_ELEMENT_COUNT = 8;
+
+// Picks the packed instance. The color is the only attribute that takes up room of its own
+template <bool TINT>
+class CCompactInstanceType2D
+{
+public:
+    typedef CCompactInstance2D CInstance;
+};
+
+template <>
+class CCompactInstanceType2D<false>
+{
+public:
+    typedef CUntintedInstance2D CInstance;
+};
+
+//////////////////////////////////////////////////////////////
+//	Compact instance layout with a set of the attributes.
+//  The fill and the shader are specialized on the same
+//  constants, so neither checks an attribute per sprite.
+//////////////////////////////////////////////////////////////
+template <uint ATTRIBUTES>
+class CCompactLayout2D
+{
+public:
+
+    enum
+    {
+        TINT = ((ATTRIBUTES & EIA_TINT) != 0),
+        ANIMATION = ((ATTRIBUTES & EIA_ANIMATION) != 0),
+        PERSPECTIVE = ((ATTRIBUTES & EIA_PERSPECTIVE) != 0)
+    };
+
+    // The instance uploaded for each sprite
+    typedef typename CCompactInstanceType2D<TINT>::CInstance CInstance;
+
+    /************************************************************************
+    *    desc:  Fill in the vertex declaration. Stream 0 is the vertex buffer
+    *           and stream 1 the instances. The offsets come from the packed
+    *           instance, so the two can't disagree
+    *
+    *	 param:	D3DVERTEXELEMENT9 * pElement - MAX_COMPACT_ELEMENT_COUNT elements to fill in
+    ************************************************************************/
+    static void GetVertexElements( D3DVERTEXELEMENT9 * pElement )
+    {
+        const D3DVERTEXELEMENT9 end = D3DDECL_END();
+        size_t count = 0;
+
+        // Position of the vertex and the index used to pick its corner
+        pElement[count++] = Element( 0, 0,  D3DDECLTYPE_FLOAT3, D3DDECLUSAGE_POSITION,     0 );
+        pElement[count++] = Element( 0, 12, D3DDECLTYPE_UBYTE4, D3DDECLUSAGE_BLENDINDICES, 0 );
+
+        // The 2x2 rotation and scale matrix as half floats, and the translation
+        pElement[count++] = Element( 1, offsetof(CInstance, axis), D3DDECLTYPE_FLOAT16_4, D3DDECLUSAGE_TEXCOORD, 1 );
+        pElement[count++] = Element( 1, offsetof(CInstance, pos),  D3DDECLTYPE_FLOAT4,    D3DDECLUSAGE_TEXCOORD, 2 );
+
+        // The color of the instance
+        if( TINT )
+            pElement[count++] = Element( 1, offsetof(CCompactInstance2D, color), D3DDECLTYPE_D3DCOLOR, D3DDECLUSAGE_COLOR, 0 );
+
+        // The UVs, and the atlas page and flags of the instance
+        pElement[count++] = Element( 1, offsetof(CInstance, uv),   D3DDECLTYPE_USHORT4N, D3DDECLUSAGE_TEXCOORD, 5 );
+        pElement[count++] = Element( 1, offsetof(CInstance, misc), D3DDECLTYPE_UBYTE4,   D3DDECLUSAGE_TEXCOORD, 6 );
+
+        pElement[count] = end;
+    }
+
+private:
+
+    // Make an element of the declaration
+    static D3DVERTEXELEMENT9 Element( WORD stream, size_t offset, int type, int usage, int usageIndex )
+    {
+        D3DVERTEXELEMENT9 element;
+        element.Stream = stream;
+        element.Offset = static_cast<WORD>(offset);
+        element.Type = static_cast<BYTE>(type);
+        element.Method = D3DDECLMETHOD_DEFAULT;
+        element.Usage = static_cast<BYTE>(usage);
+        element.UsageIndex = static_cast<BYTE>(usageIndex);
+
+        return element;
+    }
+};
+
+#endif  // __instance_layout_2d_h__
@@ -8,22 +8,31 @@
 // Physical component dependency
 #include <2d/instancemesh2d.h>
 
+// Standard lib dependencies
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 // Boost lib dependencies
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
 
 // Game lib dependencies
 #include <2d/actorsprite2d.h>
 #include <2d/spritegroup2d.h>
 #include <2d/visualsprite2d.h>
+#include <2d/renderstatecache2d.h>
 #include <utilities/exceptionhandling.h>
 #include <utilities/genfunc.h>
 #include <utilities/sortfunc.h>
 #include <utilities/statcounter.h>
-#include <system/xdevice.h>
-#include <managers/shader.h>
-#include <managers/texturemanager.h>
+#include <utilities/jobpool.h>
+#include <2d/graphicsdevice2d.h>
+#include <2d/instancestats2d.h>
 #include <managers/megatexturemanager.h>
 #include <common/matrix.h>
+#include <common/object.h>
 #include <common/texture.h>
 #include <common/megatexturecomponent.h>
 #include <common/megatexture.h>
@@ -55,14 +64,281 @@ const D3DVERTEXELEMENT9 vertexElement[] =
     // is used to determine which two UV values make up its UVs
     { 1, 80, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 5 },
 
+    // The atlas page and flags of the instance
+    { 1, 96, D3DDECLTYPE_UBYTE4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 6 },
+
     D3DDECL_END()
 };
 
+// The parts of a compact layout picked when the mesh is initialized. See CCompactLayout2D
+class CCompactLayoutEntry
+{
+public:
+
+    // Size of the instance and the vertex declaration that reads it
+    size_t stride;
+    void (*GetVertexElements)( D3DVERTEXELEMENT9 * pElement );
+
+    // The techniques the instances are drawn with as quads, as hulls and merged
+    const char * pTechnique;
+    const char * pHullTechnique;
+    const char * pPagesTechnique;
+};
+
+// The compact layouts, indexed by their attributes. The perspective is only in the fill, so the
+// layouts with and without it share their declaration and shaders
+const CCompactLayoutEntry COMPACT_LAYOUT[EIA_ALL + 1] =
+{
+    { sizeof(CCompactLayout2D<0>::CInstance), &CCompactLayout2D<0>::GetVertexElements,
+      "instanceCompactUntintedStatic", "instanceCompactUntintedStaticHull", "instanceCompactUntintedStaticPages" },
+    { sizeof(CCompactLayout2D<1>::CInstance), &CCompactLayout2D<1>::GetVertexElements,
+      "instanceCompactStatic", "instanceCompactStaticHull", "instanceCompactStaticPages" },
+    { sizeof(CCompactLayout2D<2>::CInstance), &CCompactLayout2D<2>::GetVertexElements,
+      "instanceCompactUntinted", "instanceCompactUntintedHull", "instanceCompactUntintedPages" },
+    { sizeof(CCompactLayout2D<3>::CInstance), &CCompactLayout2D<3>::GetVertexElements,
+      "instanceCompact", "instanceCompactHull", "instanceCompactPages" },
+    { sizeof(CCompactLayout2D<4>::CInstance), &CCompactLayout2D<4>::GetVertexElements,
+      "instanceCompactUntintedStatic", "instanceCompactUntintedStaticHull", "instanceCompactUntintedStaticPages" },
+    { sizeof(CCompactLayout2D<5>::CInstance), &CCompactLayout2D<5>::GetVertexElements,
+      "instanceCompactStatic", "instanceCompactStaticHull", "instanceCompactStaticPages" },
+    { sizeof(CCompactLayout2D<6>::CInstance), &CCompactLayout2D<6>::GetVertexElements,
+      "instanceCompactUntinted", "instanceCompactUntintedHull", "instanceCompactUntintedPages" },
+    { sizeof(CCompactLayout2D<7>::CInstance), &CCompactLayout2D<7>::GetVertexElements,
+      "instanceCompact", "instanceCompactHull", "instanceCompactPages" },
+};
+
+// The fill of each compact layout. Every set of attributes gets its own loop
+const CInstanceMesh2D::TCompactFill CInstanceMesh2D::COMPACT_FILL[EIA_ALL + 1] =
+{
+    &CInstanceMesh2D::FillCompactInstances<0>,
+    &CInstanceMesh2D::FillCompactInstances<1>,
+    &CInstanceMesh2D::FillCompactInstances<2>,
+    &CInstanceMesh2D::FillCompactInstances<3>,
+    &CInstanceMesh2D::FillCompactInstances<4>,
+    &CInstanceMesh2D::FillCompactInstances<5>,
+    &CInstanceMesh2D::FillCompactInstances<6>,
+    &CInstanceMesh2D::FillCompactInstances<7>,
+};
+
+// The smallest amount of instances worth handing to a worker thread
+const size_t MIN_FILL_CHUNK_SIZE = 256;
+
+// Two dirty persistent ranges closer than this many slots are uploaded as one. Rebuilding
+// a few clean slots is cheaper than another lock
+const size_t MAX_DIRTY_SLOT_GAP = 16;
+
+// The smallest amount of slots the persistent instance buffer is created with
+const size_t MIN_PERSISTENT_CAPACITY = 64;
+
+// UVs given to empty persistent slots
+const float EMPTY_SLOT_UV[4] = { 0, 0, 0, 0 };
+
+// The most atlas pages a draw can sample. The shader has a sampler for each page, so it's
+// also the most pages of a mega texture and of the meshes merged into one draw
+const size_t MAX_PAGE_COUNT = 4;
+
+// Names of the page textures in the shader. Page zero is the diffuse texture
+const char * PAGE_TEXTURE_NAME[MAX_PAGE_COUNT] = { "diffuseTexture", "pageTexture1", "pageTexture2", "pageTexture3" };
+
+// The render queue index of a merged sprite holds its mesh in the top bits
+const uint MERGED_MESH_SHIFT = 24;
+const uint MERGED_SPRITE_MASK = (1 << MERGED_MESH_SHIFT) - 1;
+
+// Sizes of the animation tables. They have to match the ones in shader_2d.fx
+const size_t MAX_ANIMATION_FRAMES = 192;
+const size_t MAX_ANIMATIONS = 32;
+
+// Flag of an instance the shader animates
+const uint INSTANCE_FLAG_ANIMATED = 1;
+
+// Flag of an instance that uses the orthographic projection. It picks the camera offset
+const uint INSTANCE_FLAG_ORTHOGRAPHIC = 2;
+
+// The hulls are drawn as a fan of triangles after the quad in the vertex and index buffers
+const int HULL_FACE_COUNT = CMegaTexture::HULL_VERTEX_COUNT - 2;
+const int HULL_INDEX_COUNT = HULL_FACE_COUNT * 3;
+
+// The hull texture holds two corners per texel
+const UINT HULL_TEXTURE_WIDTH = CMegaTexture::HULL_VERTEX_COUNT / 2;
+
+// The instance's hull is 16 bits of its misc value
+const uint MAX_HULL_COUNT = 0xFFFF;
+
+// The whole quad, going the same way around as the hulls
+const float QUAD_HULL[CMegaTexture::HULL_VERTEX_COUNT * 2] = { 0,0, 1,0, 1,0, 1,1, 1,1, 0,1, 0,1, 0,0 };
+
+// Frames with up to this many sprites are drawn as a quad batch until the first mesh calibrates
+// the threshold. A handful of quads is cheaper to copy than an instanced draw is to set up
+const uint DEFAULT_QUAD_BATCH_THRESHOLD = 16;
+
+// Most sprites a frame can have to be drawn as a quad batch. Shared by every mesh
+uint CInstanceMesh2D::quadBatchThreshold = DEFAULT_QUAD_BATCH_THRESHOLD;
+
+// Whether the quad batch threshold was calibrated or set by the game. Until it is, Init calibrates it
+static bool quadBatchThresholdSet = false;
+
+// Renders each sprite count of the quad batch calibration is timed over, either way
+const int QUAD_BATCH_RENDER_COUNT = 32;
+
+// Size and UVs of the sprites the quad batch calibration draws, so the GPU has pixels to shade
+const float QUAD_BATCH_SPRITE_SIZE = 32.f;
+const float QUAD_BATCH_SPRITE_UV[4] = { 0, 0, 1, 1 };
+
+// The clock the CPU side of the quad batch calibration is timed with
+typedef boost::chrono::high_resolution_clock CalibrationClock;
+
+// The mesh whose animation tables the shader has. The effect is shared by every mesh
+static const CInstanceMesh2D * pAnimationTableOwner = NULL;
+
+/************************************************************************
+*    desc:  Project a rectangle at a depth into normalized device
+*           coordinates. The sprites face the camera and the projection
+*           doesn't mix x and y, so every corner has the same w and the
+*           sides stay straight
+*
+*	 param:	const float * pMatrix          - row major projection
+*			float left, bottom, right, top - rectangle in view space
+*			float z                        - depth of the rectangle
+*			float * pRect                  - left, bottom, right and top after the projection
+*
+*	 ret:	bool - false if the rectangle is behind the camera
+************************************************************************/
+static bool ProjectRect( const float * pMatrix, float left, float bottom, float right, float top, float z, float * pRect )
+{
+    const float w = ((left + right) * 0.5f * pMatrix[3]) + ((bottom + top) * 0.5f * pMatrix[7]) + (z * pMatrix[11]) + pMatrix[15];
+
+    if( w <= 0.f )
+        return false;
+
+    const float x1 = ((left * pMatrix[0]) + (z * pMatrix[8]) + pMatrix[12]) / w;
+    const float x2 = ((right * pMatrix[0]) + (z * pMatrix[8]) + pMatrix[12]) / w;
+    const float y1 = ((bottom * pMatrix[5]) + (z * pMatrix[9]) + pMatrix[13]) / w;
+    const float y2 = ((top * pMatrix[5]) + (z * pMatrix[9]) + pMatrix[13]) / w;
+
+    pRect[0] = std::min( x1, x2 );
+    pRect[1] = std::min( y1, y2 );
+    pRect[2] = std::max( x1, x2 );
+    pRect[3] = std::max( y1, y2 );
+
+    return true;
+
+}	// ProjectRect
+
+
+/************************************************************************
+*    desc:  Times the draws between Begin and End on the GPU with
+*           timestamp queries. The time is read after the GPU passed the
+*           end timestamp, so reading it waits for the GPU. Timestamps
+*           that were disjoint, like when the clock changed in between,
+*           give no time
+************************************************************************/
+class CGpuTimer2D
+{
+public:
+
+    // Create the queries. False if the device has no timestamps
+    bool Create()
+    {
+        CGraphicsDevice2D & device = CGraphicsDevice2D::Instance();
+
+        if( FAILED( device.CreateQuery( D3DQUERYTYPE_TIMESTAMPDISJOINT, &spDisjoint ) ) ||
+            FAILED( device.CreateQuery( D3DQUERYTYPE_TIMESTAMP, &spBegin ) ) ||
+            FAILED( device.CreateQuery( D3DQUERYTYPE_TIMESTAMP, &spEnd ) ) ||
+            FAILED( device.CreateQuery( D3DQUERYTYPE_TIMESTAMPFREQ, &spFrequency ) ) )
+        {
+            spDisjoint.Release();
+            spBegin.Release();
+            spEnd.Release();
+            spFrequency.Release();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    // Put the timestamps before and after the draws
+    void Begin()
+    {
+        if( spFrequency == NULL )
+            return;
+
+        spDisjoint->Issue( D3DISSUE_BEGIN );
+        spBegin->Issue( D3DISSUE_END );
+    }
+
+    void End()
+    {
+        if( spFrequency == NULL )
+            return;
+
+        spEnd->Issue( D3DISSUE_END );
+        spDisjoint->Issue( D3DISSUE_END );
+        spFrequency->Issue( D3DISSUE_END );
+    }
+
+    // Wait for the GPU to get through the draws and get their time in microseconds.
+    // Negative when there's no time
+    double GetMicroseconds()
+    {
+        BOOL disjoint;
+        UINT64 begin, end, frequency;
+
+        if( (spFrequency == NULL) ||
+            !GetData( spDisjoint, &disjoint, sizeof( disjoint ) ) || disjoint ||
+            !GetData( spBegin, &begin, sizeof( begin ) ) ||
+            !GetData( spEnd, &end, sizeof( end ) ) ||
+            !GetData( spFrequency, &frequency, sizeof( frequency ) ) || (frequency == 0) )
+        {
+            return -1.0;
+        }
+
+        return (static_cast<double>(end - begin) * 1000000.0) / static_cast<double>(frequency);
+    }
+
+private:
+
+    // Wait for the answer of a query. False if the device can't give it, like when it's lost
+    static bool GetData( IDirect3DQuery9 * pQuery, void * pData, DWORD size )
+    {
+        HRESULT hr;
+        while( (hr = pQuery->GetData( pData, size, D3DGETDATA_FLUSH )) == S_FALSE )
+        {}
+
+        return (hr == S_OK);
+    }
+
+private:
+
+    CComPtr<IDirect3DQuery9> spDisjoint;
+    CComPtr<IDirect3DQuery9> spBegin;
+    CComPtr<IDirect3DQuery9> spEnd;
+    CComPtr<IDirect3DQuery9> spFrequency;
+};
+
+
 /************************************************************************
 *    desc:  Constructor                                                             
 ************************************************************************/
 CInstanceMesh2D::CInstanceMesh2D()
-               : instanceCount(0),
+               : occlusionMode(true),
+                 instanceOffset(0),
+                 persistentOpaqueCount(0),
+                 persistentCapacity(0),
+                 persistentReservedCount(0),
+                 emptySlotCount(0),
+                 persistentSortDirty(false),
+                 persistentAllDirty(false),
+                 pRecordedPacket(NULL),
+                 writePacketIndex(0),
+                 renderPacketMode(false),
+                 cameraLatchMode(false),
+                 animationTime(0),
+                 animationTableDirty(false),
+                 hullMode(true),
+                 instanceLayout(EIL_FULL),
+                 instanceAttributes(EIA_ALL),
+                 mergeLayer(0),
                  VERTEX_COUNT(4),
                  FACE_COUNT(2),
                  INDEX_COUNT(FACE_COUNT * 3)
@@ -95,37 +371,336 @@ void CInstanceMesh2D::InitInstanceSprite( CSpriteGroup2D * pSprite )
 
 
 /************************************************************************
-*    desc:  Add a sprite group to the instance mesh
+*    desc:  Add a sprite group to the instance mesh. It's only a
+*           candidate until the culling stage has seen it
 *
 *	 param:	CSpriteGroup2D * pSprite - Sprite to add to the instance mesh
+*			bool opaque              - whether the sprite is drawn in the opaque pass
 ************************************************************************/
-void CInstanceMesh2D::AddSprite( CSpriteGroup2D * pSprite )
+void CInstanceMesh2D::AddSprite( CSpriteGroup2D * pSprite, bool opaque )
 {
-    pRenderMultiMap.insert( std::make_pair(pSprite->GetPos().z, SpriteGrp(pSprite, pSprite->GetCurrentFrame())) );
+    // Sprites with a persistent slot are already in the instance data
+    if( !persistentSlotMap.empty() && (persistentSlotMap.find( pSprite ) != persistentSlotMap.end()) )
+        return;
+
+    spriteGrpVec.push_back( SpriteGrp(pSprite, pSprite->GetCurrentFrame(), opaque) );
 
 }	// AddSprite
 
 
+/************************************************************************
+*    desc:  Add the frames of a sprite's animation to the frame table of
+*           the mesh. The UVs of every frame are looked up once here so
+*           the shader can pick the frame. Call when loading, before
+*           the mesh is rendered
+*
+*	 param:	CSpriteGroup2D * pSprite - sprite whose frames are added
+*			uint frameCount          - number of frames in the animation
+*
+*	 ret:	uint - animation ID
+************************************************************************/
+uint CInstanceMesh2D::AddAnimation( CSpriteGroup2D * pSprite, uint frameCount )
+{
+    const size_t firstFrame = animationFrameVec.size() / 4;
+    const size_t animation = animationInfoVec.size() / 4;
+
+    if( (frameCount == 0) || (firstFrame + frameCount > MAX_ANIMATION_FRAMES) || (animation >= MAX_ANIMATIONS) )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("Animation of %d frames doesn't fit in the animation table (%d of %d frames, %d of %d animations).\n\n%s\nLine: %s") 
+                    % frameCount % firstFrame % MAX_ANIMATION_FRAMES % animation % MAX_ANIMATIONS % __FUNCTION__ % __LINE__ ));
+
+    const int currentFrame = pSprite->GetCurrentFrame();
+    std::vector<uint> componentIdVec( frameCount );
+
+    for( uint frame = 0; frame < frameCount; ++frame )
+    {
+        pSprite->SetCurrentFrame( frame );
+        componentIdVec[frame] = pMegaTexture->GetComponentId( pSprite->GetActiveTexture() );
+    }
+
+    pSprite->SetCurrentFrame( currentFrame );
+
+    // The shader only picks the frame, so every frame has to be on the page of the first
+    const uint page = pMegaTexture->GetPage( componentIdVec[0] );
+
+    for( uint frame = 1; frame < frameCount; ++frame )
+        if( pMegaTexture->GetPage( componentIdVec[frame] ) != page )
+            throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                    boost::str( boost::format("The frames of an animation are on different pages of the mega texture (%d and %d).\n\n%s\nLine: %s") 
+                        % page % pMegaTexture->GetPage( componentIdVec[frame] ) % __FUNCTION__ % __LINE__ ));
+
+    // The animation can only be drawn without blending if every frame can
+    bool opaque = true;
+
+    for( uint frame = 0; frame < frameCount; ++frame )
+    {
+        const float * pUV = pMegaTexture->GetUVs( componentIdVec[frame] );
+        animationFrameVec.insert( animationFrameVec.end(), pUV, pUV + 4 );
+
+        opaque = opaque && pMegaTexture->IsOpaque( componentIdVec[frame] );
+    }
+
+    animationInfoVec.push_back( static_cast<float>(firstFrame) );
+    animationInfoVec.push_back( static_cast<float>(frameCount) );
+    animationInfoVec.push_back( 0 );
+    animationInfoVec.push_back( 0 );
+    animationPageVec.push_back( page );
+    animationOpaqueVec.push_back( opaque );
+
+    animationTableDirty = true;
+
+    return static_cast<uint>(animation);
+
+}	// AddAnimation
+
+
+/************************************************************************
+*    desc:  Add a sprite group the shader animates. The animation loops
+*           from the start time, so only where in the loop it is at
+*           time zero is passed on
+*
+*	 param:	CSpriteGroup2D * pSprite - Sprite to add to the instance mesh
+*			uint animation           - ID from AddAnimation
+*			float startTime          - time the animation started at
+*			float frameRate          - frames per second
+*			bool opaque              - whether the sprite is drawn in the opaque pass
+************************************************************************/
+void CInstanceMesh2D::AddAnimatedSprite( CSpriteGroup2D * pSprite, uint animation, float startTime, float frameRate, bool opaque )
+{
+    if( (instanceAttributes & EIA_ANIMATION) == 0 )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("The mesh was initialized without animation.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
+
+    if( animation >= animationInfoVec.size() / 4 )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("Animation (%d) hasn't been added.\n\n%s\nLine: %s") % animation % __FUNCTION__ % __LINE__ ));
+
+    // Sprites with a persistent slot are already in the instance data
+    if( !persistentSlotMap.empty() && (persistentSlotMap.find( pSprite ) != persistentSlotMap.end()) )
+        return;
+
+    const float frameCount = animationInfoVec[animation * 4 + 1];
+    const float rate = CCompactInstance2D::QuantizeAnimationRate( frameRate );
+
+    float phase = -startTime * rate / frameCount;
+    phase -= std::floor( phase );
+
+    spriteGrpVec.push_back( SpriteGrp(pSprite, animation, phase, rate, opaque) );
+
+}	// AddAnimatedSprite
+
+
+/************************************************************************
+*    desc:  Set the time the animations are played at
+*
+*	 param:	float time - time in seconds
+************************************************************************/
+void CInstanceMesh2D::SetAnimationTime( float time )
+{
+    animationTime = time;
+
+}	// SetAnimationTime
+
+
+/************************************************************************
+*    desc:  Give a sprite a persistent slot in the instance data. The
+*           slots are drawn in order, so a new sprite sorts the slots
+*           again to find its place
+*
+*	 param:	CSpriteGroup2D * pSprite - Sprite to add to the instance mesh
+*			bool opaque              - whether the sprite is drawn in the opaque pass
+************************************************************************/
+void CInstanceMesh2D::AddPersistentSprite( CSpriteGroup2D * pSprite, bool opaque )
+{
+    boost::unordered_map<CSpriteGroup2D *, uint>::iterator iter = persistentSlotMap.find( pSprite );
+
+    if( iter != persistentSlotMap.end() )
+    {
+        // The opaque sprites have slots of their own
+        if( (persistentOpaqueVec[iter->second] != 0) != opaque )
+        {
+            persistentOpaqueVec[iter->second] = opaque;
+            persistentSortDirty = true;
+        }
+
+        MarkPersistentDirty( pSprite );
+        return;
+    }
+
+    uint slot = static_cast<uint>(persistentSpriteVec.size());
+
+    persistentSlotMap.insert( std::make_pair( pSprite, slot ) );
+    persistentSpriteVec.push_back( pSprite );
+    persistentKeyVec.push_back( CRenderQueue2D::GetDepthKey( pSprite->GetPos().z ) );
+    persistentOpaqueVec.push_back( opaque );
+    persistentStateVec.push_back( CPersistentState() );
+    persistentDirtyVec.push_back( 0 );
+
+    persistentSortDirty = true;
+
+}	// AddPersistentSprite
+
+
+/************************************************************************
+*    desc:  Free the persistent slot of a sprite. The slot is left empty
+*           so the other slots keep their place
+*
+*	 param:	CSpriteGroup2D * pSprite - Sprite to remove
+************************************************************************/
+void CInstanceMesh2D::RemovePersistentSprite( CSpriteGroup2D * pSprite )
+{
+    boost::unordered_map<CSpriteGroup2D *, uint>::iterator iter = persistentSlotMap.find( pSprite );
+
+    if( iter != persistentSlotMap.end() )
+    {
+        uint slot = iter->second;
+        persistentSlotMap.erase( iter );
+
+        persistentSpriteVec[slot] = NULL;
+        ++emptySlotCount;
+
+        // Compact the slots once most of them are empty
+        if( emptySlotCount > (persistentSpriteVec.size() >> 1) )
+        {
+            persistentSortDirty = true;
+        }
+        else if( !persistentDirtyVec[slot] )
+        {
+            persistentDirtyVec[slot] = 1;
+            dirtySlotVec.push_back( slot );
+        }
+    }
+
+}	// RemovePersistentSprite
+
+
+/************************************************************************
+*    desc:  Mark the persistent slot of a sprite to be rebuilt
+*
+*	 param:	CSpriteGroup2D * pSprite - Sprite that changed
+************************************************************************/
+void CInstanceMesh2D::MarkPersistentDirty( CSpriteGroup2D * pSprite )
+{
+    boost::unordered_map<CSpriteGroup2D *, uint>::iterator iter = persistentSlotMap.find( pSprite );
+
+    if( (iter != persistentSlotMap.end()) && !persistentDirtyVec[iter->second] )
+    {
+        persistentDirtyVec[iter->second] = 1;
+        dirtySlotVec.push_back( iter->second );
+    }
+
+}	// MarkPersistentDirty
+
+
+/************************************************************************
+*    desc:  Mark every persistent slot to be rebuilt
+************************************************************************/
+void CInstanceMesh2D::MarkAllPersistentDirty()
+{
+    persistentAllDirty = true;
+
+}	// MarkAllPersistentDirty
+
+
+/************************************************************************
+*    desc:  Free all of the persistent slots
+************************************************************************/
+void CInstanceMesh2D::ClearPersistentSprites()
+{
+    persistentSpriteVec.clear();
+    persistentKeyVec.clear();
+    persistentOpaqueVec.clear();
+    persistentSlotMap.clear();
+    persistentStateVec.clear();
+    persistentDirtyVec.clear();
+    dirtySlotVec.clear();
+
+    persistentOpaqueCount = 0;
+    emptySlotCount = 0;
+    persistentSortDirty = false;
+    persistentAllDirty = false;
+
+}	// ClearPersistentSprites
+
+
 /************************************************************************
 *    desc:  Initialize the mesh
+*
+*	 param:	const string & megatextureName - mega texture the mesh uses
+*			EInstanceLayout layout         - layout of the instance data
+*			uint attributes                - EInstanceAttribute flags the sprites use
+************************************************************************/
+void CInstanceMesh2D::Init( const std::string & megatextureName, EInstanceLayout layout, uint attributes )
+{
+    Init( CMegaTextureManager::Instance().GetTexture( megatextureName ), layout, attributes );
+
+}	// Init
+
+
+/************************************************************************
+*    desc:  Initialize the mesh with a mega texture that isn't in the
+*           mega texture manager
+*
+*	 param:	CMegaTexture * pTexture - mega texture the mesh uses
+*			EInstanceLayout layout  - layout of the instance data
+*			uint attributes         - EInstanceAttribute flags the sprites use
 ************************************************************************/
-void CInstanceMesh2D::Init( const std::string & megatextureName )
+void CInstanceMesh2D::Init( CMegaTexture * pTexture, EInstanceLayout layout, uint attributes )
 {
     HRESULT hr;
 
+    // The shader has a sampler for each page
+    if( pTexture->GetPageCount() > MAX_PAGE_COUNT )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("Mega texture has too many pages (%d). The most is %d.\n\n%s\nLine: %s") 
+                    % pTexture->GetPageCount() % MAX_PAGE_COUNT % __FUNCTION__ % __LINE__ ));
+
+    // The compact layout needs half floats and 16 bit normalized values in the vertex declaration
+    if( layout == EIL_COMPACT )
+    {
+        D3DCAPS9 caps;
+        CGraphicsDevice2D::Instance().GetDeviceCaps( &caps );
+
+        const DWORD compactDeclTypes = D3DDTCAPS_FLOAT16_4 | D3DDTCAPS_USHORT4N;
+        if( (caps.DeclTypes & compactDeclTypes) != compactDeclTypes )
+            layout = EIL_FULL;
+    }
+
+    instanceLayout = layout;
+    instanceAttributes = attributes & EIA_ALL;
+
+    // The persistent slots are rebuilt in the new layout
+    spPersistentBuffer.Release();
+    persistentCapacity = 0;
+    persistentReservedCount = 0;
+
     // Create the vertex declaration
-    CXDevice::Instance().GetXDevice()->CreateVertexDeclaration( vertexElement, &spVertexDeclaration );
+    spVertexDeclaration.Release();
+
+    if( instanceLayout == EIL_COMPACT )
+    {
+        // The declaration is put together from the attributes
+        D3DVERTEXELEMENT9 element[MAX_COMPACT_ELEMENT_COUNT];
+        COMPACT_LAYOUT[instanceAttributes].GetVertexElements( element );
+
+        instanceBuffer.SetStride( COMPACT_LAYOUT[instanceAttributes].stride );
+        CGraphicsDevice2D::Instance().CreateVertexDeclaration( element, &spVertexDeclaration );
+    }
+    else
+    {
+        instanceBuffer.SetStride( sizeof( CInstanceData ) );
+        CGraphicsDevice2D::Instance().CreateVertexDeclaration( vertexElement, &spVertexDeclaration );
+    }
 
     // Create the vertex buffer
     if( spVertexBuffer == NULL )
     {
-        if( FAILED( hr = CXDevice::Instance().GetXDevice()->CreateVertexBuffer( 
-                    VERTEX_COUNT * sizeof( CVertexData ),
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateVertexBuffer( 
+                    (VERTEX_COUNT + CMegaTexture::HULL_VERTEX_COUNT) * sizeof( CVertexData ),
                     D3DUSAGE_WRITEONLY, 
                     0,
                     D3DPOOL_MANAGED, 
-                    &spVertexBuffer, 
-                    NULL ) ) )
+                    &spVertexBuffer ) ) )
         {
             DisplayError( hr );
         }
@@ -134,13 +709,12 @@ void CInstanceMesh2D::Init( const std::string & megatextureName )
     // Create the index buffer
     if( spIndexBuffer == NULL )
     {
-        if( FAILED( hr = CXDevice::Instance().GetXDevice()->CreateIndexBuffer( 
-                    INDEX_COUNT * sizeof( WORD ), 
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateIndexBuffer( 
+                    (INDEX_COUNT + HULL_INDEX_COUNT) * sizeof( WORD ), 
                     D3DUSAGE_WRITEONLY,
                     D3DFMT_INDEX16, 
                     D3DPOOL_MANAGED, 
-                    &spIndexBuffer, 
-                    NULL ) ) )
+                    &spIndexBuffer ) ) )
         {
             DisplayError( hr );
         }
@@ -167,6 +741,14 @@ void CInstanceMesh2D::Init( const std::string & megatextureName )
     pVertex[2].uvIndex = 2;
     pVertex[3].uvIndex = 3;
 
+    // The corners of the hulls come after. The shader looks up their positions and UVs
+    // in the hull texture with the index
+    for( int i = 0; i < CMegaTexture::HULL_VERTEX_COUNT; ++i )
+    {
+        pVertex[VERTEX_COUNT + i].vert = CPoint();
+        pVertex[VERTEX_COUNT + i].uvIndex = i;
+    }
+
     // Unlock the vertex buffer so it can be used
     spVertexBuffer->Unlock();
 
@@ -194,165 +776,2486 @@ void CInstanceMesh2D::Init( const std::string & megatextureName )
     pIndex[4] = 3;
     pIndex[5] = 2;
 
+    // The hull is a fan from its first corner. The indexes are relative to the first hull vertex
+    for( int i = 0; i < HULL_FACE_COUNT; ++i )
+    {
+        pIndex[INDEX_COUNT + (i * 3)] = 0;
+        pIndex[INDEX_COUNT + (i * 3) + 1] = static_cast<WORD>(i + 1);
+        pIndex[INDEX_COUNT + (i * 3) + 2] = static_cast<WORD>(i + 2);
+    }
+
     // Unlock the index buffer so it can be used
     spIndexBuffer->Unlock();
 
-    // Get the texture
-    pMegaTexture = CMegaTextureManager::Instance().GetTexture( megatextureName );
+    // The small frames are drawn from these
+    CreateQuadBatchBuffers();
+
+    pMegaTexture = pTexture;
+
+    // The hulls come from the mega texture
+    CreateHullTexture();
+
+    // The animation UVs were looked up in the old texture
+    animationFrameVec.clear();
+    animationInfoVec.clear();
+    animationPageVec.clear();
+    animationOpaqueVec.clear();
+    animationTableDirty = true;
+
+    // The first mesh times the quad batch against instancing, unless the game set the threshold
+    if( !quadBatchThresholdSet )
+        CalibrateQuadBatchThreshold();
 
 }	// Init
 
 
 /************************************************************************
-*    desc:  Reset the instance buffer to the size of the group vector
+*    desc:  Create the buffers of the quad batch. The vertex buffer holds
+*           the quad once for every sprite a batch can have and the
+*           index buffer the two triangles of each. The instances are
+*           read with a frequency of one, so each corner reads its own
+*           copy of its instance and the instanced shaders draw the batch
 ************************************************************************/
-void CInstanceMesh2D::ResetInstanceBuffer()
+void CInstanceMesh2D::CreateQuadBatchBuffers()
 {
-    // Set the new instance count
-    instanceCount = pRenderMultiMap.size();
+    HRESULT hr;
 
-    HRESULT hr; 
+    if( spQuadVertexBuffer == NULL )
+    {
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateVertexBuffer( 
+                    MAX_QUAD_BATCH_COUNT * VERTEX_COUNT * sizeof( CVertexData ),
+                    D3DUSAGE_WRITEONLY, 
+                    0,
+                    D3DPOOL_MANAGED, 
+                    &spQuadVertexBuffer ) ) )
+        {
+            DisplayError( hr );
+        }
+    }
 
-    // Release the instance buffer and recreate it
-    spInstanceBuffer.Release();
+    if( spQuadIndexBuffer == NULL )
+    {
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateIndexBuffer( 
+                    MAX_QUAD_BATCH_COUNT * INDEX_COUNT * sizeof( WORD ), 
+                    D3DUSAGE_WRITEONLY,
+                    D3DFMT_INDEX16, 
+                    D3DPOOL_MANAGED, 
+                    &spQuadIndexBuffer ) ) )
+        {
+            DisplayError( hr );
+        }
+    }
 
-    if( FAILED( hr = CXDevice::Instance().GetXDevice()->CreateVertexBuffer( 
-                static_cast<UINT>(instanceCount * sizeof( CInstanceData )), 
-                D3DUSAGE_WRITEONLY,
-                0, 
-                D3DPOOL_MANAGED, 
-                &spInstanceBuffer, 
-                NULL ) ) )
+    CVertexData * pVertex;
+    if( FAILED( spQuadVertexBuffer->Lock( 0, 0, (void **)&pVertex, 0 ) ) )
     {
-        DisplayError( hr );
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                                           "An instance mesh failed to lock its quad batch vertex buffer." );
     }
 
-}	// ResetInstanceBuffer
+    // Every quad has the corners of the instanced quad
+    for( uint i = 0; i < MAX_QUAD_BATCH_COUNT; ++i, pVertex += VERTEX_COUNT )
+    {
+        pVertex[0].vert = CPoint(-0.5f,  0.5f, 0);
+        pVertex[1].vert = CPoint( 0.5f,  0.5f, 0);
+        pVertex[2].vert = CPoint(-0.5f, -0.5f, 0);
+        pVertex[3].vert = CPoint( 0.5f, -0.5f, 0);
+
+        pVertex[0].uvIndex = 0;
+        pVertex[1].uvIndex = 1;
+        pVertex[2].uvIndex = 2;
+        pVertex[3].uvIndex = 3;
+    }
 
+    spQuadVertexBuffer->Unlock();
 
-/************************************************************************
-*    desc:  Render the instance mesh
-************************************************************************/
-void CInstanceMesh2D::Render()
-{
-    // Only render if there is something to render
-    if( !pRenderMultiMap.empty() )
+    WORD * pIndex;
+    if( FAILED( spQuadIndexBuffer->Lock( 0, 0, (void **)&pIndex, 0 ) ) )
     {
-        // If our total sprite group count exceeds the instance count, we recreate the instance buffer
-        if( pRenderMultiMap.size() > instanceCount )
-            ResetInstanceBuffer();
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                                            "An instance mesh failed to lock its quad batch index buffer." );
+    }
 
-        // Update the mesh
-        Update();
+    // Each quad has the triangles of the instanced quad, moved to its own corners
+    for( uint i = 0; i < MAX_QUAD_BATCH_COUNT; ++i, pIndex += INDEX_COUNT )
+    {
+        const WORD base = static_cast<WORD>(i * VERTEX_COUNT);
+
+        pIndex[0] = base;
+        pIndex[1] = base + 1;
+        pIndex[2] = base + 2;
+        pIndex[3] = base + 1;
+        pIndex[4] = base + 3;
+        pIndex[5] = base + 2;
+    }
 
-        // Increment our stat counter to keep track of what is going on.
-        CStatCounter::Instance().IncDisplayCounter( pRenderMultiMap.size() );
+    spQuadIndexBuffer->Unlock();
 
-        // Set the vertex declaration
-        CXDevice::Instance().GetXDevice()->SetVertexDeclaration( spVertexDeclaration );
+}	// CreateQuadBatchBuffers
 
-        // Set up stream zero with our vertex buffer and however many instances of it we're rendering
-        CXDevice::Instance().GetXDevice()->SetStreamSource( 0, spVertexBuffer, 0, sizeof( CVertexData ) );
-        CXDevice::Instance().GetXDevice()->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | static_cast<uint>(pRenderMultiMap.size()) );
 
-        // Set up stream one with our instance buffer
-        CXDevice::Instance().GetXDevice()->SetStreamSource( 1, spInstanceBuffer, 0, sizeof( CInstanceData ) );
-        CXDevice::Instance().GetXDevice()->SetStreamSourceFreq( 1, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+/************************************************************************
+*    desc:  Create the hull texture. Row zero is the whole quad and each
+*           component of the mega texture has the row after its ID.
+*           Without vertex texture fetch of float textures, with more
+*           components than a texture has rows, or with several pages,
+*           there's no hull texture and the quads are drawn. Only the
+*           page techniques pick the page, and they have no hulls
+************************************************************************/
+void CInstanceMesh2D::CreateHullTexture()
+{
+    spHullTexture.Release();
 
-        // Give the indexes to DirectX
-        CXDevice::Instance().GetXDevice()->SetIndices( spIndexBuffer );
+    if( pMegaTexture->GetPageCount() > 1 )
+        return;
 
-        // Set up the shader before the rendering
-        CEffectData * pEffectData = CShader::Instance().SetEffectAndTechnique( "shader_2d", "instance" );
+    const UINT hullCount = static_cast<UINT>(pMegaTexture->GetComponentCount() + 1);
 
-        // Set the active texture to the first sprite's first texture
-        CTextureMgr::Instance().SelectTexture( pMegaTexture->GetTexture()->spTexture );
-    
-        // Begin rendering
-        UINT iPass, cPasses;
+    if( (hullCount > MAX_HULL_COUNT) || (hullCount > CGraphicsDevice2D::Instance().GetMaxTextureHeight()) )
+        return;
 
-        CShader::Instance().GetActiveShader()->Begin( &cPasses, 0 );
-        for( iPass = 0; iPass < cPasses; ++iPass )
+    // Ask the device if the vertex shader can read the texture
+    if( !CGraphicsDevice2D::Instance().CanReadVertexTexture( D3DFMT_A32B32G32R32F ) )
+        return;
+
+    HRESULT hr;
+
+    if( FAILED( hr = CGraphicsDevice2D::Instance().CreateTexture( 
+                HULL_TEXTURE_WIDTH,
+                hullCount,
+                1,
+                0,
+                D3DFMT_A32B32G32R32F,
+                D3DPOOL_MANAGED,
+                &spHullTexture ) ) )
+    {
+        DisplayError( hr );
+    }
+
+    // Lock the hull texture for copying
+    D3DLOCKED_RECT lockedRect;
+    if( FAILED( spHullTexture->LockRect( 0, &lockedRect, NULL, 0 ) ) )
+    {
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("An instance mesh failed to lock its hull texture.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
+    }
+
+    for( UINT hull = 0; hull < hullCount; ++hull )
+    {
+        const float * pHull = (hull == 0) ? QUAD_HULL : pMegaTexture->GetHull( hull - 1 );
+        float * pRow = reinterpret_cast<float *>( static_cast<BYTE *>(lockedRect.pBits) + (hull * lockedRect.Pitch) );
+
+        std::copy( pHull, pHull + (CMegaTexture::HULL_VERTEX_COUNT * 2), pRow );
+    }
+
+    // Unlock the hull texture so it can be used
+    spHullTexture->UnlockRect( 0 );
+
+}	// CreateHullTexture
+
+
+/************************************************************************
+*    desc:  Set if the instances are drawn as hulls
+*
+*	 param:	bool _hullMode - whether hulls are drawn
+************************************************************************/
+void CInstanceMesh2D::SetHullMode( bool _hullMode )
+{
+    hullMode = _hullMode;
+
+}	// SetHullMode
+
+
+/************************************************************************
+*    desc:  Get the technique the instances of this mesh are drawn with
+*           when they aren't merged. A mega texture with several pages
+*           needs the technique that picks the page of each instance
+*
+*	 param:	bool hull - whether the instances are drawn as hulls
+*
+*	 ret:	const char * - name of the technique
+************************************************************************/
+const char * CInstanceMesh2D::GetInstanceTechnique( bool hull ) const
+{
+    if( pMegaTexture->GetPageCount() > 1 )
+        return (instanceLayout == EIL_COMPACT) ? COMPACT_LAYOUT[instanceAttributes].pPagesTechnique : "instancePages";
+
+    if( instanceLayout == EIL_COMPACT )
+        return hull ? COMPACT_LAYOUT[instanceAttributes].pHullTechnique : COMPACT_LAYOUT[instanceAttributes].pTechnique;
+
+    return hull ? "instanceHull" : "instance";
+
+}	// GetInstanceTechnique
+
+
+/************************************************************************
+*    desc:  Give the hull texture of this mesh to the shader. The effect
+*           is shared by every mesh, so it's given every time
+************************************************************************/
+void CInstanceMesh2D::SetHullTexture()
+{
+    if( IsHullActive() )
+    {
+        CGraphicsDevice2D::Instance().SetEffectTexture( "hullTexture", spHullTexture );
+        CGraphicsDevice2D::Instance().SetEffectFloat( "hullCount", static_cast<float>(pMegaTexture->GetComponentCount() + 1) );
+    }
+
+}	// SetHullTexture
+
+
+/************************************************************************
+*    desc:  Give the pages of the mega texture to the shader. Shader page
+*           zero is the diffuse texture, so it goes through the cache
+*
+*	 param:	uint firstPage - shader page the first page of the mega texture goes in
+************************************************************************/
+void CInstanceMesh2D::SetPageTextures( uint firstPage ) const
+{
+    for( uint page = 0; page < pMegaTexture->GetPageCount(); ++page )
+    {
+        if( firstPage + page == 0 )
+            CRenderStateCache2D::Instance().SelectTexture( pMegaTexture->GetTexture( page )->spTexture );
+        else
+            CGraphicsDevice2D::Instance().SetEffectTexture( PAGE_TEXTURE_NAME[firstPage + page], pMegaTexture->GetTexture( page )->spTexture );
+    }
+
+}	// SetPageTextures
+
+
+/************************************************************************
+*    desc:  Get the camera position a packet is drawn with. It's the one
+*           the packet was extracted with unless the camera is latched
+*           right before the draw
+*
+*	 param:	const CRenderPacket & packet - packet to draw
+************************************************************************/
+CPoint CInstanceMesh2D::GetDrawCameraPos( const CRenderPacket & packet ) const
+{
+    if( cameraLatchMode )
+        return CWorldCamera::Instance().GetPos();
+
+    return packet.cameraPos;
+
+}	// GetDrawCameraPos
+
+
+/************************************************************************
+*    desc:  Give the camera to the shader. The instances are built
+*           without it, so it's added in clip space. The camera only
+*           translates, so its offset is the projected position with
+*           a w of 0, one for each projection
+*
+*	 param:	const CPoint & cameraPos - position of the camera
+************************************************************************/
+void CInstanceMesh2D::SetCameraOffsets( const CPoint & cameraPos )
+{
+    const float * pPerspective = CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_PERSPECTIVE );
+    const float * pOrthographic = CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC );
+    float perspectiveOffset[4], orthographicOffset[4];
+
+    for( int i = 0; i < 4; ++i )
+    {
+        perspectiveOffset[i] = (cameraPos.x * pPerspective[i]) + (cameraPos.y * pPerspective[4 + i]) + (cameraPos.z * pPerspective[8 + i]);
+        orthographicOffset[i] = (cameraPos.x * pOrthographic[i]) + (cameraPos.y * pOrthographic[4 + i]) + (cameraPos.z * pOrthographic[8 + i]);
+    }
+
+    CGraphicsDevice2D::Instance().SetEffectFloatArray( "cameraPerspectiveOffset", perspectiveOffset, 4 );
+    CGraphicsDevice2D::Instance().SetEffectFloatArray( "cameraOrthographicOffset", orthographicOffset, 4 );
+
+}	// SetCameraOffsets
+
+
+/************************************************************************
+*    desc:  Make sure the instance buffer can hold the sprites added so
+*           far. The buffer grows geometrically, so this rarely
+*           recreates it
+************************************************************************/
+void CInstanceMesh2D::ResetInstanceBuffer()
+{
+    instanceBuffer.Reserve( spriteGrpVec.size() );
+
+}	// ResetInstanceBuffer
+
+
+/************************************************************************
+*    desc:  Release the instance buffer. It's recreated on the next
+*           render. The device lost and reset are handled by the buffer
+************************************************************************/
+void CInstanceMesh2D::ReleaseInstanceBuffer()
+{
+    instanceBuffer.Release();
+
+}	// ReleaseInstanceBuffer
+
+
+/************************************************************************
+*    desc:  Set the number of mostly empty frames in a row before the
+*           instance buffer shrinks
+*
+*	 param:	uint frameCount - number of frames
+************************************************************************/
+void CInstanceMesh2D::SetInstanceBufferShrinkFrames( uint frameCount )
+{
+    instanceBuffer.SetShrinkFrameCount( frameCount );
+
+}	// SetInstanceBufferShrinkFrames
+
+
+/************************************************************************
+*    desc:  Copy the render state of the sprites added this frame into
+*           the render packet. Call at the end of the simulation, on the
+*           thread that owns the sprites. Only the visible sprites are
+*           copied. The persistent slots that changed are copied too
+************************************************************************/
+void CInstanceMesh2D::ExtractRenderPacket()
+{
+    CRenderPacket & packet = renderPacket[writePacketIndex];
+
+    packet.sourceVec.clear();
+    packet.keyVec.clear();
+    packet.opaqueVec.clear();
+    packet.submittedCount = spriteGrpVec.size();
+    packet.occludedCount = 0;
+    packet.animationTime = animationTime;
+    packet.cameraPos = CWorldCamera::Instance().GetPos();
+
+    if( !spriteGrpVec.empty() )
+    {
+        // Only the sprites the camera can see go into the packet
+        packet.occludedCount = CullSprites();
+
+        for( size_t i = 0; i < spriteGrpVec.size(); ++i )
+        {
+            if( spriteVisibleVec[i] )
+            {
+                CSpriteGroup2D * pSprite = spriteGrpVec[i].GetSpriteGrp();
+
+                packet.keyVec.push_back( CRenderQueue2D::GetDepthKey( pSprite->GetPos().z ) );
+                packet.sourceVec.push_back( CInstanceSource() );
+                CInstanceSource & source = packet.sourceVec.back();
+
+                if( spriteGrpVec[i].GetAnimation() == NO_ANIMATION )
+                {
+                    // Set the current frame before the texture of it is grabbed
+                    pSprite->SetCurrentFrame( spriteGrpVec[i].GetFrameIndex() );
+                    GatherInstanceSource( pSprite, source );
+                }
+                else
+                {
+                    // The shader picks the frame, so the frame and its UVs are left alone
+                    GatherInstanceTransform( pSprite, source );
+                    source.pUV = EMPTY_SLOT_UV;
+                    source.page = animationPageVec[ spriteGrpVec[i].GetAnimation() ];
+                    source.animation = spriteGrpVec[i].GetAnimation();
+                    source.animationPhase = spriteGrpVec[i].GetAnimationPhase();
+                    source.animationRate = spriteGrpVec[i].GetAnimationRate();
+                }
+
+                // Checked after the frame is set, because its texture decides it
+                packet.opaqueVec.push_back( spriteGrpVec[i].IsOpaque() && IsDrawnOpaque( pSprite, spriteGrpVec[i].GetAnimation() ) );
+            }
+        }
+    }
+
+    PreparePersistent( packet );
+
+    // The candidates are in the packet now
+    spriteGrpVec.clear();
+
+}	// ExtractRenderPacket
+
+
+/************************************************************************
+*    desc:  Swap the render packets. Call once per frame when both the
+*           simulation and the rendering are done with their packet
+************************************************************************/
+void CInstanceMesh2D::SwapRenderPackets()
+{
+    writePacketIndex ^= 1;
+
+}	// SwapRenderPackets
+
+
+/************************************************************************
+*    desc:  Set whether the render packets are double buffered. When
+*           they are, ExtractRenderPacket has to be called at the end of
+*           every simulation frame and Render draws the packet from the
+*           frame before. Every packet has to be rendered once, because
+*           the persistent uploads in it only hold what changed
+*
+*	 param:	bool packetMode - true to double buffer the render packets
+************************************************************************/
+void CInstanceMesh2D::SetRenderPacketMode( bool packetMode )
+{
+    renderPacketMode = packetMode;
+
+}	// SetRenderPacketMode
+
+
+/************************************************************************
+*    desc:  Set whether the camera is read right before the draw. The
+*           sprites were culled with the camera they were extracted
+*           with, so a sprite coming into view can show up a frame late
+*
+*	 param:	bool _cameraLatchMode - true to read the camera at the draw
+************************************************************************/
+void CInstanceMesh2D::SetCameraLatchMode( bool _cameraLatchMode )
+{
+    cameraLatchMode = _cameraLatchMode;
+
+}	// SetCameraLatchMode
+
+
+/************************************************************************
+*    desc:  Set the most sprites a frame can have to be drawn as a quad
+*           batch. Shared by every mesh
+*
+*	 param:	uint spriteCount - most sprites of a quad batch. Zero always
+*                              instances
+************************************************************************/
+void CInstanceMesh2D::SetQuadBatchThreshold( uint spriteCount )
+{
+    quadBatchThreshold = (spriteCount < MAX_QUAD_BATCH_COUNT) ? spriteCount : MAX_QUAD_BATCH_COUNT;
+    quadBatchThresholdSet = true;
+
+}	// SetQuadBatchThreshold
+
+
+/************************************************************************
+*    desc:  Find the most sprites a frame can have for a quad batch to
+*           draw it faster than instancing, and make it the threshold.
+*           The sprite count doubles until instancing wins. Both ways
+*           are recorded and replayed on the device like a render. The
+*           CPU builds the next frame while the GPU draws this one, so
+*           a frame costs the longer of the CPU and the GPU time. Without
+*           timestamps the CPU time decides
+************************************************************************/
+void CInstanceMesh2D::CalibrateQuadBatchThreshold()
+{
+    // Sprites in the middle of the orthographic view that every technique can draw
+    CInstanceSource source;
+    D3DXMatrixIdentity( &source.scaledMatrix );
+    source.size.w = QUAD_BATCH_SPRITE_SIZE;
+    source.size.h = QUAD_BATCH_SPRITE_SIZE;
+    source.projType = CSettings::EPT_ORTHOGRAPHIC;
+    source.pUV = QUAD_BATCH_SPRITE_UV;
+    source.page = 0;
+    source.hull = 0;
+    source.animation = NO_ANIMATION;
+    source.animationPhase = 0;
+    source.animationRate = 0;
+
+    CRenderPacket packet;
+    pRecordedPacket = &packet;
+
+    // Init is called at load, outside the game's scene. If the game is in one, the draws go in it
+    const bool sceneBegun = SUCCEEDED( CGraphicsDevice2D::Instance().BeginScene() );
+
+    // The rest of the game sets the device, shader and textures without the cache
+    CRenderStateCache2D::Instance().Invalidate();
+
+    CGpuTimer2D timer;
+    timer.Create();
+
+    uint threshold = 0;
+
+    for( uint count = 1; count <= MAX_QUAD_BATCH_COUNT; count *= 2 )
+    {
+        while( packet.sourceVec.size() < count )
+        {
+            packet.keyVec.push_back( static_cast<uint>(packet.sourceVec.size()) );
+            packet.opaqueVec.push_back( false );
+            packet.sourceVec.push_back( source );
+        }
+
+        packet.submittedCount = count;
+
+        // The first render of each way warms up the buffers
+        double instancedCpuTime, instancedGpuTime, batchCpuTime, batchGpuTime;
+        TimeQuadBatchRender( 0, timer, instancedCpuTime, instancedGpuTime );
+        TimeQuadBatchRender( count, timer, batchCpuTime, batchGpuTime );
+        TimeQuadBatchRender( 0, timer, instancedCpuTime, instancedGpuTime );
+        TimeQuadBatchRender( count, timer, batchCpuTime, batchGpuTime );
+
+        const bool gpuTimed = (instancedGpuTime >= 0.0) && (batchGpuTime >= 0.0);
+        const double instancedTime = gpuTimed ? std::max( instancedCpuTime, instancedGpuTime ) : instancedCpuTime;
+        const double batchTime = gpuTimed ? std::max( batchCpuTime, batchGpuTime ) : batchCpuTime;
+
+        NGenFunc::PostDebugMsg( "Quad Batch Calibration: %u sprites - instanced %.2f us (GPU %.2f us), quad batch %.2f us (GPU %.2f us)",
+                                count, instancedCpuTime, instancedGpuTime, batchCpuTime, batchGpuTime );
+
+        if( batchTime >= instancedTime )
+            break;
+
+        threshold = count;
+    }
+
+    if( sceneBegun )
+        CGraphicsDevice2D::Instance().EndScene();
+
+    pRecordedPacket = NULL;
+    SetQuadBatchThreshold( threshold );
+
+    NGenFunc::PostDebugMsg( "Quad Batch Calibration: threshold %u sprites", threshold );
+
+}	// CalibrateQuadBatchThreshold
+
+
+/************************************************************************
+*    desc:  Time recording and replaying the calibration packet. The
+*           instance counters of the frame aren't counted
+*
+*	 param:	uint threshold        - quad batch threshold to render with
+*			CGpuTimer2D & timer   - timestamps around the renders
+*			double & cpuTime      - microseconds a render takes the CPU
+*			double & gpuTime      - microseconds a render takes the GPU.
+*                                   Negative without timestamps
+************************************************************************/
+void CInstanceMesh2D::TimeQuadBatchRender( uint threshold, CGpuTimer2D & timer, double & cpuTime, double & gpuTime )
+{
+    quadBatchThreshold = threshold;
+
+    timer.Begin();
+    const CalibrationClock::time_point start = CalibrationClock::now();
+
+    for( int i = 0; i < QUAD_BATCH_RENDER_COUNT; ++i )
+    {
+        RecordCommands();
+        ReplayCommands( 0, commandVec.size() );
+    }
+
+    const CalibrationClock::duration elapsed = CalibrationClock::now() - start;
+    timer.End();
+
+    cpuTime = static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>( elapsed ).count()) / (1000.0 * QUAD_BATCH_RENDER_COUNT);
+
+    gpuTime = timer.GetMicroseconds();
+    if( gpuTime >= 0.0 )
+        gpuTime /= QUAD_BATCH_RENDER_COUNT;
+
+}	// TimeQuadBatchRender
+
+
+/************************************************************************
+*    desc:  Get the render packet to draw. Without the double buffering
+*           it's extracted right before it's drawn
+************************************************************************/
+const CInstanceMesh2D::CRenderPacket & CInstanceMesh2D::GetRenderPacket()
+{
+    if( !renderPacketMode )
+    {
+        ExtractRenderPacket();
+        return renderPacket[writePacketIndex];
+    }
+
+    return renderPacket[writePacketIndex ^ 1];
+
+}	// GetRenderPacket
+
+
+/************************************************************************
+*    desc:  Render the instance mesh. The opaque instances are drawn
+*           first, front to back, then the translucent ones back to
+*           front. In the opaque pass the persistent slots are drawn
+*           before the sprites of the render packet. In the translucent
+*           pass the two are merged by depth. Nothing in here touches
+*           the sprites
+************************************************************************/
+void CInstanceMesh2D::Render()
+{
+    pRecordedPacket = &GetRenderPacket();
+
+    // The rest of the game sets the device, shader and textures without the cache
+    CRenderStateCache2D::Instance().Invalidate();
+
+    RecordCommands();
+    ReplayCommands();
+
+}	// Render
+
+
+/************************************************************************
+*    desc:  Render several meshes, each with its own draws. Sorting and
+*           building the instances is most of the work of a render and
+*           the meshes don't share any of it, so each mesh records its
+*           instances and command list on a worker thread. The device
+*           isn't free threaded, so the lists are replayed in order on
+*           this thread. The packets are fetched first, here, because
+*           without the double buffering that extracts them from the
+*           sprites. Meshes of the same merge layer next to each other
+*           are drawn by RenderMerged, in their place in the order
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - meshes to render,
+*                                                       in drawing order
+************************************************************************/
+void CInstanceMesh2D::RenderParallel( const std::vector<CInstanceMesh2D *> & meshVec )
+{
+    // Split the meshes into the ones merged and the ones recorded on their own
+    std::vector<size_t> groupEndVec;
+    std::vector<CInstanceMesh2D *> recordVec;
+
+    for( size_t begin = 0; begin < meshVec.size(); begin = groupEndVec.back() )
+    {
+        groupEndVec.push_back( GetMergeGroupEnd( meshVec, begin ) );
+
+        if( groupEndVec.back() == begin + 1 )
+        {
+            meshVec[begin]->pRecordedPacket = &meshVec[begin]->GetRenderPacket();
+            recordVec.push_back( meshVec[begin] );
+        }
+    }
+
+    // Each mesh builds its instances serially inside its job
+    CJobPool::Instance().ParallelFor( recordVec.size(), 1,
+        boost::bind( &CInstanceMesh2D::RecordMeshes, boost::cref(recordVec), _1, _2 ) );
+
+    // The rest of the game sets the device, shader and textures without the cache
+    CRenderStateCache2D::Instance().Invalidate();
+
+    size_t begin = 0;
+
+    for( size_t group = 0; group < groupEndVec.size(); ++group )
+    {
+        const size_t end = groupEndVec[group];
+
+        if( end == begin + 1 )
+            meshVec[begin]->ReplayCommands();
+        else
+            RenderMerged( std::vector<CInstanceMesh2D *>( meshVec.begin() + begin, meshVec.begin() + end ) );
+
+        begin = end;
+    }
+
+}	// RenderParallel
+
+
+/************************************************************************
+*    desc:  Get the end of the meshes merged with the one at begin. The
+*           meshes after it merge while they're in the same merge layer
+*           with the same layout, and their pages and animations still
+*           fit in the shader
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - meshes in drawing order
+*			size_t begin                              - first mesh of the group
+*
+*	 ret:	size_t - one past the last mesh of the group
+************************************************************************/
+size_t CInstanceMesh2D::GetMergeGroupEnd( const std::vector<CInstanceMesh2D *> & meshVec, size_t begin )
+{
+    const CInstanceMesh2D * pFirst = meshVec[begin];
+    size_t end = begin + 1;
+
+    if( pFirst->mergeLayer == 0 )
+        return end;
+
+    size_t pageCount = pFirst->pMegaTexture->GetPageCount();
+    size_t frameCount = pFirst->animationFrameVec.size() / 4;
+    size_t animationCount = pFirst->animationInfoVec.size() / 4;
+
+    for( ; (end < meshVec.size()) && (end - begin < MAX_PAGE_COUNT); ++end )
+    {
+        const CInstanceMesh2D * pMesh = meshVec[end];
+
+        pageCount += pMesh->pMegaTexture->GetPageCount();
+        frameCount += pMesh->animationFrameVec.size() / 4;
+        animationCount += pMesh->animationInfoVec.size() / 4;
+
+        if( (pMesh->mergeLayer != pFirst->mergeLayer) ||
+            (pMesh->instanceLayout != pFirst->instanceLayout) ||
+            (pMesh->instanceAttributes != pFirst->instanceAttributes) ||
+            (pageCount > MAX_PAGE_COUNT) ||
+            (frameCount > MAX_ANIMATION_FRAMES) ||
+            (animationCount > MAX_ANIMATIONS) )
+            break;
+    }
+
+    return end;
+
+}	// GetMergeGroupEnd
+
+
+/************************************************************************
+*    desc:  Record the command lists of a range of meshes. Called on the
+*           worker threads
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - meshes to record
+*			size_t begin, end                         - range of meshes
+************************************************************************/
+void CInstanceMesh2D::RecordMeshes( const std::vector<CInstanceMesh2D *> & meshVec, size_t begin, size_t end )
+{
+    for( size_t i = begin; i < end; ++i )
+        meshVec[i]->RecordCommands();
+
+}	// RecordMeshes
+
+
+/************************************************************************
+*    desc:  Build the instances of the recorded packet into memory and
+*           record the commands that upload and draw them. Only reads
+*           the packet and writes this mesh, so meshes can record at
+*           the same time
+************************************************************************/
+void CInstanceMesh2D::RecordCommands()
+{
+    const CRenderPacket & packet = *pRecordedPacket;
+
+    commandVec.clear();
+
+    // Build the persistent slots that changed
+    StagePersistent( packet );
+    AddCommand( ECT_UPLOAD_PERSISTENT );
+
+    // Sort and build the visible sprites
+    instanceSourceVec.clear();
+    renderQueue.Clear();
+    opaqueQueue.Clear();
+    QueuePacket( packet, 0 );
+
+    const size_t instanceCount = opaqueQueue.GetCount() + renderQueue.GetCount();
+    const size_t persistentCount = packet.persistentCount;
+
+    // A few sprites are cheaper to copy out as quads than to instance. The persistent
+    // slots are only ever instanced, so a mesh with them always is
+    const bool quadBatch = (instanceCount > 0) && (instanceCount <= quadBatchThreshold) && (persistentCount == 0);
+
+    if( instanceCount > 0 )
+    {
+        const CRenderPacket * pPacket = &packet;
+        const uint animationBase = 0;
+        const uint pageBase = 0;
+        SortQueuedInstances( &pPacket, &animationBase, &pageBase );
+
+        instanceStageVec.resize( instanceCount * instanceBuffer.GetStride() );
+        BuildInstances( &instanceSourceVec[0], instanceCount, &instanceStageVec[0] );
+
+        AddCommand( ECT_UPLOAD_INSTANCES, quadBatch );
+    }
+
+    // Only render if there is something to render
+    if( (instanceCount == 0) && (persistentCount == 0) )
+        return;
+
+    AddCommand( ECT_BIND, quadBatch );
+
+    // The render states are only touched when there's something opaque
+    const bool opaque = (opaqueQueue.GetCount() > 0) || (packet.persistentOpaqueCount > 0);
+
+    if( opaque )
+        AddCommand( ECT_SAVE_DEPTH_STATES );
+
+    for( int depthPass = (opaque ? EDP_OPAQUE : EDP_TRANSLUCENT); depthPass <= EDP_TRANSLUCENT; ++depthPass )
+    {
+        size_t persistentBegin, persistentEnd, instanceBegin, instanceEnd;
+        GetPassRange( EDepthPass(depthPass), packet.persistentOpaqueCount, persistentCount, persistentBegin, persistentEnd );
+        GetPassRange( EDepthPass(depthPass), opaqueQueue.GetCount(), instanceCount, instanceBegin, instanceEnd );
+
+        if( opaque )
+            AddCommand( ECT_SET_DEPTH_PASS, depthPass );
+
+        // The begin command learns where its end is once the draws are in
+        const size_t beginIndex = commandVec.size();
+        AddCommand( ECT_BEGIN_EFFECT );
+
+        if( depthPass == EDP_TRANSLUCENT )
+        {
+            AddTranslucentDraws( packet, persistentBegin, persistentEnd, instanceBegin, instanceEnd, quadBatch );
+        }
+        else
+        {
+            // The depth buffer takes care of the order of the opaque sprites
+            if( persistentEnd > persistentBegin )
+                AddCommand( ECT_DRAW_PERSISTENT, persistentBegin, persistentEnd - persistentBegin );
+
+            if( instanceEnd > instanceBegin )
+                AddCommand( (quadBatch ? ECT_DRAW_QUAD_BATCH : ECT_DRAW_INSTANCES), instanceBegin, instanceEnd - instanceBegin );
+        }
+
+        commandVec[beginIndex].arg[0] = commandVec.size();
+        AddCommand( ECT_END_EFFECT );
+    }
+
+    if( opaque )
+        AddCommand( ECT_RESTORE_DEPTH_STATES );
+
+    AddCommand( ECT_RESET_STREAMS );
+
+}	// RecordCommands
+
+
+/************************************************************************
+*    desc:  Add a command to the command list
+*
+*	 param:	ECommandType type - what to do
+*			size_t arg0, arg1 - arguments of the command
+************************************************************************/
+void CInstanceMesh2D::AddCommand( ECommandType type, size_t arg0, size_t arg1 )
+{
+    CCommand command;
+    command.type = type;
+    command.arg[0] = arg0;
+    command.arg[1] = arg1;
+
+    commandVec.push_back( command );
+
+}	// AddCommand
+
+
+/************************************************************************
+*    desc:  Add the draws of the translucent pass. The translucent
+*           persistent slots and sprites are each sorted back to front,
+*           so they're merged by their depth keys. Each run of slots or
+*           sprites between the other's is a draw of its own. A slot
+*           goes before a sprite of the same depth
+*
+*	 param:	const CRenderPacket & packet         - recorded packet
+*			size_t persistentBegin, persistentEnd - translucent persistent slots
+*			size_t instanceBegin, instanceEnd     - translucent instances. They're
+*                                                   in the render queue's order
+*			bool quadBatch                       - draw the instances as a quad batch
+************************************************************************/
+void CInstanceMesh2D::AddTranslucentDraws( const CRenderPacket & packet, size_t persistentBegin, size_t persistentEnd,
+                                           size_t instanceBegin, size_t instanceEnd, bool quadBatch )
+{
+    size_t persistent = persistentBegin;
+    size_t instance = instanceBegin;
+
+    while( (persistent < persistentEnd) || (instance < instanceEnd) )
+    {
+        const size_t persistentRunBegin = persistent;
+
+        while( (persistent < persistentEnd) && ((instance == instanceEnd) ||
+               (packet.persistentKeyVec[persistent - persistentBegin] <= renderQueue.GetKey( instance - instanceBegin ))) )
+            ++persistent;
+
+        if( persistent > persistentRunBegin )
+            AddCommand( ECT_DRAW_PERSISTENT, persistentRunBegin, persistent - persistentRunBegin );
+
+        const size_t instanceRunBegin = instance;
+
+        while( (instance < instanceEnd) && ((persistent == persistentEnd) ||
+               (renderQueue.GetKey( instance - instanceBegin ) < packet.persistentKeyVec[persistent - persistentBegin])) )
+            ++instance;
+
+        if( instance > instanceRunBegin )
+            AddCommand( (quadBatch ? ECT_DRAW_QUAD_BATCH : ECT_DRAW_INSTANCES), instanceRunBegin, instance - instanceRunBegin );
+    }
+
+}	// AddTranslucentDraws
+
+
+/************************************************************************
+*    desc:  Upload and draw what was recorded. Call on the device thread
+************************************************************************/
+void CInstanceMesh2D::ReplayCommands()
+{
+    const CRenderPacket & packet = *pRecordedPacket;
+
+    CInstanceStats2D::Instance().IncInstanceSubmittedCounter( packet.submittedCount );
+    CInstanceStats2D::Instance().IncInstanceCulledCounter( packet.submittedCount - packet.sourceVec.size() - packet.occludedCount );
+    CInstanceStats2D::Instance().IncInstanceOccludedCounter( packet.occludedCount );
+
+    ReplayCommands( 0, commandVec.size() );
+
+}	// ReplayCommands
+
+void CInstanceMesh2D::ReplayCommands( size_t begin, size_t end )
+{
+    const CRenderPacket & packet = *pRecordedPacket;
+
+    for( size_t i = begin; i < end; ++i )
+    {
+        const CCommand & command = commandVec[i];
+
+        switch( command.type )
+        {
+            case ECT_UPLOAD_PERSISTENT:
+                UploadStagedPersistent( packet );
+                break;
+
+            case ECT_UPLOAD_INSTANCES:
+                UploadStagedInstances( command.arg[0] != 0 );
+                break;
+
+            case ECT_BIND:
+            {
+                // Increment our stat counter to keep track of what is going on.
+                CStatCounter::Instance().IncDisplayCounter( instanceSourceVec.size() + packet.persistentDrawCount );
+
+                // Set the vertex declaration
+                CRenderStateCache2D::Instance().SetVertexDeclaration( spVertexDeclaration );
+
+                // Set up stream zero with our vertex buffer
+                CRenderStateCache2D::Instance().SetStreamSource( 0, spVertexBuffer, 0, sizeof( CVertexData ) );
+
+                // Give the indexes to DirectX
+                CRenderStateCache2D::Instance().SetIndices( spIndexBuffer );
+
+                // Set up the shader before the rendering. The quad batch has no hulls
+                const bool quadBatch = (command.arg[0] != 0);
+                CRenderStateCache2D::Instance().SetEffectAndTechnique( "shader_2d", GetInstanceTechnique( IsHullActive() && !quadBatch ) );
+
+                // The corners of the hulls are read from the hull texture
+                SetHullTexture();
+
+                // The frames of the animated sprites are picked by the shader
+                SetAnimationTables( packet.animationTime );
+
+                // The camera is added to the instances in the shader
+                SetCameraOffsets( GetDrawCameraPos( packet ) );
+
+                // Give the pages of the mega texture to the shader
+                SetPageTextures( 0 );
+                break;
+            }
+
+            case ECT_SAVE_DEPTH_STATES:
+                depthStates.Save();
+                break;
+
+            case ECT_SET_DEPTH_PASS:
+                depthStates.Set( EDepthPass(command.arg[0]) );
+                break;
+
+            case ECT_RESTORE_DEPTH_STATES:
+                depthStates.Restore();
+                break;
+
+            case ECT_BEGIN_EFFECT:
+            {
+                // Every pass of the effect replays the commands up to the end command
+                const size_t effectEnd = command.arg[0];
+                UINT iPass, cPasses;
+
+                CGraphicsDevice2D::Instance().BeginEffect( &cPasses );
+                for( iPass = 0; iPass < cPasses; ++iPass )
+                {
+                    CGraphicsDevice2D::Instance().BeginEffectPass( iPass );
+                    ReplayCommands( i + 1, effectEnd );
+                    CGraphicsDevice2D::Instance().EndEffectPass();
+                }
+                CGraphicsDevice2D::Instance().EndEffect();
+
+                i = effectEnd;
+                break;
+            }
+
+            case ECT_END_EFFECT:
+                break;
+
+            case ECT_DRAW_PERSISTENT:
+                DrawInstances( spPersistentBuffer, static_cast<UINT>(command.arg[0]), static_cast<UINT>(command.arg[1]), IsHullActive() );
+                break;
+
+            case ECT_DRAW_INSTANCES:
+                DrawInstances( instanceBuffer.GetBuffer(), instanceOffset + static_cast<UINT>(command.arg[0]), static_cast<UINT>(command.arg[1]), IsHullActive() );
+                break;
+
+            case ECT_DRAW_QUAD_BATCH:
+                DrawQuadBatch( instanceOffset + static_cast<UINT>(command.arg[0] * VERTEX_COUNT), static_cast<UINT>(command.arg[1]) );
+                break;
+
+            case ECT_RESET_STREAMS:
+                CRenderStateCache2D::Instance().SetStreamSourceFreq(0,1);
+                CRenderStateCache2D::Instance().SetStreamSourceFreq(1,1);
+                break;
+        }
+    }
+
+}	// ReplayCommands
+
+
+/************************************************************************
+*    desc:  Render several meshes with one draw per pass. The visible
+*           sprites of every mesh go into one render queue, so depth
+*           order holds across the meshes. The pages of the meshes' mega
+*           textures go one after the other and the shader picks the
+*           page of each instance, so a mesh with several pages still
+*           takes one draw. In the opaque pass the persistent slots of
+*           each mesh are drawn first with their own pages. In the
+*           translucent pass they're merged with the sprites by depth
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - meshes to render. They need the
+*                                                       same layout and the first one's
+*                                                       buffers are used for the draw
+************************************************************************/
+void CInstanceMesh2D::RenderMerged( const std::vector<CInstanceMesh2D *> & meshVec )
+{
+    if( meshVec.empty() )
+        return;
+
+    if( meshVec.size() > MAX_PAGE_COUNT )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("Too many meshes to merge (%d). The most is %d.\n\n%s\nLine: %s") % meshVec.size() % MAX_PAGE_COUNT % __FUNCTION__ % __LINE__ ));
+
+    // The pages of each mesh go after the ones of the meshes before it
+    uint pageBase[MAX_PAGE_COUNT];
+    size_t pageCount = 0;
+
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+    {
+        pageBase[mesh] = static_cast<uint>(pageCount);
+        pageCount += meshVec[mesh]->pMegaTexture->GetPageCount();
+    }
+
+    if( pageCount > MAX_PAGE_COUNT )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("Too many mega texture pages to merge (%d). The most is %d.\n\n%s\nLine: %s") % pageCount % MAX_PAGE_COUNT % __FUNCTION__ % __LINE__ ));
+
+    CInstanceMesh2D * pPrimary = meshVec[0];
+    const CRenderPacket * pPacket[MAX_PAGE_COUNT];
+    bool opaque = false;
+
+    // The rest of the game sets the device, shader and textures without the cache
+    CRenderStateCache2D::Instance().Invalidate();
+
+    pPrimary->renderQueue.Clear();
+    pPrimary->opaqueQueue.Clear();
+
+    // Upload the persistent slots and queue the visible sprites of every mesh in the first mesh
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+    {
+        CInstanceMesh2D * pMesh = meshVec[mesh];
+
+        if( (pMesh->instanceLayout != pPrimary->instanceLayout) || (pMesh->instanceAttributes != pPrimary->instanceAttributes) )
+            throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                    boost::str( boost::format("Meshes with different layouts can't be merged.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
+
+        pPacket[mesh] = &pMesh->GetRenderPacket();
+
+        pMesh->UploadPersistent( *pPacket[mesh] );
+        pPrimary->QueuePacket( *pPacket[mesh], static_cast<uint>(mesh) << MERGED_MESH_SHIFT );
+
+        if( pPacket[mesh]->persistentOpaqueCount > 0 )
+            opaque = true;
+
+        CInstanceStats2D::Instance().IncInstanceSubmittedCounter( pPacket[mesh]->submittedCount );
+        CInstanceStats2D::Instance().IncInstanceCulledCounter( pPacket[mesh]->submittedCount - pPacket[mesh]->sourceVec.size() - pPacket[mesh]->occludedCount );
+        CInstanceStats2D::Instance().IncInstanceOccludedCounter( pPacket[mesh]->occludedCount );
+    }
+
+    const size_t opaqueCount = pPrimary->opaqueQueue.GetCount();
+    const size_t instanceCount = opaqueCount + pPrimary->renderQueue.GetCount();
+
+    if( opaqueCount > 0 )
+        opaque = true;
+
+    // The animation tables of the meshes go one after the other, so the animation IDs of each
+    // mesh are moved past the ones before it
+    uint animationBase[MAX_PAGE_COUNT];
+    std::vector<float> animationFrameVec;
+    std::vector<float> animationInfoVec;
+
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+    {
+        const CInstanceMesh2D * pMesh = meshVec[mesh];
+        const float frameBase = static_cast<float>(animationFrameVec.size() / 4);
+
+        animationBase[mesh] = static_cast<uint>(animationInfoVec.size() / 4);
+        animationFrameVec.insert( animationFrameVec.end(), pMesh->animationFrameVec.begin(), pMesh->animationFrameVec.end() );
+
+        for( size_t i = 0; i < pMesh->animationInfoVec.size(); i += 4 )
+        {
+            animationInfoVec.push_back( pMesh->animationInfoVec[i] + frameBase );
+            animationInfoVec.push_back( pMesh->animationInfoVec[i + 1] );
+            animationInfoVec.push_back( 0 );
+            animationInfoVec.push_back( 0 );
+        }
+    }
+
+    if( (animationFrameVec.size() / 4 > MAX_ANIMATION_FRAMES) || (animationInfoVec.size() / 4 > MAX_ANIMATIONS) )
+        throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                boost::str( boost::format("The merged meshes have too many animations (%d frames, %d animations).\n\n%s\nLine: %s") 
+                    % (animationFrameVec.size() / 4) % (animationInfoVec.size() / 4) % __FUNCTION__ % __LINE__ ));
+
+    if( instanceCount > 0 )
+        pPrimary->UploadQueuedInstances( pPacket, animationBase, pageBase );
+
+    // Set the vertex declaration, vertex buffer and indexes shared by every mesh
+    CRenderStateCache2D::Instance().SetVertexDeclaration( pPrimary->spVertexDeclaration );
+    CRenderStateCache2D::Instance().SetStreamSource( 0, pPrimary->spVertexBuffer, 0, sizeof( CVertexData ) );
+    CRenderStateCache2D::Instance().SetIndices( pPrimary->spIndexBuffer );
+
+    // Give the shader the merged animation tables. No mesh owns them
+    CRenderStateCache2D::Instance().SetEffectAndTechnique( "shader_2d", 
+        (pPrimary->instanceLayout == EIL_COMPACT) ? COMPACT_LAYOUT[pPrimary->instanceAttributes].pTechnique : "instance" );
+
+    CGraphicsDevice2D::Instance().SetEffectFloat( "animationTime", pPacket[0]->animationTime );
+
+    // The meshes were extracted in the same frame, so they share the camera
+    SetCameraOffsets( pPrimary->GetDrawCameraPos( *pPacket[0] ) );
+
+    if( !animationInfoVec.empty() )
+    {
+        CGraphicsDevice2D::Instance().SetEffectFloatArray( "animationFrameUV", &animationFrameVec[0], static_cast<UINT>(animationFrameVec.size()) );
+        CGraphicsDevice2D::Instance().SetEffectFloatArray( "animationInfo", &animationInfoVec[0], static_cast<UINT>(animationInfoVec.size()) );
+        pAnimationTableOwner = NULL;
+    }
+
+    // Every sprite is counted once, whichever pass draws it
+    size_t displayCount = instanceCount;
+
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+        displayCount += pPacket[mesh]->persistentDrawCount;
+
+    if( displayCount > 0 )
+        CStatCounter::Instance().IncDisplayCounter( displayCount );
+
+    // The render states are only touched when there's something opaque
+    CDepthStates depthStates;
+
+    if( opaque )
+        depthStates.Save();
+
+    for( int depthPass = (opaque ? EDP_OPAQUE : EDP_TRANSLUCENT); depthPass <= EDP_TRANSLUCENT; ++depthPass )
+    {
+        if( opaque )
+            depthStates.Set( EDepthPass(depthPass) );
+
+        size_t persistentBegin[MAX_PAGE_COUNT], persistentEnd[MAX_PAGE_COUNT];
+
+        for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+            GetPassRange( EDepthPass(depthPass), pPacket[mesh]->persistentOpaqueCount, pPacket[mesh]->persistentCount, persistentBegin[mesh], persistentEnd[mesh] );
+
+        size_t instanceBegin, instanceEnd;
+        GetPassRange( EDepthPass(depthPass), opaqueCount, instanceCount, instanceBegin, instanceEnd );
+
+        if( depthPass == EDP_TRANSLUCENT )
+        {
+            pPrimary->DrawMergedTranslucent( meshVec, pPacket, pageBase, persistentBegin, persistentEnd, instanceBegin, instanceEnd );
+        }
+        else
+        {
+            // The depth buffer takes care of the order of the opaque sprites
+            for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+                pPrimary->DrawMergedPersistent( meshVec[mesh], persistentBegin[mesh], persistentEnd[mesh] );
+
+            pPrimary->DrawMergedInstances( meshVec, pageBase, instanceBegin, instanceEnd );
+        }
+    }
+
+    if( opaque )
+        depthStates.Restore();
+
+    // Reset the stream frequencies
+    CRenderStateCache2D::Instance().SetStreamSourceFreq(0,1);
+    CRenderStateCache2D::Instance().SetStreamSourceFreq(1,1);
+
+}	// RenderMerged
+
+
+/************************************************************************
+*    desc:  Draw a range of the persistent slots of a merged mesh, as
+*           hulls if the mesh has them. The slots only sample the mesh's
+*           own pages
+*
+*	 param:	CInstanceMesh2D * pMesh - mesh the slots belong to
+*			size_t begin, end       - range of slots
+************************************************************************/
+void CInstanceMesh2D::DrawMergedPersistent( CInstanceMesh2D * pMesh, size_t begin, size_t end )
+{
+    if( end <= begin )
+        return;
+
+    CRenderStateCache2D::Instance().SetEffectAndTechnique( "shader_2d", pMesh->GetInstanceTechnique( pMesh->IsHullActive() ) );
+    pMesh->SetPageTextures( 0 );
+    pMesh->SetHullTexture();
+
+    UINT iPass, cPasses;
+    CGraphicsDevice2D::Instance().BeginEffect( &cPasses );
+    for( iPass = 0; iPass < cPasses; ++iPass )
+    {
+        CGraphicsDevice2D::Instance().BeginEffectPass( iPass );
+        DrawInstances( pMesh->spPersistentBuffer, static_cast<UINT>(begin), static_cast<UINT>(end - begin), pMesh->IsHullActive() );
+        CGraphicsDevice2D::Instance().EndEffectPass();
+    }
+    CGraphicsDevice2D::Instance().EndEffect();
+
+}	// DrawMergedPersistent
+
+
+/************************************************************************
+*    desc:  Draw a range of the merged sprites. The hull rows of the
+*           meshes would clash, so they're drawn as quads
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - merged meshes
+*			const uint * pPageBase                    - where the pages of each
+*                                                       mesh start in the shader
+*			size_t begin, end                         - range of instances
+************************************************************************/
+void CInstanceMesh2D::DrawMergedInstances( const std::vector<CInstanceMesh2D *> & meshVec, const uint * pPageBase, size_t begin, size_t end )
+{
+    if( end <= begin )
+        return;
+
+    CRenderStateCache2D::Instance().SetEffectAndTechnique( "shader_2d", 
+        (instanceLayout == EIL_COMPACT) ? COMPACT_LAYOUT[instanceAttributes].pPagesTechnique : "instancePages" );
+
+    // Give each mesh's pages to the shader after the pages of the meshes before it
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+        meshVec[mesh]->SetPageTextures( pPageBase[mesh] );
+
+    UINT iPass, cPasses;
+    CGraphicsDevice2D::Instance().BeginEffect( &cPasses );
+    for( iPass = 0; iPass < cPasses; ++iPass )
+    {
+        CGraphicsDevice2D::Instance().BeginEffectPass( iPass );
+        DrawInstances( instanceBuffer.GetBuffer(), instanceOffset + static_cast<UINT>(begin), static_cast<UINT>(end - begin), false );
+        CGraphicsDevice2D::Instance().EndEffectPass();
+    }
+    CGraphicsDevice2D::Instance().EndEffect();
+
+}	// DrawMergedInstances
+
+
+/************************************************************************
+*    desc:  Draw the translucent pass of the merged meshes. The slots of
+*           each mesh and the sprites are each sorted back to front, so
+*           the furthest of them is drawn next. Each run from one of
+*           them is a draw of its own. On equal depths the slots go
+*           first, in the order of the meshes, like AddTranslucentDraws
+*
+*	 param:	const vector<CInstanceMesh2D *> & meshVec - merged meshes
+*			const CRenderPacket * const * ppPacket    - packet of each mesh
+*			const uint * pPageBase                    - where the pages of each
+*                                                       mesh start in the shader
+*			const size_t * pPersistentBegin, pPersistentEnd - translucent slots of each mesh
+*			size_t instanceBegin, instanceEnd         - translucent instances. They're
+*                                                       in the render queue's order
+************************************************************************/
+void CInstanceMesh2D::DrawMergedTranslucent( const std::vector<CInstanceMesh2D *> & meshVec, const CRenderPacket * const * ppPacket,
+                                             const uint * pPageBase, const size_t * pPersistentBegin, const size_t * pPersistentEnd,
+                                             size_t instanceBegin, size_t instanceEnd )
+{
+    // The next slot of each mesh, then the next sprite
+    const size_t instanceSource = meshVec.size();
+    const size_t noSource = instanceSource + 1;
+    size_t next[MAX_PAGE_COUNT + 1];
+
+    for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+        next[mesh] = pPersistentBegin[mesh];
+
+    next[instanceSource] = instanceBegin;
+
+    size_t runSource = noSource;
+    size_t runBegin = 0;
+
+    while( true )
+    {
+        // Pick the furthest of the next slots and the next sprite
+        size_t source = noSource;
+        uint key = 0;
+
+        for( size_t mesh = 0; mesh < meshVec.size(); ++mesh )
+        {
+            if( next[mesh] < pPersistentEnd[mesh] )
+            {
+                const uint slotKey = ppPacket[mesh]->persistentKeyVec[next[mesh] - pPersistentBegin[mesh]];
+
+                if( (source == noSource) || (slotKey < key) )
+                {
+                    source = mesh;
+                    key = slotKey;
+                }
+            }
+        }
+
+        if( (next[instanceSource] < instanceEnd) &&
+            ((source == noSource) || (renderQueue.GetKey( next[instanceSource] - instanceBegin ) < key)) )
+            source = instanceSource;
+
+        // Draw the run that ended
+        if( (source != runSource) && (runSource != noSource) )
+        {
+            if( runSource == instanceSource )
+                DrawMergedInstances( meshVec, pPageBase, runBegin, next[runSource] );
+            else
+                DrawMergedPersistent( meshVec[runSource], runBegin, next[runSource] );
+        }
+
+        if( source == noSource )
+            break;
+
+        if( source != runSource )
+        {
+            runSource = source;
+            runBegin = next[source];
+        }
+
+        ++next[source];
+    }
+
+}	// DrawMergedTranslucent
+
+
+/************************************************************************
+*    desc:  Set up the instance stream and draw the instances
+*
+*	 param:	IDirect3DVertexBuffer9 * pBuffer - buffer holding the instances
+*			UINT offset                      - first instance in the buffer
+*			UINT count                       - amount of instances to draw
+*			bool hull                        - draw the hull of each instance
+*                                              instead of the quad
+************************************************************************/
+void CInstanceMesh2D::DrawInstances( IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT count, bool hull )
+{
+    // Render the mesh in stream zero however many times there are instances
+    CRenderStateCache2D::Instance().SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | count );
+
+    // Set up stream one with the instance buffer
+    CRenderStateCache2D::Instance().SetStreamSource( 1, pBuffer, offset * instanceBuffer.GetStride(), instanceBuffer.GetStride() );
+    CRenderStateCache2D::Instance().SetStreamSourceFreq( 1, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+
+    if( hull )
+        CGraphicsDevice2D::Instance().DrawIndexedPrimitive( D3DPT_TRIANGLELIST, VERTEX_COUNT, 0, CMegaTexture::HULL_VERTEX_COUNT, INDEX_COUNT, HULL_FACE_COUNT );
+    else
+        CGraphicsDevice2D::Instance().DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, VERTEX_COUNT, 0, FACE_COUNT );
+
+}	// DrawInstances
+
+
+/************************************************************************
+*    desc:  Draw expanded instances as a batch of quads. Neither stream is
+*           instanced, every corner reads its own copy of its instance
+*
+*	 param:	UINT offset - first expanded instance in the instance buffer
+*			UINT count  - amount of quads to draw
+************************************************************************/
+void CInstanceMesh2D::DrawQuadBatch( UINT offset, UINT count )
+{
+    CRenderStateCache2D::Instance().SetStreamSourceFreq( 0, 1 );
+    CRenderStateCache2D::Instance().SetStreamSourceFreq( 1, 1 );
+
+    CRenderStateCache2D::Instance().SetStreamSource( 0, spQuadVertexBuffer, 0, sizeof( CVertexData ) );
+    CRenderStateCache2D::Instance().SetStreamSource( 1, instanceBuffer.GetBuffer(), offset * instanceBuffer.GetStride(), instanceBuffer.GetStride() );
+    CRenderStateCache2D::Instance().SetIndices( spQuadIndexBuffer );
+
+    CGraphicsDevice2D::Instance().DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, count * VERTEX_COUNT, 0, count * FACE_COUNT );
+
+}	// DrawQuadBatch
+
+
+/************************************************************************
+*    desc:  Get the range of instances drawn in a pass
+*
+*	 param:	EDepthPass pass    - pass to get the range of
+*			size_t opaqueCount - number of opaque instances. They come first
+*			size_t count       - number of instances
+*			size_t & begin     - first instance of the pass
+*			size_t & end       - one past the last instance of the pass
+************************************************************************/
+void CInstanceMesh2D::GetPassRange( EDepthPass pass, size_t opaqueCount, size_t count, size_t & begin, size_t & end )
+{
+    begin = (pass == EDP_OPAQUE) ? 0 : opaqueCount;
+    end = (pass == EDP_OPAQUE) ? opaqueCount : count;
+
+}	// GetPassRange
+
+
+/************************************************************************
+*    desc:  Save the render states the depth passes change
+************************************************************************/
+void CInstanceMesh2D::CDepthStates::Save()
+{
+    zEnable = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ZENABLE );
+    zWriteEnable = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ZWRITEENABLE );
+    alphaTestEnable = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ALPHATESTENABLE );
+    alphaRef = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ALPHAREF );
+    alphaFunc = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ALPHAFUNC );
+    alphaBlendEnable = CRenderStateCache2D::Instance().GetRenderState( D3DRS_ALPHABLENDENABLE );
+
+}	// Save
+
+
+/************************************************************************
+*    desc:  Set the render states of a depth pass. Both passes test
+*           depth, so the translucent sprites behind opaque ones are
+*           rejected before they're shaded. Only fully opaque textures
+*           are drawn in the opaque pass, so it needs neither blending
+*           nor an alpha test
+*
+*	 param:	EDepthPass pass - pass to set the states of
+************************************************************************/
+void CInstanceMesh2D::CDepthStates::Set( EDepthPass pass )
+{
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ZENABLE, D3DZB_TRUE );
+
+    if( pass == EDP_OPAQUE )
+    {
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ZWRITEENABLE, TRUE );
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHATESTENABLE, FALSE );
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHABLENDENABLE, FALSE );
+    }
+    else
+    {
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ZWRITEENABLE, FALSE );
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHATESTENABLE, alphaTestEnable );
+        CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHABLENDENABLE, alphaBlendEnable );
+    }
+
+}	// Set
+
+
+/************************************************************************
+*    desc:  Put the saved render states back
+************************************************************************/
+void CInstanceMesh2D::CDepthStates::Restore()
+{
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ZENABLE, zEnable );
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ZWRITEENABLE, zWriteEnable );
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHATESTENABLE, alphaTestEnable );
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHAREF, alphaRef );
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHAFUNC, alphaFunc );
+    CRenderStateCache2D::Instance().SetRenderState( D3DRS_ALPHABLENDENABLE, alphaBlendEnable );
+
+}	// Restore
+
+
+/************************************************************************
+*    desc:  Add the visible sprites of a render packet to the render
+*           queues. Flipping the depth key sorts the opaque sprites
+*           front to back
+*
+*	 param:	const CRenderPacket & packet - packet to queue
+*			uint indexTag                - added to the index of every queued sprite
+************************************************************************/
+void CInstanceMesh2D::QueuePacket( const CRenderPacket & packet, uint indexTag )
+{
+    for( size_t i = 0; i < packet.keyVec.size(); ++i )
+    {
+        if( packet.opaqueVec[i] )
+            opaqueQueue.Add( ~packet.keyVec[i], indexTag | static_cast<uint>(i) );
+        else
+            renderQueue.Add( packet.keyVec[i], indexTag | static_cast<uint>(i) );
+    }
+
+}	// QueuePacket
+
+
+/************************************************************************
+*    desc:  Sort the render queues and put the sources of their instances
+*           in the order they're drawn. The opaque instances go first
+*
+*	 param:	const CRenderPacket * const * ppPacket - packets the queued sprites
+*                                                    belong to, by mesh
+*			const uint * pAnimationBase            - where the animations of each
+*                                                    mesh start in the shader
+*			const uint * pPageBase                 - where the pages of each
+*                                                    mesh start in the shader
+************************************************************************/
+void CInstanceMesh2D::SortQueuedInstances( const CRenderPacket * const * ppPacket, const uint * pAnimationBase, const uint * pPageBase )
+{
+    // Sort the opaque sprite groups front to back and the translucent ones back to front
+    opaqueQueue.Sort();
+    renderQueue.Sort();
+
+    // Put the instance sources in the order they're drawn
+    const CRenderQueue2D * pQueue[] = { &opaqueQueue, &renderQueue };
+    size_t instanceIndex = 0;
+
+    instanceSourceVec.resize( opaqueQueue.GetCount() + renderQueue.GetCount() );
+
+    for( int queue = 0; queue < 2; ++queue )
+    {
+        for( size_t i = 0; i < pQueue[queue]->GetCount(); ++i, ++instanceIndex )
+        {
+            const uint mesh = pQueue[queue]->GetIndex( i ) >> MERGED_MESH_SHIFT;
+
+            CInstanceSource & source = instanceSourceVec[instanceIndex];
+
+            source = ppPacket[mesh]->sourceVec[ pQueue[queue]->GetIndex( i ) & MERGED_SPRITE_MASK ];
+            source.page += pPageBase[mesh];
+
+            if( source.animation != NO_ANIMATION )
+                source.animation += pAnimationBase[mesh];
+        }
+    }
+
+}	// SortQueuedInstances
+
+
+/************************************************************************
+*    desc:  Sort the render queues and upload their instances to the
+*           instance buffer. The opaque instances go first
+*
+*	 param:	const CRenderPacket * const * ppPacket - packets the queued sprites
+*                                                    belong to, by mesh
+*			const uint * pAnimationBase            - where the animations of each
+*                                                    mesh start in the shader
+*			const uint * pPageBase                 - where the pages of each
+*                                                    mesh start in the shader
+************************************************************************/
+void CInstanceMesh2D::UploadQueuedInstances( const CRenderPacket * const * ppPacket, const uint * pAnimationBase, const uint * pPageBase )
+{
+    SortQueuedInstances( ppPacket, pAnimationBase, pPageBase );
+
+    // Append this frame's instances to the instance buffer
+    void * pInstance = instanceBuffer.Lock( instanceSourceVec.size(), instanceOffset );
+
+    try
+    {
+        BuildInstances( &instanceSourceVec[0], instanceSourceVec.size(), pInstance );
+    }
+    catch( ... )
+    {
+        instanceBuffer.Unlock();
+        throw;
+    }
+    
+    instanceBuffer.Unlock();
+
+}	// UploadQueuedInstances
+
+
+/************************************************************************
+*    desc:  Copy the instances built by the recording into the instance
+*           buffer
+*
+*	 param:	bool expand - copy each instance once for every corner of its
+*                         quad, for the quad batch
+************************************************************************/
+void CInstanceMesh2D::UploadStagedInstances( bool expand )
+{
+    const size_t count = instanceSourceVec.size();
+    const size_t stride = instanceBuffer.GetStride();
+
+    if( !expand )
+    {
+        void * pInstance = instanceBuffer.Lock( count, instanceOffset );
+        std::memcpy( pInstance, &instanceStageVec[0], count * stride );
+        instanceBuffer.Unlock();
+
+        return;
+    }
+
+    char * pVertex = static_cast<char *>(instanceBuffer.Lock( count * VERTEX_COUNT, instanceOffset ));
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        const char * pInstance = &instanceStageVec[i * stride];
+
+        for( int j = 0; j < VERTEX_COUNT; ++j, pVertex += stride )
+            std::memcpy( pVertex, pInstance, stride );
+    }
+
+    instanceBuffer.Unlock();
+
+}	// UploadStagedInstances
+
+
+/************************************************************************
+*    desc:  Give the animation tables of this mesh to the shader. The
+*           effect is shared by every mesh, so the tables are only sent
+*           when another mesh's are in it or they changed
+*
+*	 param:	float time - time the animations are played at
+************************************************************************/
+void CInstanceMesh2D::SetAnimationTables( float time )
+{
+    CGraphicsDevice2D::Instance().SetEffectFloat( "animationTime", time );
+
+    if( animationInfoVec.empty() || ((pAnimationTableOwner == this) && !animationTableDirty) )
+        return;
+
+    CGraphicsDevice2D::Instance().SetEffectFloatArray( "animationFrameUV", &animationFrameVec[0], static_cast<UINT>(animationFrameVec.size()) );
+    CGraphicsDevice2D::Instance().SetEffectFloatArray( "animationInfo", &animationInfoVec[0], static_cast<UINT>(animationInfoVec.size()) );
+
+    pAnimationTableOwner = this;
+    animationTableDirty = false;
+
+}	// SetAnimationTables
+
+
+/************************************************************************
+*    desc:  Cull the sprites added this frame against the view of their
+*           projection. The bounding spheres are gathered in structure
+*           of arrays form and tested four at a time. The perspective
+*           sprites that are left are then tested against the opaque
+*           sprites in front of them
+*
+*	 ret:	size_t - number of sprites hidden behind opaque sprites
+************************************************************************/
+size_t CInstanceMesh2D::CullSprites()
+{
+    // The camera position is the same for every sprite
+    const CPoint cameraPos = CWorldCamera::Instance().GetPos();
+
+    perspectiveFrustum.SetProjection( CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_PERSPECTIVE ) );
+    orthographicFrustum.SetProjection( CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC ) );
+
+    perspectiveCullSet.Clear();
+    orthographicCullSet.Clear();
+
+    for( size_t i = 0; i < spriteGrpVec.size(); ++i )
+    {
+        CSpriteGroup2D * pSprite = spriteGrpVec[i].GetSpriteGrp();
+
+        // The sphere around the sprite's quad after it's been scaled and rotated
+        const float * pMatrix = pSprite->GetScaledMatrix()();
+        const float w = pSprite->GetVisualSprite()->GetSize(false).w;
+        const float h = pSprite->GetVisualSprite()->GetSize(false).h;
+        const float xAxisSq = pMatrix[0] * pMatrix[0] + pMatrix[1] * pMatrix[1] + pMatrix[2] * pMatrix[2];
+        const float yAxisSq = pMatrix[4] * pMatrix[4] + pMatrix[5] * pMatrix[5] + pMatrix[6] * pMatrix[6];
+
+        const CPoint pos = cameraPos + pSprite->GetTransPos();
+        const float radius = 0.5f * std::sqrt( w * w * xAxisSq + h * h * yAxisSq );
+
+        CCullSet & cullSet = (pSprite->GetProjectionType() == CSettings::EPT_ORTHOGRAPHIC) ? orthographicCullSet : perspectiveCullSet;
+        cullSet.Add( pos.x, pos.y, pos.z, radius, static_cast<uint>(i) );
+    }
+
+    perspectiveCullSet.Cull( perspectiveFrustum, spriteVisibleVec, spriteGrpVec.size() );
+    orthographicCullSet.Cull( orthographicFrustum, spriteVisibleVec, spriteGrpVec.size() );
+
+    if( !occlusionMode )
+        return 0;
+
+    // Rasterize the opaque middles of the opaque perspective sprites that can be seen and the
+    // persistent ones. The frame of an animated sprite isn't known here, so it doesn't occlude
+    const float * pPerspectiveMatrix = CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_PERSPECTIVE );
+
+    occlusionBuffer.Clear();
+
+    for( size_t i = 0; i < spriteGrpVec.size(); ++i )
+    {
+        CSpriteGroup2D * pSprite = spriteGrpVec[i].GetSpriteGrp();
+
+        if( spriteVisibleVec[i] && spriteGrpVec[i].IsOpaque() && (spriteGrpVec[i].GetAnimation() == NO_ANIMATION) &&
+            (pSprite->GetProjectionType() == CSettings::EPT_PERSPECTIVE) )
+        {
+            pSprite->SetCurrentFrame( spriteGrpVec[i].GetFrameIndex() );
+            AddOccluder( pSprite, cameraPos, pPerspectiveMatrix );
+        }
+    }
+
+    for( size_t slot = 0; slot < persistentSpriteVec.size(); ++slot )
+    {
+        CSpriteGroup2D * pSprite = persistentSpriteVec[slot];
+
+        if( (pSprite != NULL) && persistentOpaqueVec[slot] && (pSprite->GetProjectionType() == CSettings::EPT_PERSPECTIVE) )
+            AddOccluder( pSprite, cameraPos, pPerspectiveMatrix );
+    }
+
+    if( occlusionBuffer.GetOccluderCount() == 0 )
+        return 0;
+
+    occlusionBuffer.Rasterize();
+
+    return perspectiveCullSet.Occlude( occlusionBuffer, pPerspectiveMatrix, spriteVisibleVec );
+
+}	// CullSprites
+
+
+/************************************************************************
+*    desc:  Add the fully opaque middle of a sprite's texture to the
+*           occlusion buffer. A rotated sprite adds the biggest screen
+*           aligned square that fits in its rotated middle. A faded
+*           sprite is seen through, so it adds nothing
+*
+*	 param:	CSpriteGroup2D * pSprite - opaque sprite
+*			const CPoint & cameraPos - position of the camera
+*			const float * pMatrix    - row major perspective projection
+************************************************************************/
+void CInstanceMesh2D::AddOccluder( CSpriteGroup2D * pSprite, const CPoint & cameraPos, const float * pMatrix )
+{
+    if( pSprite->GetResultColor().a < 1.f )
+        return;
+
+    const float * pOccluder = pMegaTexture->GetOccluder( pMegaTexture->GetComponentId( pSprite->GetActiveTexture() ) );
+
+    if( pOccluder[2] <= pOccluder[0] )
+        return;
+
+    // The opaque middle on the quad, with y going up
+    const float w = pSprite->GetVisualSprite()->GetSize(false).w;
+    const float h = pSprite->GetVisualSprite()->GetSize(false).h;
+    const float localLeft = (pOccluder[0] - 0.5f) * w;
+    const float localRight = (pOccluder[2] - 0.5f) * w;
+    const float localTop = (0.5f - pOccluder[1]) * h;
+    const float localBottom = (0.5f - pOccluder[3]) * h;
+    const float localX = (localLeft + localRight) * 0.5f;
+    const float localY = (localTop + localBottom) * 0.5f;
+
+    // Move the middle into the world
+    const float * pScaled = pSprite->GetScaledMatrix()();
+    const CPoint pos = cameraPos + pSprite->GetTransPos();
+    const float x = pos.x + (localX * pScaled[0]) + (localY * pScaled[4]);
+    const float y = pos.y + (localX * pScaled[1]) + (localY * pScaled[5]);
+
+    float halfW, halfH;
+
+    if( (pScaled[1] == 0.f) && (pScaled[4] == 0.f) )
+    {
+        halfW = std::fabs( (localRight - localLeft) * 0.5f * pScaled[0] );
+        halfH = std::fabs( (localTop - localBottom) * 0.5f * pScaled[5] );
+    }
+    else
+    {
+        const float xLength = std::sqrt( (pScaled[0] * pScaled[0]) + (pScaled[1] * pScaled[1]) );
+        const float yLength = std::sqrt( (pScaled[4] * pScaled[4]) + (pScaled[5] * pScaled[5]) );
+
+        if( xLength == 0.f )
+            return;
+
+        const float halfSide = std::min( (localRight - localLeft) * 0.5f * xLength, (localTop - localBottom) * 0.5f * yLength );
+
+        halfW = halfSide / ((std::fabs( pScaled[0] ) + std::fabs( pScaled[1] )) / xLength);
+        halfH = halfW;
+    }
+
+    float rect[4];
+
+    if( ProjectRect( pMatrix, x - halfW, y - halfH, x + halfW, y + halfH, pos.z, rect ) )
+        occlusionBuffer.AddOccluder( rect[0], rect[1], rect[2], rect[3], pos.z );
+
+}	// AddOccluder
+
+
+/************************************************************************
+*    desc:  Set if the sprites hidden behind opaque sprites are rejected
+*
+*	 param:	bool _occlusionMode - whether the sprites are occluded
+************************************************************************/
+void CInstanceMesh2D::SetOcclusionMode( bool _occlusionMode )
+{
+    occlusionMode = _occlusionMode;
+
+}	// SetOcclusionMode
+
+
+/************************************************************************
+*    desc:  Set the layer the mesh is merged in
+*
+*	 param:	uint _mergeLayer - layer of the mesh. Zero never merges
+************************************************************************/
+void CInstanceMesh2D::SetMergeLayer( uint _mergeLayer )
+{
+    mergeLayer = _mergeLayer;
+
+}	// SetMergeLayer
+
+
+/************************************************************************
+*    desc:  Add a bounding sphere to the cull set
+*
+*	 param:	float x, y, z     - center of the sphere
+*			float radius      - radius of the sphere
+*			uint spriteIndex  - index of the sprite in the sprite group vector
+************************************************************************/
+void CInstanceMesh2D::CCullSet::Add( float x, float y, float z, float radius, uint spriteIndex )
+{
+    xVec.push_back( x );
+    yVec.push_back( y );
+    zVec.push_back( z );
+    radiusVec.push_back( radius );
+    spriteIndexVec.push_back( spriteIndex );
+
+}	// Add
+
+
+/************************************************************************
+*    desc:  Cull the spheres against a frustum and mark the sprites
+*
+*	 param:	const CViewFrustum2D & frustum  - view to cull against
+*			vector<char> & spriteVisibleVec - visibility of each sprite
+*			size_t spriteCount              - number of sprites
+************************************************************************/
+void CInstanceMesh2D::CCullSet::Cull( const CViewFrustum2D & frustum, std::vector<char> & spriteVisibleVec, size_t spriteCount )
+{
+    spriteVisibleVec.resize( spriteCount );
+
+    if( spriteIndexVec.empty() )
+        return;
+
+    visibleVec.resize( spriteIndexVec.size() );
+    frustum.CullSpheres( &xVec[0], &yVec[0], &zVec[0], &radiusVec[0], spriteIndexVec.size(), &visibleVec[0] );
+
+    for( size_t i = 0; i < spriteIndexVec.size(); ++i )
+        spriteVisibleVec[ spriteIndexVec[i] ] = static_cast<char>(visibleVec[i]);
+
+}	// Cull
+
+
+/************************************************************************
+*    desc:  Unmark the visible sprites whose bounding square is behind
+*           the occluders. Cull has to have been called first
+*
+*	 param:	const COcclusionBuffer2D & buffer - rasterized occluders
+*			const float * pMatrix            - row major projection of the set
+*			vector<char> & spriteVisibleVec  - visibility of each sprite
+*
+*	 ret:	size_t - number of sprites hidden
+************************************************************************/
+size_t CInstanceMesh2D::CCullSet::Occlude( const COcclusionBuffer2D & buffer, const float * pMatrix, std::vector<char> & spriteVisibleVec )
+{
+    size_t occludedCount = 0;
+    float rect[4];
+
+    for( size_t i = 0; i < spriteIndexVec.size(); ++i )
+    {
+        if( visibleVec[i] && 
+            ProjectRect( pMatrix, xVec[i] - radiusVec[i], yVec[i] - radiusVec[i], xVec[i] + radiusVec[i], yVec[i] + radiusVec[i], zVec[i], rect ) &&
+            buffer.IsOccluded( rect[0], rect[1], rect[2], rect[3], zVec[i] ) )
+        {
+            spriteVisibleVec[ spriteIndexVec[i] ] = 0;
+            ++occludedCount;
+        }
+    }
+
+    return occludedCount;
+
+}	// Occlude
+
+
+/************************************************************************
+*    desc:  Clear the cull set. The vectors keep their memory
+************************************************************************/
+void CInstanceMesh2D::CCullSet::Clear()
+{
+    xVec.clear();
+    yVec.clear();
+    zVec.clear();
+    radiusVec.clear();
+    spriteIndexVec.clear();
+
+}	// Clear
+
+
+/************************************************************************
+*    desc:  Copy the persistent slots that changed into the render
+*           packet. Only the changed slots are copied, and slots close
+*           to each other are put in one range so they're uploaded with
+*           one lock
+*
+*	 param:	CRenderPacket & packet - packet to copy into
+************************************************************************/
+void CInstanceMesh2D::PreparePersistent( CRenderPacket & packet )
+{
+    packet.persistentSourceVec.clear();
+    packet.persistentRangeVec.clear();
+    packet.persistentCount = 0;
+    packet.persistentOpaqueCount = 0;
+    packet.persistentDrawCount = 0;
+    packet.persistentCapacity = persistentReservedCount;
+    packet.persistentKeyVec.clear();
+
+    if( persistentSpriteVec.empty() )
+        return;
+
+    // Every slot is built again anyway after a sort
+    if( !persistentSortDirty && !persistentAllDirty )
+        FindChangedPersistent();
+
+    // The camera isn't part of the instances, so moving it doesn't change any slot
+    // The slots are drawn in order, so a sprite that changed depth or pass needs the slots
+    // sorted again. Nothing was looked for when every slot is dirty, so every slot is checked
+    const size_t checkCount = persistentAllDirty ? persistentSpriteVec.size() : dirtySlotVec.size();
+
+    for( size_t i = 0; (i < checkCount) && !persistentSortDirty; ++i )
+    {
+        const size_t slot = persistentAllDirty ? i : dirtySlotVec[i];
+        CSpriteGroup2D * pSprite = persistentSpriteVec[slot];
+
+        if( pSprite != NULL )
+            persistentSortDirty = (CRenderQueue2D::GetDepthKey( pSprite->GetPos().z ) != persistentKeyVec[slot]) ||
+                ((slot < persistentOpaqueCount) != (persistentOpaqueVec[slot] && IsDrawnOpaque( pSprite, NO_ANIMATION )));
+    }
+
+    if( persistentSortDirty )
+        SortPersistentSlots();
+
+    const size_t slotCount = persistentSpriteVec.size();
+
+    if( slotCount == 0 )
+        return;
+
+    // Grow the buffer geometrically. The new buffer has to be filled completely
+    if( persistentReservedCount < slotCount )
+    {
+        persistentReservedCount = std::max( std::max( slotCount, persistentReservedCount * 2 ), MIN_PERSISTENT_CAPACITY );
+        persistentAllDirty = true;
+    }
+
+    // Copy everything when most of the slots changed anyway
+    if( persistentAllDirty || (dirtySlotVec.size() > (slotCount >> 1)) )
+    {
+        GatherPersistentRange( packet, 0, slotCount );
+    }
+    else if( !dirtySlotVec.empty() )
+    {
+        std::sort( dirtySlotVec.begin(), dirtySlotVec.end() );
+
+        size_t rangeBegin = dirtySlotVec[0];
+        size_t rangeEnd = rangeBegin + 1;
+
+        for( size_t i = 1; i < dirtySlotVec.size(); ++i )
         {
-            CShader::Instance().GetActiveShader()->BeginPass( iPass );
-            CXDevice::Instance().GetXDevice()->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, VERTEX_COUNT, 0, FACE_COUNT );
-            CShader::Instance().GetActiveShader()->EndPass();
+            if( dirtySlotVec[i] > rangeEnd + MAX_DIRTY_SLOT_GAP )
+            {
+                GatherPersistentRange( packet, rangeBegin, rangeEnd );
+                rangeBegin = dirtySlotVec[i];
+            }
+
+            rangeEnd = dirtySlotVec[i] + 1;
         }
-        CShader::Instance().GetActiveShader()->End();
 
-        // Reset the stream frequencies
-        CXDevice::Instance().GetXDevice()->SetStreamSourceFreq(0,1);
-        CXDevice::Instance().GetXDevice()->SetStreamSourceFreq(1,1);
+        GatherPersistentRange( packet, rangeBegin, rangeEnd );
     }
 
-}	// Render
+    for( size_t i = 0; i < dirtySlotVec.size(); ++i )
+        persistentDirtyVec[ dirtySlotVec[i] ] = 0;
+
+    dirtySlotVec.clear();
+    persistentAllDirty = false;
+
+    packet.persistentCount = slotCount;
+    packet.persistentOpaqueCount = persistentOpaqueCount;
+    packet.persistentDrawCount = slotCount - emptySlotCount;
+    packet.persistentCapacity = persistentReservedCount;
+    packet.persistentKeyVec.assign( persistentKeyVec.begin() + persistentOpaqueCount, persistentKeyVec.end() );
+
+}	// PreparePersistent
+
+
+/************************************************************************
+*    desc:  Mark the persistent slots whose sprites changed since their
+*           slots were built. The sprite flags its own moves, rotations
+*           and scales until ResetTransformParameters is called, which
+*           happens when its slot is built. The color, frame and
+*           visibility are compared with what the slot was built from.
+*           Nothing is built here, so a frame where nothing changed only
+*           costs the checks
+************************************************************************/
+void CInstanceMesh2D::FindChangedPersistent()
+{
+    for( size_t slot = 0; slot < persistentSpriteVec.size(); ++slot )
+    {
+        CSpriteGroup2D * pSprite = persistentSpriteVec[slot];
+
+        if( (pSprite == NULL) || persistentDirtyVec[slot] )
+            continue;
+
+        const CPersistentState & state = persistentStateVec[slot];
+        const CColor & color = pSprite->GetResultColor();
+
+        if( pSprite->GetParameters().IsSet( CObject::TRANSLATE ) ||
+            pSprite->GetParameters().IsSet( CObject::ROTATE ) ||
+            pSprite->GetParameters().IsSet( CObject::SCALE ) ||
+            (pSprite->IsVisible() != state.visible) ||
+            (pSprite->GetActiveTexture() != state.pTexture) ||
+            (color.r != state.color.r) || (color.g != state.color.g) ||
+            (color.b != state.color.b) || (color.a != state.color.a) )
+        {
+            persistentDirtyVec[slot] = 1;
+            dirtySlotVec.push_back( static_cast<uint>(slot) );
+        }
+    }
+
+}	// FindChangedPersistent
+
+
+/************************************************************************
+*    desc:  Sort the persistent sprites and give them new slots. The
+*           opaque sprites get the first slots front to back, the
+*           translucent ones the rest back to front. Empty slots are
+*           dropped. Every slot is uploaded after. A sprite flagged
+*           opaque that can't be drawn without blending right now is
+*           sorted with the translucent ones but keeps its flag
+************************************************************************/
+void CInstanceMesh2D::SortPersistentSlots()
+{
+    // The empty slots are packed out as the live sprites are copied
+    std::vector<CSpriteGroup2D *> liveSpriteVec;
+    std::vector<char> liveOpaqueVec;
+    std::vector<char> liveDrawnOpaqueVec;
+
+    liveSpriteVec.reserve( persistentSlotMap.size() );
+    liveOpaqueVec.reserve( persistentSlotMap.size() );
+    liveDrawnOpaqueVec.reserve( persistentSlotMap.size() );
+
+    for( size_t slot = 0; slot < persistentSpriteVec.size(); ++slot )
+    {
+        if( persistentSpriteVec[slot] != NULL )
+        {
+            liveSpriteVec.push_back( persistentSpriteVec[slot] );
+            liveOpaqueVec.push_back( persistentOpaqueVec[slot] );
+            liveDrawnOpaqueVec.push_back( persistentOpaqueVec[slot] && IsDrawnOpaque( persistentSpriteVec[slot], NO_ANIMATION ) );
+        }
+    }
+
+    const size_t liveCount = liveSpriteVec.size();
+
+    persistentSpriteVec.resize( liveCount );
+    persistentKeyVec.resize( liveCount );
+    persistentOpaqueVec.resize( liveCount );
+
+    size_t slot = 0;
+
+    // Sort the opaque sprites first, then the translucent ones
+    for( int opaque = 1; opaque >= 0; --opaque )
+    {
+        persistentQueue.Clear();
+        persistentQueue.Reserve( liveCount );
+
+        for( size_t i = 0; i < liveCount; ++i )
+        {
+            if( liveDrawnOpaqueVec[i] == opaque )
+            {
+                const uint key = CRenderQueue2D::GetDepthKey( liveSpriteVec[i]->GetPos().z );
+                persistentQueue.Add( opaque ? ~key : key, static_cast<uint>(i) );
+            }
+        }
+
+        persistentQueue.Sort();
+
+        // Put the sprites in their new slots
+        for( size_t i = 0; i < persistentQueue.GetCount(); ++i, ++slot )
+        {
+            persistentSpriteVec[slot] = liveSpriteVec[ persistentQueue.GetIndex( i ) ];
+            persistentKeyVec[slot] = opaque ? ~persistentQueue.GetKey( i ) : persistentQueue.GetKey( i );
+            persistentOpaqueVec[slot] = liveOpaqueVec[ persistentQueue.GetIndex( i ) ];
+            persistentSlotMap[ persistentSpriteVec[slot] ] = static_cast<uint>(slot);
+        }
+
+        if( opaque )
+            persistentOpaqueCount = slot;
+    }
+
+    persistentStateVec.assign( liveCount, CPersistentState() );
+    persistentDirtyVec.assign( liveCount, 0 );
+    dirtySlotVec.clear();
+
+    emptySlotCount = 0;
+    persistentSortDirty = false;
+    persistentAllDirty = true;
+
+}	// SortPersistentSlots
+
+
+/************************************************************************
+*    desc:  Can a sprite flagged opaque be drawn in the opaque pass. That
+*           pass draws without blending, so only a sprite that isn't
+*           faded and whose texture, or every frame of its animation,
+*           is fully opaque can. The rest are drawn translucent
+*
+*	 param:	CSpriteGroup2D * pSprite - sprite to check
+*			uint animation           - animation of the sprite or NO_ANIMATION
+*
+*	 ret:	bool - true if the sprite can be drawn in the opaque pass
+************************************************************************/
+bool CInstanceMesh2D::IsDrawnOpaque( CSpriteGroup2D * pSprite, uint animation ) const
+{
+    if( pSprite->GetResultColor().a < 1.f )
+        return false;
+
+    if( animation != NO_ANIMATION )
+        return (animationOpaqueVec[animation] != 0);
+
+    return pMegaTexture->IsOpaque( pMegaTexture->GetComponentId( pSprite->GetActiveTexture() ) );
+
+}	// IsDrawnOpaque
+
+
+/************************************************************************
+*    desc:  Copy a range of persistent slots into the render packet
+*
+*	 param:	CRenderPacket & packet - packet to copy into
+*			size_t begin, end      - range of slots to copy
+************************************************************************/
+void CInstanceMesh2D::GatherPersistentRange( CRenderPacket & packet, size_t begin, size_t end )
+{
+    CSlotRange range;
+    range.begin = static_cast<uint>(begin);
+    range.end = static_cast<uint>(end);
+    packet.persistentRangeVec.push_back( range );
+
+    const size_t sourceBegin = packet.persistentSourceVec.size();
+    packet.persistentSourceVec.resize( sourceBegin + (end - begin) );
+
+    for( size_t slot = begin; slot < end; ++slot )
+    {
+        CInstanceSource & source = packet.persistentSourceVec[sourceBegin + slot - begin];
+        CSpriteGroup2D * pSprite = persistentSpriteVec[slot];
+
+        if( pSprite != NULL )
+        {
+            CPersistentState & state = persistentStateVec[slot];
+            state.color = pSprite->GetResultColor();
+            state.pTexture = pSprite->GetActiveTexture();
+            state.visible = pSprite->IsVisible();
+        }
+
+        if( (pSprite != NULL) && pSprite->IsVisible() )
+        {
+            GatherInstanceSource( pSprite, source );
+        }
+        else
+        {
+            // An empty or hidden slot is drawn as a quad with no size
+            if( pSprite != NULL )
+                pSprite->ResetTransformParameters();
+
+            D3DXMatrixIdentity( &source.scaledMatrix );
+            source.size.w = 0;
+            source.size.h = 0;
+            source.projType = CSettings::EPT_ORTHOGRAPHIC;
+            source.color = CColor();
+            source.pUV = EMPTY_SLOT_UV;
+            source.page = 0;
+            source.hull = 0;
+            source.animation = NO_ANIMATION;
+        }
+    }
+
+}	// GatherPersistentRange
+
+
+/************************************************************************
+*    desc:  Upload the persistent ranges of a render packet. The buffer
+*           is managed, so only the locked ranges are sent to the card
+*
+*	 param:	const CRenderPacket & packet - packet to upload
+************************************************************************/
+void CInstanceMesh2D::UploadPersistent( const CRenderPacket & packet )
+{
+    StagePersistent( packet );
+    UploadStagedPersistent( packet );
+
+}	// UploadPersistent
+
+
+/************************************************************************
+*    desc:  Build the persistent ranges of a render packet into memory.
+*           The ranges follow each other in the packet, so they're
+*           built in one go
+*
+*	 param:	const CRenderPacket & packet - packet to build
+************************************************************************/
+void CInstanceMesh2D::StagePersistent( const CRenderPacket & packet )
+{
+    persistentStageVec.resize( packet.persistentSourceVec.size() * instanceBuffer.GetStride() );
+
+    if( !packet.persistentSourceVec.empty() )
+        BuildInstances( &packet.persistentSourceVec[0], packet.persistentSourceVec.size(), &persistentStageVec[0] );
+
+}	// StagePersistent
+
+
+/************************************************************************
+*    desc:  Copy the staged persistent ranges of a render packet into the
+*           persistent buffer, growing it first if the packet asks to
+*
+*	 param:	const CRenderPacket & packet - packet the ranges were staged from
+************************************************************************/
+void CInstanceMesh2D::UploadStagedPersistent( const CRenderPacket & packet )
+{
+    // The packet holds every slot when the buffer has to grow
+    if( packet.persistentCapacity > persistentCapacity )
+    {
+        HRESULT hr;
+
+        spPersistentBuffer.Release();
+        persistentCapacity = packet.persistentCapacity;
+
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateVertexBuffer( 
+                    static_cast<UINT>(persistentCapacity * instanceBuffer.GetStride()),
+                    D3DUSAGE_WRITEONLY, 
+                    0,
+                    D3DPOOL_MANAGED, 
+                    &spPersistentBuffer ) ) )
+        {
+            persistentCapacity = 0;
+            DisplayError( hr );
+        }
+    }
+
+    const UINT stride = instanceBuffer.GetStride();
+    size_t stageOffset = 0;
+
+    for( size_t i = 0; i < packet.persistentRangeVec.size(); ++i )
+    {
+        const CSlotRange & range = packet.persistentRangeVec[i];
+        const size_t size = (range.end - range.begin) * stride;
+        void * pInstance;
+
+        if( FAILED( spPersistentBuffer->Lock( range.begin * stride, static_cast<UINT>(size), &pInstance, 0 ) ) )
+        {
+            throw NExcept::CCriticalException( "Instance Mesh Error!", 
+                                               "An instance mesh failed to lock its persistent instance buffer." );
+        }
+
+        std::memcpy( pInstance, &persistentStageVec[stageOffset], size );
+
+        spPersistentBuffer->Unlock();
+
+        stageOffset += size;
+    }
+
+}	// UploadStagedPersistent
+
+
+/************************************************************************
+*    desc:  Copy the data needed to build the instance of one sprite
+*
+*	 param:	CSpriteGroup2D * pSprite  - sprite to copy from
+*			CInstanceSource & source  - source to fill in
+************************************************************************/
+void CInstanceMesh2D::GatherInstanceSource( CSpriteGroup2D * pSprite, CInstanceSource & source )
+{
+    GatherInstanceTransform( pSprite, source );
+
+    // Find the UVs and hull of the current frame once here, so building the instance is a plain read
+    const uint componentId = pMegaTexture->GetComponentId( pSprite->GetActiveTexture() );
+
+    source.pUV = pMegaTexture->GetUVs( componentId );
+    source.page = pMegaTexture->GetPage( componentId );
+    source.hull = (componentId < MAX_HULL_COUNT) ? componentId + 1 : 0;
+    source.animation = NO_ANIMATION;
+
+}	// GatherInstanceSource
 
 
 /************************************************************************
-*    desc:  Update the mesh information
+*    desc:  Copy the size, transform and color of one sprite. The UVs
+*           are left alone. The camera isn't added, the shader does it
+*
+*	 param:	CSpriteGroup2D * pSprite  - sprite to copy from
+*			CInstanceSource & source  - source to fill in
 ************************************************************************/
-void CInstanceMesh2D::Update()
+void CInstanceMesh2D::GatherInstanceTransform( CSpriteGroup2D * pSprite, CInstanceSource & source )
 {
-    // Set the instance buffer values
-    CInstanceData * pInstance;
-    if( FAILED( spInstanceBuffer->Lock( 0, 0, (void **)&pInstance, 0 ) ) )
+    // The size is used to make the generic mesh in the vertex buffer conform to the
+    // size of the specific sprite
+    source.size.w = pSprite->GetVisualSprite()->GetSize(false).w;
+    source.size.h = pSprite->GetVisualSprite()->GetSize(false).h;
+
+    // Position relative to the world, so a sprite that doesn't move keeps its instance
+    const CPoint pos = pSprite->GetTransPos();
+
+    // The compact layout only keeps the part of the matrix a sprite that rotates around z uses.
+    // Anything else would be drawn flattened without a word. Meshes only get the compact layout
+    // when they ask for it, so a sprite like that in one is an error
+    if( (instanceLayout == EIL_COMPACT) && !NInstancePack2D::IsPackable( pSprite->GetScaledMatrix()() ) )
         throw NExcept::CCriticalException( "Instance Mesh Error!", 
-                                            "An instance mesh failed to lock its instance buffer." );
+                boost::str( boost::format("A sprite rotated around x or y can't be drawn with the compact instance layout. Init the mesh with EIL_FULL.\n\n%s\nLine: %s") 
+                    % __FUNCTION__ % __LINE__ ));
+
+    // Copy it to the DirectX matrix
+    source.scaledMatrix = D3DXMATRIX( pSprite->GetScaledMatrix()() );
+    source.scaledMatrix._41 = pos.x;
+    source.scaledMatrix._42 = pos.y;
+    source.scaledMatrix._43 = pos.z;
+
+    source.projType = pSprite->GetProjectionType();
+    source.color = pSprite->GetResultColor();
+    source.page = 0;
+    source.hull = 0;
+
+    // We reset the required transformations so we're not constantly recalculating matrices
+    pSprite->ResetTransformParameters();
+
+}	// GatherInstanceTransform
+
+
+/************************************************************************
+*    desc:  Get the clip space matrix of an instance
+*
+*	 param:	const CInstanceSource & source - data copied out of the sprite
+*			D3DXMATRIX & matrix            - matrix to fill in
+************************************************************************/
+void CInstanceMesh2D::GetInstanceMatrix( const CInstanceSource & source, D3DXMATRIX & matrix ) const
+{
+    // Create a scale matrix so that the generic mesh in the vertex buffer will conform
+    // to the size of the specific sprite
+    D3DXMATRIX sizeMatrix( source.size.w, 0, 0, 0,
+                           0, source.size.h, 0, 0,
+                           0, 0, 1, 0,
+                           0, 0, 0, 1 );
+
+    // Create the matrix to send to the shader
+    matrix = sizeMatrix * source.scaledMatrix * 
+        ((source.projType == CSettings::EPT_ORTHOGRAPHIC) ? orthographicMatrix : perspectiveMatrix);
+
+}	// GetInstanceMatrix
+
+
+/************************************************************************
+*    desc:  Compose the clip space matrices of a block of instances.
+*           Sprites that only rotate around z go through the SIMD batch,
+*           the rest through the full matrix multiply. A layout without
+*           perspective gives every sprite the orthographic projection
+*
+*	 param:	const CInstanceSource * pSource - first instance source of the block
+*			size_t count                    - amount of instances, up to AFFINE_BATCH_SIZE
+*			CAffineBatch2D & batch          - batch that receives the matrices
+************************************************************************/
+template <bool PERSPECTIVE>
+void CInstanceMesh2D::TransformInstances( const CInstanceSource * pSource, size_t count, CAffineBatch2D & batch ) const
+{
+    for( size_t i = 0; i < count; ++i )
+        batch.Set( i, pSource[i].size.w, pSource[i].size.h, pSource[i].scaledMatrix, 
+                   !PERSPECTIVE || (pSource[i].projType == CSettings::EPT_ORTHOGRAPHIC) );
+
+    batch.Transform( count, PERSPECTIVE ? perspectiveMatrix : orthographicMatrix, orthographicMatrix );
+
+    // Redo the few that the batch can't handle
+    for( size_t i = 0; i < count; ++i )
+    {
+        if( !CAffineBatch2D::IsAffine( pSource[i].scaledMatrix ) )
+        {
+            D3DXMATRIX matrix;
+
+            if( PERSPECTIVE )
+            {
+                GetInstanceMatrix( pSource[i], matrix );
+            }
+            else
+            {
+                CInstanceSource source = pSource[i];
+                source.projType = CSettings::EPT_ORTHOGRAPHIC;
+                GetInstanceMatrix( source, matrix );
+            }
+
+            batch.SetMatrix( i, matrix );
+        }
+    }
+
+}	// TransformInstances
+
+
+/************************************************************************
+*    desc:  Build the instance data of an array of instance sources.
+*           Every instance is independent, so the instance data is built
+*           on the worker threads. Each chunk writes its own range of
+*           the locked buffer
+*
+*	 param:	const CInstanceSource * pSource - sources to build from
+*			size_t count                    - amount of instances
+*			void * pInstance                - locked instance buffer
+************************************************************************/
+void CInstanceMesh2D::BuildInstances( const CInstanceSource * pSource, size_t count, void * pInstance )
+{
+    if( count == 0 )
+        return;
+
+    // Every instance uses one of these two
+    perspectiveMatrix = D3DXMATRIX( CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_PERSPECTIVE ) );
+    orthographicMatrix = D3DXMATRIX( CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC ) );
 
-    // Begin copying the instance data
-    renderIter = pRenderMultiMap.begin();
-    uint instanceIndex = 0;
+    // The fill of the compact layout is picked here once, not for each sprite
+    if( instanceLayout == EIL_COMPACT )
+        CJobPool::Instance().ParallelFor( count, MIN_FILL_CHUNK_SIZE,
+            boost::bind( COMPACT_FILL[instanceAttributes], this, pSource, pInstance, _1, _2 ) );
+    else
+        CJobPool::Instance().ParallelFor( count, MIN_FILL_CHUNK_SIZE,
+            boost::bind( &CInstanceMesh2D::FillInstances, this, pSource, static_cast<CInstanceData *>(pInstance), _1, _2 ) );
 
-    while( renderIter != pRenderMultiMap.end() )
+}	// BuildInstances
+
+
+/************************************************************************
+*    desc:  Build the instance data of a range of instances. Called on
+*           the worker threads, so it only reads the instance sources
+*           and writes its own range of the instance buffer
+*
+*	 param:	const CInstanceSource * pSource - instance sources
+*			CInstanceData * pInstance       - locked instance buffer
+*			void * pBuffer                  - locked instance buffer in the compact
+*			                                  layout of the attributes
+*			size_t begin, end               - range of instances to build
+************************************************************************/
+void CInstanceMesh2D::FillInstances( const CInstanceSource * pSource, CInstanceData * pInstance, size_t begin, size_t end )
+{
+    CAffineBatch2D batch;
+    D3DXMATRIX cameraViewProjectionMatrix;
+
+    for( size_t blockBegin = begin; blockBegin < end; blockBegin += AFFINE_BATCH_SIZE )
     {
-        // Create a scale matrix so that the generic mesh in the vertex buffer will conform
-        // to the size of the specific sprite
-        int x = renderIter->second.GetSpriteGrp()->GetVisualSprite()->GetSize(false).w;
-        int y = renderIter->second.GetSpriteGrp()->GetVisualSprite()->GetSize(false).h;
-        D3DXMATRIX sizeMatrix( x, 0, 0, 0,
-                                0, y, 0, 0,
-                                0, 0, 1, 0,
-                                0, 0, 0, 1 );
+        const size_t blockCount = std::min( AFFINE_BATCH_SIZE, end - blockBegin );
+
+        TransformInstances<true>( &pSource[blockBegin], blockCount, batch );
 
-        CPoint finalPos = CWorldCamera::Instance().GetPos() + renderIter->second.GetSpriteGrp()->GetTransPos();
+        for( size_t i = 0; i < blockCount; ++i )
+        {
+            const size_t instanceIndex = blockBegin + i;
+
+            batch.GetMatrix( i, cameraViewProjectionMatrix );
+
+            // Set the instance data
+            pInstance[instanceIndex].SetMatrix( cameraViewProjectionMatrix );
+            pInstance[instanceIndex].SetColor( pSource[instanceIndex].color );
+
+            // The shader picks the camera offset of the projection
+            const uint projectionFlag = (pSource[instanceIndex].projType == CSettings::EPT_ORTHOGRAPHIC) ? INSTANCE_FLAG_ORTHOGRAPHIC : 0;
+
+            // Set the UVs using the mega texture component data, or the animation the shader picks them from
+            if( pSource[instanceIndex].animation == NO_ANIMATION )
+            {
+                pInstance[instanceIndex].SetUVs( pSource[instanceIndex].pUV );
+                pInstance[instanceIndex].SetMisc( pSource[instanceIndex].page, projectionFlag, pSource[instanceIndex].hull );
+            }
+            else
+            {
+                pInstance[instanceIndex].SetAnimation( pSource[instanceIndex].animation, pSource[instanceIndex].animationPhase, pSource[instanceIndex].animationRate );
+                pInstance[instanceIndex].SetMisc( pSource[instanceIndex].page, INSTANCE_FLAG_ANIMATED | projectionFlag, 0 );
+            }
+        }
+    }
 
-        // Copy it to the DirectX matrix
-        D3DXMATRIX scalCameraMatrix( renderIter->second.GetSpriteGrp()->GetScaledMatrix()() );
-        scalCameraMatrix._41 = finalPos.x;
-        scalCameraMatrix._42 = finalPos.y;
-        scalCameraMatrix._43 = finalPos.z;
+}	// FillInstances
 
-        // Create the matrix to send to the shader
-        D3DXMATRIX cameraViewProjectionMatrix = sizeMatrix * scalCameraMatrix * 
-                                                CXDevice::Instance().GetProjectionMatrix( renderIter->second.GetSpriteGrp()->GetProjectionType() );
+template <uint ATTRIBUTES>
+void CInstanceMesh2D::FillCompactInstances( const CInstanceSource * pSource, void * pBuffer, size_t begin, size_t end )
+{
+    typedef CCompactLayout2D<ATTRIBUTES> TLayout;
+    typename TLayout::CInstance * pInstance = static_cast<typename TLayout::CInstance *>(pBuffer);
 
-        // Set the instance data
-        pInstance[instanceIndex].SetMatrix( cameraViewProjectionMatrix );
-        pInstance[instanceIndex].SetColor( renderIter->second.GetSpriteGrp()->GetResultColor() );
+    CAffineBatch2D batch;
+    float cameraViewProjectionMatrix[16];
 
-        // Set the current frame
-        renderIter->second.GetSpriteGrp()->SetCurrentFrame( renderIter->second.GetFrameIndex() );
+    for( size_t blockBegin = begin; blockBegin < end; blockBegin += AFFINE_BATCH_SIZE )
+    {
+        const size_t blockCount = std::min( AFFINE_BATCH_SIZE, end - blockBegin );
 
-        // Set the UVs using the mega texture component data
-        pInstance[instanceIndex].SetUVs( pMegaTexture->GetUVs( renderIter->second.GetSpriteGrp()->GetActiveTexture() ) );
+        TransformInstances<TLayout::PERSPECTIVE != 0>( &pSource[blockBegin], blockCount, batch );
 
-        // We reset the required transformations so we're not constantly recalculating matrices
-        renderIter->second.GetSpriteGrp()->ResetTransformParameters();
-        ++instanceIndex;
-        ++renderIter;
+        for( size_t i = 0; i < blockCount; ++i )
+        {
+            const size_t instanceIndex = blockBegin + i;
+
+            batch.GetMatrix( i, cameraViewProjectionMatrix );
+
+            // Set the instance data. An untinted instance has no color to set
+            pInstance[instanceIndex].SetMatrix( cameraViewProjectionMatrix );
+            pInstance[instanceIndex].SetColor( pSource[instanceIndex].color );
+
+            // The shader picks the camera offset of the projection. Without perspective it's always orthographic
+            const uint projectionFlag = (!TLayout::PERSPECTIVE || (pSource[instanceIndex].projType == CSettings::EPT_ORTHOGRAPHIC)) ? INSTANCE_FLAG_ORTHOGRAPHIC : 0;
+
+            // Only a layout with animation has to check for it
+            if( !TLayout::ANIMATION || (pSource[instanceIndex].animation == NO_ANIMATION) )
+            {
+                pInstance[instanceIndex].SetUVs( pSource[instanceIndex].pUV );
+                pInstance[instanceIndex].SetMisc( pSource[instanceIndex].page, projectionFlag, pSource[instanceIndex].hull );
+            }
+            else
+            {
+                pInstance[instanceIndex].SetAnimation( pSource[instanceIndex].animation, pSource[instanceIndex].animationPhase, pSource[instanceIndex].animationRate );
+                pInstance[instanceIndex].SetMisc( pSource[instanceIndex].page, INSTANCE_FLAG_ANIMATED | projectionFlag, 0 );
+            }
+        }
     }
-    
-    spInstanceBuffer->Unlock();
 
-}	// Update
+}	// FillCompactInstances
 
 
 /************************************************************************
-*    desc:  Clear the render multi map
+*    desc:  Clear the sprites added this frame. The sprite group vector
+*           keeps its memory so nothing is allocated next frame. The
+*           render queue belongs to the rendering and is cleared there
 ************************************************************************/
 void CInstanceMesh2D::Clear()
 {
-    pRenderMultiMap.clear();
+    spriteGrpVec.clear();
 
 }	// ClearRenderVector
 
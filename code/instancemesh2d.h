@@ -13,8 +13,7 @@
 
 // Standard lib dependencies
 #include <string>
-#include <map>
-#include <functional>
+#include <vector>
 
 // DirectX lib dependencies
 #include <d3dx9.h>
@@ -22,6 +21,7 @@
 // Boost lib dependencies
 #include <boost/noncopyable.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/unordered_map.hpp>
 
 // Game lib dependencies
 #include <common/defs.h>
@@ -29,18 +29,57 @@
 #include <common/color.h>
 #include <common/point.h>
 #include <common/matrix.h>
+#include <common/size.h>
 #include <common/worldpoint.h>
+#include <misc/settings.h>
+#include <2d/renderqueue2d.h>
+#include <2d/instancepack2d.h>
+#include <2d/instancelayout2d.h>
+#include <2d/instancebuffer2d.h>
+#include <2d/affinebatch2d.h>
+#include <2d/viewfrustum2d.h>
+#include <2d/occlusionbuffer2d.h>
 
 // Forward declaration(s)
 class CMegaTexture;
 class CMegaTextureComponent;
 class CSpriteGroup2D;
 class CActorSprite2D;
+class CGpuTimer2D;
+
+namespace NText
+{
+    class CTextureFor2D;
+}
 
 class CInstanceMesh2D : public boost::noncopyable
 {
+    // The benchmarks drive the phases of the rendering on generated sprites
+    friend class CInstanceMeshBench2D;
+
+    // The unit test renders render packets of generated sprites
+    friend class CInstanceMeshTest2D;
+
 public:
 
+    // The layouts the instance data can be uploaded in
+    enum EInstanceLayout
+    {
+        // Full 4x4 matrix, float color, float UVs and the page. 100 bytes
+        EIL_FULL,
+
+        // 2x2 matrix and translation, packed color, 16 bit UVs and the page. 40 bytes, or 36
+        // without the color. Opt in, only for meshes whose sprites never rotate around x or y.
+        // Gathering a sprite that does throws. See CCompactLayout2D
+        EIL_COMPACT
+    };
+
+    // ID of a sprite the shader doesn't animate
+    static const uint NO_ANIMATION = 0xFFFFFFFF;
+
+    // Most sprites a quad batch can hold
+    static const uint MAX_QUAD_BATCH_COUNT = 256;
+
     // Constructor
     CInstanceMesh2D();
 
@@ -48,18 +87,118 @@ public:
     void InitInstanceSprite( CActorSprite2D * pSprite );
     void InitInstanceSprite( CSpriteGroup2D * pSprite );
 
-    // Add a sprite to the instance mesh
-    void AddSprite( CSpriteGroup2D * pSprite );
+    // Add a sprite to the instance mesh. Opaque sprites are drawn first, front to back with
+    // depth writes and no blending, so the sprites behind them aren't shaded. A sprite flagged
+    // opaque is only drawn that way while it isn't faded and its texture is fully opaque, and
+    // is drawn translucent otherwise. Translucent sprites are drawn after, back to front
+    void AddSprite( CSpriteGroup2D * pSprite, bool opaque = false );
+
+    // Add the frames of a sprite's animation to the frame table of the mesh. The UVs of the
+    // frames are looked up once here and the shader picks the frame. The frames have to be on
+    // one page of the mega texture. Returns the animation ID
+    uint AddAnimation( CSpriteGroup2D * pSprite, uint frameCount );
+
+    // Add a sprite the shader animates. Its frame is never set or looked up on the CPU.
+    // The start time is in the same clock as SetAnimationTime
+    void AddAnimatedSprite( CSpriteGroup2D * pSprite, uint animation, float startTime, float frameRate, bool opaque = false );
+
+    // Set the time the animations are played at, in seconds. Call once per frame
+    void SetAnimationTime( float time );
 
-    // Initialize the mesh
-    void Init( const std::string & megatextureName );
+    // Give a sprite a persistent slot in the instance data. Its instance is only rebuilt
+    // when the sprite is moved, rotated or scaled, or its color, frame or visibility changes.
+    // Adding a sprite that already has a slot marks it dirty
+    void AddPersistentSprite( CSpriteGroup2D * pSprite, bool opaque = false );
 
-    // Reset the instance buffer to the size of the group vector
+    // Free the persistent slot of a sprite
+    void RemovePersistentSprite( CSpriteGroup2D * pSprite );
+
+    // Mark the persistent slot of a sprite to be rebuilt. Only needed for changes the mesh
+    // doesn't look for, like the size of the sprite's visual
+    void MarkPersistentDirty( CSpriteGroup2D * pSprite );
+
+    // Mark every persistent slot to be rebuilt
+    void MarkAllPersistentDirty();
+
+    // Free all of the persistent slots
+    void ClearPersistentSprites();
+
+    // Initialize the mesh. The full layout draws any sprite, so it's the default. The compact one
+    // falls back to it if the hardware can't read it. The attributes are the EInstanceAttribute
+    // flags the sprites of the mesh use. The compact layout leaves the others out of the instance
+    // data and the shader. The first mesh initialized calibrates the quad batch threshold by
+    // drawing on the device, unless the game set it first, so initialize after the shaders load
+    void Init( const std::string & megatextureName, EInstanceLayout layout = EIL_FULL, uint attributes = EIA_ALL );
+
+    // Initialize the mesh with a mega texture that isn't in the mega texture manager, like
+    // one created from textures the caller made
+    void Init( CMegaTexture * pTexture, EInstanceLayout layout = EIL_FULL, uint attributes = EIA_ALL );
+
+    // Make sure the instance buffer can hold the sprites added so far
     void ResetInstanceBuffer();
 
-    // Render the instance mesh
+    // Release the instance buffer. It's recreated on the next render. The buffer releases and
+    // recreates itself when the device is lost and reset, see CGraphicsDevice2D::LostDevice
+    void ReleaseInstanceBuffer();
+
+    // Set the number of mostly empty frames in a row before the instance buffer shrinks
+    void SetInstanceBufferShrinkFrames( uint frameCount );
+
+    // Copy the render state of the sprites added this frame into the render packet.
+    // Call at the end of the simulation. Clears the sprites added this frame
+    void ExtractRenderPacket();
+
+    // Swap the packet the simulation extracts into with the one the rendering draws.
+    // Call once per frame when both are done with their packet
+    void SwapRenderPackets();
+
+    // Double buffer the render packets so the simulation of the next frame can overlap the
+    // rendering. Off by default, then Render extracts the packet itself. Every packet
+    // has to be rendered once, because its persistent uploads only hold what changed
+    void SetRenderPacketMode( bool packetMode );
+
+    // Read the camera right before the draw instead of when the render packet is extracted.
+    // Off by default. The camera isn't part of the instances, so the view follows the newest
+    // camera, but the sprites and the culling stay on the frame they were extracted from
+    void SetCameraLatchMode( bool cameraLatchMode );
+
+    // Draw each instance as the hull around the seen pixels of its texture instead of the
+    // whole quad. On by default. Needs vertex texture fetch of float textures, without it
+    // the quads are drawn. Shader animated instances, merged draws and meshes whose mega
+    // texture has several pages always use the quad
+    void SetHullMode( bool hullMode );
+
+    // Reject the sprites hidden behind the fully opaque middle of opaque sprites. On by
+    // default. Only the perspective sprites are occluded. Faded sprites never occlude.
+    // Persistent opaque sprites occlude but are never occluded themselves
+    void SetOcclusionMode( bool occlusionMode );
+
+    // Set the layer the mesh is merged in. Meshes next to each other in RenderParallel with
+    // the same layer, the same layout and room for their pages are drawn with RenderMerged.
+    // Zero, the default, never merges
+    void SetMergeLayer( uint mergeLayer );
+
+    // Set the most sprites a frame can have to be drawn as a batch of quads built on the CPU
+    // instead of being instanced. Shared by every mesh. Zero always instances, and it's kept
+    // under MAX_QUAD_BATCH_COUNT. Meshes with persistent slots are always instanced. The first
+    // mesh initialized calibrates it on the device, unless it was set before
+    static void SetQuadBatchThreshold( uint spriteCount );
+    static uint GetQuadBatchThreshold()
+    { return quadBatchThreshold; }
+
+    // Render the instance mesh. Only reads the render packet, never the sprites
     void Render();
 
+    // Render several meshes, each with its own draws. The instances and the command list of
+    // each mesh are recorded on the worker threads, then the lists are replayed in order on
+    // this thread, the only one that touches the device. Meshes of the same merge layer next
+    // to each other are drawn merged instead
+    static void RenderParallel( const std::vector<CInstanceMesh2D *> & meshVec );
+
+    // Render several meshes with one sorted draw. The pages of the meshes' mega textures are
+    // the atlas pages, MAX_PAGE_COUNT of them at most
+    static void RenderMerged( const std::vector<CInstanceMesh2D *> & meshVec );
+
     // Clear the render vector
     void Clear();
 
@@ -89,7 +228,7 @@ private:
     {
     public:
 
-        // We fit the matrix data into 12 floats instead of 16
+        // All 16 floats of the matrix are uploaded. See CCompactInstance2D for the smaller layout
         void SetMatrix( const D3DXMATRIX & matrix )
         {
             mat11 = matrix._11; mat12 = matrix._12; mat13 = matrix._13; mat14 = matrix._14;
@@ -117,13 +256,28 @@ private:
         }
         
         // Set the UVs
-        void SetUVs( float uv[4] )
+        void SetUVs( const float uv[4] )
         {
             u1 = uv[0];
             v1 = uv[1];
             u2 = uv[2];
             v2 = uv[3];
         }
+
+        // Set the animation ID, the phase at time zero and the frame rate in place of the UVs
+        void SetAnimation( uint animation, float phase, float rate )
+        {
+            u1 = static_cast<float>(animation);
+            v1 = phase;
+            u2 = rate;
+            v2 = 0;
+        }
+
+        // Set the atlas page, the flags and the hull
+        void SetMisc( uint page, uint flags, uint hull )
+        {
+            misc = page | (flags << 8) | (hull << 16);
+        }
         
         // Instance matrix. I wrote out all floats individually so that I know
         // the exact order they're in
@@ -136,8 +290,11 @@ private:
         float r,g,b,a;
 
         // We only have two Us and two Vs, so currently the 2D instancing doesn't support
-        // UV mapping diagnally
+        // UV mapping diagnally. A shader animated instance has its animation here instead
         float u1,v1,u2,v2;
+
+        // Atlas page in the first byte, flags in the second and the hull in the last two
+        uint misc;
     };
 
     //////////////////////////////////////////////////////////////
@@ -146,8 +303,12 @@ private:
     class SpriteGrp
     {
     public:
-        SpriteGrp( CSpriteGroup2D * pSpriteGroupp, int frmIndex )
-            : pSpriteGrp(pSpriteGroupp), frameIndex(frmIndex)
+        SpriteGrp( CSpriteGroup2D * pSpriteGroupp, int frmIndex, bool opq )
+            : pSpriteGrp(pSpriteGroupp), frameIndex(frmIndex), animation(NO_ANIMATION), animationPhase(0), animationRate(0), opaque(opq)
+        {}
+
+        SpriteGrp( CSpriteGroup2D * pSpriteGroupp, uint anim, float phase, float rate, bool opq )
+            : pSpriteGrp(pSpriteGroupp), frameIndex(0), animation(anim), animationPhase(phase), animationRate(rate), opaque(opq)
         {}
 
         CSpriteGroup2D * GetSpriteGrp()
@@ -156,37 +317,544 @@ private:
         int GetFrameIndex()
         { return frameIndex; }
 
+        uint GetAnimation()
+        { return animation; }
+
+        float GetAnimationPhase()
+        { return animationPhase; }
+
+        float GetAnimationRate()
+        { return animationRate; }
+
+        bool IsOpaque()
+        { return opaque; }
+
     private:
         CSpriteGroup2D * pSpriteGrp;
         int frameIndex;
+
+        // The animation the shader plays instead of the frame
+        uint animation;
+        float animationPhase;
+        float animationRate;
+
+        // Whether the sprite is drawn in the opaque pass
+        bool opaque;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	Data copied out of a sprite to build its instance data
+    //////////////////////////////////////////////////////////////
+    class CInstanceSource
+    {
+    public:
+
+        // Scaled matrix of the sprite with the camera translation
+        D3DXMATRIX scaledMatrix;
+
+        // Size of the sprite's visual
+        CSize<float> size;
+
+        // The projection the sprite is rendered with
+        CSettings::EProjectionType projType;
+
+        // The color of the sprite
+        CColor color;
+
+        // UVs of the sprite's current frame. Points into the mega texture's UV table
+        const float * pUV;
+
+        // The atlas page the UVs are in
+        uint page;
+
+        // Row of the hull texture the instance is drawn with. Row zero is the whole quad
+        uint hull;
+
+        // The animation the shader plays in place of the UVs, its phase at time zero and its frame rate
+        uint animation;
+        float animationPhase;
+        float animationRate;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	Bounding spheres of the sprites of one projection, in
+    //  structure of arrays form so they can be culled with SIMD
+    //////////////////////////////////////////////////////////////
+    class CCullSet
+    {
+    public:
+
+        // Add a bounding sphere
+        void Add( float x, float y, float z, float radius, uint spriteIndex );
+
+        // Cull the spheres against a frustum and mark the sprites that can be seen
+        void Cull( const CViewFrustum2D & frustum, std::vector<char> & spriteVisibleVec, size_t spriteCount );
+
+        // Unmark the visible sprites hidden behind the occluders. Returns how many were hidden
+        size_t Occlude( const COcclusionBuffer2D & buffer, const float * pMatrix, std::vector<char> & spriteVisibleVec );
+
+        // Clear the set
+        void Clear();
+
+    private:
+
+        // Centers and radii of the spheres
+        std::vector<float> xVec, yVec, zVec, radiusVec;
+
+        // The sprite each sphere belongs to and whether it can be seen
+        std::vector<uint> spriteIndexVec;
+        std::vector<uint> visibleVec;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	The passes the instances are drawn in
+    //////////////////////////////////////////////////////////////
+    enum EDepthPass
+    {
+        // Front to back with depth writes and no blending
+        EDP_OPAQUE,
+
+        // Back to front with the depth test only
+        EDP_TRANSLUCENT
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	Render states of the depth passes and the ones they
+    //  replaced so they can be put back
+    //////////////////////////////////////////////////////////////
+    class CDepthStates
+    {
+    public:
+
+        // Save the render states the passes change
+        void Save();
+
+        // Set the render states of a pass
+        void Set( EDepthPass pass );
+
+        // Put the saved render states back
+        void Restore();
+
+    private:
+
+        DWORD zEnable;
+        DWORD zWriteEnable;
+        DWORD alphaTestEnable;
+        DWORD alphaRef;
+        DWORD alphaFunc;
+        DWORD alphaBlendEnable;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	What a persistent slot was last built from. A sprite
+    //  that doesn't match it anymore has its slot rebuilt
+    //////////////////////////////////////////////////////////////
+    class CPersistentState
+    {
+    public:
+
+        CPersistentState()
+            : pTexture(NULL), visible(false)
+        {}
+
+        CColor color;
+        NText::CTextureFor2D * pTexture;
+        bool visible;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	Range of persistent slots to upload
+    //////////////////////////////////////////////////////////////
+    class CSlotRange
+    {
+    public:
+
+        uint begin, end;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	Everything the rendering needs from one simulation frame.
+    //  The simulation fills one while the other is rendered
+    //////////////////////////////////////////////////////////////
+    class CRenderPacket
+    {
+    public:
+
+        CRenderPacket()
+            : persistentCount(0), persistentOpaqueCount(0), persistentDrawCount(0), persistentCapacity(0), submittedCount(0), occludedCount(0), animationTime(0)
+        {}
+
+        // Sources of the visible sprites in the order they were added, their depth keys and
+        // whether they're opaque
+        std::vector<CInstanceSource> sourceVec;
+        std::vector<uint> keyVec;
+        std::vector<char> opaqueVec;
+
+        // Sources of the persistent slots that changed and the ranges of slots they go to
+        std::vector<CInstanceSource> persistentSourceVec;
+        std::vector<CSlotRange> persistentRangeVec;
+
+        // Number of persistent slots, how many of them come first for the opaque sprites, how many
+        // of them aren't empty and how many the buffer has to hold
+        size_t persistentCount;
+        size_t persistentOpaqueCount;
+        size_t persistentDrawCount;
+        size_t persistentCapacity;
+
+        // Depth keys of the translucent persistent slots. The translucent pass merges them
+        // with the sprites back to front
+        std::vector<uint> persistentKeyVec;
+
+        // Number of sprites added before the culling and how many of them were occluded
+        size_t submittedCount;
+        size_t occludedCount;
+
+        // The time the animations are played at
+        float animationTime;
+
+        // Position of the camera when the packet was extracted. The shader adds it to every instance
+        CPoint cameraPos;
+    };
+
+    //////////////////////////////////////////////////////////////
+    //	What the device thread does to draw a recorded render,
+    //  in order
+    //////////////////////////////////////////////////////////////
+    enum ECommandType
+    {
+        // Copy the staged instances into the device buffers. The argument of the instance
+        // upload is whether they're expanded for a quad batch
+        ECT_UPLOAD_PERSISTENT,
+        ECT_UPLOAD_INSTANCES,
+
+        // Set the declaration, streams, technique and textures of the mesh. The argument is
+        // whether the instances are drawn as a quad batch
+        ECT_BIND,
+
+        // Save, set and restore the render states of the depth passes. The argument is the pass
+        ECT_SAVE_DEPTH_STATES,
+        ECT_SET_DEPTH_PASS,
+        ECT_RESTORE_DEPTH_STATES,
+
+        // Every effect pass replays the commands up to the end command. The argument is the
+        // index of the end command
+        ECT_BEGIN_EFFECT,
+        ECT_END_EFFECT,
+
+        // Draw a range of instances. The arguments are the first instance and the count
+        ECT_DRAW_PERSISTENT,
+        ECT_DRAW_INSTANCES,
+
+        // Draw a range of instances as a quad batch. The arguments are the first instance and the count
+        ECT_DRAW_QUAD_BATCH,
+
+        // Reset the stream frequencies
+        ECT_RESET_STREAMS,
+    };
+
+    class CCommand
+    {
+    public:
+
+        ECommandType type;
+        size_t arg[2];
     };
     
 
 private:
 
-    // Update the mesh information
-    void Update();
+    // Get the render packet to draw. Extracts it first when the packets aren't double buffered
+    const CRenderPacket & GetRenderPacket();
+
+    // Build the instances of the recorded packet into memory and record the commands that
+    // draw them. Never touches the device
+    void RecordCommands();
+
+    // Record the command lists of a range of meshes
+    static void RecordMeshes( const std::vector<CInstanceMesh2D *> & meshVec, size_t begin, size_t end );
+
+    // Get the end of the meshes merged with the one at begin. One past begin if it isn't merged
+    static size_t GetMergeGroupEnd( const std::vector<CInstanceMesh2D *> & meshVec, size_t begin );
+
+    // Draw a range of a merged mesh's persistent slots, or of the merged sprites, with their own
+    // technique and pages. Nothing is drawn for an empty range
+    void DrawMergedPersistent( CInstanceMesh2D * pMesh, size_t begin, size_t end );
+    void DrawMergedInstances( const std::vector<CInstanceMesh2D *> & meshVec, const uint * pPageBase, size_t begin, size_t end );
+
+    // Draw the translucent pass of the merged meshes. The persistent slots of each mesh and the
+    // sprites are merged back to front
+    void DrawMergedTranslucent( const std::vector<CInstanceMesh2D *> & meshVec, const CRenderPacket * const * ppPacket,
+                                const uint * pPageBase, const size_t * pPersistentBegin, const size_t * pPersistentEnd,
+                                size_t instanceBegin, size_t instanceEnd );
+
+    // Upload and draw what was recorded. Call on the device thread
+    void ReplayCommands();
+    void ReplayCommands( size_t begin, size_t end );
+
+    // Add a command to the command list
+    void AddCommand( ECommandType type, size_t arg0 = 0, size_t arg1 = 0 );
+
+    // Add the draws of the translucent pass. The persistent slots and the sprites are merged back to front
+    void AddTranslucentDraws( const CRenderPacket & packet, size_t persistentBegin, size_t persistentEnd,
+                              size_t instanceBegin, size_t instanceEnd, bool quadBatch );
+
+    // Cull the sprites added this frame and mark the visible ones. Returns how many
+    // were hidden behind opaque sprites
+    size_t CullSprites();
+
+    // Can a sprite flagged opaque be drawn in the opaque pass
+    bool IsDrawnOpaque( CSpriteGroup2D * pSprite, uint animation ) const;
+
+    // Add the fully opaque middle of a sprite that isn't faded to the occlusion buffer
+    void AddOccluder( CSpriteGroup2D * pSprite, const CPoint & cameraPos, const float * pMatrix );
+
+    // Add the visible sprites of a render packet to the render queue
+    void QueuePacket( const CRenderPacket & packet, uint indexTag );
+
+    // Sort the render queue and put the sources of its instances in drawing order
+    void SortQueuedInstances( const CRenderPacket * const * ppPacket, const uint * pAnimationBase, const uint * pPageBase );
+
+    // Sort the render queue and upload its instances
+    void UploadQueuedInstances( const CRenderPacket * const * ppPacket, const uint * pAnimationBase, const uint * pPageBase );
+
+    // Copy the staged instances into the instance buffer. Expanded, each instance is copied
+    // once for every corner of its quad
+    void UploadStagedInstances( bool expand );
+
+    // Give the animation tables of this mesh to the shader, unless they're already there
+    void SetAnimationTables( float time );
+
+    // Copy the data needed to build an instance out of a sprite. The transform doesn't copy the UVs
+    void GatherInstanceSource( CSpriteGroup2D * pSprite, CInstanceSource & source );
+    void GatherInstanceTransform( CSpriteGroup2D * pSprite, CInstanceSource & source );
+
+    // Get the clip space matrix of an instance
+    void GetInstanceMatrix( const CInstanceSource & source, D3DXMATRIX & matrix ) const;
+
+    // Compose the clip space matrices of a block of instances. Without perspective every
+    // instance uses the orthographic projection
+    template <bool PERSPECTIVE>
+    void TransformInstances( const CInstanceSource * pSource, size_t count, CAffineBatch2D & batch ) const;
+
+    // Build the instance data of an array of instance sources on the worker threads
+    void BuildInstances( const CInstanceSource * pSource, size_t count, void * pInstance );
+
+    // Build the instance data of a range of instances
+    void FillInstances( const CInstanceSource * pSource, CInstanceData * pInstance, size_t begin, size_t end );
+    template <uint ATTRIBUTES>
+    void FillCompactInstances( const CInstanceSource * pSource, void * pInstance, size_t begin, size_t end );
+
+    // Copy the persistent slots that changed since the last extraction into the render packet
+    void PreparePersistent( CRenderPacket & packet );
+
+    // Mark the persistent slots whose sprites changed since their slots were built
+    void FindChangedPersistent();
+
+    // Sort the persistent sprites back to front and give them new slots
+    void SortPersistentSlots();
+
+    // Copy a range of persistent slots into the render packet
+    void GatherPersistentRange( CRenderPacket & packet, size_t begin, size_t end );
+
+    // Upload the persistent ranges of a render packet
+    void UploadPersistent( const CRenderPacket & packet );
+
+    // Build the persistent ranges of a render packet into memory and copy them into the buffer
+    void StagePersistent( const CRenderPacket & packet );
+    void UploadStagedPersistent( const CRenderPacket & packet );
+
+    // Set up the instance stream and draw the instances as hulls or quads
+    void DrawInstances( IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT count, bool hull );
+
+    // Draw expanded instances as a batch of quads
+    void DrawQuadBatch( UINT offset, UINT count );
+
+    // Create the corners and indexes of the quad batch
+    void CreateQuadBatchBuffers();
+
+    // Create the hull texture from the hulls of the mega texture
+    void CreateHullTexture();
+
+    // Time the quad batch against instancing on the device and make the most sprites the
+    // quad batch draws faster the threshold
+    void CalibrateQuadBatchThreshold();
+
+    // Time recording and replaying the recorded packet with a quad batch threshold, per render
+    void TimeQuadBatchRender( uint threshold, CGpuTimer2D & timer, double & cpuTime, double & gpuTime );
+
+    // Whether the instances of this mesh are drawn as hulls
+    bool IsHullActive() const
+    { return hullMode && (spHullTexture != NULL); }
+
+    // Get the technique the instances of this mesh are drawn with, not merged
+    const char * GetInstanceTechnique( bool hull ) const;
+
+    // Give the hull texture of this mesh to the shader
+    void SetHullTexture();
+
+    // Give the pages of the mega texture to the shader, starting at the shader page given
+    void SetPageTextures( uint firstPage ) const;
+
+    // Get the camera position a packet is drawn with
+    CPoint GetDrawCameraPos( const CRenderPacket & packet ) const;
+
+    // Give the camera to the shader as an offset in clip space for each projection
+    static void SetCameraOffsets( const CPoint & cameraPos );
+
+    // Get the range of instances drawn in a pass. The opaque instances come first
+    static void GetPassRange( EDepthPass pass, size_t opaqueCount, size_t count, size_t & begin, size_t & end );
 
     // Display error information
     void DisplayError( HRESULT hr );
 
 private:
 
-    // MultiMap of sprite groups. These objects own none of these sprites
-    std::multimap<CWorldValue, SpriteGrp, std::greater<CWorldValue>> pRenderMultiMap;
-    std::multimap<CWorldValue, SpriteGrp, std::greater<CWorldValue>>::iterator renderIter;
+    // Vector of sprite groups in the order they were added. These are the culling candidates.
+    // These objects own none of these sprites
+    std::vector<SpriteGrp> spriteGrpVec;
+
+    // Queues that sort the visible translucent sprite groups back to front and the opaque
+    // ones front to back
+    CRenderQueue2D renderQueue;
+    CRenderQueue2D opaqueQueue;
+
+    // The views the sprites are culled against and their bounding spheres
+    CViewFrustum2D perspectiveFrustum;
+    CViewFrustum2D orthographicFrustum;
+    CCullSet perspectiveCullSet;
+    CCullSet orthographicCullSet;
+
+    // Whether each sprite group survived the culling
+    std::vector<char> spriteVisibleVec;
+
+    // Depth of the opaque sprites on the screen and whether the sprites behind them are rejected
+    COcclusionBuffer2D occlusionBuffer;
+    bool occlusionMode;
+
+    // Instance sources in back to front order. Kept between frames to reuse the memory
+    std::vector<CInstanceSource> instanceSourceVec;
 
     // Vertex buffer
     CComPtr<IDirect3DVertexBuffer9> spVertexBuffer;
     CComPtr<IDirect3DIndexBuffer9> spIndexBuffer;
     CComPtr<IDirect3DVertexDeclaration9> spVertexDeclaration;
-    CComPtr<IDirect3DVertexBuffer9> spInstanceBuffer;
+
+    // The quad repeated MAX_QUAD_BATCH_COUNT times and its indexes, for the quad batches
+    CComPtr<IDirect3DVertexBuffer9> spQuadVertexBuffer;
+    CComPtr<IDirect3DIndexBuffer9> spQuadIndexBuffer;
+
+    // Ring buffer the instance data is appended to every frame
+    CInstanceBuffer2D instanceBuffer;
+
+    // Where this frame's instances start in the instance buffer
+    UINT instanceOffset;
+
+    // Sprites with a persistent slot in back to front order. A removed sprite
+    // leaves an empty slot until the slots are sorted again
+    std::vector<CSpriteGroup2D *> persistentSpriteVec;
+
+    // Depth key of each persistent slot when the slots were sorted and whether its sprite is opaque
+    std::vector<uint> persistentKeyVec;
+    std::vector<char> persistentOpaqueVec;
+
+    // The opaque sprites have the slots before this one, front to back
+    size_t persistentOpaqueCount;
+
+    // The slot of each persistent sprite
+    boost::unordered_map<CSpriteGroup2D *, uint> persistentSlotMap;
+
+    // What each persistent slot was last built from
+    std::vector<CPersistentState> persistentStateVec;
+
+    // Flag and list of the persistent slots waiting to be uploaded
+    std::vector<char> persistentDirtyVec;
+    std::vector<uint> dirtySlotVec;
+
+    // Queue used to sort the persistent sprites
+    CRenderQueue2D persistentQueue;
+
+    // Managed instance buffer holding the persistent slots. Only the dirty ranges are locked,
+    // so only those are sent to the card
+    CComPtr<IDirect3DVertexBuffer9> spPersistentBuffer;
+    size_t persistentCapacity;
+
+    // The number of persistent slots the simulation has asked the buffer to hold
+    size_t persistentReservedCount;
+
+    // Number of persistent slots left empty by removed sprites
+    size_t emptySlotCount;
+
+    // Whether the persistent slots need to be sorted again or all uploaded
+    bool persistentSortDirty;
+    bool persistentAllDirty;
+
+    // The packet the command list was recorded from
+    const CRenderPacket * pRecordedPacket;
+
+    // Commands that draw the recorded packet and the instances built for them. Kept between
+    // frames to reuse the memory
+    std::vector<CCommand> commandVec;
+    std::vector<char> instanceStageVec;
+    std::vector<char> persistentStageVec;
+
+    // Render states the recorded depth passes put back
+    CDepthStates depthStates;
+
+    // The packets the simulation extracts into and the rendering draws, and the one being extracted into
+    CRenderPacket renderPacket[2];
+    uint writePacketIndex;
+
+    // Whether the render packets are double buffered
+    bool renderPacketMode;
+
+    // Whether the camera is read right before the draw
+    bool cameraLatchMode;
+
+    // UVs of every animation frame and the first frame and frame count of each animation.
+    // Four floats each, laid out like the shader constants
+    std::vector<float> animationFrameVec;
+    std::vector<float> animationInfoVec;
+
+    // The mega texture page the frames of each animation are on
+    std::vector<uint> animationPageVec;
+
+    // Whether every frame of each animation is fully opaque
+    std::vector<char> animationOpaqueVec;
+
+    // The time the animations are played at
+    float animationTime;
+
+    // Whether the animation tables changed since they were given to the shader
+    bool animationTableDirty;
+
+    // The projections, copied once per build so the worker threads don't fetch them per sprite
+    D3DXMATRIX perspectiveMatrix;
+    D3DXMATRIX orthographicMatrix;
 
     // Texture information that the instance mesh is using
     CMegaTexture * pMegaTexture;
 
-    // The total number of instances the instance buffer can hold
-    size_t instanceCount;
+    // The hull of every mega texture component, a row each after the whole quad in row zero
+    CComPtr<IDirect3DTexture9> spHullTexture;
+
+    // Whether the instances are drawn as hulls when the hull texture could be made
+    bool hullMode;
+
+    // The layout of the instance data
+    EInstanceLayout instanceLayout;
+
+    // The EInstanceAttribute flags the sprites use
+    uint instanceAttributes;
+
+    // The layer the mesh is merged in. Zero never merges
+    uint mergeLayer;
+
+    // The fill of each compact layout, indexed by its attributes
+    typedef void (CInstanceMesh2D::*TCompactFill)( const CInstanceSource *, void *, size_t, size_t );
+    static const TCompactFill COMPACT_FILL[EIA_ALL + 1];
+
+    // Most sprites a frame can have to be drawn as a quad batch
+    static uint quadBatchThreshold;
 
     // Constants
     const int VERTEX_COUNT;
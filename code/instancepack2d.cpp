@@ -0,0 +1,398 @@
+/************************************************************************
+*    FILE NAME:       instancepack2d.cpp
+*
+*    DESCRIPTION:     Compact 40 and 36 byte instance data for 2D
+*                     sprites and the functions used to pack and unpack it.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/instancepack2d.h>
+
+// Standard lib dependencies
+#include <cstring>
+
+// Boost lib dependencies
+#include <boost/static_assert.hpp>
+
+// The vertex declarations expect the compact instances to be exactly this big
+BOOST_STATIC_ASSERT( sizeof(CCompactInstance2D) == 40 );
+BOOST_STATIC_ASSERT( sizeof(CUntintedInstance2D) == 36 );
+
+namespace NInstancePack2D
+{
+    /************************************************************************
+    *    desc:  Convert a 32 bit float to a 16 bit half float. Rounds to the
+    *           nearest even value like the hardware does
+    *
+    *	 param:	float value - value to convert
+    *
+    *	 ret:	unsigned short - half float
+    ************************************************************************/
+    unsigned short FloatToHalf( float value )
+    {
+        uint bits;
+        std::memcpy( &bits, &value, sizeof(bits) );
+
+        uint sign = (bits >> 16) & 0x8000;
+        uint floatExponent = (bits >> 23) & 0xFF;
+        uint mantissa = bits & 0x7FFFFF;
+        int exponent = static_cast<int>(floatExponent) - 127 + 15;
+
+        // Infinity and NaN
+        if( floatExponent == 0xFF )
+            return static_cast<unsigned short>( sign | 0x7C00 | (mantissa ? 0x200 : 0) );
+
+        // Too big for a half float
+        if( exponent >= 31 )
+            return static_cast<unsigned short>( sign | 0x7C00 );
+
+        // Too small for a normalized half float
+        if( exponent <= 0 )
+        {
+            if( exponent < -10 )
+                return static_cast<unsigned short>( sign );
+
+            // Add the implicit bit and shift the mantissa into place
+            mantissa |= 0x800000;
+            uint shift = static_cast<uint>(14 - exponent);
+            uint half = mantissa >> shift;
+            uint remainder = mantissa & ((1 << shift) - 1);
+            uint halfway = 1 << (shift - 1);
+
+            if( (remainder > halfway) || ((remainder == halfway) && (half & 1)) )
+                ++half;
+
+            return static_cast<unsigned short>( sign | half );
+        }
+
+        uint half = (static_cast<uint>(exponent) << 10) | (mantissa >> 13);
+        uint remainder = mantissa & 0x1FFF;
+
+        // Rounding up can carry into the exponent, which is what we want
+        if( (remainder > 0x1000) || ((remainder == 0x1000) && (half & 1)) )
+            ++half;
+
+        return static_cast<unsigned short>( sign | half );
+
+    }	// FloatToHalf
+
+
+    /************************************************************************
+    *    desc:  Convert a 16 bit half float to a 32 bit float
+    *
+    *	 param:	unsigned short value - half float to convert
+    *
+    *	 ret:	float - converted value
+    ************************************************************************/
+    float HalfToFloat( unsigned short value )
+    {
+        uint sign = static_cast<uint>(value & 0x8000) << 16;
+        int exponent = (value >> 10) & 0x1F;
+        uint mantissa = value & 0x3FF;
+        uint bits;
+
+        if( exponent == 0 )
+        {
+            if( mantissa == 0 )
+            {
+                bits = sign;
+            }
+            else
+            {
+                // Normalize the denormalized half float
+                exponent = 1;
+                while( (mantissa & 0x400) == 0 )
+                {
+                    mantissa <<= 1;
+                    --exponent;
+                }
+
+                mantissa &= 0x3FF;
+                bits = sign | (static_cast<uint>(exponent + 127 - 15) << 23) | (mantissa << 13);
+            }
+        }
+        else if( exponent == 31 )
+        {
+            bits = sign | 0x7F800000 | (mantissa << 13);
+        }
+        else
+        {
+            bits = sign | (static_cast<uint>(exponent + 127 - 15) << 23) | (mantissa << 13);
+        }
+
+        float result;
+        std::memcpy( &result, &bits, sizeof(result) );
+
+        return result;
+
+    }	// HalfToFloat
+
+
+    /************************************************************************
+    *    desc:  Convert a float in the 0 to 1 range to a 16 bit normalized
+    *           value. Values outside of the range are clamped
+    *
+    *	 param:	float value - value to convert
+    *
+    *	 ret:	unsigned short - normalized value
+    ************************************************************************/
+    unsigned short FloatToUNorm16( float value )
+    {
+        if( !(value > 0.f) )
+            return 0;
+
+        if( value >= 1.f )
+            return 0xFFFF;
+
+        return static_cast<unsigned short>( value * 65535.f + 0.5f );
+
+    }	// FloatToUNorm16
+
+
+    /************************************************************************
+    *    desc:  Convert a 16 bit normalized value to a float
+    *
+    *	 param:	unsigned short value - value to convert
+    *
+    *	 ret:	float - value in the 0 to 1 range
+    ************************************************************************/
+    float UNorm16ToFloat( unsigned short value )
+    {
+        return static_cast<float>(value) / 65535.f;
+
+    }	// UNorm16ToFloat
+
+
+    /************************************************************************
+    *    desc:  Convert a color channel to a byte
+    ************************************************************************/
+    uint ChannelToByte( float value )
+    {
+        if( !(value > 0.f) )
+            return 0;
+
+        if( value >= 1.f )
+            return 0xFF;
+
+        return static_cast<uint>( value * 255.f + 0.5f );
+
+    }	// ChannelToByte
+
+
+    /************************************************************************
+    *    desc:  Convert a color to the 32 bit ARGB value that
+    *           D3DDECLTYPE_D3DCOLOR expects
+    *
+    *	 param:	const CColor & color - color to convert
+    *
+    *	 ret:	uint - packed color
+    ************************************************************************/
+    uint PackColor( const CColor & color )
+    {
+        return (ChannelToByte( color.a ) << 24) |
+               (ChannelToByte( color.r ) << 16) |
+               (ChannelToByte( color.g ) << 8) |
+                ChannelToByte( color.b );
+
+    }	// PackColor
+
+
+    /************************************************************************
+    *    desc:  Convert a 32 bit ARGB value to a color
+    *
+    *	 param:	uint color - packed color
+    *
+    *	 ret:	CColor - unpacked color
+    ************************************************************************/
+    CColor UnpackColor( uint color )
+    {
+        CColor result;
+        result.a = static_cast<float>((color >> 24) & 0xFF) / 255.f;
+        result.r = static_cast<float>((color >> 16) & 0xFF) / 255.f;
+        result.g = static_cast<float>((color >> 8) & 0xFF) / 255.f;
+        result.b = static_cast<float>(color & 0xFF) / 255.f;
+
+        return result;
+
+    }	// UnpackColor
+
+
+    /************************************************************************
+    *    desc:  Pack a clip space matrix. The quad's vertices have a z of 0
+    *           and the matrix only rotates around z, so the 2x2 matrix and
+    *           the translation row are all of it that moves a vertex. w is
+    *           left in, so the camera offset can be added before the divide
+    *
+    *	 param:	const float * pMatrix  - 16 floats of a row major matrix
+    *			unsigned short * pAxis - 4 half floats of the 2x2 matrix
+    *			float * pPos           - 4 floats of the translation
+    ************************************************************************/
+    void PackMatrix( const float * pMatrix, unsigned short * pAxis, float * pPos )
+    {
+        pAxis[0] = FloatToHalf( pMatrix[0] );
+        pAxis[1] = FloatToHalf( pMatrix[1] );
+        pAxis[2] = FloatToHalf( pMatrix[4] );
+        pAxis[3] = FloatToHalf( pMatrix[5] );
+
+        pPos[0] = pMatrix[12];
+        pPos[1] = pMatrix[13];
+        pPos[2] = pMatrix[14];
+        pPos[3] = pMatrix[15];
+
+    }	// PackMatrix
+
+
+    /************************************************************************
+    *    desc:  Is the matrix one PackMatrix keeps all of. A sprite rotated
+    *           around x or y gives its x and y axes a z and w, and each
+    *           vertex of the quad a depth of its own, which the packed
+    *           matrix has no room for
+    *
+    *	 param:	const float * pMatrix - 16 floats of a row major matrix
+    *
+    *	 ret:	bool - true if the matrix only rotates around z
+    ************************************************************************/
+    bool IsPackable( const float * pMatrix )
+    {
+        return (pMatrix[2] == 0.f) && (pMatrix[3] == 0.f) &&
+               (pMatrix[6] == 0.f) && (pMatrix[7] == 0.f);
+
+    }	// IsPackable
+
+
+    /************************************************************************
+    *    desc:  Pack the UVs as 16 bit normalized values
+    *
+    *	 param:	const float * pUV        - u1, v1, u2, v2
+    *			unsigned short * pPacked - 4 packed values
+    ************************************************************************/
+    void PackUVs( const float * pUV, unsigned short * pPacked )
+    {
+        for( int i = 0; i < 4; ++i )
+            pPacked[i] = FloatToUNorm16( pUV[i] );
+
+    }	// PackUVs
+
+
+    /************************************************************************
+    *    desc:  Pack the animation of a shader animated instance where the
+    *           UVs go. The ID is stored as is and the shader scales it back
+    *           up, the rate is stored as a fraction of the fastest rate
+    *
+    *	 param:	uint animation           - animation ID
+    *			float phase              - where in the loop the animation is at time zero
+    *			float rate               - frames per second
+    *			unsigned short * pPacked - 4 packed values
+    ************************************************************************/
+    void PackAnimation( uint animation, float phase, float rate, unsigned short * pPacked )
+    {
+        pPacked[0] = static_cast<unsigned short>(animation);
+        pPacked[1] = FloatToUNorm16( phase );
+        pPacked[2] = FloatToUNorm16( rate / MAX_ANIMATION_RATE );
+        pPacked[3] = 0;
+
+    }	// PackAnimation
+
+}	// NInstancePack2D
+
+
+/************************************************************************
+*    desc:  Pack a clip space matrix. See NInstancePack2D::PackMatrix
+*
+*	 param:	const float * pMatrix - 16 floats of a row major matrix
+************************************************************************/
+void CCompactInstance2D::SetMatrix( const float * pMatrix )
+{
+    NInstancePack2D::PackMatrix( pMatrix, axis, pos );
+
+}	// SetMatrix
+
+
+/************************************************************************
+*    desc:  Unpack the matrix. Only the parts that move a vertex of the
+*           quad are kept
+*
+*	 param:	float * pMatrix - 16 floats to write the row major matrix to
+************************************************************************/
+void CCompactInstance2D::GetMatrix( float * pMatrix ) const
+{
+    for( int i = 0; i < 16; ++i )
+        pMatrix[i] = 0.f;
+
+    pMatrix[0] = NInstancePack2D::HalfToFloat( axis[0] );
+    pMatrix[1] = NInstancePack2D::HalfToFloat( axis[1] );
+    pMatrix[4] = NInstancePack2D::HalfToFloat( axis[2] );
+    pMatrix[5] = NInstancePack2D::HalfToFloat( axis[3] );
+    pMatrix[10] = 1.f;
+    pMatrix[12] = pos[0];
+    pMatrix[13] = pos[1];
+    pMatrix[14] = pos[2];
+    pMatrix[15] = pos[3];
+
+}	// GetMatrix
+
+
+/************************************************************************
+*    desc:  Set-Get the color
+************************************************************************/
+void CCompactInstance2D::SetColor( const CColor & _color )
+{
+    color = NInstancePack2D::PackColor( _color );
+
+}	// SetColor
+
+CColor CCompactInstance2D::GetColor() const
+{
+    return NInstancePack2D::UnpackColor( color );
+
+}	// GetColor
+
+
+/************************************************************************
+*    desc:  Set-Get the UVs
+*
+*	 param:	float * pUV - u1, v1, u2, v2
+************************************************************************/
+void CCompactInstance2D::SetUVs( const float * pUV )
+{
+    NInstancePack2D::PackUVs( pUV, uv );
+
+}	// SetUVs
+
+void CCompactInstance2D::GetUVs( float * pUV ) const
+{
+    for( int i = 0; i < 4; ++i )
+        pUV[i] = NInstancePack2D::UNorm16ToFloat( uv[i] );
+
+}	// GetUVs
+
+
+/************************************************************************
+*    desc:  Set the animation of a shader animated instance. See
+*           NInstancePack2D::PackAnimation
+*
+*	 param:	uint animation - animation ID
+*			float phase    - where in the loop the animation is at time zero
+*			float rate     - frames per second
+************************************************************************/
+void CCompactInstance2D::SetAnimation( uint animation, float phase, float rate )
+{
+    NInstancePack2D::PackAnimation( animation, phase, rate, uv );
+
+}	// SetAnimation
+
+
+/************************************************************************
+*    desc:  Round a frame rate to one the compact layout can store
+*           exactly. The phase has to be worked out with the rounded
+*           rate or the animation drifts from where it should be
+*
+*	 param:	float rate - frames per second
+*
+*	 ret:	float - rounded frames per second
+************************************************************************/
+float CCompactInstance2D::QuantizeAnimationRate( float rate )
+{
+    return NInstancePack2D::UNorm16ToFloat( NInstancePack2D::FloatToUNorm16( rate / MAX_ANIMATION_RATE ) ) * MAX_ANIMATION_RATE;
+
+}	// QuantizeAnimationRate
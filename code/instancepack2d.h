@@ -0,0 +1,136 @@
+/************************************************************************
+*    FILE NAME:       instancepack2d.h
+*
+*    DESCRIPTION:     Compact 40 and 36 byte instance data for 2D
+*                     sprites and the functions used to pack and unpack it.
+************************************************************************/
+
+#ifndef __instance_pack_2d_h__
+#define __instance_pack_2d_h__
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <common/color.h>
+
+// The fastest frame rate a shader animated instance can have. The compact layout
+// stores the rate as a fraction of it. The shader has the same value
+const float MAX_ANIMATION_RATE = 120.f;
+
+namespace NInstancePack2D
+{
+    // Convert between 32 bit floats and 16 bit half floats
+    unsigned short FloatToHalf( float value );
+    float HalfToFloat( unsigned short value );
+
+    // Convert between floats in the 0 to 1 range and 16 bit normalized values
+    unsigned short FloatToUNorm16( float value );
+    float UNorm16ToFloat( unsigned short value );
+
+    // Convert between a color and the 32 bit ARGB value D3DDECLTYPE_D3DCOLOR expects
+    uint PackColor( const CColor & color );
+    CColor UnpackColor( uint color );
+
+    // Pack a clip space matrix into a 2x2 matrix of half floats and a clip space translation
+    void PackMatrix( const float * pMatrix, unsigned short * pAxis, float * pPos );
+
+    // Is the matrix one PackMatrix keeps all of. False if it rotates the quad out of the xy plane
+    bool IsPackable( const float * pMatrix );
+
+    // Pack the UVs, or the animation that takes their place, as 16 bit normalized values
+    void PackUVs( const float * pUV, unsigned short * pPacked );
+    void PackAnimation( uint animation, float phase, float rate, unsigned short * pPacked );
+}
+
+//////////////////////////////////////////////////////////////
+//	Compact instance data. A 2D sprite is a flat quad that
+//  only rotates around z, so every vertex of it has the same
+//  clip space z and w. A 2x2 matrix and a translation are
+//  all the shader needs to rebuild the transform.
+//////////////////////////////////////////////////////////////
+class CCompactInstance2D
+{
+public:
+
+    // Pack a clip space matrix. The matrix is row major and is only allowed to rotate around z
+    void SetMatrix( const float * pMatrix );
+
+    // Unpack the matrix
+    void GetMatrix( float * pMatrix ) const;
+
+    // Set-Get the color
+    void SetColor( const CColor & color );
+    CColor GetColor() const;
+
+    // Set-Get the UVs
+    void SetUVs( const float * pUV );
+    void GetUVs( float * pUV ) const;
+
+    // Set the animation ID, the phase at time zero and the frame rate in place of the UVs.
+    // The rate has to be one QuantizeAnimationRate returned
+    void SetAnimation( uint animation, float phase, float rate );
+
+    // Round a frame rate to one the compact layout can store exactly
+    static float QuantizeAnimationRate( float rate );
+
+    // Set the atlas page, the flags and the hull
+    void SetMisc( uint page, uint flags, uint hull )
+    { misc = page | (flags << 8) | (hull << 16); }
+
+    // The 2x2 rotation and scale matrix as half floats. Rows one and two of the matrix
+    unsigned short axis[4];
+
+    // Translation in clip space, without the camera. The shader adds it
+    float pos[4];
+
+    // Color modifier in ARGB order
+    uint color;
+
+    // Two Us and two Vs as 16 bit normalized values. Or the animation ID, phase and frame rate
+    unsigned short uv[4];
+
+    // Atlas page in the first byte, flags in the second and the hull in the last two
+    uint misc;
+};
+
+//////////////////////////////////////////////////////////////
+//	Compact instance data without the color, for meshes
+//  whose sprites are never tinted. The shader uses white.
+//////////////////////////////////////////////////////////////
+class CUntintedInstance2D
+{
+public:
+
+    // Pack a clip space matrix. The matrix is row major and is only allowed to rotate around z
+    void SetMatrix( const float * pMatrix )
+    { NInstancePack2D::PackMatrix( pMatrix, axis, pos ); }
+
+    // There's no color to set
+    void SetColor( const CColor & )
+    {}
+
+    // Set the UVs
+    void SetUVs( const float * pUV )
+    { NInstancePack2D::PackUVs( pUV, uv ); }
+
+    // Set the animation ID, the phase at time zero and the frame rate in place of the UVs
+    void SetAnimation( uint animation, float phase, float rate )
+    { NInstancePack2D::PackAnimation( animation, phase, rate, uv ); }
+
+    // Set the atlas page, the flags and the hull
+    void SetMisc( uint page, uint flags, uint hull )
+    { misc = page | (flags << 8) | (hull << 16); }
+
+    // The 2x2 rotation and scale matrix as half floats
+    unsigned short axis[4];
+
+    // Translation in clip space, without the camera. The shader adds it
+    float pos[4];
+
+    // Two Us and two Vs as 16 bit normalized values. Or the animation ID, phase and frame rate
+    unsigned short uv[4];
+
+    // Atlas page in the first byte, flags in the second and the hull in the last two
+    uint misc;
+};
+
+#endif  // __instance_pack_2d_h__
@@ -0,0 +1,33 @@
+/************************************************************************
+*    FILE NAME:       instancestats2d.cpp
+*
+*    DESCRIPTION:     Counters of the 2D instance rendering, kept next to
+*                     the game's stat counter. Read them and reset them
+*                     once per frame.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/instancestats2d.h>
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CInstanceStats2D::CInstanceStats2D()
+{
+    ResetCounters();
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Reset the counters
+************************************************************************/
+void CInstanceStats2D::ResetCounters()
+{
+    reallocCount = 0;
+    stallLockCount = 0;
+    submittedCount = 0;
+    culledCount = 0;
+    occludedCount = 0;
+
+}	// ResetCounters
@@ -0,0 +1,84 @@
+/************************************************************************
+*    FILE NAME:       instancestats2d.h
+*
+*    DESCRIPTION:     Counters of the 2D instance rendering, kept next to
+*                     the game's stat counter. Read them and reset them
+*                     once per frame.
+************************************************************************/
+
+#ifndef __instance_stats_2d_h__
+#define __instance_stats_2d_h__
+
+// Standard lib dependencies
+#include <cstddef>
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+
+class CInstanceStats2D : public boost::noncopyable
+{
+public:
+
+    // Get the instance of the singleton class
+    static CInstanceStats2D & Instance()
+    {
+        static CInstanceStats2D instanceStats;
+        return instanceStats;
+    }
+
+    // Count an instance buffer that was created or recreated
+    void IncInstanceReallocCounter()
+    { ++reallocCount; }
+
+    // Count a discard lock of an instance buffer that wrapped around. It can wait on the GPU
+    void IncInstanceStallLockCounter()
+    { ++stallLockCount; }
+
+    // Count the sprites handed to the instance meshes, the ones the view frustum culled
+    // and the ones hidden behind opaque sprites
+    void IncInstanceSubmittedCounter( size_t count )
+    { submittedCount += count; }
+
+    void IncInstanceCulledCounter( size_t count )
+    { culledCount += count; }
+
+    void IncInstanceOccludedCounter( size_t count )
+    { occludedCount += count; }
+
+    // Get the counts since the counters were reset
+    size_t GetReallocCount() const
+    { return reallocCount; }
+
+    size_t GetStallLockCount() const
+    { return stallLockCount; }
+
+    size_t GetSubmittedCount() const
+    { return submittedCount; }
+
+    size_t GetCulledCount() const
+    { return culledCount; }
+
+    size_t GetOccludedCount() const
+    { return occludedCount; }
+
+    // Reset the counters. Call once per frame
+    void ResetCounters();
+
+private:
+
+    // Constructor
+    CInstanceStats2D();
+
+private:
+
+    // Instance buffers created and discard locks that wrapped around
+    size_t reallocCount;
+    size_t stallLockCount;
+
+    // Sprites submitted, the ones culled by the view frustum and the occluded ones
+    size_t submittedCount;
+    size_t culledCount;
+    size_t occludedCount;
+};
+
+#endif  // __instance_stats_2d_h__
@@ -0,0 +1,227 @@
+/************************************************************************
+*    FILE NAME:       jobpool.cpp
+*
+*    DESCRIPTION:     Pool of worker threads used to split independent
+*                     work into chunks and run them in parallel.
+************************************************************************/
+
+// Physical component dependency
+#include <utilities/jobpool.h>
+
+// Boost lib dependencies
+#include <boost/bind.hpp>
+
+// The amount of chunks each thread gets on average. More than one so a
+// thread that gets preempted doesn't hold up the whole job
+const size_t CHUNKS_PER_THREAD = 4;
+
+// The flag the thread specific pointer points to. The pointer is never deleted
+static bool insideJobFlag = true;
+
+/************************************************************************
+*    desc:  Cleanup function for the thread specific pointer. The flag
+*           is static so there is nothing to delete
+************************************************************************/
+static void NoCleanup( bool * )
+{
+}	// NoCleanup
+
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CJobPool::CJobPool()
+        : pJob(NULL),
+          jobCount(0),
+          chunkSize(0),
+          chunkTotal(0),
+          nextChunk(0),
+          chunksDone(0),
+          generation(0),
+          quit(false),
+          spInsideJob(NoCleanup)
+{
+    // The calling thread works on the jobs too, so we need one less worker
+    uint hardwareThreads = boost::thread::hardware_concurrency();
+
+    for( uint i = 1; i < hardwareThreads; ++i )
+        threadGroup.create_thread( boost::bind( &CJobPool::WorkerLoop, this ) );
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Destructor
+************************************************************************/
+CJobPool::~CJobPool()
+{
+    {
+        boost::mutex::scoped_lock lock( stateMutex );
+        quit = true;
+    }
+
+    jobCondition.notify_all();
+    threadGroup.join_all();
+
+}	// Destructor
+
+
+/************************************************************************
+*    desc:  Get the number of threads that work on a job, including the
+*           calling thread
+*
+*	 ret:	size_t - thread count
+************************************************************************/
+size_t CJobPool::GetThreadCount() const
+{
+    return threadGroup.size() + 1;
+
+}	// GetThreadCount
+
+
+/************************************************************************
+*    desc:  Split the range into chunks and run them on the worker
+*           threads and the calling thread
+*
+*	 param:	size_t count         - size of the range
+*			size_t minChunkSize  - smallest amount of the range worth
+*                                  handing to another thread
+*			const JobFunc & job  - function to call for each chunk
+************************************************************************/
+void CJobPool::ParallelFor( size_t count, size_t minChunkSize, const JobFunc & job )
+{
+    if( count == 0 )
+        return;
+
+    // Run the job serially if it's too small to split up, there are no workers, or if
+    // we're already inside a job. Waiting on the pool from inside a job would deadlock
+    if( (count <= minChunkSize) || threadGroup.size() == 0 || (spInsideJob.get() != NULL) )
+    {
+        job( 0, count );
+        return;
+    }
+
+    boost::mutex::scoped_lock jobLock( jobMutex );
+
+    {
+        boost::mutex::scoped_lock lock( stateMutex );
+
+        // Split the range up so each thread gets a few chunks, but no chunk is too small
+        chunkSize = count / (GetThreadCount() * CHUNKS_PER_THREAD);
+        if( chunkSize < minChunkSize )
+            chunkSize = (minChunkSize > 0) ? minChunkSize : 1;
+
+        pJob = &job;
+        jobCount = count;
+        chunkTotal = (count + chunkSize - 1) / chunkSize;
+        nextChunk = 0;
+        chunksDone = 0;
+        spException.reset();
+        ++generation;
+    }
+
+    jobCondition.notify_all();
+
+    // Help out with the job
+    spInsideJob.reset( &insideJobFlag );
+    RunChunks();
+    spInsideJob.reset();
+
+    boost::mutex::scoped_lock lock( stateMutex );
+
+    while( chunksDone < chunkTotal )
+        doneCondition.wait( lock );
+
+    pJob = NULL;
+
+    // Pass on any exception a chunk threw
+    if( spException )
+    {
+        NExcept::CCriticalException exception( *spException );
+        spException.reset();
+
+        throw exception;
+    }
+
+}	// ParallelFor
+
+
+/************************************************************************
+*    desc:  The loop each worker thread waits in
+************************************************************************/
+void CJobPool::WorkerLoop()
+{
+    spInsideJob.reset( &insideJobFlag );
+
+    uint seenGeneration = 0;
+
+    while( true )
+    {
+        {
+            boost::mutex::scoped_lock lock( stateMutex );
+
+            while( !quit && (seenGeneration == generation) )
+                jobCondition.wait( lock );
+
+            if( quit )
+                break;
+
+            seenGeneration = generation;
+        }
+
+        RunChunks();
+    }
+
+}	// WorkerLoop
+
+
+/************************************************************************
+*    desc:  Grab chunks of the current job until there are none left
+************************************************************************/
+void CJobPool::RunChunks()
+{
+    while( true )
+    {
+        size_t chunk;
+
+        {
+            boost::mutex::scoped_lock lock( stateMutex );
+
+            if( nextChunk >= chunkTotal )
+                break;
+
+            chunk = nextChunk++;
+        }
+
+        size_t begin = chunk * chunkSize;
+        size_t end = begin + chunkSize;
+        if( end > jobCount )
+            end = jobCount;
+
+        // The job can't be stopped halfway, so remember the first exception and keep going
+        try
+        {
+            (*pJob)( begin, end );
+        }
+        catch( NExcept::CCriticalException & ex )
+        {
+            boost::mutex::scoped_lock lock( stateMutex );
+
+            if( !spException )
+                spException.reset( new NExcept::CCriticalException( ex ) );
+        }
+        catch( ... )
+        {
+            boost::mutex::scoped_lock lock( stateMutex );
+
+            if( !spException )
+                spException.reset( new NExcept::CCriticalException( "Job Pool Error!", "Unknown exception thrown by a job." ) );
+        }
+
+        boost::mutex::scoped_lock lock( stateMutex );
+
+        if( ++chunksDone == chunkTotal )
+            doneCondition.notify_all();
+    }
+
+}	// RunChunks
@@ -0,0 +1,94 @@
+/************************************************************************
+*    FILE NAME:       jobpool.h
+*
+*    DESCRIPTION:     Pool of worker threads used to split independent
+*                     work into chunks and run them in parallel.
+************************************************************************/
+
+#ifndef __job_pool_h__
+#define __job_pool_h__
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/scoped_ptr.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <utilities/exceptionhandling.h>
+
+class CJobPool : public boost::noncopyable
+{
+public:
+
+    // Function that handles the range [begin, end) of a job
+    typedef boost::function<void (size_t begin, size_t end)> JobFunc;
+
+    // Get the instance of the singleton class
+    static CJobPool & Instance()
+    {
+        static CJobPool jobPool;
+        return jobPool;
+    }
+
+    // Split the range into chunks and run them on the worker threads and the calling thread.
+    // Returns once the whole range is done. Calls made from inside a job run serially
+    void ParallelFor( size_t count, size_t minChunkSize, const JobFunc & job );
+
+    // Get the number of threads that work on a job, including the calling thread
+    size_t GetThreadCount() const;
+
+private:
+
+    // Constructor
+    CJobPool();
+
+    // Destructor
+    ~CJobPool();
+
+    // The loop each worker thread waits in
+    void WorkerLoop();
+
+    // Grab chunks of the current job until there are none left
+    void RunChunks();
+
+private:
+
+    // The worker threads
+    boost::thread_group threadGroup;
+
+    // Serializes jobs handed to the pool
+    boost::mutex jobMutex;
+
+    // Guards the job state below
+    boost::mutex stateMutex;
+    boost::condition_variable jobCondition;
+    boost::condition_variable doneCondition;
+
+    // The current job and how it's split up
+    const JobFunc * pJob;
+    size_t jobCount;
+    size_t chunkSize;
+    size_t chunkTotal;
+    size_t nextChunk;
+    size_t chunksDone;
+
+    // Incremented for every job so sleeping workers know there's something new to do
+    uint generation;
+
+    // Flag to shut down the worker threads
+    bool quit;
+
+    // The first exception thrown by a chunk. It is rethrown on the calling thread
+    boost::scoped_ptr<NExcept::CCriticalException> spException;
+
+    // Set on the worker threads and while the calling thread is inside a job
+    boost::thread_specific_ptr<bool> spInsideJob;
+
+};
+
+#endif  // __job_pool_h__
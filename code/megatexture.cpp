@@ -10,24 +10,31 @@
 // Physical component dependency
 #include <common/megatexture.h>
 
+// Standard lib dependencies
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
 // Boost lib dependencies
 #include <boost/format.hpp>
-#include <boost/container/vector.hpp>
+#include <boost/chrono.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 // Game lib dependencies
 #include <utilities/exceptionhandling.h>
-#include <utilities/sortfunc.h>
 #include <utilities/deletefuncs.h>
-#include <utilities/collisionfunc2d.h>
 #include <utilities/genfunc.h>
-#include <system/xdevice.h>
+#include <2d/graphicsdevice2d.h>
 #include <managers/texturemanager.h>
-#include <managers/shader.h>
 #include <common/texture.h>
 #include <common/vertex2d.h>
 #include <common/megatexturecomponent.h>
-#include <common/texturepartition.h>
+#include <common/atlaspacker.h>
 #include <3d/worldcamera.h>
+#include <2d/renderstatecache2d.h>
 
 // Vertex data to pass to the shader
 const D3DVERTEXELEMENT9 vertexElement[] =
@@ -41,11 +48,102 @@ const D3DVERTEXELEMENT9 vertexElement[] =
     D3DDECL_END()
 };
 
+// Clock the packing is timed with
+typedef boost::chrono::high_resolution_clock PackClock;
+
+// A cache file is a header, a record for each component in the order the group's textures
+// come in, a record for each page, and then the pixels of the pages one after the other
+// with their rows packed. It starts with "MTEX" and the version of the layout
+const boost::uint32_t CACHE_MAGIC = 0x5845544D;
+const boost::uint32_t CACHE_VERSION = 2;
+
+// Extension of the cache files
+const char * CACHE_EXTENSION = ".megatex";
+
+// Bytes of an A8R8G8B8 pixel
+const size_t CACHE_PIXEL_SIZE = 4;
+
+// FNV-1a, the hash the cache keys are made with
+const boost::uint64_t HASH_OFFSET = 0xCBF29CE484222325ULL;
+const boost::uint64_t HASH_PRIME = 0x100000001B3ULL;
+
+// Header of a cache file
+class CCacheHeader
+{
+public:
+
+    boost::uint32_t magic;
+    boost::uint32_t version;
+
+    // Key of the group it was baked from
+    boost::uint64_t key;
+
+    boost::uint32_t componentCount;
+    boost::uint32_t pageCount;
+};
+
+// Everything a component of a cache file needs that isn't in its texture
+class CCacheComponent
+{
+public:
+
+    boost::int32_t x, y, w, h;
+
+    // Counted from the first page of the group
+    boost::uint32_t page;
+
+    float uv[4];
+    float hull[CMegaTexture::HULL_VERTEX_COUNT * 2];
+    float occluder[4];
+};
+
+// Size of a page of a cache file
+class CCachePage
+{
+public:
+
+    boost::int32_t w, h;
+};
+
+
+/************************************************************************
+*    desc:  Add bytes to a hash
+*
+*	 param:	boost::uint64_t & hash - hash to add to
+*			const void * pData     - bytes to add
+*			size_t size            - number of bytes
+************************************************************************/
+static void HashBytes( boost::uint64_t & hash, const void * pData, size_t size )
+{
+    const unsigned char * pByte = static_cast<const unsigned char *>(pData);
+
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash ^= pByte[i];
+        hash *= HASH_PRIME;
+    }
+
+}	// HashBytes
+
+
+/************************************************************************
+*    desc:  Get the milliseconds since a time
+*
+*	 param:	const PackClock::time_point & start - time to measure from
+************************************************************************/
+static double GetElapsedMs( const PackClock::time_point & start )
+{
+    return static_cast<double>(boost::chrono::duration_cast<boost::chrono::microseconds>( PackClock::now() - start ).count()) / 1000.0;
+
+}	// GetElapsedMs
+
 /************************************************************************
 *    desc:  Constructor
 ************************************************************************/
 CMegaTexture::CMegaTexture()
-            : VERTEX_COUNT(4),
+            : atlasPacker(EAP_MAXRECTS_SHORT_SIDE),
+              atlasSort(EAS_HEIGHT),
+              VERTEX_COUNT(4),
               FACE_COUNT(2),
               INDEX_COUNT(FACE_COUNT * 3)
 {
@@ -71,18 +169,17 @@ void CMegaTexture::InitBuffers()
 
     // Create the vertex declaration
     if( spVertexDeclaration == NULL )
-        CXDevice::Instance().GetXDevice()->CreateVertexDeclaration( vertexElement, &spVertexDeclaration );
+        CGraphicsDevice2D::Instance().CreateVertexDeclaration( vertexElement, &spVertexDeclaration );
 
     // Create the vertex buffer
     if( spVertexBuffer == NULL )
     {
-        if( FAILED( hr = CXDevice::Instance().GetXDevice()->CreateVertexBuffer( 
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateVertexBuffer( 
                     VERTEX_COUNT * sizeof( CVertex2D ),
                     0, 
                     0,
                     D3DPOOL_MANAGED, 
-                    &spVertexBuffer, 
-                    NULL ) ) )
+                    &spVertexBuffer ) ) )
         {
             DisplayError( hr, __FUNCTION__, __LINE__ );
         }
@@ -91,13 +188,12 @@ void CMegaTexture::InitBuffers()
     // Create the index buffer
     if( spIndexBuffer == NULL )
     {
-        if( FAILED( hr = CXDevice::Instance().GetXDevice()->CreateIndexBuffer( 
+        if( FAILED( hr = CGraphicsDevice2D::Instance().CreateIndexBuffer( 
                     INDEX_COUNT * sizeof( WORD ), 
                     0,
                     D3DFMT_INDEX16, 
                     D3DPOOL_MANAGED, 
-                    &spIndexBuffer, 
-                    NULL ) ) )
+                    &spIndexBuffer ) ) )
         {
             DisplayError( hr, __FUNCTION__, __LINE__ );
         }
@@ -131,17 +227,19 @@ void CMegaTexture::InitBuffers()
 
 
 /************************************************************************
-*    desc:  Get a mega texture
+*    desc:  Get a page of the mega texture
+*
+*    param: uint page - page whose texture to get
 *
-*	 ret:	NText::CTextureFor2D * - mega texture to return
+*	 ret:	NText::CTextureFor2D * - texture of the page
 ************************************************************************/
-NText::CTextureFor2D * CMegaTexture::GetTexture()
+NText::CTextureFor2D * CMegaTexture::GetTexture( uint page )
 {
-    if( spMegaTexture == NULL )
+    if( page >= spPageVec.size() )
         throw NExcept::CCriticalException( "Mega Texture Error!", 
                 boost::str( boost::format("Trying to get a texture that hasn't been created.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
 
-    return spMegaTexture.get();
+    return &spPageVec[page];
 
 }	// GetTexture
 
@@ -152,28 +250,58 @@ NText::CTextureFor2D * CMegaTexture::GetTexture()
 *    param: NText::CTextureFor2D * pTex - texture whose UVs to get
 *
 *	 ret:	float * - UVs of the texture
+*
+*    NOTE:  Uses a local iterator so it can be called from several
+*           threads at once
 ************************************************************************/
 float * CMegaTexture::GetUVs( NText::CTextureFor2D * pTex )
 {
-    spComponentMapIter = spComponentMap.find( pTex );
+    SPComponentMapIter componentIter = spComponentMap.find( pTex );
 
-    if( spComponentMapIter == spComponentMap.end() )
+    if( componentIter == spComponentMap.end() )
         throw NExcept::CCriticalException( "Mega Texture Error!", 
                 boost::str( boost::format("Texture component missing.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
 
-    return spComponentMapIter->second->uv;
+    return componentIter->second->uv;
 
 }	// GetUVs
 
 
 /************************************************************************
-*    desc:  Render the mega texture
+*    desc:  Get the ID of a texture's component
+*  
+*    param: NText::CTextureFor2D * pTex - texture whose ID to get
+*
+*	 ret:	uint - index of the component's UVs in the UV table
+************************************************************************/
+uint CMegaTexture::GetComponentId( NText::CTextureFor2D * pTex ) const
+{
+    ComponentIdMap::const_iterator idIter = componentIdMap.find( pTex );
+
+    if( idIter == componentIdMap.end() )
+        throw NExcept::CCriticalException( "Mega Texture Error!", 
+                boost::str( boost::format("Texture component missing.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
+
+    return idIter->second;
+
+}	// GetComponentId
+
+
+/************************************************************************
+*    desc:  Render a page of the mega texture
+*
+*    param: uint page - page to render
 ************************************************************************/
-void CMegaTexture::Render()
+void CMegaTexture::Render( uint page )
 {
+    NText::CTextureFor2D * pPage = GetTexture( page );
+
     // Initialize the buffers. If the buffers are already made, nothing happens
     // in here
     InitBuffers();
+
+    // The rest of the game sets the device, shader and textures without the cache
+    CRenderStateCache2D::Instance().Invalidate();
         
     // Lock the vertex buffer for copying
     CVertex2D * pVertex;
@@ -181,8 +309,8 @@ void CMegaTexture::Render()
         throw NExcept::CCriticalException( "Mega Texture Error!", 
                 boost::str( boost::format("Failed to lock the vertex buffer.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
 
-    // Get the size of the whole mega texture
-    CSize<float> tmpHalfSize = spMegaTexture->size / 2;
+    // Get the size of the whole page
+    CSize<float> tmpHalfSize = pPage->size / 2;
 
     // The vertices are positioned in a way that they they make a quad with side sizes of 1
     pVertex[0].vert = CPoint(-tmpHalfSize.w, tmpHalfSize.h,0) + CWorldCamera::Instance().GetPos();
@@ -198,39 +326,70 @@ void CMegaTexture::Render()
     spVertexBuffer->Unlock();
 
     // Set the vertex declaration
-    CXDevice::Instance().GetXDevice()->SetVertexDeclaration( spVertexDeclaration );
+    CRenderStateCache2D::Instance().SetVertexDeclaration( spVertexDeclaration );
 
     // Set up stream zero with our vertex buffer and set the indexes
-    CXDevice::Instance().GetXDevice()->SetStreamSource( 0, spVertexBuffer, 0, sizeof( CVertex2D ) );
-    CXDevice::Instance().GetXDevice()->SetIndices( spIndexBuffer );
+    CRenderStateCache2D::Instance().SetStreamSource( 0, spVertexBuffer, 0, sizeof( CVertex2D ) );
+    CRenderStateCache2D::Instance().SetIndices( spIndexBuffer );
 
     // Set up the shader before the rendering
-    CEffectData * pEffectData = CShader::Instance().SetEffectAndTechnique( "shader_2d", "linearFilter" );
+    CRenderStateCache2D::Instance().SetEffectAndTechnique( "shader_2d", "linearFilter" );
 
     // Copy the matrix to the shader
-    CShader::Instance().SetEffectValue( pEffectData, "cameraViewProjMatrix", 
-                                        CXDevice::Instance().GetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC ) );
+    CGraphicsDevice2D::Instance().SetEffectMatrix( "cameraViewProjMatrix", CGraphicsDevice2D::Instance().GetProjectionMatrix( CSettings::EPT_ORTHOGRAPHIC ) );
 
     // Set the material color
-    CShader::Instance().SetEffectValue( pEffectData, "materialColor", D3DXVECTOR4(1,1,1,1) );
+    const float materialColor[4] = { 1, 1, 1, 1 };
+    CGraphicsDevice2D::Instance().SetEffectFloatArray( "materialColor", materialColor, 4 );
 
     // Set the active texture to the first sprite's first texture
-    CTextureMgr::Instance().SelectTexture( spMegaTexture->spTexture );
+    CRenderStateCache2D::Instance().SelectTexture( pPage->spTexture );
     
     // Begin rendering
     UINT iPass, cPasses;
-    CShader::Instance().GetActiveShader()->Begin( &cPasses, 0 );
+    CGraphicsDevice2D::Instance().BeginEffect( &cPasses );
     for( iPass = 0; iPass < cPasses; ++iPass )
     {
-        CShader::Instance().GetActiveShader()->BeginPass( iPass );
-        CXDevice::Instance().GetXDevice()->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, VERTEX_COUNT, 0, FACE_COUNT );
-        CShader::Instance().GetActiveShader()->EndPass();
+        CGraphicsDevice2D::Instance().BeginEffectPass( iPass );
+        CGraphicsDevice2D::Instance().DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, VERTEX_COUNT, 0, FACE_COUNT );
+        CGraphicsDevice2D::Instance().EndEffectPass();
     }
-    CShader::Instance().GetActiveShader()->End();
+    CGraphicsDevice2D::Instance().EndEffect();
 
 }	// Render
 
 
+/************************************************************************
+*    desc:  Set how the textures are packed and the order they're packed
+*           in. Skyline packs the fastest and MaxRects the tightest
+*  
+*    param: EAtlasPacker packer - packer to place the textures with
+*			EAtlasSort sort     - order to place them in
+************************************************************************/
+void CMegaTexture::SetPackMode( EAtlasPacker packer, EAtlasSort sort )
+{
+    atlasPacker = packer;
+    atlasSort = sort;
+
+}	// SetPackMode
+
+
+/************************************************************************
+*    desc:  Set the folder the mega textures are baked into
+*  
+*    param: const string & folder - folder of the cache files. Empty turns
+*                                   the cache off
+************************************************************************/
+void CMegaTexture::SetCacheFolder( const std::string & folder )
+{
+    cacheFolder = folder;
+
+    if( !cacheFolder.empty() && (cacheFolder[cacheFolder.size() - 1] != '/') && (cacheFolder[cacheFolder.size() - 1] != '\\') )
+        cacheFolder += '/';
+
+}	// SetCacheFolder
+
+
 /************************************************************************
 *    desc:  Create a mega texture using the group name passed in
 *  
@@ -238,322 +397,493 @@ void CMegaTexture::Render()
 *			int wlimit	   - limit the width the texture will fit into
 ************************************************************************/
 void CMegaTexture::CreateMegaTexture( const std::string & group, uint wLimit )
+{
+    // Get the textures from the texture manager
+    std::vector<NText::CTextureFor2D *> pTextureVector;
+    CTextureMgr::Instance().GetGroupTextures( group, pTextureVector );
+
+    CreateMegaTexture( group, pTextureVector, wLimit );
+
+}	// CreateMegaTexture
+
+
+/************************************************************************
+*    desc:  Create a mega texture out of the textures passed in
+*  
+*    param: string & group - name of the group the textures are
+*			const vector<CTextureFor2D *> & pTextureVector - textures to combine
+*			int wlimit	   - limit the width the texture will fit into
+************************************************************************/
+void CMegaTexture::CreateMegaTexture( const std::string & group, const std::vector<NText::CTextureFor2D *> & pTextureVector, uint wLimit )
 {
     // Make sure we don't go over the max size
-    if( wLimit > CXDevice::Instance().GetMaxTextureWidth() )
-        wLimit = CXDevice::Instance().GetMaxTextureWidth();
+    if( wLimit > CGraphicsDevice2D::Instance().GetMaxTextureWidth() )
+        wLimit = CGraphicsDevice2D::Instance().GetMaxTextureWidth();
 
     // Make sure the hardware can handles this texture size
-    if( CXDevice::Instance().GetMaxTextureWidth() < wLimit )
+    if( CGraphicsDevice2D::Instance().GetMaxTextureWidth() < wLimit )
         throw NExcept::CCriticalException("Max texture width too small!",
-                    boost::str( boost::format("Max texture width needed (%d) but was found (%d) (%s).\n\n%s\nLine: %s") % wLimit % CXDevice::Instance().GetMaxTextureWidth() % group % __FUNCTION__ % __LINE__ ));
-
-    // The size of the mega texture;
-    CSize<int> megaTextureSize;
+                    boost::str( boost::format("Max texture width needed (%d) but was found (%d) (%s).\n\n%s\nLine: %s") % wLimit % CGraphicsDevice2D::Instance().GetMaxTextureWidth() % group % __FUNCTION__ % __LINE__ ));
 
-    // Get the textures from the texture manager
-    std::vector<NText::CTextureFor2D *> pTextureVector;
-    CTextureMgr::Instance().GetGroupTextures( group, pTextureVector );
-
-    // We don't want to create a mega texture if there's no textures in the texture manager
+    // We don't want to create a mega texture if there's no textures in the group
     if( !pTextureVector.empty() )
     {
-        // Sort the textures by largest height to smallest height
-        sort( pTextureVector.begin(), pTextureVector.end(), NSortFunc::Texture2DSort );
+        // A group that's the same as when it was baked loads from its cache file
+        const PackClock::time_point loadStart = PackClock::now();
+        boost::uint64_t cacheKey = 0;
+        const bool cacheActive = !cacheFolder.empty() && GetCacheKey( group, wLimit, pTextureVector, cacheKey );
+
+        if( cacheActive && LoadCache( group, cacheKey, pTextureVector ) )
+        {
+            NGenFunc::PostDebugMsg( "Mega Texture Create: %s - %d textures loaded from %s in %.2f ms",
+                                    group.c_str(), static_cast<int>(pTextureVector.size()),
+                                    GetCachePath( group ).c_str(), GetElapsedMs( loadStart ) );
+            return;
+        }
 
-        // Create a vector to hold the sorted component data
-        boost::container::vector<CMegaTextureComponent *> pTmpSortedComponentVec;
-        boost::container::vector<CMegaTextureComponent *>::iterator sortedComponentVecIter;
+        const PackClock::time_point start = PackClock::now();
 
         // Add the textures into the component containers
+        std::vector< CSize<int> > sizeVec( pTextureVector.size() );
+        std::vector<CPointInt> posVec;
+        std::vector<uint> pageVec;
+        std::vector< CSize<int> > pageSizeVec;
+        const size_t firstComponent = pComponentVec.size();
+        const size_t firstPage = spPageVec.size();
+
+        AddComponents( pTextureVector );
+
         for( size_t i = 0; i < pTextureVector.size(); ++i )
         {
-            CMegaTextureComponent * pTmpComponent = new CMegaTextureComponent( pTextureVector[i] );
-            spComponentMap.insert( pTextureVector[i], pTmpComponent );
-            pTmpSortedComponentVec.push_back( pTmpComponent );
+            sizeVec[i].w = static_cast<int>(pTextureVector[i]->size.w);
+            sizeVec[i].h = static_cast<int>(pTextureVector[i]->size.h);
         }
 
-        // Two dimensional pointer vector of partitions and add the first partition to it
-        SPPartitionVecVec spPartitionVecVec;
-        spPartitionVecVec.push_back( new boost::ptr_vector<CTexturePartition> );
-        spPartitionVecVec[0].push_back( new CTexturePartition );
-        spPartitionVecVec[0][0].size = CSize<int>( wLimit, CXDevice::Instance().GetMaxTextureHeight() );
-
-        for( sortedComponentVecIter  = pTmpSortedComponentVec.begin();
-             sortedComponentVecIter != pTmpSortedComponentVec.end();
-           ++sortedComponentVecIter )
+        // Pack the textures into the least height they fit in. What doesn't fit within the
+        // most height goes onto the next page. Only a texture too big for a page by itself fails
+        if( !NAtlasPacker::PackPages( atlasPacker, atlasSort, 
+                                      static_cast<int>(wLimit), 
+                                      static_cast<int>(CGraphicsDevice2D::Instance().GetMaxTextureHeight()),
+                                      sizeVec, posVec, pageVec, pageSizeVec ) )
         {
-            // Loop through each row of partitions
-            for( size_t i = 0; i < spPartitionVecVec.size(); ++i )
-            {
-                bool nextComponent = false;
-
-                // Loop through each partition in a row
-                for( size_t j = 0; j < spPartitionVecVec[i].size(); ++j )
-                {
-                    // Get the far position. The far position is the point diagnally across from the position
-                    CPointInt farPos;
-                    farPos.x = spPartitionVecVec[i][j].pos.x + (*sortedComponentVecIter)->pTexture->size.w;
-                    farPos.y = spPartitionVecVec[i][j].pos.y + (*sortedComponentVecIter)->pTexture->size.h;
-
-                    // If we get in here, we can't fit the texture in this row by any means, so we'll move
-                    // onto the next row
-                    if( farPos.x > static_cast<int>(wLimit) )
-                        break;
-
-                    // If we get into here, then we can't fit all of our textures into one
-                    else if( farPos.y > static_cast<int>(CXDevice::Instance().GetMaxTextureHeight()) )
-                        throw NExcept::CCriticalException( "Mega Texture Error!", 
-                            boost::str( boost::format("Cannot fit all textures of the group with a 4048x4048 space.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
-                        
-                    // If the partition is vacant, we're going to see if we can fit the texture in it
-                    if( spPartitionVecVec[i][j].vacant )
-                        nextComponent = FitTextureToPartition( 
-                            static_cast<int>(i), static_cast<int>(j), *sortedComponentVecIter, spPartitionVecVec );
-
-                    if( nextComponent )
-                        break;
-                }
-
-                if( nextComponent )
-                    break;
-            }
+            throw NExcept::CCriticalException( "Mega Texture Error!", 
+                boost::str( boost::format("A texture of the group (%s) doesn't fit within a %dx%d page.\n\n%s\nLine: %s") 
+                    % group % wLimit % CGraphicsDevice2D::Instance().GetMaxTextureHeight() % __FUNCTION__ % __LINE__ ));
+        }
 
-            // Update the mega texture's size
-            if( (*sortedComponentVecIter)->pos.x + (*sortedComponentVecIter)->pTexture->size.w > megaTextureSize.w )
-                megaTextureSize.w = (*sortedComponentVecIter)->pos.x + (*sortedComponentVecIter)->pTexture->size.w;
+        double textureArea = 0;
+        pageTableVec.resize( pComponentVec.size() );
 
-            if( (*sortedComponentVecIter)->pos.y + (*sortedComponentVecIter)->pTexture->size.h > megaTextureSize.h )
-                megaTextureSize.h = (*sortedComponentVecIter)->pos.y + (*sortedComponentVecIter)->pTexture->size.h;
+        for( size_t i = 0; i < posVec.size(); ++i )
+        {
+            pComponentVec[firstComponent + i]->pos = posVec[i];
+            pageTableVec[firstComponent + i] = static_cast<uint>(firstPage + pageVec[i]);
+            textureArea += static_cast<double>(sizeVec[i].w) * sizeVec[i].h;
         }
 
+        const double packTime = GetElapsedMs( start );
+
         // Make sure no textures are overlapping
         CheckTextureOverlap();
 
-        // Create the mega texture and set its size
-        spMegaTexture.reset( new NText::CTextureFor2D() );
-        spMegaTexture->size.w = megaTextureSize.w;
-        spMegaTexture->size.h = megaTextureSize.h;
+        // Create the pages and set their sizes
+        double pageArea = 0;
 
-        NGenFunc::PostDebugMsg( "Mega Texture Create: %s - %d x %d", group.c_str(), megaTextureSize.w, megaTextureSize.h );
+        for( size_t i = 0; i < pageSizeVec.size(); ++i )
+        {
+            NText::CTextureFor2D * pPage = new NText::CTextureFor2D();
+            spPageVec.push_back( pPage );
+            pPage->size.w = pageSizeVec[i].w;
+            pPage->size.h = pageSizeVec[i].h;
+
+            pageArea += static_cast<double>(pageSizeVec[i].w) * pageSizeVec[i].h;
+        }
 
-        // Create the texture we're going to give to the shader
-        CopyToMegaTexture( group );
+        NGenFunc::PostDebugMsg( "Mega Texture Create: %s - %d page(s), first %d x %d, %d textures, %.1f%% filled, packed in %.2f ms (%s, %s sort)",
+                                group.c_str(), static_cast<int>(pageSizeVec.size()),
+                                pageSizeVec.front().w, pageSizeVec.front().h,
+                                static_cast<int>(posVec.size()),
+                                100.0 * textureArea / pageArea,
+                                packTime,
+                                NAtlasPacker::GetPackerName( atlasPacker ),
+                                NAtlasPacker::GetSortName( atlasSort ) );
+
+        // Create the textures we're going to give to the shader
+        CopyToMegaTexture( group, firstComponent, firstPage );
 
         // Calculate the UVs
         CalculateGroupUVs();
+
+        // Calculate the hulls and occluders from the alpha of the copied textures
+        CalculateGroupHulls();
+        CalculateGroupOccluders();
+
+        // Bake the group so the next start can load it
+        if( cacheActive )
+            SaveCache( group, cacheKey, firstComponent, firstPage );
     }
 
 }	// CreateMegaTexture
 
 
 /************************************************************************
-*    desc:  Try to fit a texture into partitions
+*    desc:  Add the textures of a group to the components and give each
+*           one the next ID
 *  
-*    param: int row                            - the row index of the initial 
-*											     vacant partition
-*			int column                         - the column index of the initial 
-*											     vacant partition
-*			CMegaTextureComponent * pComponent - the texture we're trying to fit
-*			SPPartitionVecVec & spPartVecVec   - 2d vector of partitions
+*    param: const vector<CTextureFor2D *> & pTextureVector - textures of the group
 ************************************************************************/
-bool CMegaTexture::FitTextureToPartition( int row, int column, 
-                                          CMegaTextureComponent * pComponent,
-                                          SPPartitionVecVec & spPartVecVec  )
+void CMegaTexture::AddComponents( const std::vector<NText::CTextureFor2D *> & pTextureVector )
 {
-    // The resize object holds the height and width of the current partitions' resized
-    // heights and widths. The newEntry size holds the height and width of the new
-    // partitions' heights and widths
-    CSize<int> resize, newEntry;
+    for( size_t i = 0; i < pTextureVector.size(); ++i )
+    {
+        NText::CTextureFor2D * pTexture = pTextureVector[i];
+
+        CMegaTextureComponent * pTmpComponent = new CMegaTextureComponent( pTexture );
+        spComponentMap.insert( pTexture, pTmpComponent );
+
+        // Give the component the next ID
+        componentIdMap[ pTexture ] = static_cast<uint>(pComponentVec.size());
+        pComponentVec.push_back( pTmpComponent );
+    }
 
-    // The total size of the partitions used to fit the width of the texture
-    CSize<int> totalSize;
+}	// AddComponents
 
-    // Between the values row and endRow, and column and endColumn, is where we will
-    // try and fit our texture
-    int endRow = 0;
-    int endColumn = 1;
 
-    // The new row and new column index will be one after the end row and end column indexes
-    int newRow = 0;
-    int newColumn = 1;
+/************************************************************************
+*    desc:  Get the key of a group's cache file. It's a hash of the pack
+*           mode, the limits, and the size and pixels of every texture
+*           in order, so any change to what the group is baked from
+*           makes a new key. Only textures of 32 bit pixels that can be
+*           locked are hashed
+*  
+*    param: const string & group - group of the textures
+*			uint wLimit          - width the textures are packed in
+*			const vector<CTextureFor2D *> & pTextureVector - textures of the group
+*			boost::uint64_t & key - key of the group
+*
+*	 ret:	bool - false if the textures can't be read to make the key
+************************************************************************/
+bool CMegaTexture::GetCacheKey( const std::string & group, uint wLimit, 
+                                const std::vector<NText::CTextureFor2D *> & pTextureVector, boost::uint64_t & key )
+{
+    key = HASH_OFFSET;
 
-    // Check if we can fit the texture's width into nearby partitions
-    for( size_t i = column; i < spPartVecVec[row].size(); ++i )
+    const boost::uint32_t setting[] =
     {
-        // If we run into a non-vacant partition before fitting the texture, the texture
-        // can't fit here, so we return false
-        if( !spPartVecVec[row][i].vacant )
+        CACHE_VERSION,
+        wLimit,
+        CGraphicsDevice2D::Instance().GetMaxTextureHeight(),
+        static_cast<boost::uint32_t>(atlasPacker),
+        static_cast<boost::uint32_t>(atlasSort),
+        static_cast<boost::uint32_t>(pTextureVector.size())
+    };
+
+    HashBytes( key, group.c_str(), group.size() );
+    HashBytes( key, setting, sizeof(setting) );
+
+    for( size_t i = 0; i < pTextureVector.size(); ++i )
+    {
+        IDirect3DTexture9 * pTexture = pTextureVector[i]->spTexture;
+        D3DSURFACE_DESC desc;
+        D3DLOCKED_RECT lockedRect;
+
+        if( FAILED( pTexture->GetLevelDesc( 0, &desc ) ) || 
+            ((desc.Format != D3DFMT_A8R8G8B8) && (desc.Format != D3DFMT_X8R8G8B8)) )
             return false;
 
-        totalSize.w += spPartVecVec[row][i].size.w;
+        if( FAILED( pTexture->LockRect( 0, &lockedRect, NULL, D3DLOCK_READONLY ) ) )
+            return false;
 
-        // Once the texture width is less or equal to the total width, we know how
-        // many partitions will be used to fit the texture's width
-        if( pComponent->pTexture->size.w <= totalSize.w )
+        const boost::int32_t size[] =
         {
-            endColumn = static_cast<int>(i);
-            newColumn = static_cast<int>(i + 1);
-            newEntry.w = totalSize.w - pComponent->pTexture->size.w;
-            resize.w = spPartVecVec[row][i].size.w - newEntry.w;
-            break;
-        }
+            static_cast<boost::int32_t>(pTextureVector[i]->size.w),
+            static_cast<boost::int32_t>(pTextureVector[i]->size.h),
+            static_cast<boost::int32_t>(desc.Width),
+            static_cast<boost::int32_t>(desc.Height),
+            static_cast<boost::int32_t>(desc.Format)
+        };
+
+        HashBytes( key, size, sizeof(size) );
+
+        for( UINT y = 0; y < desc.Height; ++y )
+            HashBytes( key, static_cast<const BYTE *>(lockedRect.pBits) + (y * lockedRect.Pitch), desc.Width * CACHE_PIXEL_SIZE );
+
+        pTexture->UnlockRect( 0 );
     }
 
-    // Check if we can fit the texture's height into nearby partitions
-    for( size_t i = row; i < spPartVecVec.size(); ++i )
+    return true;
+
+}	// GetCacheKey
+
+
+/************************************************************************
+*    desc:  Get the path of a group's cache file
+*  
+*    param: const string & group - group of the textures
+************************************************************************/
+std::string CMegaTexture::GetCachePath( const std::string & group ) const
+{
+    return cacheFolder + group + CACHE_EXTENSION;
+
+}	// GetCachePath
+
+
+/************************************************************************
+*    desc:  Load a group from its cache file. The file is mapped and
+*           checked before anything is added, then each page is filled
+*           with one lock straight from the mapped pixels. The packing,
+*           the overlap check, the copies of the textures and the
+*           calculation of the UVs, hulls and occluders are all skipped
+*  
+*    param: const string & group - group of the textures
+*			boost::uint64_t key  - key the group has now
+*			const vector<CTextureFor2D *> & pTextureVector - textures of the group
+*
+*	 ret:	bool - false if there's no cache file or it's out of date
+************************************************************************/
+bool CMegaTexture::LoadCache( const std::string & group, boost::uint64_t key, const std::vector<NText::CTextureFor2D *> & pTextureVector )
+{
+    boost::interprocess::file_mapping cacheFile;
+    boost::interprocess::mapped_region cacheRegion;
+
+    // There's no cache file the first time a group is created
+    try
+    {
+        boost::interprocess::file_mapping( GetCachePath( group ).c_str(), boost::interprocess::read_only ).swap( cacheFile );
+        boost::interprocess::mapped_region( cacheFile, boost::interprocess::read_only ).swap( cacheRegion );
+    }
+    catch( boost::interprocess::interprocess_exception & )
+    {
+        return false;
+    }
+
+    const BYTE * pFile = static_cast<const BYTE *>(cacheRegion.get_address());
+    const size_t fileSize = cacheRegion.get_size();
+
+    // Check that it was baked from what the group is made of now
+    CCacheHeader header;
+
+    if( fileSize < sizeof(header) )
+        return false;
+
+    std::memcpy( &header, pFile, sizeof(header) );
+
+    if( (header.magic != CACHE_MAGIC) || (header.version != CACHE_VERSION) || (header.key != key) ||
+        (header.componentCount != pTextureVector.size()) || (header.pageCount == 0) )
+        return false;
+
+    const size_t pageOffset = sizeof(header) + (header.componentCount * sizeof(CCacheComponent));
+    const size_t pixelOffset = pageOffset + (header.pageCount * sizeof(CCachePage));
+
+    if( fileSize < pixelOffset )
+        return false;
+
+    // The records aren't aligned in the file, so they're copied out
+    std::vector<CCacheComponent> componentVec( header.componentCount );
+    std::vector<CCachePage> pageVec( header.pageCount );
+    std::memcpy( &componentVec[0], pFile + sizeof(header), componentVec.size() * sizeof(CCacheComponent) );
+    std::memcpy( &pageVec[0], pFile + pageOffset, pageVec.size() * sizeof(CCachePage) );
+
+    // A file cut short is baked again
+    size_t pixelSize = 0;
+
+    for( size_t i = 0; i < pageVec.size(); ++i )
     {
-        // If we run into a non-vacant partition before fitting the texture, the texture
-        // can't fit here, so we return false
-        if( !spPartVecVec[i][column].vacant )
+        if( (pageVec[i].w <= 0) || (pageVec[i].h <= 0) )
             return false;
 
-        totalSize.h += spPartVecVec[i][column].size.h;
+        pixelSize += static_cast<size_t>(pageVec[i].w) * pageVec[i].h * CACHE_PIXEL_SIZE;
+    }
+
+    if( fileSize - pixelOffset < pixelSize )
+        return false;
+
+    for( size_t i = 0; i < componentVec.size(); ++i )
+        if( componentVec[i].page >= header.pageCount )
+            return false;
+
+    // Add the components with their baked placement
+    const size_t firstComponent = pComponentVec.size();
+    const size_t firstPage = spPageVec.size();
+
+    AddComponents( pTextureVector );
+
+    uvTableVec.resize( pComponentVec.size() * 4 );
+    hullTableVec.resize( pComponentVec.size() * HULL_VERTEX_COUNT * 2 );
+    occluderTableVec.resize( pComponentVec.size() * 4 );
+    pageTableVec.resize( pComponentVec.size() );
+
+    for( size_t i = 0; i < componentVec.size(); ++i )
+    {
+        const CCacheComponent & record = componentVec[i];
+        const size_t id = firstComponent + i;
+        CMegaTextureComponent * pComponent = pComponentVec[id];
+
+        pComponent->pos.x = record.x;
+        pComponent->pos.y = record.y;
+        pageTableVec[id] = static_cast<uint>(firstPage + record.page);
 
-        // Once the texture width is less or equal to the total width, we know how
-        // many partitions will be used to fit the texture's width
-        if( pComponent->pTexture->size.h <= totalSize.h )
+        for( int j = 0; j < 4; ++j )
         {
-            endRow = static_cast<int>(i);
-            newRow = static_cast<int>(i + 1);
-            newEntry.h = totalSize.h - pComponent->pTexture->size.h;
-            resize.h = spPartVecVec[i][column].size.h - newEntry.h;
-            break;
+            pComponent->uv[j] = record.uv[j];
+            uvTableVec[id * 4 + j] = record.uv[j];
         }
+
+        std::copy( record.hull, record.hull + (HULL_VERTEX_COUNT * 2), &hullTableVec[id * HULL_VERTEX_COUNT * 2] );
+        std::copy( record.occluder, record.occluder + 4, &occluderTableVec[id * 4] );
     }
 
-    // All we need to check before inserting is that all partitions within the
-    // partCount are vacant
-    for( int i = row + 1; i <= endRow; ++i )
+    // Create the pages and copy their pixels straight from the file
+    const BYTE * pPixel = pFile + pixelOffset;
+    HRESULT hresult;
+
+    for( size_t i = 0; i < pageVec.size(); ++i )
     {
-        for( int j = column + 1; j <= endColumn; ++j )
+        NText::CTextureFor2D * pPage = new NText::CTextureFor2D();
+        spPageVec.push_back( pPage );
+        pPage->size.w = pageVec[i].w;
+        pPage->size.h = pageVec[i].h;
+
+        if( FAILED( hresult = CGraphicsDevice2D::Instance().CreateTexture( 
+                pageVec[i].w,
+                pageVec[i].h,
+                1, 
+                0, 
+                D3DFMT_A8R8G8B8,
+                D3DPOOL_MANAGED, 
+                &pPage->spTexture ) ) )
         {
-            if( !spPartVecVec[i][j].vacant )
-                return false;
+            DisplayError( hresult, __FUNCTION__, __LINE__ );
         }
+
+        D3DLOCKED_RECT lockedRect;
+
+        if( FAILED( hresult = pPage->spTexture->LockRect( 0, &lockedRect, NULL, 0 ) ) )
+            DisplayError( hresult, __FUNCTION__, __LINE__ );
+
+        const size_t rowSize = pageVec[i].w * CACHE_PIXEL_SIZE;
+
+        for( int y = 0; y < pageVec[i].h; ++y, pPixel += rowSize )
+            std::memcpy( static_cast<BYTE *>(lockedRect.pBits) + (y * lockedRect.Pitch), pPixel, rowSize );
+
+        pPage->spTexture->UnlockRect( 0 );
     }
 
-    // Once we've gotten this far, it means our texture will fit here. So we
-    // begin subdividing partitions. We start by adding a new column and resizing
-    // the width of the column before it if the texture doesn't fit completely into
-    // the width of the partitions
-    if( newEntry.w > 0 )
+    return true;
+
+}	// LoadCache
+
+
+/************************************************************************
+*    desc:  Bake the group just created into its cache file. A cache that
+*           can't be written only makes the next start slower, so it
+*           doesn't throw
+*  
+*    param: const string & group  - group of the textures
+*			boost::uint64_t key   - key of the group
+*			size_t firstComponent - first component of the group
+*			size_t firstPage      - first page of the group
+************************************************************************/
+void CMegaTexture::SaveCache( const std::string & group, boost::uint64_t key, size_t firstComponent, size_t firstPage )
+{
+    const std::string path = GetCachePath( group );
+    std::ofstream cacheFile( path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+    CCacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.componentCount = static_cast<boost::uint32_t>(pComponentVec.size() - firstComponent);
+    header.pageCount = static_cast<boost::uint32_t>(spPageVec.size() - firstPage);
+
+    cacheFile.write( reinterpret_cast<const char *>(&header), sizeof(header) );
+
+    for( size_t i = firstComponent; i < pComponentVec.size(); ++i )
     {
-        for( size_t i = 0; i < spPartVecVec.size(); ++i )
-        {
-            // Resize the widths of the partitions in the end column
-            spPartVecVec[i][endColumn].size.w = resize.w;
-
-            // Create a new partition
-            CTexturePartition * pTmpPart = new CTexturePartition();
-            pTmpPart->size.w = newEntry.w;
-            pTmpPart->size.h = spPartVecVec[i][endColumn].size.h;
-            pTmpPart->pos.x = spPartVecVec[i][endColumn].pos.x + resize.w;
-            pTmpPart->pos.y = spPartVecVec[i][endColumn].pos.y;
-            pTmpPart->vacant = spPartVecVec[i][endColumn].vacant;
-
-            // Add the new partition after the current one
-            if( newColumn < static_cast<int>(spPartVecVec[i].size()) )
-                spPartVecVec[i].insert( spPartVecVec[i].begin()+newColumn, pTmpPart );
-            else
-                spPartVecVec[i].push_back( pTmpPart );
-        }
+        const CMegaTextureComponent * pComponent = pComponentVec[i];
+
+        CCacheComponent record;
+        record.x = pComponent->pos.x;
+        record.y = pComponent->pos.y;
+        record.w = static_cast<boost::int32_t>(pComponent->pTexture->size.w);
+        record.h = static_cast<boost::int32_t>(pComponent->pTexture->size.h);
+        record.page = static_cast<boost::uint32_t>(pageTableVec[i] - firstPage);
+
+        std::copy( &uvTableVec[i * 4], &uvTableVec[i * 4] + 4, record.uv );
+        std::copy( GetHull( static_cast<uint>(i) ), GetHull( static_cast<uint>(i) ) + (HULL_VERTEX_COUNT * 2), record.hull );
+        std::copy( GetOccluder( static_cast<uint>(i) ), GetOccluder( static_cast<uint>(i) ) + 4, record.occluder );
+
+        cacheFile.write( reinterpret_cast<const char *>(&record), sizeof(record) );
     }
 
-    // We add the new row if the texture doesn't fit completely into the height of the partitions
-    if( newEntry.h > 0 )
+    for( size_t i = firstPage; i < spPageVec.size(); ++i )
     {
-        if( newRow < static_cast<int>(spPartVecVec.size()) )
-            spPartVecVec.insert( spPartVecVec.begin()+newRow, new boost::ptr_vector<CTexturePartition> );
-        else
-            spPartVecVec.push_back( new boost::ptr_vector<CTexturePartition> );
+        CCachePage page;
+        page.w = static_cast<boost::int32_t>(spPageVec[i].size.w);
+        page.h = static_cast<boost::int32_t>(spPageVec[i].size.h);
 
-        // Now we add in the new row and resize the height of the row before it
-        for( size_t i = 0; i < spPartVecVec[endRow].size(); ++i )
-        {
-            // Resize the heights of the partitions in the end row
-            spPartVecVec[endRow][i].size.h = resize.h;
-
-            // Create a new partition
-            CTexturePartition * pTmpPart = new CTexturePartition();
-            pTmpPart->size.h = newEntry.h;
-            pTmpPart->size.w = spPartVecVec[endRow][i].size.w;
-            pTmpPart->pos.y = spPartVecVec[endRow][i].pos.y + resize.h;
-            pTmpPart->pos.x = spPartVecVec[endRow][i].pos.x;
-            pTmpPart->vacant = spPartVecVec[endRow][i].vacant;
-
-            // Add the new partition to the new row
-            spPartVecVec[newRow].push_back( pTmpPart );
-        }
+        cacheFile.write( reinterpret_cast<const char *>(&page), sizeof(page) );
     }
 
-    // Go through all of the partitions used to store this texture and
-    // mark them as unvacant
-    for( int i = row; i <= endRow; ++i )
+    // The pixels of the pages with their rows packed
+    for( size_t i = firstPage; (i < spPageVec.size()) && cacheFile.good(); ++i )
     {
-        for( int j = column; j <= endColumn; ++j )
-            spPartVecVec[i][j].vacant = false;
+        const int width = static_cast<int>(spPageVec[i].size.w);
+        const int height = static_cast<int>(spPageVec[i].size.h);
+        D3DLOCKED_RECT lockedRect;
+        HRESULT hresult;
+
+        if( FAILED( hresult = spPageVec[i].spTexture->LockRect( 0, &lockedRect, NULL, D3DLOCK_READONLY ) ) )
+            DisplayError( hresult, __FUNCTION__, __LINE__ );
+
+        for( int y = 0; y < height; ++y )
+            cacheFile.write( static_cast<const char *>(lockedRect.pBits) + (y * lockedRect.Pitch), width * CACHE_PIXEL_SIZE );
+
+        spPageVec[i].spTexture->UnlockRect( 0 );
     }
 
-    // Lastly, we set the passed in component's position
-    pComponent->pos = spPartVecVec[row][column].pos;
+    cacheFile.close();
 
-    return true;
+    if( cacheFile.fail() )
+    {
+        std::remove( path.c_str() );
+        NGenFunc::PostDebugMsg( "Mega Texture Cache: %s - couldn't be written to %s", group.c_str(), path.c_str() );
+    }
+    else
+    {
+        NGenFunc::PostDebugMsg( "Mega Texture Cache: %s - baked to %s", group.c_str(), path.c_str() );
+    }
 
-}	// FitTextureToPartition
+}	// SaveCache
 
 
 /************************************************************************
-*    desc:  If any textures are overlapping, throw an exception
+*    desc:  If any textures on the same page are overlapping, throw an
+*           exception. Every pair is found with a sweep, so it's cheap
+*           enough to always run
 ************************************************************************/
 void CMegaTexture::CheckTextureOverlap()
 {
-    spComponentMapIter = spComponentMap.begin();
+    std::vector<CAtlasRect> rectVec( pComponentVec.size() );
 
-    // Let's double check that no textures are overlapping
-    while( spComponentMapIter != spComponentMap.end() )
+    for( size_t i = 0; i < pComponentVec.size(); ++i )
     {
-        // Set the four points of the texture quad
-        CPointInt p[4];
-        p[0]   = spComponentMapIter->second->pos;
-        p[1].x = spComponentMapIter->second->pos.x + spComponentMapIter->second->pTexture->size.w;
-        p[1].y = spComponentMapIter->second->pos.y;
-        p[2].x = spComponentMapIter->second->pos.x;
-        p[2].y = spComponentMapIter->second->pos.y + spComponentMapIter->second->pTexture->size.h;
-        p[3].x = spComponentMapIter->second->pos.x + spComponentMapIter->second->pTexture->size.w;
-        p[3].y = spComponentMapIter->second->pos.y + spComponentMapIter->second->pTexture->size.h;
-
-        // Get another iterator so that we can compare every texture's placement against every other
-        // texture's placement
-        SPComponentMapIter tmpComponentMapIter = spComponentMap.begin();
-
-        while( tmpComponentMapIter != spComponentMap.end() )
-        {
-            // We don't want to compare a texture against itself
-            if( tmpComponentMapIter != spComponentMapIter )
-            {
-                // Set the bounds to check against
-                uint right, left, top, bottom;
-                right  = tmpComponentMapIter->second->pos.x + tmpComponentMapIter->second->pTexture->size.w;
-                left   = tmpComponentMapIter->second->pos.x;
-                top    = tmpComponentMapIter->second->pos.y + tmpComponentMapIter->second->pTexture->size.h;
-                bottom = tmpComponentMapIter->second->pos.y;
-
-                // Check each point against each bound
-                for( int k = 0; k < 4; ++k )
-                {
-                    if( NCollisionFunc2D::PointInRect( p[k], top, bottom, left, right ) )
-                        throw NExcept::CCriticalException( "Mega Texture Error!", 
-                            boost::str( boost::format("Error creating a mega texture due to texture overlap.\n\n%s\nLine: %s") % __FUNCTION__ % __LINE__ ));
-                }
-            }
+        CMegaTextureComponent * pComponent = pComponentVec[i];
 
-            ++tmpComponentMapIter;
-        }
-
-        ++spComponentMapIter;
+        rectVec[i] = CAtlasRect( pComponent->pos.x, 
+                                 pComponent->pos.y, 
+                                 static_cast<int>(pComponent->pTexture->size.w), 
+                                 static_cast<int>(pComponent->pTexture->size.h) );
     }
 
+    std::vector< std::pair<size_t, size_t> > overlapVec;
+    NAtlasPacker::FindOverlaps( rectVec, pageTableVec, overlapVec );
+
+    if( !overlapVec.empty() )
+        throw NExcept::CCriticalException( "Mega Texture Error!", 
+            boost::str( boost::format("Error creating a mega texture due to texture overlap (%d pairs, the first are components %d and %d on page %d).\n\n%s\nLine: %s") 
+                % overlapVec.size() % overlapVec[0].first % overlapVec[0].second % pageTableVec[overlapVec[0].first] % __FUNCTION__ % __LINE__ ));
+
 }	// CheckTextureOverlap
 
 
@@ -562,93 +892,319 @@ void CMegaTexture::CheckTextureOverlap()
 ************************************************************************/
 void CMegaTexture::CalculateGroupUVs()
 {
-    spComponentMapIter = spComponentMap.begin();
-    while( spComponentMapIter != spComponentMap.end() )
+    uvTableVec.resize( pComponentVec.size() * 4 );
+
+    for( size_t i = 0; i < pComponentVec.size(); ++i )
     {
+        CMegaTextureComponent * pComponent = pComponentVec[i];
+
         // Set the four points of the texture quad
         CPoint p[2];
-        p[0].x = spComponentMapIter->second->pos.x + 0.5f;
-        p[0].y = spComponentMapIter->second->pos.y + 0.5f;
-        p[1].x = spComponentMapIter->second->pos.x + spComponentMapIter->second->pTexture->size.w - 0.5f;
-        p[1].y = spComponentMapIter->second->pos.y + spComponentMapIter->second->pTexture->size.h - 0.5f;
+        p[0].x = pComponent->pos.x + 0.5f;
+        p[0].y = pComponent->pos.y + 0.5f;
+        p[1].x = pComponent->pos.x + pComponent->pTexture->size.w - 0.5f;
+        p[1].y = pComponent->pos.y + pComponent->pTexture->size.h - 0.5f;
 
-        // We flip the v's because the textures in our mega texture are upside-down for some reason
-        spComponentMapIter->second->uv[0] = p[0].x / spMegaTexture->size.w;
-        spComponentMapIter->second->uv[1] = p[0].y / spMegaTexture->size.h;
-        spComponentMapIter->second->uv[2] = p[1].x / spMegaTexture->size.w;
-        spComponentMapIter->second->uv[3] = p[1].y / spMegaTexture->size.h;
+        // The UVs are in the space of the component's page
+        const NText::CTextureFor2D & page = spPageVec[pageTableVec[i]];
 
-        ++spComponentMapIter;
+        // We flip the v's because the textures in our mega texture are upside-down for some reason
+        pComponent->uv[0] = p[0].x / page.size.w;
+        pComponent->uv[1] = p[0].y / page.size.h;
+        pComponent->uv[2] = p[1].x / page.size.w;
+        pComponent->uv[3] = p[1].y / page.size.h;
+
+        // Copy them to the UV table
+        for( int j = 0; j < 4; ++j )
+            uvTableVec[i * 4 + j] = pComponent->uv[j];
     }
         
 }	// CalculateGroupUVs
 
 
 /************************************************************************
-*    desc:  Render the textures to a single texture surface
-*
-*	 param:	const string & group - group from the texture manager to use
+*    desc:  Calculate the hulls of a mega texture. Each hull is the
+*           octagon cut by the tightest horizontal, vertical and
+*           diagonal lines around the pixels with any alpha. The
+*           pixels' whole squares are inside it, so nothing that can
+*           be seen is lost. A component with no alpha at all keeps
+*           the whole quad
 ************************************************************************/
-void CMegaTexture::CopyToMegaTexture( const std::string & group )
+void CMegaTexture::CalculateGroupHulls()
 {
-    HRESULT hresult;
+    hullTableVec.resize( pComponentVec.size() * HULL_VERTEX_COUNT * 2 );
 
-    CComPtr< IDirect3DSurface9 > spTmpMegaSurface;
-    
-    // Create the mega texture
-    if( FAILED( hresult = CXDevice::Instance().GetXDevice()->CreateTexture( 
-            spMegaTexture->size.w,
-            spMegaTexture->size.h,
-            1, 
-            0, 
-            D3DFMT_A8R8G8B8,
-            D3DPOOL_MANAGED, 
-            &spMegaTexture->spTexture,
-            NULL ) ) )
+    std::vector<D3DLOCKED_RECT> lockedRectVec;
+    LockPages( lockedRectVec );
+
+    for( size_t i = 0; i < pComponentVec.size(); ++i )
     {
-        DisplayError( hresult, __FUNCTION__, __LINE__ );
+        CMegaTextureComponent * pComponent = pComponentVec[i];
+        const D3DLOCKED_RECT & lockedRect = lockedRectVec[pageTableVec[i]];
+
+        const int width = static_cast<int>(pComponent->pTexture->size.w);
+        const int height = static_cast<int>(pComponent->pTexture->size.h);
+
+        // Bounds of the seen pixels on the x, y, x + y and x - y axes. The pixel
+        // centers are at whole numbers, so the bounds are half a pixel past them
+        float left = 1e9f, right = -1e9f, top = 1e9f, bottom = -1e9f;
+        float sumMin = 1e9f, sumMax = -1e9f, diffMin = 1e9f, diffMax = -1e9f;
+
+        for( int y = 0; y < height; ++y )
+        {
+            const DWORD * pRow = reinterpret_cast<const DWORD *>( static_cast<const BYTE *>(lockedRect.pBits) + 
+                ((pComponent->pos.y + y) * lockedRect.Pitch) ) + pComponent->pos.x;
+
+            for( int x = 0; x < width; ++x )
+            {
+                if( (pRow[x] >> 24) != 0 )
+                {
+                    left = std::min( left, x - 0.5f );
+                    right = std::max( right, x + 0.5f );
+                    top = std::min( top, y - 0.5f );
+                    bottom = std::max( bottom, y + 0.5f );
+                    sumMin = std::min( sumMin, static_cast<float>(x + y - 1) );
+                    sumMax = std::max( sumMax, static_cast<float>(x + y + 1) );
+                    diffMin = std::min( diffMin, static_cast<float>(x - y - 1) );
+                    diffMax = std::max( diffMax, static_cast<float>(x - y + 1) );
+                }
+            }
+        }
+
+        // The UVs only go from the first pixel center to the last
+        const float maxX = static_cast<float>(std::max( width - 1, 1 ));
+        const float maxY = static_cast<float>(std::max( height - 1, 1 ));
+
+        if( right < left )
+        {
+            left = 0; right = maxX;
+            top = 0; bottom = maxY;
+        }
+
+        left = std::max( left, 0.f );
+        right = std::min( right, maxX );
+        top = std::max( top, 0.f );
+        bottom = std::min( bottom, maxY );
+
+        // Keep the diagonals from cutting past the corners of the box
+        sumMin = std::max( sumMin, left + top );
+        sumMax = std::min( sumMax, right + bottom );
+        diffMin = std::max( diffMin, left - bottom );
+        diffMax = std::min( diffMax, right - top );
+
+        // The corners going clockwise from the top left diagonal
+        const float corner[HULL_VERTEX_COUNT * 2] =
+        {
+            sumMin - top,     top,
+            diffMax + top,    top,
+            right,            right - diffMax,
+            right,            sumMax - right,
+            sumMax - bottom,  bottom,
+            diffMin + bottom, bottom,
+            left,             left - diffMin,
+            left,             sumMin - left
+        };
+
+        float * pHull = &hullTableVec[i * HULL_VERTEX_COUNT * 2];
+
+        for( int j = 0; j < HULL_VERTEX_COUNT; ++j )
+        {
+            pHull[j * 2] = corner[j * 2] / maxX;
+            pHull[j * 2 + 1] = corner[j * 2 + 1] / maxY;
+        }
     }
 
-    // Grab the surface of the mega texture
-    if( FAILED( hresult = spMegaTexture->spTexture->GetSurfaceLevel( 0, &spTmpMegaSurface ) ) )
-        DisplayError( hresult, __FUNCTION__, __LINE__ );
+    UnlockPages();
+
+}	// CalculateGroupHulls
 
-    spComponentMapIter = spComponentMap.begin();
-    while( spComponentMapIter != spComponentMap.end() )
+
+/************************************************************************
+*    desc:  Calculate the occluders of a mega texture. Each occluder is
+*           the biggest rectangle of the component's shape, centered on
+*           it, whose pixels are all fully opaque. Only the pixel
+*           centers are taken, because the filtering blends the outer
+*           half of an edge pixel with its neighbor. A component that's
+*           opaque all over gets all of it, so IsOpaque can tell it apart
+************************************************************************/
+void CMegaTexture::CalculateGroupOccluders()
+{
+    occluderTableVec.assign( pComponentVec.size() * 4, 0.f );
+
+    std::vector<D3DLOCKED_RECT> lockedRectVec;
+    LockPages( lockedRectVec );
+
+    // Count of the opaque pixels above and to the left of each pixel, so any
+    // rectangle can be checked with four reads
+    std::vector<int> opaqueSumVec;
+
+    for( size_t i = 0; i < pComponentVec.size(); ++i )
     {
-        // Temporary texture and surface of the texture
-        CComPtr< IDirect3DSurface9 > spTmpSurface;
+        CMegaTextureComponent * pComponent = pComponentVec[i];
+        const D3DLOCKED_RECT & lockedRect = lockedRectVec[pageTableVec[i]];
+
+        const int width = static_cast<int>(pComponent->pTexture->size.w);
+        const int height = static_cast<int>(pComponent->pTexture->size.h);
+        const int sumWidth = width + 1;
+
+        opaqueSumVec.assign( sumWidth * (height + 1), 0 );
+
+        for( int y = 0; y < height; ++y )
+        {
+            const DWORD * pRow = reinterpret_cast<const DWORD *>( static_cast<const BYTE *>(lockedRect.pBits) + 
+                ((pComponent->pos.y + y) * lockedRect.Pitch) ) + pComponent->pos.x;
+
+            for( int x = 0; x < width; ++x )
+            {
+                opaqueSumVec[(y + 1) * sumWidth + x + 1] = ((pRow[x] >> 24) == 0xFF ? 1 : 0) +
+                    opaqueSumVec[y * sumWidth + x + 1] + opaqueSumVec[(y + 1) * sumWidth + x] - opaqueSumVec[y * sumWidth + x];
+            }
+        }
+
+        // The search below never reaches the whole component
+        if( opaqueSumVec[height * sumWidth + width] == width * height )
+        {
+            float * pOccluder = &occluderTableVec[i * 4];
+            pOccluder[0] = 0.f;
+            pOccluder[1] = 0.f;
+            pOccluder[2] = 1.f;
+            pOccluder[3] = 1.f;
+
+            continue;
+        }
+
+        // Find the biggest scale of the centered rectangle that's still all opaque
+        int bestLeft = 0, bestTop = 0, bestRight = -1, bestBottom = -1;
+        float low = 0.f, high = 1.f;
 
-        if( FAILED( hresult = spComponentMapIter->second->pTexture->spTexture->GetSurfaceLevel( 0, &spTmpSurface ) ) )
+        for( int step = 0; step < 12; ++step )
+        {
+            const float scale = (low + high) * 0.5f;
+
+            const int left = static_cast<int>( std::ceil( (width - (width * scale)) * 0.5f ) );
+            const int top = static_cast<int>( std::ceil( (height - (height * scale)) * 0.5f ) );
+            const int right = width - left;
+            const int bottom = height - top;
+
+            const int area = (right - left) * (bottom - top);
+            const int opaqueCount = (area <= 0) ? -1 :
+                opaqueSumVec[bottom * sumWidth + right] - opaqueSumVec[top * sumWidth + right] -
+                opaqueSumVec[bottom * sumWidth + left] + opaqueSumVec[top * sumWidth + left];
+
+            if( opaqueCount == area )
+            {
+                bestLeft = left;
+                bestTop = top;
+                bestRight = right - 1;
+                bestBottom = bottom - 1;
+                low = scale;
+            }
+            else
+            {
+                high = scale;
+            }
+        }
+
+        // The UVs only go from the first pixel center to the last
+        const float maxX = static_cast<float>(std::max( width - 1, 1 ));
+        const float maxY = static_cast<float>(std::max( height - 1, 1 ));
+
+        if( bestRight > bestLeft && bestBottom > bestTop )
+        {
+            float * pOccluder = &occluderTableVec[i * 4];
+            pOccluder[0] = bestLeft / maxX;
+            pOccluder[1] = bestTop / maxY;
+            pOccluder[2] = bestRight / maxX;
+            pOccluder[3] = bestBottom / maxY;
+        }
+    }
+
+    UnlockPages();
+
+}	// CalculateGroupOccluders
+
+
+/************************************************************************
+*    desc:  Lock every page to read the copied textures
+*
+*	 param:	vector<D3DLOCKED_RECT> & lockedRectVec - locked rect of each page
+************************************************************************/
+void CMegaTexture::LockPages( std::vector<D3DLOCKED_RECT> & lockedRectVec )
+{
+    HRESULT hresult;
+
+    lockedRectVec.resize( spPageVec.size() );
+
+    for( size_t i = 0; i < spPageVec.size(); ++i )
+        if( FAILED( hresult = spPageVec[i].spTexture->LockRect( 0, &lockedRectVec[i], NULL, D3DLOCK_READONLY ) ) )
             DisplayError( hresult, __FUNCTION__, __LINE__ );
 
+}	// LockPages
+
+
+/************************************************************************
+*    desc:  Unlock the pages locked to read them
+************************************************************************/
+void CMegaTexture::UnlockPages()
+{
+    for( size_t i = 0; i < spPageVec.size(); ++i )
+        spPageVec[i].spTexture->UnlockRect( 0 );
+
+}	// UnlockPages
+
+
+/************************************************************************
+*    desc:  Copy the textures onto their pages through the device
+*
+*	 param:	const string & group  - group the textures are from
+*			size_t firstComponent - first component of the group
+*			size_t firstPage      - first page of the group
+************************************************************************/
+void CMegaTexture::CopyToMegaTexture( const std::string & group, size_t firstComponent, size_t firstPage )
+{
+    HRESULT hresult;
+
+    // Create the pages of the group
+    for( size_t i = firstPage; i < spPageVec.size(); ++i )
+    {
+        if( FAILED( hresult = CGraphicsDevice2D::Instance().CreateTexture( 
+                spPageVec[i].size.w,
+                spPageVec[i].size.h,
+                1, 
+                0, 
+                D3DFMT_A8R8G8B8,
+                D3DPOOL_MANAGED, 
+                &spPageVec[i].spTexture ) ) )
+        {
+            DisplayError( hresult, __FUNCTION__, __LINE__ );
+        }
+    }
+
+    for( size_t i = firstComponent; i < pComponentVec.size(); ++i )
+    {
+        CMegaTextureComponent * pComponent = pComponentVec[i];
+
         // Set up the source and destination rects. Both rects are cropped by half a pixel on 
         // each edge to preserve the texture as best as possible
         RECT srcRect, destRect;
         srcRect.left = 0.5f;
         srcRect.top = 0.5f;
-        srcRect.right = spComponentMapIter->second->pTexture->size.w - 0.5f;
-        srcRect.bottom = spComponentMapIter->second->pTexture->size.h - 0.5f;
-        destRect.left = spComponentMapIter->second->pos.x;
-        destRect.top = spComponentMapIter->second->pos.y;
+        srcRect.right = pComponent->pTexture->size.w - 0.5f;
+        srcRect.bottom = pComponent->pTexture->size.h - 0.5f;
+        destRect.left = pComponent->pos.x;
+        destRect.top = pComponent->pos.y;
         destRect.right = destRect.left + srcRect.right;
         destRect.bottom = destRect.top + srcRect.bottom;
 
-        // Load the temporary surface of the single texture into the surface of the mega texture
-        if( FAILED( hresult = D3DXLoadSurfaceFromSurface( 
-                spTmpMegaSurface,
-                NULL,
-                &destRect,
-                spTmpSurface,
-                NULL,
-                &srcRect,
-                D3DX_FILTER_NONE,
-                0 ) ) )
+        // Copy the single texture onto its page
+        if( FAILED( hresult = CGraphicsDevice2D::Instance().CopyTexture( 
+                pComponent->pTexture->spTexture,
+                srcRect,
+                spPageVec[pageTableVec[i]].spTexture,
+                destRect ) ) )
         {
             DisplayError( hresult, __FUNCTION__, __LINE__ );
         }
-
-        ++spComponentMapIter;
     }
 
 }	// CopyToMegaTexture
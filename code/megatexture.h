@@ -18,21 +18,23 @@
 
 // Standard lib dependencies
 #include <string>
+#include <vector>
 
 // Boost lib dependencies
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
-#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/cstdint.hpp>
 
 // Game lib dependencies
 #include <common/pointint.h>
 #include <common/size.h>
 #include <common/uv.h>
 #include <common/defs.h>
+#include <common/atlaspacker.h>
 
 // Forward declaration(s)
 class CMegaTextureComponent;
-class CTexturePartition;
 
 namespace NText
 {
@@ -42,60 +44,163 @@ namespace NText
 // Typedefs for boost containers and objects
 typedef boost::ptr_map< NText::CTextureFor2D *, CMegaTextureComponent > SPComponentMap;
 typedef SPComponentMap::iterator SPComponentMapIter;
-typedef boost::ptr_vector< boost::ptr_vector<CTexturePartition> > SPPartitionVecVec;
+typedef boost::unordered_map< NText::CTextureFor2D *, uint > ComponentIdMap;
+typedef boost::ptr_vector< NText::CTextureFor2D > SPTextureVec;
 
 class CMegaTexture
 {
 public:
 
+    // Number of corners of a component's hull. Every hull has this many, some may be the same point
+    static const int HULL_VERTEX_COUNT = 8;
+
     // Constructor
     CMegaTexture();
 
     // Destructor
     virtual ~CMegaTexture();
 
-    // Create a mega texture using the group name passed in
+    // Set how the textures are packed and the order they're packed in. Call before creating
+    // the mega texture. MaxRects with the best short side fit, tallest first, by default
+    void SetPackMode( EAtlasPacker packer, EAtlasSort sort );
+
+    // Set the folder the mega textures are baked into. A group whose textures and pack mode
+    // haven't changed since it was baked loads from its cache file instead of being packed
+    // and copied again. Any other group is baked when it's created. Empty, the default,
+    // turns the cache off
+    void SetCacheFolder( const std::string & folder );
+
+    // Create a mega texture using the group name passed in. Textures that don't fit within the
+    // most size the device takes spill onto more pages
     void CreateMegaTexture( const std::string & group, uint wLimit );
 
-    // Get the mega texture's texture
-    NText::CTextureFor2D * GetTexture();
+    // Create a mega texture out of the textures passed in, in place of the texture manager's
+    // group. The group names the cache file. The textures are still owned by the caller
+    void CreateMegaTexture( const std::string & group, const std::vector<NText::CTextureFor2D *> & pTextureVector, uint wLimit );
+
+    // Get the texture of a page of the mega texture
+    NText::CTextureFor2D * GetTexture( uint page = 0 );
+
+    // Get the number of pages of the mega texture
+    size_t GetPageCount() const
+    { return spPageVec.size(); }
+
+    // Get the page a component is on. Its UVs are in the space of that page
+    uint GetPage( uint componentId ) const
+    { return pageTableVec[componentId]; }
 
     // Get the UVs of a texture
     float * GetUVs( NText::CTextureFor2D * pTex );
 
-    // Render the mega texture
-    void Render();
+    // Get the ID of a texture's component. The IDs are dense and given out when the
+    // mega texture is created, so they can index the UV table
+    uint GetComponentId( NText::CTextureFor2D * pTex ) const;
+
+    // Get the UVs of a component from the UV table. Only reads, so it's safe from any thread
+    const float * GetUVs( uint componentId ) const
+    { return &uvTableVec[componentId * 4]; }
+
+    // Get the hull of a component. HULL_VERTEX_COUNT x, y pairs going clockwise, in the 0 to 1 space
+    // of the component's UVs with y going down. Only reads, so it's safe from any thread
+    const float * GetHull( uint componentId ) const
+    { return &hullTableVec[componentId * HULL_VERTEX_COUNT * 2]; }
+
+    // Get the fully opaque rectangle of a component. Left, top, right and bottom in the same
+    // space as the hull. Left isn't less than right if the component has none
+    const float * GetOccluder( uint componentId ) const
+    { return &occluderTableVec[componentId * 4]; }
+
+    // Is every pixel of a component fully opaque. Only those can be drawn without blending
+    bool IsOpaque( uint componentId ) const
+    {
+        const float * pOccluder = GetOccluder( componentId );
+        return (pOccluder[0] == 0.f) && (pOccluder[1] == 0.f) && (pOccluder[2] == 1.f) && (pOccluder[3] == 1.f);
+    }
+
+    // Get the number of components in the mega texture
+    size_t GetComponentCount() const
+    { return pComponentVec.size(); }
+
+    // Render a page of the mega texture
+    void Render( uint page = 0 );
 
 private:
 
     // Initialize the mega texture's buffers
     void InitBuffers();
 
-    // Try to fit a texture into partitions
-    bool FitTextureToPartition( int row, int column, 
-                                CMegaTextureComponent * pComponent, 
-                                SPPartitionVecVec & spPartVecVec ); 
+    // Add the textures of a group to the components and give them IDs
+    void AddComponents( const std::vector<NText::CTextureFor2D *> & pTextureVector );
+
+    // Get the key of a group's cache file. It covers everything the baked group is made
+    // from. Returns false if the textures can't be read to make it
+    bool GetCacheKey( const std::string & group, uint wLimit, 
+                      const std::vector<NText::CTextureFor2D *> & pTextureVector, boost::uint64_t & key );
+
+    // Get the path of a group's cache file
+    std::string GetCachePath( const std::string & group ) const;
 
-    // If any textures are overlapping, assert
+    // Load a group from its cache file. Returns false, with nothing added, if there's no
+    // cache file or it was baked from something else
+    bool LoadCache( const std::string & group, boost::uint64_t key, const std::vector<NText::CTextureFor2D *> & pTextureVector );
+
+    // Bake the group just created into its cache file
+    void SaveCache( const std::string & group, boost::uint64_t key, size_t firstComponent, size_t firstPage );
+
+    // If any textures on the same page are overlapping, throw
     void CheckTextureOverlap();
 
     // Calculate the UVs of a mega texture
     void CalculateGroupUVs();
 
-    // Render the textures to a single texture surface
-    void CopyToMegaTexture( const std::string & group );
+    // Calculate the hulls around the pixels of each component that can be seen
+    void CalculateGroupHulls();
+
+    // Calculate the fully opaque rectangle in the middle of each component
+    void CalculateGroupOccluders();
+
+    // Lock every page to read the copied textures
+    void LockPages( std::vector<D3DLOCKED_RECT> & lockedRectVec );
+
+    // Unlock the pages locked to read them
+    void UnlockPages();
+
+    // Copy the textures onto their pages
+    void CopyToMegaTexture( const std::string & group, size_t firstComponent, size_t firstPage );
 
     // Display error information
     void DisplayError( HRESULT hr, const std::string & functionStr, int lineValue );
 
 private:
 
-    // Mega texture
-    boost::scoped_ptr< NText::CTextureFor2D > spMegaTexture;
+    // The pages of the mega texture
+    SPTextureVec spPageVec;
 
     // Map to hold the texture components
     SPComponentMap spComponentMap;
-    SPComponentMapIter spComponentMapIter;
+
+    // The components in ID order and the ID of each texture. These objects own none of the components
+    std::vector<CMegaTextureComponent *> pComponentVec;
+    ComponentIdMap componentIdMap;
+
+    // The page of every component in ID order
+    std::vector<uint> pageTableVec;
+
+    // The UVs of every component in ID order. Four floats per component
+    std::vector<float> uvTableVec;
+
+    // The hull of every component in ID order. HULL_VERTEX_COUNT x, y pairs per component
+    std::vector<float> hullTableVec;
+
+    // The fully opaque rectangle of every component in ID order. Four floats per component
+    std::vector<float> occluderTableVec;
+
+    // How the textures are packed and the order they're packed in
+    EAtlasPacker atlasPacker;
+    EAtlasSort atlasSort;
+
+    // Folder the groups are baked into, ending in a separator. Empty if there's no cache
+    std::string cacheFolder;
 
     // The mega texture's buffers
     CComPtr< IDirect3DVertexBuffer9 > spVertexBuffer;
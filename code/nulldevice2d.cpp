@@ -0,0 +1,822 @@
+/************************************************************************
+*    FILE NAME:       nulldevice2d.cpp
+*
+*    DESCRIPTION:     Device for the 2D rendering that needs no card.
+*                     Buffers and textures live in plain memory, so they
+*                     can be locked and filled like the real ones. The
+*                     draws are only counted.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/nulldevice2d.h>
+
+// Standard lib dependencies
+#include <cstring>
+#include <vector>
+
+// Boost lib dependencies
+#include <boost/chrono.hpp>
+
+// The largest texture the device says it can make
+const uint MAX_TEXTURE_SIZE = 4096;
+
+// The stream frequency bits that aren't the count
+const UINT STREAM_FREQUENCY_FLAGS = D3DSTREAMSOURCE_INDEXEDDATA | D3DSTREAMSOURCE_INSTANCEDATA;
+
+// The timestamps count nanoseconds
+const UINT64 TIMESTAMP_FREQUENCY = 1000000000;
+
+/************************************************************************
+*    desc:  Get the bytes of a pixel. The formats the game doesn't use
+*           are taken as four bytes
+************************************************************************/
+static UINT GetPixelSize( D3DFORMAT format )
+{
+    switch( format )
+    {
+        case D3DFMT_A32B32G32R32F: return 16;
+        case D3DFMT_A16B16G16R16F: return 8;
+        case D3DFMT_L8:
+        case D3DFMT_A8:            return 1;
+        default:                   return 4;
+    }
+
+}	// GetPixelSize
+
+
+/************************************************************************
+*    desc:  The parts every resource in plain memory has in common
+************************************************************************/
+template <class TInterface>
+class CNullResource2D : public TInterface
+{
+public:
+
+    CNullResource2D( D3DRESOURCETYPE _type, DWORD _usage, D3DPOOL _pool )
+        : refCount(1), priority(0), type(_type), usage(_usage), pool(_pool)
+    {}
+
+    virtual ~CNullResource2D(){}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)( REFIID, void ** ppObject )
+    { *ppObject = NULL; return E_NOINTERFACE; }
+
+    STDMETHOD_(ULONG, AddRef)()
+    { return ++refCount; }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        const ULONG count = --refCount;
+        if( count == 0 )
+            delete this;
+
+        return count;
+    }
+
+    // IDirect3DResource9. There's no device to hand out and no private data to keep
+    STDMETHOD(GetDevice)( IDirect3DDevice9 ** ppDevice )
+    { *ppDevice = NULL; return D3DERR_INVALIDCALL; }
+
+    STDMETHOD(SetPrivateData)( REFGUID, const void *, DWORD, DWORD )
+    { return D3DERR_INVALIDCALL; }
+
+    STDMETHOD(GetPrivateData)( REFGUID, void *, DWORD * )
+    { return D3DERR_NOTFOUND; }
+
+    STDMETHOD(FreePrivateData)( REFGUID )
+    { return D3DERR_NOTFOUND; }
+
+    STDMETHOD_(DWORD, SetPriority)( DWORD _priority )
+    { const DWORD oldPriority = priority; priority = _priority; return oldPriority; }
+
+    STDMETHOD_(DWORD, GetPriority)()
+    { return priority; }
+
+    STDMETHOD_(void, PreLoad)()
+    {}
+
+    STDMETHOD_(D3DRESOURCETYPE, GetType)()
+    { return type; }
+
+protected:
+
+    // Lock a range of the memory. A size of zero locks to the end
+    HRESULT LockRange( std::vector<BYTE> & dataVec, UINT offset, UINT size, void ** ppData )
+    {
+        if( (size == 0) && (offset <= dataVec.size()) )
+            size = static_cast<UINT>(dataVec.size()) - offset;
+
+        if( (ppData == NULL) || (offset + size > dataVec.size()) )
+            return D3DERR_INVALIDCALL;
+
+        *ppData = dataVec.empty() ? NULL : &dataVec[offset];
+
+        return D3D_OK;
+    }
+
+    ULONG refCount;
+    DWORD priority;
+    D3DRESOURCETYPE type;
+    DWORD usage;
+    D3DPOOL pool;
+};
+
+
+/************************************************************************
+*    desc:  Vertex buffer in plain memory
+************************************************************************/
+class CNullVertexBuffer2D : public CNullResource2D<IDirect3DVertexBuffer9>
+{
+public:
+
+    CNullVertexBuffer2D( UINT length, DWORD _usage, DWORD _fvf, D3DPOOL _pool )
+        : CNullResource2D<IDirect3DVertexBuffer9>( D3DRTYPE_VERTEXBUFFER, _usage, _pool ), dataVec(length), fvf(_fvf)
+    {}
+
+    STDMETHOD(Lock)( UINT offset, UINT size, void ** ppData, DWORD )
+    { return LockRange( dataVec, offset, size, ppData ); }
+
+    STDMETHOD(Unlock)()
+    { return D3D_OK; }
+
+    STDMETHOD(GetDesc)( D3DVERTEXBUFFER_DESC * pDesc )
+    {
+        pDesc->Format = D3DFMT_VERTEXDATA;
+        pDesc->Type = type;
+        pDesc->Usage = usage;
+        pDesc->Pool = pool;
+        pDesc->Size = static_cast<UINT>(dataVec.size());
+        pDesc->FVF = fvf;
+
+        return D3D_OK;
+    }
+
+private:
+
+    std::vector<BYTE> dataVec;
+    DWORD fvf;
+};
+
+
+/************************************************************************
+*    desc:  Index buffer in plain memory
+************************************************************************/
+class CNullIndexBuffer2D : public CNullResource2D<IDirect3DIndexBuffer9>
+{
+public:
+
+    CNullIndexBuffer2D( UINT length, DWORD _usage, D3DFORMAT _format, D3DPOOL _pool )
+        : CNullResource2D<IDirect3DIndexBuffer9>( D3DRTYPE_INDEXBUFFER, _usage, _pool ), dataVec(length), format(_format)
+    {}
+
+    STDMETHOD(Lock)( UINT offset, UINT size, void ** ppData, DWORD )
+    { return LockRange( dataVec, offset, size, ppData ); }
+
+    STDMETHOD(Unlock)()
+    { return D3D_OK; }
+
+    STDMETHOD(GetDesc)( D3DINDEXBUFFER_DESC * pDesc )
+    {
+        pDesc->Format = format;
+        pDesc->Type = type;
+        pDesc->Usage = usage;
+        pDesc->Pool = pool;
+        pDesc->Size = static_cast<UINT>(dataVec.size());
+
+        return D3D_OK;
+    }
+
+private:
+
+    std::vector<BYTE> dataVec;
+    D3DFORMAT format;
+};
+
+
+/************************************************************************
+*    desc:  Texture in plain memory. Only the top level is kept. Its
+*           surface isn't handed out. The device copies textures by
+*           locking them
+************************************************************************/
+class CNullTexture2D : public CNullResource2D<IDirect3DTexture9>
+{
+public:
+
+    CNullTexture2D( UINT _width, UINT _height, DWORD _usage, D3DFORMAT _format, D3DPOOL _pool )
+        : CNullResource2D<IDirect3DTexture9>( D3DRTYPE_TEXTURE, _usage, _pool ),
+          width(_width), height(_height), format(_format), pixelSize(GetPixelSize( _format )), pitch(_width * pixelSize)
+    {
+        dataVec.resize( pitch * height );
+    }
+
+    // IDirect3DBaseTexture9
+    STDMETHOD_(DWORD, SetLOD)( DWORD )
+    { return 0; }
+
+    STDMETHOD_(DWORD, GetLOD)()
+    { return 0; }
+
+    STDMETHOD_(DWORD, GetLevelCount)()
+    { return 1; }
+
+    STDMETHOD(SetAutoGenFilterType)( D3DTEXTUREFILTERTYPE )
+    { return D3D_OK; }
+
+    STDMETHOD_(D3DTEXTUREFILTERTYPE, GetAutoGenFilterType)()
+    { return D3DTEXF_LINEAR; }
+
+    STDMETHOD_(void, GenerateMipSubLevels)()
+    {}
+
+    // IDirect3DTexture9
+    STDMETHOD(GetLevelDesc)( UINT level, D3DSURFACE_DESC * pDesc )
+    {
+        if( level != 0 )
+            return D3DERR_INVALIDCALL;
+
+        pDesc->Format = format;
+        pDesc->Type = D3DRTYPE_SURFACE;
+        pDesc->Usage = usage;
+        pDesc->Pool = pool;
+        pDesc->MultiSampleType = D3DMULTISAMPLE_NONE;
+        pDesc->MultiSampleQuality = 0;
+        pDesc->Width = width;
+        pDesc->Height = height;
+
+        return D3D_OK;
+    }
+
+    STDMETHOD(GetSurfaceLevel)( UINT, IDirect3DSurface9 ** ppSurface )
+    { *ppSurface = NULL; return D3DERR_NOTAVAILABLE; }
+
+    STDMETHOD(LockRect)( UINT level, D3DLOCKED_RECT * pLockedRect, const RECT * pRect, DWORD )
+    {
+        if( (level != 0) || dataVec.empty() )
+            return D3DERR_INVALIDCALL;
+
+        const UINT offset = (pRect == NULL) ? 0 : (pRect->top * pitch) + (pRect->left * pixelSize);
+
+        pLockedRect->Pitch = pitch;
+        pLockedRect->pBits = &dataVec[offset];
+
+        return D3D_OK;
+    }
+
+    STDMETHOD(UnlockRect)( UINT )
+    { return D3D_OK; }
+
+    STDMETHOD(AddDirtyRect)( const RECT * )
+    { return D3D_OK; }
+
+private:
+
+    UINT width;
+    UINT height;
+    D3DFORMAT format;
+    UINT pixelSize;
+    UINT pitch;
+    std::vector<BYTE> dataVec;
+};
+
+
+/************************************************************************
+*    desc:  Vertex declaration that keeps a copy of its elements
+************************************************************************/
+class CNullVertexDeclaration2D : public IDirect3DVertexDeclaration9
+{
+public:
+
+    CNullVertexDeclaration2D( const D3DVERTEXELEMENT9 * pElement )
+        : refCount(1)
+    {
+        // The elements end with D3DDECL_END, which is kept too
+        do
+        {
+            elementVec.push_back( *pElement );
+        }
+        while( (pElement++)->Stream != 0xFF );
+    }
+
+    virtual ~CNullVertexDeclaration2D(){}
+
+    STDMETHOD(QueryInterface)( REFIID, void ** ppObject )
+    { *ppObject = NULL; return E_NOINTERFACE; }
+
+    STDMETHOD_(ULONG, AddRef)()
+    { return ++refCount; }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        const ULONG count = --refCount;
+        if( count == 0 )
+            delete this;
+
+        return count;
+    }
+
+    STDMETHOD(GetDevice)( IDirect3DDevice9 ** ppDevice )
+    { *ppDevice = NULL; return D3DERR_INVALIDCALL; }
+
+    STDMETHOD(GetDeclaration)( D3DVERTEXELEMENT9 * pElement, UINT * pCount )
+    {
+        if( pElement != NULL )
+            std::memcpy( pElement, &elementVec[0], elementVec.size() * sizeof( D3DVERTEXELEMENT9 ) );
+
+        *pCount = static_cast<UINT>(elementVec.size());
+
+        return D3D_OK;
+    }
+
+private:
+
+    ULONG refCount;
+    std::vector<D3DVERTEXELEMENT9> elementVec;
+};
+
+
+/************************************************************************
+*    desc:  Timestamp query. There's no GPU, so a timestamp is read off
+*           the CPU clock when it's issued. The answer is ready at once,
+*           the timestamps are never disjoint and they count nanoseconds
+************************************************************************/
+class CNullQuery2D : public IDirect3DQuery9
+{
+public:
+
+    CNullQuery2D( D3DQUERYTYPE _type )
+        : refCount(1), type(_type), timestamp(0), issued(false)
+    {}
+
+    virtual ~CNullQuery2D(){}
+
+    STDMETHOD(QueryInterface)( REFIID, void ** ppObject )
+    { *ppObject = NULL; return E_NOINTERFACE; }
+
+    STDMETHOD_(ULONG, AddRef)()
+    { return ++refCount; }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        const ULONG count = --refCount;
+        if( count == 0 )
+            delete this;
+
+        return count;
+    }
+
+    STDMETHOD(GetDevice)( IDirect3DDevice9 ** ppDevice )
+    { *ppDevice = NULL; return D3DERR_INVALIDCALL; }
+
+    STDMETHOD_(D3DQUERYTYPE, GetType)()
+    { return type; }
+
+    STDMETHOD_(DWORD, GetDataSize)()
+    { return (type == D3DQUERYTYPE_TIMESTAMPDISJOINT) ? sizeof( BOOL ) : sizeof( UINT64 ); }
+
+    STDMETHOD(Issue)( DWORD flags )
+    {
+        if( flags & D3DISSUE_END )
+        {
+            timestamp = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                boost::chrono::steady_clock::now().time_since_epoch() ).count();
+            issued = true;
+        }
+
+        return D3D_OK;
+    }
+
+    STDMETHOD(GetData)( void * pData, DWORD size, DWORD )
+    {
+        if( !issued || (size < GetDataSize()) )
+            return D3DERR_INVALIDCALL;
+
+        if( type == D3DQUERYTYPE_TIMESTAMPDISJOINT )
+            *static_cast<BOOL *>(pData) = FALSE;
+
+        else if( type == D3DQUERYTYPE_TIMESTAMPFREQ )
+            *static_cast<UINT64 *>(pData) = TIMESTAMP_FREQUENCY;
+
+        else
+            *static_cast<UINT64 *>(pData) = timestamp;
+
+        return S_OK;
+    }
+
+private:
+
+    ULONG refCount;
+    D3DQUERYTYPE type;
+    UINT64 timestamp;
+    bool issued;
+};
+
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CNullDevice2D::CNullDevice2D()
+             : vertexTextureSupport(true),
+               timestampSupport(true),
+               inScene(false),
+               meshFrequency(1),
+               drawCount(0),
+               instanceCount(0)
+{
+    std::memset( &caps, 0, sizeof( caps ) );
+    caps.VertexShaderVersion = D3DVS_VERSION(3, 0);
+    caps.PixelShaderVersion = D3DPS_VERSION(3, 0);
+    caps.MaxStreams = 16;
+    caps.DevCaps2 = D3DDEVCAPS2_STREAMOFFSET;
+    caps.DeclTypes = D3DDTCAPS_UBYTE4 | D3DDTCAPS_USHORT4N | D3DDTCAPS_FLOAT16_2 | D3DDTCAPS_FLOAT16_4;
+    caps.MaxVertexShaderConst = 256;
+    caps.NumSimultaneousRTs = 1;
+    caps.MaxTextureWidth = MAX_TEXTURE_SIZE;
+    caps.MaxTextureHeight = MAX_TEXTURE_SIZE;
+
+    std::memset( perspectiveMatrix, 0, sizeof( perspectiveMatrix ) );
+    std::memset( orthographicMatrix, 0, sizeof( orthographicMatrix ) );
+
+    for( int i = 0; i < 16; i += 5 )
+    {
+        perspectiveMatrix[i] = 1.f;
+        orthographicMatrix[i] = 1.f;
+    }
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Set what the device says it can do
+*
+*	 param:	const D3DCAPS9 & caps - capabilities of the device
+************************************************************************/
+void CNullDevice2D::SetDeviceCaps( const D3DCAPS9 & _caps )
+{
+    caps = _caps;
+
+}	// SetDeviceCaps
+
+
+/************************************************************************
+*    desc:  Set whether vertex shaders can read textures
+*
+*	 param:	bool support - true if they can
+************************************************************************/
+void CNullDevice2D::SetVertexTextureSupport( bool support )
+{
+    vertexTextureSupport = support;
+
+}	// SetVertexTextureSupport
+
+
+/************************************************************************
+*    desc:  Set whether the device answers timestamp queries
+*
+*	 param:	bool support - true if it does
+************************************************************************/
+void CNullDevice2D::SetTimestampSupport( bool support )
+{
+    timestampSupport = support;
+
+}	// SetTimestampSupport
+
+
+/************************************************************************
+*    desc:  Set a projection matrix of the camera
+*
+*	 param:	CSettings::EProjectionType type - perspective or orthographic
+*			const float * pMatrix           - 16 floats of a row major matrix
+************************************************************************/
+void CNullDevice2D::SetProjectionMatrix( CSettings::EProjectionType type, const float * pMatrix )
+{
+    if( type == CSettings::EPT_PERSPECTIVE )
+        std::memcpy( perspectiveMatrix, pMatrix, sizeof( perspectiveMatrix ) );
+    else
+        std::memcpy( orthographicMatrix, pMatrix, sizeof( orthographicMatrix ) );
+
+}	// SetProjectionMatrix
+
+
+/************************************************************************
+*    desc:  Reset the draw and instance counters
+************************************************************************/
+void CNullDevice2D::ResetCounters()
+{
+    drawCount = 0;
+    instanceCount = 0;
+
+}	// ResetCounters
+
+
+/************************************************************************
+*    desc:  What the device can do
+************************************************************************/
+HRESULT CNullDevice2D::GetDeviceCaps( D3DCAPS9 * pCaps )
+{
+    *pCaps = caps;
+
+    return D3D_OK;
+
+}	// GetDeviceCaps
+
+bool CNullDevice2D::CanReadVertexTexture( D3DFORMAT )
+{
+    return vertexTextureSupport;
+
+}	// CanReadVertexTexture
+
+uint CNullDevice2D::GetMaxTextureWidth()
+{
+    return caps.MaxTextureWidth;
+
+}	// GetMaxTextureWidth
+
+uint CNullDevice2D::GetMaxTextureHeight()
+{
+    return caps.MaxTextureHeight;
+
+}	// GetMaxTextureHeight
+
+
+/************************************************************************
+*    desc:  Get a projection matrix of the camera
+*
+*	 param:	CSettings::EProjectionType type - perspective or orthographic
+*
+*	 ret:	const float * - 16 floats of a row major matrix
+************************************************************************/
+const float * CNullDevice2D::GetProjectionMatrix( CSettings::EProjectionType type )
+{
+    if( type == CSettings::EPT_PERSPECTIVE )
+        return perspectiveMatrix;
+
+    return orthographicMatrix;
+
+}	// GetProjectionMatrix
+
+
+/************************************************************************
+*    desc:  Create the resources in plain memory
+************************************************************************/
+HRESULT CNullDevice2D::CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration )
+{
+    *ppDeclaration = new CNullVertexDeclaration2D( pElement );
+
+    return D3D_OK;
+
+}	// CreateVertexDeclaration
+
+HRESULT CNullDevice2D::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer )
+{
+    *ppBuffer = new CNullVertexBuffer2D( length, usage, fvf, pool );
+
+    return D3D_OK;
+
+}	// CreateVertexBuffer
+
+HRESULT CNullDevice2D::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer )
+{
+    *ppBuffer = new CNullIndexBuffer2D( length, usage, format, pool );
+
+    return D3D_OK;
+
+}	// CreateIndexBuffer
+
+HRESULT CNullDevice2D::CreateTexture( UINT width, UINT height, UINT, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture )
+{
+    if( (width == 0) || (height == 0) || (width > caps.MaxTextureWidth) || (height > caps.MaxTextureHeight) )
+        return D3DERR_INVALIDCALL;
+
+    *ppTexture = new CNullTexture2D( width, height, usage, format, pool );
+
+    return D3D_OK;
+
+}	// CreateTexture
+
+
+/************************************************************************
+*    desc:  Copy a rectangle of a texture into another, a row at a time.
+*           There's no filter to convert with, so both need the same
+*           format and the rectangles the same size
+************************************************************************/
+HRESULT CNullDevice2D::CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect )
+{
+    D3DSURFACE_DESC sourceDesc, destDesc;
+    HRESULT hr;
+
+    if( FAILED( hr = pSource->GetLevelDesc( 0, &sourceDesc ) ) || FAILED( hr = pDest->GetLevelDesc( 0, &destDesc ) ) )
+        return hr;
+
+    const LONG width = sourceRect.right - sourceRect.left;
+    const LONG height = sourceRect.bottom - sourceRect.top;
+
+    if( (sourceDesc.Format != destDesc.Format) || (width != destRect.right - destRect.left) || (height != destRect.bottom - destRect.top) ||
+        (sourceRect.left < 0) || (sourceRect.top < 0) || (sourceRect.right > static_cast<LONG>(sourceDesc.Width)) || (sourceRect.bottom > static_cast<LONG>(sourceDesc.Height)) ||
+        (destRect.left < 0) || (destRect.top < 0) || (destRect.right > static_cast<LONG>(destDesc.Width)) || (destRect.bottom > static_cast<LONG>(destDesc.Height)) )
+    {
+        return D3DERR_INVALIDCALL;
+    }
+
+    if( (width <= 0) || (height <= 0) )
+        return D3D_OK;
+
+    D3DLOCKED_RECT sourceLock, destLock;
+
+    if( FAILED( hr = pSource->LockRect( 0, &sourceLock, &sourceRect, D3DLOCK_READONLY ) ) )
+        return hr;
+
+    if( FAILED( hr = pDest->LockRect( 0, &destLock, &destRect, 0 ) ) )
+    {
+        pSource->UnlockRect( 0 );
+        return hr;
+    }
+
+    const size_t rowSize = width * GetPixelSize( sourceDesc.Format );
+
+    for( LONG row = 0; row < height; ++row )
+        std::memcpy( static_cast<BYTE *>(destLock.pBits) + (row * destLock.Pitch),
+                     static_cast<const BYTE *>(sourceLock.pBits) + (row * sourceLock.Pitch), rowSize );
+
+    pDest->UnlockRect( 0 );
+    pSource->UnlockRect( 0 );
+
+    return D3D_OK;
+
+}	// CopyTexture
+
+
+/************************************************************************
+*    desc:  Bind the resources and states. The bindings don't matter
+*           without a card, but the render states are read back and the
+*           instancing decides how much a draw draws
+************************************************************************/
+HRESULT CNullDevice2D::SetVertexDeclaration( IDirect3DVertexDeclaration9 * )
+{
+    return D3D_OK;
+
+}	// SetVertexDeclaration
+
+HRESULT CNullDevice2D::SetStreamSource( UINT, IDirect3DVertexBuffer9 *, UINT, UINT )
+{
+    return D3D_OK;
+
+}	// SetStreamSource
+
+HRESULT CNullDevice2D::SetStreamSourceFreq( UINT stream, UINT setting )
+{
+    if( stream == 0 )
+        meshFrequency = ((setting & D3DSTREAMSOURCE_INDEXEDDATA) != 0) ? (setting & ~STREAM_FREQUENCY_FLAGS) : 1;
+
+    return D3D_OK;
+
+}	// SetStreamSourceFreq
+
+HRESULT CNullDevice2D::SetIndices( IDirect3DIndexBuffer9 * )
+{
+    return D3D_OK;
+
+}	// SetIndices
+
+HRESULT CNullDevice2D::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    renderStateMap[state] = value;
+
+    return D3D_OK;
+
+}	// SetRenderState
+
+HRESULT CNullDevice2D::GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue )
+{
+    boost::unordered_map<int, DWORD>::const_iterator iter = renderStateMap.find( state );
+    *pValue = (iter != renderStateMap.end()) ? iter->second : 0;
+
+    return D3D_OK;
+
+}	// GetRenderState
+
+HRESULT CNullDevice2D::SelectTexture( IDirect3DBaseTexture9 * )
+{
+    return D3D_OK;
+
+}	// SelectTexture
+
+
+/************************************************************************
+*    desc:  There's no shader without a card, so the effect values go
+*           nowhere. The technique has one pass, so the draws in it
+*           are made and counted
+************************************************************************/
+HRESULT CNullDevice2D::SetEffectAndTechnique( const std::string &, const std::string & )
+{
+    return D3D_OK;
+
+}	// SetEffectAndTechnique
+
+HRESULT CNullDevice2D::SetEffectFloat( const char *, float )
+{
+    return D3D_OK;
+
+}	// SetEffectFloat
+
+HRESULT CNullDevice2D::SetEffectFloatArray( const char *, const float *, UINT )
+{
+    return D3D_OK;
+
+}	// SetEffectFloatArray
+
+HRESULT CNullDevice2D::SetEffectMatrix( const char *, const float * )
+{
+    return D3D_OK;
+
+}	// SetEffectMatrix
+
+HRESULT CNullDevice2D::SetEffectTexture( const char *, IDirect3DBaseTexture9 * )
+{
+    return D3D_OK;
+
+}	// SetEffectTexture
+
+HRESULT CNullDevice2D::BeginEffect( UINT * pPassCount )
+{
+    *pPassCount = 1;
+
+    return D3D_OK;
+
+}	// BeginEffect
+
+HRESULT CNullDevice2D::BeginEffectPass( UINT )
+{
+    return D3D_OK;
+
+}	// BeginEffectPass
+
+HRESULT CNullDevice2D::EndEffectPass()
+{
+    return D3D_OK;
+
+}	// EndEffectPass
+
+HRESULT CNullDevice2D::EndEffect()
+{
+    return D3D_OK;
+
+}	// EndEffect
+
+
+/************************************************************************
+*    desc:  Count the draw and the instances it draws
+************************************************************************/
+HRESULT CNullDevice2D::DrawIndexedPrimitive( D3DPRIMITIVETYPE, int, UINT, UINT, UINT, UINT )
+{
+    ++drawCount;
+    instanceCount += meshFrequency;
+
+    return D3D_OK;
+
+}	// DrawIndexedPrimitive
+
+
+/************************************************************************
+*    desc:  Begin and end a scene. Like the card, a scene can't be begun
+*           inside another or ended when none was begun
+************************************************************************/
+HRESULT CNullDevice2D::BeginScene()
+{
+    if( inScene )
+        return D3DERR_INVALIDCALL;
+
+    inScene = true;
+
+    return D3D_OK;
+
+}	// BeginScene
+
+HRESULT CNullDevice2D::EndScene()
+{
+    if( !inScene )
+        return D3DERR_INVALIDCALL;
+
+    inScene = false;
+
+    return D3D_OK;
+
+}	// EndScene
+
+
+/************************************************************************
+*    desc:  Create a query. Only the timestamp queries are answered
+************************************************************************/
+HRESULT CNullDevice2D::CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery )
+{
+    if( !timestampSupport ||
+        ((type != D3DQUERYTYPE_TIMESTAMP) && (type != D3DQUERYTYPE_TIMESTAMPDISJOINT) && (type != D3DQUERYTYPE_TIMESTAMPFREQ)) )
+    {
+        return D3DERR_NOTAVAILABLE;
+    }
+
+    *ppQuery = new CNullQuery2D( type );
+
+    return D3D_OK;
+
+}	// CreateQuery
@@ -0,0 +1,118 @@
+/************************************************************************
+*    FILE NAME:       nulldevice2d.h
+*
+*    DESCRIPTION:     Device for the 2D rendering that needs no card.
+*                     Buffers and textures live in plain memory, so they
+*                     can be locked and filled like the real ones. The
+*                     draws are only counted.
+************************************************************************/
+
+#ifndef __null_device_2d_h__
+#define __null_device_2d_h__
+
+// Physical component dependency
+#include <2d/graphicsdevice2d.h>
+
+// Boost lib dependencies
+#include <boost/unordered_map.hpp>
+
+class CNullDevice2D : public CGraphicsDevice2D
+{
+public:
+
+    // Constructor. The device starts out as a shader model 3 card that has everything the
+    // 2D rendering asks for
+    CNullDevice2D();
+
+    // Set what the device says it can do
+    void SetDeviceCaps( const D3DCAPS9 & caps );
+    void SetVertexTextureSupport( bool support );
+    void SetTimestampSupport( bool support );
+
+    // Set a projection matrix of the camera, 16 floats row major. Both start as identity
+    void SetProjectionMatrix( CSettings::EProjectionType type, const float * pMatrix );
+
+    // Get the number of draws and the instances they drew since the counters were reset
+    size_t GetDrawCount() const
+    { return drawCount; }
+
+    size_t GetInstanceCount() const
+    { return instanceCount; }
+
+    // Reset the counters
+    void ResetCounters();
+
+    // What the device can do
+    virtual HRESULT GetDeviceCaps( D3DCAPS9 * pCaps );
+    virtual bool CanReadVertexTexture( D3DFORMAT format );
+    virtual uint GetMaxTextureWidth();
+    virtual uint GetMaxTextureHeight();
+
+    // Get a projection matrix of the camera
+    virtual const float * GetProjectionMatrix( CSettings::EProjectionType type );
+
+    // Create the resources in plain memory
+    virtual HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration );
+    virtual HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture );
+
+    // Copy a texture in plain memory. Both need the same format
+    virtual HRESULT CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect );
+
+    // Bind the resources and states. Only the render states and instancing are kept
+    virtual HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration );
+    virtual HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride );
+    virtual HRESULT SetStreamSourceFreq( UINT stream, UINT setting );
+    virtual HRESULT SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer );
+    virtual HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+    virtual HRESULT GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue );
+    virtual HRESULT SelectTexture( IDirect3DBaseTexture9 * pTexture );
+
+    // There's no shader without a card. The technique has one pass, so the draws in it are counted
+    virtual HRESULT SetEffectAndTechnique( const std::string & effect, const std::string & technique );
+    virtual HRESULT SetEffectFloat( const char * pName, float value );
+    virtual HRESULT SetEffectFloatArray( const char * pName, const float * pValue, UINT count );
+    virtual HRESULT SetEffectMatrix( const char * pName, const float * pMatrix );
+    virtual HRESULT SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture );
+    virtual HRESULT BeginEffect( UINT * pPassCount );
+    virtual HRESULT BeginEffectPass( UINT pass );
+    virtual HRESULT EndEffectPass();
+    virtual HRESULT EndEffect();
+
+    // Count the draw
+    virtual HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount );
+
+    // Begin and end a scene
+    virtual HRESULT BeginScene();
+    virtual HRESULT EndScene();
+
+    // Create a query. The timestamps are read off the CPU clock
+    virtual HRESULT CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery );
+
+private:
+
+    // What the device says it can do
+    D3DCAPS9 caps;
+    bool vertexTextureSupport;
+    bool timestampSupport;
+
+    // Whether a scene was begun and not ended
+    bool inScene;
+
+    // Projection matrices of the camera, row major
+    float perspectiveMatrix[16];
+    float orthographicMatrix[16];
+
+    // Render states that were set. The ones never set are zero
+    boost::unordered_map<int, DWORD> renderStateMap;
+
+    // Number of times the mesh in stream zero is drawn by each draw
+    UINT meshFrequency;
+
+    // Draws and the instances they drew since the counters were reset
+    size_t drawCount;
+    size_t instanceCount;
+};
+
+#endif  // __null_device_2d_h__
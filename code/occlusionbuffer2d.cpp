@@ -0,0 +1,246 @@
+/************************************************************************
+*    FILE NAME:       occlusionbuffer2d.cpp
+*
+*    DESCRIPTION:     Coarse tile buffer of the nearest opaque depth on
+*                     the screen. Opaque sprites are rasterized into it
+*                     front to back and sprites fully behind them are
+*                     rejected. Only plain floats go in and out, so it
+*                     runs without a device.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/occlusionbuffer2d.h>
+
+// Standard lib dependencies
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// SIMD lib dependencies
+#include <emmintrin.h>
+
+// The default number of tiles. Close to the shape of a wide screen
+const uint DEFAULT_COLUMNS = 64;
+const uint DEFAULT_ROWS = 36;
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+COcclusionBuffer2D::COcclusionBuffer2D()
+                  : columns(0),
+                    rows(0),
+                    rasterizedCount(0)
+{
+    SetResolution( DEFAULT_COLUMNS, DEFAULT_ROWS );
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Set the number of tiles across and down the screen
+*
+*	 param:	uint columns - tiles across
+*			uint rows    - tiles down
+************************************************************************/
+void COcclusionBuffer2D::SetResolution( uint _columns, uint _rows )
+{
+    columns = _columns;
+    rows = _rows;
+
+    depthVec.resize( columns * rows );
+    Clear();
+
+}	// SetResolution
+
+
+/************************************************************************
+*    desc:  Clear the occluders and set every tile to the farthest depth
+************************************************************************/
+void COcclusionBuffer2D::Clear()
+{
+    std::fill( depthVec.begin(), depthVec.end(), FLT_MAX );
+    occluderVec.clear();
+    rasterizedCount = 0;
+
+}	// Clear
+
+
+/************************************************************************
+*    desc:  Add an occluder. It's rasterized by the next Rasterize
+*
+*	 param:	float left, bottom, right, top - fully opaque rectangle in
+*                                            normalized device coordinates
+*			float depth                    - distance from the camera
+************************************************************************/
+void COcclusionBuffer2D::AddOccluder( float left, float bottom, float right, float top, float depth )
+{
+    // An occluder has to have area to cover a tile
+    if( (right <= left) || (top <= bottom) )
+        return;
+
+    COccluder occluder;
+    occluder.left = left;
+    occluder.bottom = bottom;
+    occluder.right = right;
+    occluder.top = top;
+    occluder.depth = depth;
+
+    occluderVec.push_back( occluder );
+
+}	// AddOccluder
+
+
+/************************************************************************
+*    desc:  Rasterize the occluders front to back. Each tile keeps the
+*           nearest depth of the occluders that fully cover it, four
+*           tiles at a time
+************************************************************************/
+void COcclusionBuffer2D::Rasterize()
+{
+    std::sort( occluderVec.begin(), occluderVec.end(), OccluderSort );
+
+    for( size_t i = 0; i < occluderVec.size(); ++i )
+    {
+        const COccluder & occluder = occluderVec[i];
+
+        // A nearer occluder already hides this one, so it can't make any tile nearer
+        if( IsOccluded( occluder.left, occluder.bottom, occluder.right, occluder.top, occluder.depth ) )
+            continue;
+
+        const CTileRange range = GetInnerRange( occluder.left, occluder.bottom, occluder.right, occluder.top );
+
+        if( range.IsEmpty() )
+            continue;
+
+        const __m128 depth4 = _mm_set1_ps( occluder.depth );
+
+        for( uint row = range.rowBegin; row < range.rowEnd; ++row )
+        {
+            float * pRow = &depthVec[row * columns];
+            uint column = range.columnBegin;
+
+            for( ; column + 4 <= range.columnEnd; column += 4 )
+                _mm_storeu_ps( &pRow[column], _mm_min_ps( _mm_loadu_ps( &pRow[column] ), depth4 ) );
+
+            // The remainder
+            for( ; column < range.columnEnd; ++column )
+                pRow[column] = std::min( pRow[column], occluder.depth );
+        }
+
+        ++rasterizedCount;
+    }
+
+}	// Rasterize
+
+
+/************************************************************************
+*    desc:  Check if a rectangle is behind the occluders in every tile
+*           it touches. A rectangle at the same depth as an occluder
+*           isn't behind it
+*
+*	 param:	float left, bottom, right, top - rectangle in normalized device coordinates
+*			float depth                    - nearest depth of the rectangle
+*
+*	 ret:	bool - true if the rectangle can't be seen
+************************************************************************/
+bool COcclusionBuffer2D::IsOccluded( float left, float bottom, float right, float top, float depth ) const
+{
+    const CTileRange range = GetOuterRange( left, bottom, right, top );
+
+    if( range.IsEmpty() )
+        return false;
+
+    return GetFarthestDepth( range ) < depth;
+
+}	// IsOccluded
+
+
+/************************************************************************
+*    desc:  Sort the occluders front to back
+************************************************************************/
+bool COcclusionBuffer2D::OccluderSort( const COccluder & a, const COccluder & b )
+{
+    return a.depth < b.depth;
+
+}	// OccluderSort
+
+
+/************************************************************************
+*    desc:  Get the tiles fully inside a rectangle. Row zero is the top
+*
+*	 param:	float left, bottom, right, top - rectangle in normalized device coordinates
+*
+*	 ret:	CTileRange - tiles inside the rectangle
+************************************************************************/
+COcclusionBuffer2D::CTileRange COcclusionBuffer2D::GetInnerRange( float left, float bottom, float right, float top ) const
+{
+    const float columnScale = 0.5f * columns;
+    const float rowScale = 0.5f * rows;
+
+    CTileRange range;
+    range.columnBegin = static_cast<uint>( std::max( std::ceil( (left + 1.f) * columnScale ), 0.f ) );
+    range.columnEnd   = static_cast<uint>( std::max( std::min( std::floor( (right + 1.f) * columnScale ), static_cast<float>(columns) ), 0.f ) );
+    range.rowBegin    = static_cast<uint>( std::max( std::ceil( (1.f - top) * rowScale ), 0.f ) );
+    range.rowEnd      = static_cast<uint>( std::max( std::min( std::floor( (1.f - bottom) * rowScale ), static_cast<float>(rows) ), 0.f ) );
+
+    return range;
+
+}	// GetInnerRange
+
+
+/************************************************************************
+*    desc:  Get the tiles a rectangle touches. Row zero is the top
+*
+*	 param:	float left, bottom, right, top - rectangle in normalized device coordinates
+*
+*	 ret:	CTileRange - tiles the rectangle touches
+************************************************************************/
+COcclusionBuffer2D::CTileRange COcclusionBuffer2D::GetOuterRange( float left, float bottom, float right, float top ) const
+{
+    const float columnScale = 0.5f * columns;
+    const float rowScale = 0.5f * rows;
+
+    CTileRange range;
+    range.columnBegin = static_cast<uint>( std::max( std::floor( (left + 1.f) * columnScale ), 0.f ) );
+    range.columnEnd   = static_cast<uint>( std::max( std::min( std::ceil( (right + 1.f) * columnScale ), static_cast<float>(columns) ), 0.f ) );
+    range.rowBegin    = static_cast<uint>( std::max( std::floor( (1.f - top) * rowScale ), 0.f ) );
+    range.rowEnd      = static_cast<uint>( std::max( std::min( std::ceil( (1.f - bottom) * rowScale ), static_cast<float>(rows) ), 0.f ) );
+
+    return range;
+
+}	// GetOuterRange
+
+
+/************************************************************************
+*    desc:  Get the farthest depth of a range of tiles, four tiles at a
+*           time
+*
+*	 param:	const CTileRange & range - tiles to check
+*
+*	 ret:	float - farthest depth
+************************************************************************/
+float COcclusionBuffer2D::GetFarthestDepth( const CTileRange & range ) const
+{
+    __m128 farthest4 = _mm_set1_ps( -FLT_MAX );
+    float farthest = -FLT_MAX;
+
+    for( uint row = range.rowBegin; row < range.rowEnd; ++row )
+    {
+        const float * pRow = &depthVec[row * columns];
+        uint column = range.columnBegin;
+
+        for( ; column + 4 <= range.columnEnd; column += 4 )
+            farthest4 = _mm_max_ps( farthest4, _mm_loadu_ps( &pRow[column] ) );
+
+        // The remainder
+        for( ; column < range.columnEnd; ++column )
+            farthest = std::max( farthest, pRow[column] );
+    }
+
+    // Fold the four lanes into one
+    farthest4 = _mm_max_ps( farthest4, _mm_shuffle_ps( farthest4, farthest4, _MM_SHUFFLE(1, 0, 3, 2) ) );
+    farthest4 = _mm_max_ps( farthest4, _mm_shuffle_ps( farthest4, farthest4, _MM_SHUFFLE(2, 3, 0, 1) ) );
+
+    return std::max( farthest, _mm_cvtss_f32( farthest4 ) );
+
+}	// GetFarthestDepth
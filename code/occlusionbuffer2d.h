@@ -0,0 +1,104 @@
+/************************************************************************
+*    FILE NAME:       occlusionbuffer2d.h
+*
+*    DESCRIPTION:     Coarse tile buffer of the nearest opaque depth on
+*                     the screen. Opaque sprites are rasterized into it
+*                     front to back and sprites fully behind them are
+*                     rejected. Only plain floats go in and out, so it
+*                     runs without a device.
+************************************************************************/
+
+#ifndef __occlusion_buffer_2d_h__
+#define __occlusion_buffer_2d_h__
+
+// Standard lib dependencies
+#include <cstddef>
+#include <vector>
+
+// Game lib dependencies
+#include <common/defs.h>
+
+class COcclusionBuffer2D
+{
+public:
+
+    // Constructor
+    COcclusionBuffer2D();
+
+    // Set the number of tiles across and down the screen. Clears the buffer
+    void SetResolution( uint columns, uint rows );
+
+    // Clear the occluders and the tiles
+    void Clear();
+
+    // Add an occluder. The rectangle is in normalized device coordinates and has to be
+    // fully opaque. The depth is its distance from the camera, smaller is nearer
+    void AddOccluder( float left, float bottom, float right, float top, float depth );
+
+    // Rasterize the occluders front to back. Only the tiles an occluder fully covers are
+    // written. Occluders already hidden by nearer ones are skipped
+    void Rasterize();
+
+    // Check if a rectangle is behind the occluders in every tile it touches. The rectangle
+    // is in normalized device coordinates and the depth is its nearest point
+    bool IsOccluded( float left, float bottom, float right, float top, float depth ) const;
+
+    // Get the number of occluders added and how many of them were rasterized
+    size_t GetOccluderCount() const
+    { return occluderVec.size(); }
+
+    size_t GetRasterizedCount() const
+    { return rasterizedCount; }
+
+private:
+
+    // Tile range of a rectangle. The end is one past the last tile
+    class CTileRange
+    {
+    public:
+
+        uint columnBegin, columnEnd;
+        uint rowBegin, rowEnd;
+
+        bool IsEmpty() const
+        { return (columnBegin >= columnEnd) || (rowBegin >= rowEnd); }
+    };
+
+    // Rectangle and depth of an occluder
+    class COccluder
+    {
+    public:
+
+        float left, bottom, right, top;
+        float depth;
+    };
+
+    // Sort the occluders front to back
+    static bool OccluderSort( const COccluder & a, const COccluder & b );
+
+    // Get the tiles fully inside a rectangle
+    CTileRange GetInnerRange( float left, float bottom, float right, float top ) const;
+
+    // Get the tiles a rectangle touches
+    CTileRange GetOuterRange( float left, float bottom, float right, float top ) const;
+
+    // Get the farthest depth of a range of tiles
+    float GetFarthestDepth( const CTileRange & range ) const;
+
+private:
+
+    // Number of tiles across and down
+    uint columns;
+    uint rows;
+
+    // Nearest occluder depth of each tile. Tiles with no occluder are at the farthest depth
+    std::vector<float> depthVec;
+
+    // The occluders waiting to be rasterized
+    std::vector<COccluder> occluderVec;
+
+    // Number of occluders rasterized by the last Rasterize
+    size_t rasterizedCount;
+};
+
+#endif  // __occlusion_buffer_2d_h__
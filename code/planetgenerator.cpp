@@ -57,6 +57,7 @@ const int PLANET_COLOR_DIAMETER = PLANET_SECTOR_SIZE * 3;
 ************************************************************************/
 CPlanetGenerator::CPlanetGenerator()
                 : CGenerator(),
+                  pInstMesh(NULL),
                   GetRandPlanetPos( generator, IntDistribution( -(PLANET_SECTOR_SIZE >> 1), (PLANET_SECTOR_SIZE >> 1) ) ),
                   GetRandPlanetDepth( generator, IntDistribution( PLANET_DEPTH_MIN, PLANET_DEPTH_MAX ) ),
                   GetRandPlanetScale( generator, FloatDistribution( PLANET_SCALE_MIN, PLANET_SCALE_MAX ) ),
@@ -83,7 +84,7 @@ CPlanetGenerator::~CPlanetGenerator()
 ************************************************************************/
 void CPlanetGenerator::Init( CPointInt & focus, uint wSeed )
 {
-    CInstanceMesh2D * pInstMesh = CInstanceMeshManager::Instance().GetInstanceMeshPtr( "(space)" );
+    pInstMesh = CInstanceMeshManager::Instance().GetInstanceMeshPtr( "(space)" );
 
     CObjectData2D * pPlanetObjData = CObjectDataList2D::Instance().GetData( "(space)", "planet" );
     CObjectData2D * pAtmosObjData = CObjectDataList2D::Instance().GetData( "(space)", "planet_atmosphere" );
@@ -325,12 +326,22 @@ void CPlanetGenerator::GeneratePlanet( vector<CSector2D *>::iterator & sectorIte
 
             pTmpPlanet->SetColor( color );
             pTmpAtmosphere->SetColor( color );
+
+            // Upload the planet parts once instead of every frame. The planet body is solid,
+            // so it goes in the opaque pass and hides what's behind it
+            pInstMesh->AddPersistentSprite( pTmpPlanet, true );
+            pInstMesh->AddPersistentSprite( pTmpAtmosphere );
+            pInstMesh->AddPersistentSprite( pTmpShadow );
         }
         else
         {
             pTmpPlanet->SetVisible( false );
             pTmpAtmosphere->SetVisible( false );
             pTmpShadow->SetVisible( false );
+
+            pInstMesh->RemovePersistentSprite( pTmpPlanet );
+            pInstMesh->RemovePersistentSprite( pTmpAtmosphere );
+            pInstMesh->RemovePersistentSprite( pTmpShadow );
         }
 
         planetCount--;
@@ -409,6 +420,7 @@ void CPlanetGenerator::OrganizeSectors( const CPointInt & point )
             ( (*sectorVecIter)->GetPosition().y > point.y + variance ) ||
             ( (*sectorVecIter)->GetPosition().y < point.y - variance ) )
         {
+            RemovePlanets( *sectorVecIter );
             pUnusedSectorVector.push_back( (*sectorVecIter) );
             sectorVecIter = pUsedSectorVector.erase( sectorVecIter );
         }
@@ -419,11 +431,28 @@ void CPlanetGenerator::OrganizeSectors( const CPointInt & point )
 }	// OrganizeSectors */
 
 
+/************************************************************************
+*    desc:  Free the persistent instance slots of a sector's planets
+*
+*	 param: CSector2D * pSector - sector that's no longer used
+************************************************************************/
+void CPlanetGenerator::RemovePlanets( CSector2D * pSector )
+{
+    for( int i = PLANET_INDEX_START * 3; i < PLANET_INDEX_END * 3; ++i )
+        pInstMesh->RemovePersistentSprite( pSector->GetGroup( i ) );
+
+}	// RemovePlanets
+
+
 /************************************************************************
 *    desc:  Clear the contents of the generator
 ************************************************************************/
 void CPlanetGenerator::Clear()
 {
+    // The sprites are about to be freed
+    if( pInstMesh != NULL )
+        pInstMesh->ClearPersistentSprites();
+
     CGenerator::Clear();
 
 }	// Clear */
\ No newline at end of file
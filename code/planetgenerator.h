@@ -17,6 +17,9 @@
 #include <common/defs.h>
 #include <3d/worldcamera.h>
 
+// Forward declaration(s)
+class CInstanceMesh2D;
+
 class CPlanetGenerator : public CGenerator
 {
 public:
@@ -47,11 +50,18 @@ private:
     // Get the position of the color sector
     CPointInt GetColorSectorPos( std::vector<CSector2D *>::iterator & sectorIter );
 
+    // Free the persistent instance slots of a sector's planets
+    void RemovePlanets( CSector2D * pSector );
+
 private:
 
     // The center of the background
     CPointInt center;
 
+    // The instance mesh the planets are drawn with. The planets only change when their
+    // sector is generated, so they're given persistent slots in it
+    CInstanceMesh2D * pInstMesh;
+
     // Generator just for the color
     BaseRandGenType colorGenerator;
 
@@ -0,0 +1,398 @@
+/************************************************************************
+*    FILE NAME:       recordingdevice2d.cpp
+*
+*    DESCRIPTION:     Device for the 2D rendering that logs the calls
+*                     made to it and passes them on to another device.
+*                     Used to check the call stream the rendering makes.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/recordingdevice2d.h>
+
+// The names of the call types
+const char * CALL_NAME[CRecordingDevice2D::ECT_MAX_CALL_TYPES] =
+{
+    "CreateVertexDeclaration",
+    "CreateVertexBuffer",
+    "CreateIndexBuffer",
+    "CreateTexture",
+    "CopyTexture",
+    "SetVertexDeclaration",
+    "SetStreamSource",
+    "SetStreamSourceFreq",
+    "SetIndices",
+    "SetRenderState",
+    "GetRenderState",
+    "SelectTexture",
+    "SetEffectAndTechnique",
+    "SetEffectFloat",
+    "SetEffectFloatArray",
+    "SetEffectMatrix",
+    "SetEffectTexture",
+    "BeginEffect",
+    "BeginEffectPass",
+    "EndEffectPass",
+    "EndEffect",
+    "DrawIndexedPrimitive",
+    "BeginScene",
+    "EndScene",
+    "CreateQuery",
+};
+
+/************************************************************************
+*    desc:  Constructor
+*
+*	 param:	CGraphicsDevice2D & device - device the calls are passed on to
+************************************************************************/
+CRecordingDevice2D::CRecordingDevice2D( CGraphicsDevice2D & _device )
+                  : device(_device)
+{
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Get the number of logged calls of a type
+*
+*	 param:	ECallType type - type of call to count
+************************************************************************/
+size_t CRecordingDevice2D::GetCallCount( ECallType type ) const
+{
+    size_t count = 0;
+
+    for( size_t i = 0; i < callVec.size(); ++i )
+        if( callVec[i].type == type )
+            ++count;
+
+    return count;
+
+}	// GetCallCount
+
+
+/************************************************************************
+*    desc:  Get the name of a call type
+*
+*	 param:	ECallType type - type of call
+************************************************************************/
+const char * CRecordingDevice2D::GetCallName( ECallType type )
+{
+    return CALL_NAME[type];
+
+}	// GetCallName
+
+
+/************************************************************************
+*    desc:  Forget the logged calls
+************************************************************************/
+void CRecordingDevice2D::Clear()
+{
+    callVec.clear();
+
+}	// Clear
+
+
+/************************************************************************
+*    desc:  Log a call
+*
+*	 param:	ECallType type     - call made
+*			const void * pObject - resource the call binds, if any
+*			UINT arg0 - arg3     - numbers passed to the call
+************************************************************************/
+void CRecordingDevice2D::Log( ECallType type, const void * pObject, UINT arg0, UINT arg1, UINT arg2, UINT arg3 )
+{
+    CCall call;
+    call.type = type;
+    call.pObject = pObject;
+    call.arg[0] = arg0;
+    call.arg[1] = arg1;
+    call.arg[2] = arg2;
+    call.arg[3] = arg3;
+
+    callVec.push_back( call );
+
+}	// Log
+
+
+/************************************************************************
+*    desc:  Log a call that sets something by name
+*
+*	 param:	ECallType type       - call made
+*			const string & name  - technique or effect value the call sets
+*			const void * pObject - resource the call binds, if any
+*			UINT arg0            - number passed to the call
+************************************************************************/
+void CRecordingDevice2D::LogName( ECallType type, const std::string & name, const void * pObject, UINT arg0 )
+{
+    Log( type, pObject, arg0 );
+    callVec.back().name = name;
+
+}	// LogName
+
+
+/************************************************************************
+*    desc:  What the device can do. Asking doesn't change anything, so
+*           it isn't logged
+************************************************************************/
+HRESULT CRecordingDevice2D::GetDeviceCaps( D3DCAPS9 * pCaps )
+{
+    return device.GetDeviceCaps( pCaps );
+
+}	// GetDeviceCaps
+
+bool CRecordingDevice2D::CanReadVertexTexture( D3DFORMAT format )
+{
+    return device.CanReadVertexTexture( format );
+
+}	// CanReadVertexTexture
+
+uint CRecordingDevice2D::GetMaxTextureWidth()
+{
+    return device.GetMaxTextureWidth();
+
+}	// GetMaxTextureWidth
+
+uint CRecordingDevice2D::GetMaxTextureHeight()
+{
+    return device.GetMaxTextureHeight();
+
+}	// GetMaxTextureHeight
+
+const float * CRecordingDevice2D::GetProjectionMatrix( CSettings::EProjectionType type )
+{
+    return device.GetProjectionMatrix( type );
+
+}	// GetProjectionMatrix
+
+
+/************************************************************************
+*    desc:  Create the resources. The resource made is logged
+************************************************************************/
+HRESULT CRecordingDevice2D::CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration )
+{
+    const HRESULT hr = device.CreateVertexDeclaration( pElement, ppDeclaration );
+    Log( ECT_CREATE_VERTEX_DECLARATION, *ppDeclaration );
+
+    return hr;
+
+}	// CreateVertexDeclaration
+
+HRESULT CRecordingDevice2D::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer )
+{
+    const HRESULT hr = device.CreateVertexBuffer( length, usage, fvf, pool, ppBuffer );
+    Log( ECT_CREATE_VERTEX_BUFFER, *ppBuffer, length, usage, fvf, pool );
+
+    return hr;
+
+}	// CreateVertexBuffer
+
+HRESULT CRecordingDevice2D::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer )
+{
+    const HRESULT hr = device.CreateIndexBuffer( length, usage, format, pool, ppBuffer );
+    Log( ECT_CREATE_INDEX_BUFFER, *ppBuffer, length, usage, format, pool );
+
+    return hr;
+
+}	// CreateIndexBuffer
+
+HRESULT CRecordingDevice2D::CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture )
+{
+    const HRESULT hr = device.CreateTexture( width, height, levels, usage, format, pool, ppTexture );
+    Log( ECT_CREATE_TEXTURE, *ppTexture, width, height, format, pool );
+
+    return hr;
+
+}	// CreateTexture
+
+
+/************************************************************************
+*    desc:  Copy a texture. The size of the copy is logged
+************************************************************************/
+HRESULT CRecordingDevice2D::CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect )
+{
+    Log( ECT_COPY_TEXTURE, pDest, destRect.left, destRect.top, destRect.right - destRect.left, destRect.bottom - destRect.top );
+
+    return device.CopyTexture( pSource, sourceRect, pDest, destRect );
+
+}	// CopyTexture
+
+
+/************************************************************************
+*    desc:  Bind the resources and states
+************************************************************************/
+HRESULT CRecordingDevice2D::SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration )
+{
+    Log( ECT_SET_VERTEX_DECLARATION, pDeclaration );
+
+    return device.SetVertexDeclaration( pDeclaration );
+
+}	// SetVertexDeclaration
+
+HRESULT CRecordingDevice2D::SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride )
+{
+    Log( ECT_SET_STREAM_SOURCE, pBuffer, stream, offset, stride );
+
+    return device.SetStreamSource( stream, pBuffer, offset, stride );
+
+}	// SetStreamSource
+
+HRESULT CRecordingDevice2D::SetStreamSourceFreq( UINT stream, UINT setting )
+{
+    Log( ECT_SET_STREAM_SOURCE_FREQ, NULL, stream, setting );
+
+    return device.SetStreamSourceFreq( stream, setting );
+
+}	// SetStreamSourceFreq
+
+HRESULT CRecordingDevice2D::SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer )
+{
+    Log( ECT_SET_INDICES, pIndexBuffer );
+
+    return device.SetIndices( pIndexBuffer );
+
+}	// SetIndices
+
+HRESULT CRecordingDevice2D::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    Log( ECT_SET_RENDER_STATE, NULL, state, value );
+
+    return device.SetRenderState( state, value );
+
+}	// SetRenderState
+
+HRESULT CRecordingDevice2D::GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue )
+{
+    Log( ECT_GET_RENDER_STATE, NULL, state );
+
+    return device.GetRenderState( state, pValue );
+
+}	// GetRenderState
+
+HRESULT CRecordingDevice2D::SelectTexture( IDirect3DBaseTexture9 * pTexture )
+{
+    Log( ECT_SELECT_TEXTURE, pTexture );
+
+    return device.SelectTexture( pTexture );
+
+}	// SelectTexture
+
+
+/************************************************************************
+*    desc:  Set the effect and its values and run its passes. The
+*           technique and the names of the values are logged
+************************************************************************/
+HRESULT CRecordingDevice2D::SetEffectAndTechnique( const std::string & effect, const std::string & technique )
+{
+    LogName( ECT_SET_EFFECT_AND_TECHNIQUE, technique );
+
+    return device.SetEffectAndTechnique( effect, technique );
+
+}	// SetEffectAndTechnique
+
+HRESULT CRecordingDevice2D::SetEffectFloat( const char * pName, float value )
+{
+    LogName( ECT_SET_EFFECT_FLOAT, pName );
+
+    return device.SetEffectFloat( pName, value );
+
+}	// SetEffectFloat
+
+HRESULT CRecordingDevice2D::SetEffectFloatArray( const char * pName, const float * pValue, UINT count )
+{
+    LogName( ECT_SET_EFFECT_FLOAT_ARRAY, pName, NULL, count );
+
+    return device.SetEffectFloatArray( pName, pValue, count );
+
+}	// SetEffectFloatArray
+
+HRESULT CRecordingDevice2D::SetEffectMatrix( const char * pName, const float * pMatrix )
+{
+    LogName( ECT_SET_EFFECT_MATRIX, pName );
+
+    return device.SetEffectMatrix( pName, pMatrix );
+
+}	// SetEffectMatrix
+
+HRESULT CRecordingDevice2D::SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture )
+{
+    LogName( ECT_SET_EFFECT_TEXTURE, pName, pTexture );
+
+    return device.SetEffectTexture( pName, pTexture );
+
+}	// SetEffectTexture
+
+HRESULT CRecordingDevice2D::BeginEffect( UINT * pPassCount )
+{
+    const HRESULT hr = device.BeginEffect( pPassCount );
+    Log( ECT_BEGIN_EFFECT, NULL, *pPassCount );
+
+    return hr;
+
+}	// BeginEffect
+
+HRESULT CRecordingDevice2D::BeginEffectPass( UINT pass )
+{
+    Log( ECT_BEGIN_EFFECT_PASS, NULL, pass );
+
+    return device.BeginEffectPass( pass );
+
+}	// BeginEffectPass
+
+HRESULT CRecordingDevice2D::EndEffectPass()
+{
+    Log( ECT_END_EFFECT_PASS, NULL );
+
+    return device.EndEffectPass();
+
+}	// EndEffectPass
+
+HRESULT CRecordingDevice2D::EndEffect()
+{
+    Log( ECT_END_EFFECT, NULL );
+
+    return device.EndEffect();
+
+}	// EndEffect
+
+
+/************************************************************************
+*    desc:  Draw
+************************************************************************/
+HRESULT CRecordingDevice2D::DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount )
+{
+    Log( ECT_DRAW_INDEXED_PRIMITIVE, NULL, baseVertex, vertexCount, startIndex, primitiveCount );
+
+    return device.DrawIndexedPrimitive( type, baseVertex, minVertex, vertexCount, startIndex, primitiveCount );
+
+}	// DrawIndexedPrimitive
+
+
+/************************************************************************
+*    desc:  Begin and end a scene
+************************************************************************/
+HRESULT CRecordingDevice2D::BeginScene()
+{
+    Log( ECT_BEGIN_SCENE, NULL );
+
+    return device.BeginScene();
+
+}	// BeginScene
+
+HRESULT CRecordingDevice2D::EndScene()
+{
+    Log( ECT_END_SCENE, NULL );
+
+    return device.EndScene();
+
+}	// EndScene
+
+
+/************************************************************************
+*    desc:  Create a query. The query is logged, NULL if it wasn't made
+************************************************************************/
+HRESULT CRecordingDevice2D::CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery )
+{
+    const HRESULT hr = device.CreateQuery( type, ppQuery );
+    Log( ECT_CREATE_QUERY, (SUCCEEDED( hr ) ? *ppQuery : NULL), type );
+
+    return hr;
+
+}	// CreateQuery
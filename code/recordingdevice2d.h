@@ -0,0 +1,148 @@
+/************************************************************************
+*    FILE NAME:       recordingdevice2d.h
+*
+*    DESCRIPTION:     Device for the 2D rendering that logs the calls
+*                     made to it and passes them on to another device.
+*                     Used to check the call stream the rendering makes.
+************************************************************************/
+
+#ifndef __recording_device_2d_h__
+#define __recording_device_2d_h__
+
+// Physical component dependency
+#include <2d/graphicsdevice2d.h>
+
+// Standard lib dependencies
+#include <string>
+#include <vector>
+
+class CRecordingDevice2D : public CGraphicsDevice2D
+{
+public:
+
+    // The calls that are logged
+    enum ECallType
+    {
+        ECT_CREATE_VERTEX_DECLARATION,
+        ECT_CREATE_VERTEX_BUFFER,
+        ECT_CREATE_INDEX_BUFFER,
+        ECT_CREATE_TEXTURE,
+        ECT_COPY_TEXTURE,
+        ECT_SET_VERTEX_DECLARATION,
+        ECT_SET_STREAM_SOURCE,
+        ECT_SET_STREAM_SOURCE_FREQ,
+        ECT_SET_INDICES,
+        ECT_SET_RENDER_STATE,
+        ECT_GET_RENDER_STATE,
+        ECT_SELECT_TEXTURE,
+        ECT_SET_EFFECT_AND_TECHNIQUE,
+        ECT_SET_EFFECT_FLOAT,
+        ECT_SET_EFFECT_FLOAT_ARRAY,
+        ECT_SET_EFFECT_MATRIX,
+        ECT_SET_EFFECT_TEXTURE,
+        ECT_BEGIN_EFFECT,
+        ECT_BEGIN_EFFECT_PASS,
+        ECT_END_EFFECT_PASS,
+        ECT_END_EFFECT,
+        ECT_DRAW_INDEXED_PRIMITIVE,
+        ECT_BEGIN_SCENE,
+        ECT_END_SCENE,
+        ECT_CREATE_QUERY,
+        ECT_MAX_CALL_TYPES
+    };
+
+    // A logged call. The object is the resource bound, if any, and the arguments are the
+    // numbers passed in the order the call takes them. The name is the technique or the
+    // effect value the call sets, if any
+    class CCall
+    {
+    public:
+
+        ECallType type;
+        const void * pObject;
+        UINT arg[4];
+        std::string name;
+    };
+
+    // Constructor. The calls are passed on to the device given
+    CRecordingDevice2D( CGraphicsDevice2D & device );
+
+    // Get the logged calls in the order they were made
+    const std::vector<CCall> & GetCallVec() const
+    { return callVec; }
+
+    // Get the number of logged calls of a type
+    size_t GetCallCount( ECallType type ) const;
+
+    // Get the name of a call type
+    static const char * GetCallName( ECallType type );
+
+    // Forget the logged calls
+    void Clear();
+
+    // What the device can do. Not logged
+    virtual HRESULT GetDeviceCaps( D3DCAPS9 * pCaps );
+    virtual bool CanReadVertexTexture( D3DFORMAT format );
+    virtual uint GetMaxTextureWidth();
+    virtual uint GetMaxTextureHeight();
+
+    // Get a projection matrix of the camera. Not logged
+    virtual const float * GetProjectionMatrix( CSettings::EProjectionType type );
+
+    // Create the resources
+    virtual HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 * pElement, IDirect3DVertexDeclaration9 ** ppDeclaration );
+    virtual HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 ** ppBuffer );
+    virtual HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 ** ppTexture );
+
+    // Copy a texture
+    virtual HRESULT CopyTexture( IDirect3DTexture9 * pSource, const RECT & sourceRect, IDirect3DTexture9 * pDest, const RECT & destRect );
+
+    // Bind the resources and states
+    virtual HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration );
+    virtual HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride );
+    virtual HRESULT SetStreamSourceFreq( UINT stream, UINT setting );
+    virtual HRESULT SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer );
+    virtual HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+    virtual HRESULT GetRenderState( D3DRENDERSTATETYPE state, DWORD * pValue );
+    virtual HRESULT SelectTexture( IDirect3DBaseTexture9 * pTexture );
+
+    // Set the effect and its values and run its passes
+    virtual HRESULT SetEffectAndTechnique( const std::string & effect, const std::string & technique );
+    virtual HRESULT SetEffectFloat( const char * pName, float value );
+    virtual HRESULT SetEffectFloatArray( const char * pName, const float * pValue, UINT count );
+    virtual HRESULT SetEffectMatrix( const char * pName, const float * pMatrix );
+    virtual HRESULT SetEffectTexture( const char * pName, IDirect3DBaseTexture9 * pTexture );
+    virtual HRESULT BeginEffect( UINT * pPassCount );
+    virtual HRESULT BeginEffectPass( UINT pass );
+    virtual HRESULT EndEffectPass();
+    virtual HRESULT EndEffect();
+
+    // Draw
+    virtual HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, int baseVertex, UINT minVertex, UINT vertexCount, UINT startIndex, UINT primitiveCount );
+
+    // Begin and end a scene
+    virtual HRESULT BeginScene();
+    virtual HRESULT EndScene();
+
+    // Create a query. Issuing it and reading it back aren't logged
+    virtual HRESULT CreateQuery( D3DQUERYTYPE type, IDirect3DQuery9 ** ppQuery );
+
+private:
+
+    // Log a call
+    void Log( ECallType type, const void * pObject, UINT arg0 = 0, UINT arg1 = 0, UINT arg2 = 0, UINT arg3 = 0 );
+
+    // Log a call that sets something by name
+    void LogName( ECallType type, const std::string & name, const void * pObject = NULL, UINT arg0 = 0 );
+
+private:
+
+    // The device the calls are passed on to
+    CGraphicsDevice2D & device;
+
+    // The logged calls
+    std::vector<CCall> callVec;
+};
+
+#endif  // __recording_device_2d_h__
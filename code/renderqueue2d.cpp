@@ -0,0 +1,169 @@
+/************************************************************************
+*    FILE NAME:       renderqueue2d.cpp
+*
+*    DESCRIPTION:     Flat, frame persistent render queue that sorts
+*                     its entries back to front with a stable LSD
+*                     radix sort.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/renderqueue2d.h>
+
+// Standard lib dependencies
+#include <cstring>
+#include <algorithm>
+
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CRenderQueue2D::CRenderQueue2D()
+              : histogramVec( RADIX_SIZE * RADIX_PASSES, 0 )
+{
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Convert a depth into a sort key. The depth is quantized to
+*           a float and its bits are flipped so that an ascending sort
+*           of the keys gives a far to near order
+*
+*	 param:	const CWorldValue & depth - depth to convert
+*
+*	 ret:	uint - sort key
+************************************************************************/
+uint CRenderQueue2D::GetDepthKey( const CWorldValue & depth )
+{
+    float value = static_cast<float>(depth.i) + depth.f;
+
+    uint bits;
+    std::memcpy( &bits, &value, sizeof(bits) );
+
+    // Map the float onto an unsigned int that sorts in the same order as the float.
+    // Negative floats have all bits flipped, positive floats only the sign bit
+    if( bits & 0x80000000 )
+        bits = ~bits;
+    else
+        bits |= 0x80000000;
+
+    // Flip again so the furthest depth gets the smallest key
+    return ~bits;
+
+}	// GetDepthKey
+
+
+/************************************************************************
+*    desc:  Add an entry to the queue
+*
+*	 param:	uint key   - sort key of the entry
+*			uint index - index returned for the entry, the add order if not given
+************************************************************************/
+void CRenderQueue2D::Add( uint key )
+{
+    CEntry entry;
+    entry.key = key;
+    entry.index = static_cast<uint>(entryVec.size());
+
+    entryVec.push_back( entry );
+
+}	// Add
+
+void CRenderQueue2D::Add( uint key, uint index )
+{
+    CEntry entry;
+    entry.key = key;
+    entry.index = index;
+
+    entryVec.push_back( entry );
+
+}	// Add
+
+
+/************************************************************************
+*    desc:  Sort the entries back to front. Each pass is a counting sort
+*           so entries with equal keys keep the order they were added in
+************************************************************************/
+void CRenderQueue2D::Sort()
+{
+    const size_t count = entryVec.size();
+
+    if( count < 2 )
+        return;
+
+    if( tmpEntryVec.size() < count )
+        tmpEntryVec.resize( count );
+
+    // Build the histograms of all passes with one walk through the keys
+    std::fill( histogramVec.begin(), histogramVec.end(), 0 );
+    uint * pHistogram = &histogramVec[0];
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        uint key = entryVec[i].key;
+
+        for( int pass = 0; pass < RADIX_PASSES; ++pass )
+            ++pHistogram[ (pass * RADIX_SIZE) + ((key >> (pass * RADIX_BITS)) & RADIX_MASK) ];
+    }
+
+    CEntry * pSrc = &entryVec[0];
+    CEntry * pDest = &tmpEntryVec[0];
+
+    for( int pass = 0; pass < RADIX_PASSES; ++pass )
+    {
+        uint * pPassHistogram = pHistogram + (pass * RADIX_SIZE);
+        const int shift = pass * RADIX_BITS;
+
+        // If every key shares the same digit, this pass wouldn't move anything
+        if( pPassHistogram[ (pSrc[0].key >> shift) & RADIX_MASK ] == count )
+            continue;
+
+        // Turn the counts into starting offsets
+        uint offset = 0;
+        for( int i = 0; i < RADIX_SIZE; ++i )
+        {
+            uint tmpCount = pPassHistogram[i];
+            pPassHistogram[i] = offset;
+            offset += tmpCount;
+        }
+
+        // Scatter the entries into their buckets
+        for( size_t i = 0; i < count; ++i )
+            pDest[ pPassHistogram[ (pSrc[i].key >> shift) & RADIX_MASK ]++ ] = pSrc[i];
+
+        std::swap( pSrc, pDest );
+    }
+
+    // If the sorted entries ended up in the temporary buffer, swap the buffers. Both
+    // vectors keep their capacity so no allocation happens here
+    if( pSrc != &entryVec[0] )
+    {
+        tmpEntryVec.resize( count );
+        entryVec.swap( tmpEntryVec );
+    }
+
+}	// Sort
+
+
+/************************************************************************
+*    desc:  Make sure the queue can hold the passed in amount without
+*           allocating
+*
+*	 param:	size_t count - amount of entries to reserve
+************************************************************************/
+void CRenderQueue2D::Reserve( size_t count )
+{
+    entryVec.reserve( count );
+    tmpEntryVec.reserve( count );
+
+}	// Reserve
+
+
+/************************************************************************
+*    desc:  Clear the queue. The allocated memory is kept for the next
+*           frame
+************************************************************************/
+void CRenderQueue2D::Clear()
+{
+    entryVec.clear();
+
+}	// Clear
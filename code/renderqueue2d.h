@@ -0,0 +1,92 @@
+/************************************************************************
+*    FILE NAME:       renderqueue2d.h
+*
+*    DESCRIPTION:     Flat, frame persistent render queue that sorts
+*                     its entries back to front with a stable LSD
+*                     radix sort.
+************************************************************************/
+
+#ifndef __render_queue_2d_h__
+#define __render_queue_2d_h__
+
+// Standard lib dependencies
+#include <vector>
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+#include <common/worldpoint.h>
+
+class CRenderQueue2D : public boost::noncopyable
+{
+public:
+
+    // Constructor
+    CRenderQueue2D();
+
+    // Convert a depth into a sort key. Smaller keys are further away
+    static uint GetDepthKey( const CWorldValue & depth );
+
+    // Add an entry to the queue. The entry's index is the order it was added in
+    void Add( uint key );
+
+    // Add an entry with an index of its own
+    void Add( uint key, uint index );
+
+    // Sort the entries back to front. Entries with equal keys keep the order they were added in
+    void Sort();
+
+    // Get the number of entries in the queue
+    size_t GetCount() const
+    { return entryVec.size(); }
+
+    bool IsEmpty() const
+    { return entryVec.empty(); }
+
+    // Get the insertion index of the sorted entry
+    uint GetIndex( size_t sortedIndex ) const
+    { return entryVec[sortedIndex].index; }
+
+    // Get the key of the sorted entry
+    uint GetKey( size_t sortedIndex ) const
+    { return entryVec[sortedIndex].key; }
+
+    // Make sure the queue can hold the passed in amount without allocating
+    void Reserve( size_t count );
+
+    // Clear the queue. The allocated memory is kept for the next frame
+    void Clear();
+
+private:
+
+    // Key and the index the entry was added with
+    class CEntry
+    {
+    public:
+        uint key;
+        uint index;
+    };
+
+    // The number of bits sorted per pass and the number of passes needed for 32 bit keys
+    enum
+    {
+        RADIX_BITS = 11,
+        RADIX_SIZE = 1 << RADIX_BITS,
+        RADIX_MASK = RADIX_SIZE - 1,
+        RADIX_PASSES = 3
+    };
+
+private:
+
+    // The entries and the buffer the sort ping pongs with
+    std::vector<CEntry> entryVec;
+    std::vector<CEntry> tmpEntryVec;
+
+    // Histogram of each radix pass
+    std::vector<uint> histogramVec;
+
+};
+
+#endif  // __render_queue_2d_h__
@@ -0,0 +1,275 @@
+/************************************************************************
+*    FILE NAME:       renderstatecache2d.cpp
+*
+*    DESCRIPTION:     Keeps track of the bindings of the device, its
+*                     effect and texture, and drops the calls that
+*                     wouldn't change them.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/renderstatecache2d.h>
+
+// Game lib dependencies
+#include <2d/graphicsdevice2d.h>
+
+/************************************************************************
+*    desc:  Constructor
+************************************************************************/
+CRenderStateCache2D::CRenderStateCache2D()
+                   : issuedCount(0),
+                     filteredCount(0)
+{
+    Invalidate();
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Forget the bindings, so the next call of each kind is issued.
+*           Anything outside the cache can have changed them between
+*           renders, so it's called at the start of each render
+************************************************************************/
+void CRenderStateCache2D::Invalidate()
+{
+    pDeclaration = NULL;
+    pIndexBuffer = NULL;
+    pTexture = NULL;
+    declarationKnown = false;
+    indexBufferKnown = false;
+    textureKnown = false;
+    techniqueKnown = false;
+    renderStateMap.clear();
+
+    for( UINT i = 0; i < MAX_STREAMS; ++i )
+    {
+        stream[i].pBuffer = NULL;
+        stream[i].offset = 0;
+        stream[i].stride = 0;
+        stream[i].frequency = 1;
+        stream[i].sourceKnown = false;
+        stream[i].frequencyKnown = false;
+    }
+
+}	// Invalidate
+
+
+/************************************************************************
+*    desc:  Set the vertex declaration
+************************************************************************/
+void CRenderStateCache2D::SetVertexDeclaration( IDirect3DVertexDeclaration9 * _pDeclaration )
+{
+    if( Filter( declarationKnown && (pDeclaration == _pDeclaration) ) )
+        return;
+
+    GetDevice().SetVertexDeclaration( _pDeclaration );
+
+    pDeclaration = _pDeclaration;
+    declarationKnown = true;
+
+}	// SetVertexDeclaration
+
+
+/************************************************************************
+*    desc:  Set the source of a stream. Streams past the tracked ones are
+*           always issued
+************************************************************************/
+void CRenderStateCache2D::SetStreamSource( UINT index, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride )
+{
+    if( index >= MAX_STREAMS )
+    {
+        Filter( false );
+        GetDevice().SetStreamSource( index, pBuffer, offset, stride );
+        return;
+    }
+
+    CStreamState & state = stream[index];
+
+    if( Filter( state.sourceKnown && (state.pBuffer == pBuffer) && (state.offset == offset) && (state.stride == stride) ) )
+        return;
+
+    GetDevice().SetStreamSource( index, pBuffer, offset, stride );
+
+    state.pBuffer = pBuffer;
+    state.offset = offset;
+    state.stride = stride;
+    state.sourceKnown = true;
+
+}	// SetStreamSource
+
+
+/************************************************************************
+*    desc:  Set the frequency of a stream. Streams past the tracked ones
+*           are always issued
+************************************************************************/
+void CRenderStateCache2D::SetStreamSourceFreq( UINT index, UINT setting )
+{
+    if( index >= MAX_STREAMS )
+    {
+        Filter( false );
+        GetDevice().SetStreamSourceFreq( index, setting );
+        return;
+    }
+
+    CStreamState & state = stream[index];
+
+    if( Filter( state.frequencyKnown && (state.frequency == setting) ) )
+        return;
+
+    GetDevice().SetStreamSourceFreq( index, setting );
+
+    state.frequency = setting;
+    state.frequencyKnown = true;
+
+}	// SetStreamSourceFreq
+
+
+/************************************************************************
+*    desc:  Set the index buffer
+************************************************************************/
+void CRenderStateCache2D::SetIndices( IDirect3DIndexBuffer9 * _pIndexBuffer )
+{
+    if( Filter( indexBufferKnown && (pIndexBuffer == _pIndexBuffer) ) )
+        return;
+
+    GetDevice().SetIndices( _pIndexBuffer );
+
+    pIndexBuffer = _pIndexBuffer;
+    indexBufferKnown = true;
+
+}	// SetIndices
+
+
+/************************************************************************
+*    desc:  Set a render state
+************************************************************************/
+void CRenderStateCache2D::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    boost::unordered_map<int, DWORD>::iterator iter = renderStateMap.find( state );
+
+    if( Filter( (iter != renderStateMap.end()) && (iter->second == value) ) )
+        return;
+
+    GetDevice().SetRenderState( state, value );
+
+    renderStateMap[state] = value;
+
+}	// SetRenderState
+
+
+/************************************************************************
+*    desc:  Get a render state. The device is only asked the first time
+*           after the cache was invalidated
+*
+*	 param:	D3DRENDERSTATETYPE state - state to get
+*
+*	 ret:	DWORD - value of the state
+************************************************************************/
+DWORD CRenderStateCache2D::GetRenderState( D3DRENDERSTATETYPE state )
+{
+    boost::unordered_map<int, DWORD>::iterator iter = renderStateMap.find( state );
+
+    if( iter != renderStateMap.end() )
+        return iter->second;
+
+    DWORD value = 0;
+    GetDevice().GetRenderState( state, &value );
+
+    renderStateMap[state] = value;
+
+    return value;
+
+}	// GetRenderState
+
+
+/************************************************************************
+*    desc:  Set the effect and technique
+*
+*	 param:	const string & effect    - name of the effect
+*			const string & technique - name of the technique
+************************************************************************/
+void CRenderStateCache2D::SetEffectAndTechnique( const std::string & _effect, const std::string & _technique )
+{
+    if( Filter( techniqueKnown && (effect == _effect) && (technique == _technique) ) )
+        return;
+
+    GetDevice().SetEffectAndTechnique( _effect, _technique );
+
+    effect = _effect;
+    technique = _technique;
+    techniqueKnown = true;
+
+}	// SetEffectAndTechnique
+
+
+/************************************************************************
+*    desc:  Select the texture
+************************************************************************/
+void CRenderStateCache2D::SelectTexture( IDirect3DBaseTexture9 * _pTexture )
+{
+    if( Filter( textureKnown && (pTexture == _pTexture) ) )
+        return;
+
+    GetDevice().SelectTexture( _pTexture );
+
+    pTexture = _pTexture;
+    textureKnown = true;
+
+}	// SelectTexture
+
+
+/************************************************************************
+*    desc:  Get the number of calls issued and filtered out since the
+*           counters were reset
+************************************************************************/
+size_t CRenderStateCache2D::GetIssuedCount() const
+{
+    return issuedCount;
+
+}	// GetIssuedCount
+
+size_t CRenderStateCache2D::GetFilteredCount() const
+{
+    return filteredCount;
+
+}	// GetFilteredCount
+
+
+/************************************************************************
+*    desc:  Reset the counters
+************************************************************************/
+void CRenderStateCache2D::ResetCounters()
+{
+    issuedCount = 0;
+    filteredCount = 0;
+
+}	// ResetCounters
+
+
+/************************************************************************
+*    desc:  Get the device the calls go to. A null or recording device
+*           can be set in place of the game's with CGraphicsDevice2D
+************************************************************************/
+CGraphicsDevice2D & CRenderStateCache2D::GetDevice()
+{
+    return CGraphicsDevice2D::Instance();
+
+}	// GetDevice
+
+
+/************************************************************************
+*    desc:  Count a call
+*
+*	 param:	bool redundant - whether the call wouldn't change anything
+*
+*	 ret:	bool - true if the call should be dropped
+************************************************************************/
+bool CRenderStateCache2D::Filter( bool redundant )
+{
+    if( redundant )
+        ++filteredCount;
+    else
+        ++issuedCount;
+
+    return redundant;
+
+}	// Filter
@@ -0,0 +1,117 @@
+/************************************************************************
+*    FILE NAME:       renderstatecache2d.h
+*
+*    DESCRIPTION:     Keeps track of the bindings of the device, its
+*                     effect and texture, and drops the calls that
+*                     wouldn't change them.
+************************************************************************/
+
+#ifndef __render_state_cache_2d_h__
+#define __render_state_cache_2d_h__
+
+// Standard lib dependencies
+#include <string>
+
+// DirectX lib dependencies
+#include <d3d9.h>
+
+// Boost lib dependencies
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+
+// Game lib dependencies
+#include <common/defs.h>
+
+// Forward declaration(s)
+class CGraphicsDevice2D;
+
+class CRenderStateCache2D : public boost::noncopyable
+{
+public:
+
+    // Get the instance of the singleton class
+    static CRenderStateCache2D & Instance()
+    {
+        static CRenderStateCache2D renderStateCache;
+        return renderStateCache;
+    }
+
+    // Forget the bindings. The rest of the game sets the device, shader and textures without
+    // the cache, so every renderer that uses it calls this before its first call of a render.
+    // Also called when the device is set or reset
+    void Invalidate();
+
+    // Device calls. Only issued when they change the binding
+    void SetVertexDeclaration( IDirect3DVertexDeclaration9 * pDeclaration );
+    void SetStreamSource( UINT stream, IDirect3DVertexBuffer9 * pBuffer, UINT offset, UINT stride );
+    void SetStreamSourceFreq( UINT stream, UINT setting );
+    void SetIndices( IDirect3DIndexBuffer9 * pIndexBuffer );
+    void SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+
+    // Get a render state. Only asks the device if the state isn't known since the last
+    // Invalidate, so a value is never kept from another render
+    DWORD GetRenderState( D3DRENDERSTATETYPE state );
+
+    // Effect and texture calls. Only issued when they change the binding
+    void SetEffectAndTechnique( const std::string & effect, const std::string & technique );
+    void SelectTexture( IDirect3DBaseTexture9 * pTexture );
+
+    // Get the number of calls issued and filtered out since the counters were reset
+    size_t GetIssuedCount() const;
+    size_t GetFilteredCount() const;
+
+    // Reset the counters. Call once per frame
+    void ResetCounters();
+
+private:
+
+    // Constructor
+    CRenderStateCache2D();
+
+    // Get the device the calls go to
+    CGraphicsDevice2D & GetDevice();
+
+    // Count a call. Returns true if it's redundant and should be dropped
+    bool Filter( bool redundant );
+
+private:
+
+    // The most streams that are tracked. The instance meshes only use two
+    static const UINT MAX_STREAMS = 4;
+
+    // Binding of a stream
+    class CStreamState
+    {
+    public:
+
+        IDirect3DVertexBuffer9 * pBuffer;
+        UINT offset;
+        UINT stride;
+        UINT frequency;
+
+        // Whether the source and the frequency are known
+        bool sourceKnown;
+        bool frequencyKnown;
+    };
+
+    // The bindings and whether they're known
+    IDirect3DVertexDeclaration9 * pDeclaration;
+    IDirect3DIndexBuffer9 * pIndexBuffer;
+    IDirect3DBaseTexture9 * pTexture;
+    CStreamState stream[MAX_STREAMS];
+    boost::unordered_map<int, DWORD> renderStateMap;
+    bool declarationKnown;
+    bool indexBufferKnown;
+    bool textureKnown;
+
+    // The effect and technique that are set
+    std::string effect;
+    std::string technique;
+    bool techniqueKnown;
+
+    // Calls issued and filtered out since the counters were reset
+    size_t issuedCount;
+    size_t filteredCount;
+};
+
+#endif  // __render_state_cache_2d_h__
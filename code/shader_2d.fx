@@ -5,6 +5,11 @@
 // Camera view matrix
 float4x4 cameraViewProjMatrix;
 
+// The camera position projected with a w of 0, for each projection. The instances are built
+// without the camera, so it's added in clip space. See SetCameraOffsets in instancemesh2d.cpp
+float4 cameraPerspectiveOffset;
+float4 cameraOrthographicOffset;
+
 // Object's color
 float4 materialColor;
 
@@ -14,6 +19,34 @@ float4 materialColor;
 // Texture
 texture diffuseTexture;
 
+// Textures of the other atlas pages when meshes are merged. Page zero is diffuseTexture
+texture pageTexture1;
+texture pageTexture2;
+texture pageTexture3;
+
+// Sizes of the animation tables. They have to match the ones in instancemesh2d.cpp
+#define MAX_ANIMATION_FRAMES 192
+#define MAX_ANIMATIONS 32
+
+// The compact layout stores the frame rate as a fraction of this. See instancepack2d.h
+static const float MAX_ANIMATION_RATE = 120.0;
+
+// UVs of every frame of the animations, u1 v1 u2 v2
+float4 animationFrameUV[MAX_ANIMATION_FRAMES];
+
+// First frame and frame count of each animation
+float4 animationInfo[MAX_ANIMATIONS];
+
+// Time the animations are played at, in seconds
+float animationTime;
+
+// Corners of the hulls the instances are drawn as, two per texel. Row zero is the whole quad
+// and each atlas component has a row after it. See CreateHullTexture in instancemesh2d.cpp
+texture hullTexture;
+
+// Number of rows in the hull texture
+float hullCount;
+
 
 //-----------------------------------------------------------------------------
 // STRUCT DEFINITIONS
@@ -25,6 +58,13 @@ struct PS_INPUT
     float4 color  : COLOR0;
 };
 
+struct PS_INPUT_PAGE
+{
+	float2 uv0    : TEXCOORD0;
+	float4 color  : COLOR0;
+	float page    : TEXCOORD1;
+};
+
 struct VS_INPUT_COLOR_ONLY
 {
 	float4 pos	  : POSITION;
@@ -41,6 +81,29 @@ struct VS_INPUT_INSTANCE
 	float4 iMatrix4  : TEXCOORD4;
 	float4 iColor	 : COLOR0;
 	float4 iUV		 : TEXCOORD5;
+	float4 iMisc	 : TEXCOORD6;
+};
+
+struct VS_INPUT_COMPACT_INSTANCE
+{
+	float4 vPos	     : POSITION;
+	uint vUVIndex    : BLENDINDICES;
+	float4 iAxis     : TEXCOORD1;
+	float4 iPos      : TEXCOORD2;
+	float4 iColor	 : COLOR0;
+	float4 iUV		 : TEXCOORD5;
+	float4 iMisc	 : TEXCOORD6;
+};
+
+// The compact instance of a mesh whose sprites aren't tinted. See CUntintedInstance2D
+struct VS_INPUT_COMPACT_UNTINTED_INSTANCE
+{
+	float4 vPos	     : POSITION;
+	uint vUVIndex    : BLENDINDICES;
+	float4 iAxis     : TEXCOORD1;
+	float4 iPos      : TEXCOORD2;
+	float4 iUV		 : TEXCOORD5;
+	float4 iMisc	 : TEXCOORD6;
 };
 
 struct VS_OUTPUT_COLOR_ONLY
@@ -50,6 +113,14 @@ struct VS_OUTPUT_COLOR_ONLY
 	float4 color  : COLOR0;
 };
 
+struct VS_OUTPUT_PAGE
+{
+	float4 pos	  : POSITION;
+	float2 uv0    : TEXCOORD0;
+	float4 color  : COLOR0;
+	float page    : TEXCOORD1;
+};
+
 
 //-----------------------------------------------------------------------------
 // TEXTURE SAMPLERS
@@ -74,6 +145,94 @@ sampler_state
     //AddressV = Clamp;
 };
 
+sampler pageSampler1 = 
+sampler_state
+{
+    Texture = <pageTexture1>;
+	MinFilter = Linear;
+    MagFilter = Linear;
+};
+
+sampler pageSampler2 = 
+sampler_state
+{
+    Texture = <pageTexture2>;
+	MinFilter = Linear;
+    MagFilter = Linear;
+};
+
+sampler pageSampler3 = 
+sampler_state
+{
+    Texture = <pageTexture3>;
+	MinFilter = Linear;
+    MagFilter = Linear;
+};
+
+// Read by the vertex shader, so the corners have to come back exactly as they were stored
+sampler hullSampler = 
+sampler_state
+{
+    Texture = <hullTexture>;
+	MinFilter = Point;
+    MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+
+
+//-----------------------------------------------------------------------------
+// FUNCTIONS
+//-----------------------------------------------------------------------------
+
+// Get the UVs of an instance. An animated instance has its animation ID, its phase at time
+// zero and its frame rate where the UVs go, and the frame is picked from the animation time.
+// The first flag of the misc byte marks an animated instance
+float4 GetInstanceUV( float4 iUV, float4 iMisc, float idScale, float rateScale )
+{
+	float4 uv = iUV;
+
+	[branch]
+	if( fmod( iMisc.y, 2 ) > 0.5 )
+	{
+		float4 info = animationInfo[ round( iUV.x * idScale ) ];
+		float loop = frac( (animationTime * iUV.z * rateScale / info.y) + iUV.y );
+
+		uv = animationFrameUV[ info.x + min( floor( loop * info.y ), info.y - 1 ) ];
+	}
+
+	return uv;
+}
+
+// Get the camera offset of an instance. The second flag of the misc byte marks an orthographic instance
+float4 GetCameraOffset( float4 iMisc )
+{
+	return (fmod( floor( iMisc.y / 2 ), 2 ) > 0.5) ? cameraOrthographicOffset : cameraPerspectiveOffset;
+}
+
+// Get the corner of the instance's quad or hull a vertex is at, in the 0 to 1 space of the
+// UVs with y going down. The quad's corners come from the vertex's index. The hull of the
+// instance is in the last two bytes of the misc value, and the index picks its corner
+float2 GetInstanceCorner( uint vUVIndex, float4 iMisc, uniform bool hull )
+{
+	float2 corner;
+
+	if( hull )
+	{
+		float row = iMisc.z + (iMisc.w * 256);
+		float4 texel = tex2Dlod( hullSampler, float4( (floor( vUVIndex / 2.0 ) + 0.5) / 4, (row + 0.5) / hullCount, 0, 0 ) );
+
+		corner = (fmod( vUVIndex, 2 ) < 0.5) ? texel.xy : texel.zw;
+	}
+	else
+	{
+		corner = float2( fmod( vUVIndex, 2 ), floor( vUVIndex / 2.0 ) );
+	}
+
+	return corner;
+}
 
 
 //-----------------------------------------------------------------------------
@@ -93,31 +252,96 @@ VS_OUTPUT_COLOR_ONLY v_shader( VS_INPUT_COLOR_ONLY IN )
 	return OUT;
 }
 
-// Instancing vertex shader
-VS_OUTPUT_COLOR_ONLY v_instance_shader( VS_INPUT_INSTANCE IN )
+// Instancing vertex shader. The vertex is a corner of the quad, or of the hull when hull is
+// true. The position and UVs both come from the corner, so a hull only covers the texels in it
+VS_OUTPUT_COLOR_ONLY v_instance_shader( VS_INPUT_INSTANCE IN, uniform bool hull )
 {
 	VS_OUTPUT_COLOR_ONLY OUT;
 
 	float4x4 mInstanceMatrix = float4x4(IN.iMatrix1,IN.iMatrix2,IN.iMatrix3,IN.iMatrix4);
 
-	float2 uv;
+	float4 iUV = GetInstanceUV( IN.iUV, IN.iMisc, 1, 1 );
+	float2 corner = GetInstanceCorner( IN.vUVIndex, IN.iMisc, hull );
 
-	if( IN.vUVIndex == 0 )
-		uv = IN.iUV.xy;
+	OUT.pos = mul( float4( corner.x - 0.5, 0.5 - corner.y, 0, 1 ), mInstanceMatrix ) + GetCameraOffset( IN.iMisc );
+	OUT.uv0 = lerp( iUV.xy, iUV.zw, corner );
 
-	else if( IN.vUVIndex == 1 )
-		uv = IN.iUV.zy;
+	OUT.color = IN.iColor;
 
-	else if( IN.vUVIndex == 2 )
-		uv = IN.iUV.xw;
-	
-	else
-		uv = IN.iUV.zw;
+	return OUT;
+}
 
-	OUT.pos = mul( IN.vPos, mInstanceMatrix );
-	OUT.uv0 = uv;
+// Compact instancing vertex shader. Every vertex of the quad has the same z and w,
+// so only the 2x2 matrix and the translation are needed to rebuild the transform.
+// A mesh without animation skips looking its UVs up
+VS_OUTPUT_COLOR_ONLY CompactInstance( uint vUVIndex, float4 iAxis, float4 iPos, float4 iColor, float4 iUV, float4 iMisc,
+                                      uniform bool hull, uniform bool animated )
+{
+	VS_OUTPUT_COLOR_ONLY OUT;
 
-	OUT.color = IN.iColor;
+	// The animation ID and frame rate were stored as 16 bit normalized values
+	if( animated )
+		iUV = GetInstanceUV( iUV, iMisc, 65535, MAX_ANIMATION_RATE );
+
+	float2 corner = GetInstanceCorner( vUVIndex, iMisc, hull );
+	float2 vPos = float2( corner.x - 0.5, 0.5 - corner.y );
+
+	OUT.pos = iPos + GetCameraOffset( iMisc );
+	OUT.pos.xy += (vPos.x * iAxis.xy) + (vPos.y * iAxis.zw);
+	OUT.uv0 = lerp( iUV.xy, iUV.zw, corner );
+
+	OUT.color = iColor;
+
+	return OUT;
+}
+
+VS_OUTPUT_COLOR_ONLY v_instance_compact_shader( VS_INPUT_COMPACT_INSTANCE IN, uniform bool hull, uniform bool animated )
+{
+	return CompactInstance( IN.vUVIndex, IN.iAxis, IN.iPos, IN.iColor, IN.iUV, IN.iMisc, hull, animated );
+}
+
+// The instances of a mesh that isn't tinted are drawn white
+VS_OUTPUT_COLOR_ONLY v_instance_compact_untinted_shader( VS_INPUT_COMPACT_UNTINTED_INSTANCE IN, uniform bool hull, uniform bool animated )
+{
+	return CompactInstance( IN.vUVIndex, IN.iAxis, IN.iPos, float4( 1, 1, 1, 1 ), IN.iUV, IN.iMisc, hull, animated );
+}
+
+// Instancing vertex shaders that pass the atlas page on to the pixel shader
+VS_OUTPUT_PAGE v_instance_pages_shader( VS_INPUT_INSTANCE IN )
+{
+	VS_OUTPUT_COLOR_ONLY base = v_instance_shader( IN, false );
+	VS_OUTPUT_PAGE OUT;
+
+	OUT.pos = base.pos;
+	OUT.uv0 = base.uv0;
+	OUT.color = base.color;
+	OUT.page = IN.iMisc.x;
+
+	return OUT;
+}
+
+VS_OUTPUT_PAGE v_instance_compact_pages_shader( VS_INPUT_COMPACT_INSTANCE IN, uniform bool animated )
+{
+	VS_OUTPUT_COLOR_ONLY base = v_instance_compact_shader( IN, false, animated );
+	VS_OUTPUT_PAGE OUT;
+
+	OUT.pos = base.pos;
+	OUT.uv0 = base.uv0;
+	OUT.color = base.color;
+	OUT.page = IN.iMisc.x;
+
+	return OUT;
+}
+
+VS_OUTPUT_PAGE v_instance_compact_untinted_pages_shader( VS_INPUT_COMPACT_UNTINTED_INSTANCE IN, uniform bool animated )
+{
+	VS_OUTPUT_COLOR_ONLY base = v_instance_compact_untinted_shader( IN, false, animated );
+	VS_OUTPUT_PAGE OUT;
+
+	OUT.pos = base.pos;
+	OUT.uv0 = base.uv0;
+	OUT.color = base.color;
+	OUT.page = IN.iMisc.x;
 
 	return OUT;
 }
@@ -138,6 +362,31 @@ float4 p_shader_linear( PS_INPUT IN ) : COLOR
 	return tex2D( textureSamplerLinear, IN.uv0 ) * IN.color;
 }
 
+// Linear texture filter pixel shader that samples the instance's atlas page. The page is the
+// same for the whole quad, so the branches don't diverge. The gradients are taken outside
+// of them because they can't be taken inside
+float4 p_shader_pages( PS_INPUT_PAGE IN ) : COLOR
+{
+	float2 uvDx = ddx( IN.uv0 );
+	float2 uvDy = ddy( IN.uv0 );
+	float4 texel;
+
+	[branch]
+	if( IN.page < 0.5 )
+		texel = tex2Dgrad( textureSamplerLinear, IN.uv0, uvDx, uvDy );
+
+	else if( IN.page < 1.5 )
+		texel = tex2Dgrad( pageSampler1, IN.uv0, uvDx, uvDy );
+
+	else if( IN.page < 2.5 )
+		texel = tex2Dgrad( pageSampler2, IN.uv0, uvDx, uvDy );
+
+	else
+		texel = tex2Dgrad( pageSampler3, IN.uv0, uvDx, uvDy );
+
+	return texel * IN.color;
+}
+
 // Rect texture filter pixel shader
 float4 p_shader_rect( PS_INPUT IN ) : COLOR
 {
@@ -181,9 +430,135 @@ technique instance
 {
 	pass Pass0
 	{
-		VertexShader = compile vs_3_0 v_instance_shader();
+		VertexShader = compile vs_3_0 v_instance_shader( false );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompact
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_shader( false, true );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceHull
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_shader( true );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactHull
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_shader( true, true );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instancePages
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_pages_shader();
+		PixelShader  = compile ps_3_0 p_shader_pages();
+	}
+}
+
+technique instanceCompactPages
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_pages_shader( true );
+		PixelShader  = compile ps_3_0 p_shader_pages();
+	}
+}
+
+// Compact techniques of the meshes that leave out the color or the animation. See CCompactLayout2D
+
+technique instanceCompactStatic
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_shader( false, false );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactStaticHull
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_shader( true, false );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactStaticPages
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_pages_shader( false );
+		PixelShader  = compile ps_3_0 p_shader_pages();
+	}
+}
+
+technique instanceCompactUntinted
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_shader( false, true );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactUntintedHull
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_shader( true, true );
 		PixelShader  = compile ps_3_0 p_shader_linear();
 	}
 }
 
+technique instanceCompactUntintedPages
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_pages_shader( true );
+		PixelShader  = compile ps_3_0 p_shader_pages();
+	}
+}
 
+technique instanceCompactUntintedStatic
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_shader( false, false );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactUntintedStaticHull
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_shader( true, false );
+		PixelShader  = compile ps_3_0 p_shader_linear();
+	}
+}
+
+technique instanceCompactUntintedStaticPages
+{
+	pass Pass0
+	{
+		VertexShader = compile vs_3_0 v_instance_compact_untinted_pages_shader( false );
+		PixelShader  = compile ps_3_0 p_shader_pages();
+	}
+}
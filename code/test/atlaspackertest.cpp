@@ -0,0 +1,272 @@
+/************************************************************************
+*    FILE NAME:       atlaspackertest.cpp
+*
+*    DESCRIPTION:     Unit test of the overlap check of the atlas packer.
+*                     The pairs it finds are checked against comparing
+*                     every rectangle with every other one.
+************************************************************************/
+
+// Standard lib dependencies
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// Boost lib dependencies
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+// Game lib dependencies
+#include <common/atlaspacker.h>
+#include <test/testcheck.h>
+
+// Pairs of rectangle indexes
+typedef std::vector< std::pair<size_t, size_t> > OverlapVec;
+
+/************************************************************************
+*    desc:  Find the overlapping pairs by comparing every rectangle with
+*           every other one. The lower index comes first
+************************************************************************/
+static void FindOverlapsSlowly( const std::vector<CAtlasRect> & rectVec,
+                                const std::vector<uint> & pageVec,
+                                OverlapVec & overlapVec )
+{
+    overlapVec.clear();
+
+    for( size_t i = 0; i < rectVec.size(); ++i )
+    {
+        for( size_t j = i + 1; j < rectVec.size(); ++j )
+        {
+            const CAtlasRect & a = rectVec[i];
+            const CAtlasRect & b = rectVec[j];
+
+            if( (pageVec[i] == pageVec[j]) &&
+                (a.w > 0) && (a.h > 0) && (b.w > 0) && (b.h > 0) &&
+                (a.x < b.x + b.w) && (b.x < a.x + a.w) &&
+                (a.y < b.y + b.h) && (b.y < a.y + a.h) )
+            {
+                overlapVec.push_back( std::make_pair( i, j ) );
+            }
+        }
+    }
+
+}	// FindOverlapsSlowly
+
+
+/************************************************************************
+*    desc:  Check FindOverlaps against the slow way. Every pair has to
+*           be found once, with the lower index first
+************************************************************************/
+static bool CheckOverlaps( const std::vector<CAtlasRect> & rectVec, const std::vector<uint> & pageVec )
+{
+    OverlapVec foundVec, expectedVec;
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, foundVec );
+    FindOverlapsSlowly( rectVec, pageVec, expectedVec );
+
+    bool lowerFirst = true;
+    for( size_t i = 0; i < foundVec.size(); ++i )
+        lowerFirst = lowerFirst && (foundVec[i].first < foundVec[i].second);
+
+    std::sort( foundVec.begin(), foundVec.end() );
+
+    return lowerFirst && (foundVec == expectedVec);
+
+}	// CheckOverlaps
+
+
+/************************************************************************
+*    desc:  Add a rectangle on a page
+************************************************************************/
+static void AddRect( std::vector<CAtlasRect> & rectVec, std::vector<uint> & pageVec,
+                     int x, int y, int w, int h, uint page = 0 )
+{
+    rectVec.push_back( CAtlasRect( x, y, w, h ) );
+    pageVec.push_back( page );
+
+}	// AddRect
+
+
+/************************************************************************
+*    desc:  Rectangles that only share an edge or a corner don't overlap
+************************************************************************/
+static void TestEdgeTouching()
+{
+    std::vector<CAtlasRect> rectVec;
+    std::vector<uint> pageVec;
+
+    // A grid of two by two
+    AddRect( rectVec, pageVec, 0, 0, 10, 10 );
+    AddRect( rectVec, pageVec, 10, 0, 10, 10 );
+    AddRect( rectVec, pageVec, 0, 10, 10, 10 );
+    AddRect( rectVec, pageVec, 10, 10, 10, 10 );
+
+    OverlapVec overlapVec;
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+    TEST_CHECK( overlapVec.empty() );
+    TEST_CHECK( CheckOverlaps( rectVec, pageVec ) );
+
+    // One pixel more is an overlap with both neighbors and the one across the corner
+    rectVec[0].w = 11;
+    rectVec[0].h = 11;
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+    TEST_CHECK( overlapVec.size() == 3 );
+    TEST_CHECK( CheckOverlaps( rectVec, pageVec ) );
+
+}	// TestEdgeTouching
+
+
+/************************************************************************
+*    desc:  Nested and identical rectangles overlap, empty ones overlap
+*           nothing, not even what they're inside of
+************************************************************************/
+static void TestNestedIdenticalAndEmpty()
+{
+    std::vector<CAtlasRect> rectVec;
+    std::vector<uint> pageVec;
+
+    AddRect( rectVec, pageVec, 0, 0, 100, 100 );
+    AddRect( rectVec, pageVec, 10, 10, 5, 5 );
+    AddRect( rectVec, pageVec, 0, 0, 100, 100 );
+    AddRect( rectVec, pageVec, 20, 20, 0, 5 );
+    AddRect( rectVec, pageVec, 30, 30, 5, 0 );
+    AddRect( rectVec, pageVec, 30, 30, 0, 0 );
+
+    OverlapVec overlapVec;
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+    std::sort( overlapVec.begin(), overlapVec.end() );
+
+    // The nested one overlaps both big ones, and the big ones overlap each other
+    TEST_CHECK( overlapVec.size() == 3 );
+    TEST_CHECK( (overlapVec.size() == 3) &&
+                (overlapVec[0] == std::make_pair( size_t(0), size_t(1) )) &&
+                (overlapVec[1] == std::make_pair( size_t(0), size_t(2) )) &&
+                (overlapVec[2] == std::make_pair( size_t(1), size_t(2) )) );
+    TEST_CHECK( CheckOverlaps( rectVec, pageVec ) );
+
+    // Two that cross without either holding a corner of the other
+    rectVec.clear();
+    pageVec.clear();
+    AddRect( rectVec, pageVec, 0, 10, 100, 10 );
+    AddRect( rectVec, pageVec, 45, 0, 10, 100 );
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+    TEST_CHECK( overlapVec.size() == 1 );
+
+}	// TestNestedIdenticalAndEmpty
+
+
+/************************************************************************
+*    desc:  Only rectangles on the same page can overlap
+************************************************************************/
+static void TestPages()
+{
+    std::vector<CAtlasRect> rectVec;
+    std::vector<uint> pageVec;
+
+    AddRect( rectVec, pageVec, 0, 0, 10, 10, 0 );
+    AddRect( rectVec, pageVec, 5, 5, 10, 10, 1 );
+    AddRect( rectVec, pageVec, 0, 0, 10, 10, 2 );
+    AddRect( rectVec, pageVec, 8, 8, 10, 10, 1 );
+
+    OverlapVec overlapVec;
+    NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+    TEST_CHECK( overlapVec.size() == 1 );
+    TEST_CHECK( (overlapVec.size() == 1) && (overlapVec[0] == std::make_pair( size_t(1), size_t(3) )) );
+    TEST_CHECK( CheckOverlaps( rectVec, pageVec ) );
+
+}	// TestPages
+
+
+/************************************************************************
+*    desc:  A lattice of long thin rectangles, where every row crosses
+*           every column, and random rectangles on two pages
+************************************************************************/
+static void TestAgainstSlowCheck()
+{
+    std::vector<CAtlasRect> rectVec;
+    std::vector<uint> pageVec;
+
+    for( int i = 0; i < 50; ++i )
+    {
+        AddRect( rectVec, pageVec, 0, i * 2, 200, 2 );
+        AddRect( rectVec, pageVec, i * 4, 0, 2, 100 );
+    }
+
+    TEST_CHECK( CheckOverlaps( rectVec, pageVec ) );
+
+    boost::random::mt19937 generator( 2468 );
+    bool allSame = true;
+
+    for( int test = 0; test < 2000; ++test )
+    {
+        boost::random::uniform_int_distribution<int> countDist( 1, 60 );
+        boost::random::uniform_int_distribution<int> spanDist( 1, 40 );
+        const int count = countDist( generator );
+        const int span = spanDist( generator );
+
+        // Small spans give many shared edges and equal rectangles
+        boost::random::uniform_int_distribution<int> posDist( 0, span - 1 );
+        boost::random::uniform_int_distribution<int> sizeDist( 0, span / 2 + 1 );
+        boost::random::uniform_int_distribution<int> pageDist( 0, 1 );
+
+        rectVec.clear();
+        pageVec.clear();
+
+        for( int i = 0; i < count; ++i )
+            AddRect( rectVec, pageVec, posDist( generator ), posDist( generator ), sizeDist( generator ), sizeDist( generator ), pageDist( generator ) );
+
+        allSame = allSame && CheckOverlaps( rectVec, pageVec );
+    }
+
+    TEST_CHECK( allSame );
+
+}	// TestAgainstSlowCheck
+
+
+/************************************************************************
+*    desc:  The packers never place two rectangles over each other, on
+*           one page or several
+************************************************************************/
+static void TestPackedPages()
+{
+    boost::random::mt19937 generator( 1357 );
+    boost::random::uniform_int_distribution<int> sizeDist( 4, 63 );
+
+    std::vector< CSize<int> > sizeVec;
+    for( int i = 0; i < 3000; ++i )
+        sizeVec.push_back( CSize<int>( sizeDist( generator ), sizeDist( generator ) ) );
+
+    const EAtlasPacker packerVec[] = { EAP_MAXRECTS_SHORT_SIDE, EAP_SKYLINE };
+
+    for( size_t p = 0; p < sizeof(packerVec) / sizeof(packerVec[0]); ++p )
+    {
+        std::vector<CPointInt> posVec;
+        std::vector<uint> pageVec;
+        std::vector< CSize<int> > pageSizeVec;
+
+        if( !TEST_CHECK( NAtlasPacker::PackPages( packerVec[p], EAS_HEIGHT, 512, 512, sizeVec, posVec, pageVec, pageSizeVec ) ) )
+            continue;
+
+        TEST_CHECK( pageSizeVec.size() > 1 );
+
+        std::vector<CAtlasRect> rectVec;
+        for( size_t i = 0; i < sizeVec.size(); ++i )
+            rectVec.push_back( CAtlasRect( posVec[i].x, posVec[i].y, sizeVec[i].w, sizeVec[i].h ) );
+
+        OverlapVec overlapVec;
+        NAtlasPacker::FindOverlaps( rectVec, pageVec, overlapVec );
+        TEST_CHECK( overlapVec.empty() );
+    }
+
+}	// TestPackedPages
+
+
+int main()
+{
+    TestEdgeTouching();
+    TestNestedIdenticalAndEmpty();
+    TestPages();
+    TestAgainstSlowCheck();
+    TestPackedPages();
+
+    return NTestCheck::Finish( "atlaspackertest" );
+
+}	// main
@@ -0,0 +1,154 @@
+/************************************************************************
+*    FILE NAME:       instancebuffer2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the instance ring buffer on the null
+*                     device. Checks where the locks land, what counts
+*                     as a stall and the device lost and reset.
+************************************************************************/
+
+// Game lib dependencies
+#include <2d/instancebuffer2d.h>
+#include <2d/instancestats2d.h>
+#include <2d/nulldevice2d.h>
+#include <test/testcheck.h>
+
+// Size of the instances the test locks
+const UINT TEST_STRIDE = 32;
+
+/************************************************************************
+*    desc:  Locks are appended until the buffer is full, and only the
+*           discard that wraps around counts as a stall
+************************************************************************/
+static void TestWrap()
+{
+    CInstanceStats2D::Instance().ResetCounters();
+
+    CInstanceBuffer2D buffer;
+    buffer.SetStride( TEST_STRIDE );
+    UINT offset;
+
+    // The first lock creates the buffer and starts at the beginning
+    buffer.Lock( 100, offset );
+    buffer.Unlock();
+
+    const size_t capacity = buffer.GetCapacity();
+    TEST_CHECK( offset == 0 );
+    TEST_CHECK( capacity >= 100 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetReallocCount() == 1 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetStallLockCount() == 0 );
+
+    // Locks are appended while they fit
+    size_t expected = 100;
+    while( expected + 100 <= capacity )
+    {
+        buffer.Lock( 100, offset );
+        buffer.Unlock();
+
+        TEST_CHECK( offset == expected );
+        expected += 100;
+    }
+
+    TEST_CHECK( CInstanceStats2D::Instance().GetStallLockCount() == 0 );
+
+    // The one that doesn't fit wraps around
+    buffer.Lock( 100, offset );
+    buffer.Unlock();
+
+    TEST_CHECK( offset == 0 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetStallLockCount() == 1 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetReallocCount() == 1 );
+
+}	// TestWrap
+
+
+/************************************************************************
+*    desc:  Without stream offsets every lock is a discard at the
+*           beginning. That's the normal case there, not a stall
+************************************************************************/
+static void TestNoStreamOffset( CNullDevice2D & device )
+{
+    D3DCAPS9 caps;
+    device.GetDeviceCaps( &caps );
+    caps.DevCaps2 &= ~D3DDEVCAPS2_STREAMOFFSET;
+    device.SetDeviceCaps( caps );
+
+    CInstanceStats2D::Instance().ResetCounters();
+
+    CInstanceBuffer2D buffer;
+    buffer.SetStride( TEST_STRIDE );
+
+    bool allAtStart = true;
+    for( int i = 0; i < 50; ++i )
+    {
+        UINT offset;
+        buffer.Lock( 100, offset );
+        buffer.Unlock();
+
+        allAtStart = allAtStart && (offset == 0);
+    }
+
+    TEST_CHECK( allAtStart );
+    TEST_CHECK( CInstanceStats2D::Instance().GetStallLockCount() == 0 );
+
+    caps.DevCaps2 |= D3DDEVCAPS2_STREAMOFFSET;
+    device.SetDeviceCaps( caps );
+
+}	// TestNoStreamOffset
+
+
+/************************************************************************
+*    desc:  The buffer is released when the device is lost and comes
+*           back at the same size when it's reset
+************************************************************************/
+static void TestLostAndReset()
+{
+    CInstanceBuffer2D buffer;
+    buffer.SetStride( TEST_STRIDE );
+
+    // A buffer that was never created stays that way
+    CGraphicsDevice2D::LostDevice();
+    CGraphicsDevice2D::ResetDevice();
+    TEST_CHECK( buffer.GetBuffer() == NULL );
+
+    UINT offset;
+    buffer.Lock( 1000, offset );
+    buffer.Unlock();
+
+    const size_t capacity = buffer.GetCapacity();
+    TEST_CHECK( buffer.GetBuffer() != NULL );
+
+    CGraphicsDevice2D::LostDevice();
+    TEST_CHECK( buffer.GetBuffer() == NULL );
+    TEST_CHECK( buffer.GetCapacity() == 0 );
+
+    CGraphicsDevice2D::ResetDevice();
+    TEST_CHECK( buffer.GetBuffer() != NULL );
+    TEST_CHECK( buffer.GetCapacity() == capacity );
+
+    // The recreated buffer is empty, so the next lock starts at the beginning without a stall
+    CInstanceStats2D::Instance().ResetCounters();
+
+    buffer.Lock( 10, offset );
+    buffer.Unlock();
+
+    TEST_CHECK( offset == 0 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetStallLockCount() == 0 );
+    TEST_CHECK( CInstanceStats2D::Instance().GetReallocCount() == 0 );
+
+}	// TestLostAndReset
+
+
+int main()
+{
+    CNullDevice2D device;
+    CGraphicsDevice2D::SetInstance( &device );
+
+    TestWrap();
+    TestNoStreamOffset( device );
+    TestLostAndReset();
+
+    CGraphicsDevice2D::SetInstance( NULL );
+
+    return NTestCheck::Finish( "instancebuffer2dtest" );
+
+}	// main
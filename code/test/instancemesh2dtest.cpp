@@ -0,0 +1,420 @@
+/************************************************************************
+*    FILE NAME:       instancemesh2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the mega texture and the instance
+*                     mesh rendering on the recording device. The mega
+*                     texture is made from textures in plain memory and
+*                     render packets of generated sprites are drawn,
+*                     instanced and as a quad batch. Checks the calls
+*                     that reach the device and the calibration of the
+*                     quad batch threshold.
+************************************************************************/
+
+// Standard lib dependencies
+#include <vector>
+
+// Boost lib dependencies
+#include <boost/ptr_container/ptr_vector.hpp>
+
+// Game lib dependencies
+#include <2d/instancemesh2d.h>
+#include <2d/instancestats2d.h>
+#include <2d/nulldevice2d.h>
+#include <2d/recordingdevice2d.h>
+#include <2d/renderqueue2d.h>
+#include <common/megatexture.h>
+#include <common/texture.h>
+#include <common/worldpoint.h>
+#include <test/testcheck.h>
+
+// Width and height of the textures the mega texture is made from
+const int TEXTURE_SIZE[][2] = { {32, 32}, {16, 48}, {24, 8} };
+const int TEXTURE_COUNT = sizeof(TEXTURE_SIZE) / sizeof(TEXTURE_SIZE[0]);
+
+// Width the mega texture is packed in
+const uint MEGA_TEXTURE_WIDTH = 128;
+
+// Sprites of the render packets and how many of them are opaque
+const size_t INSTANCED_COUNT = 40;
+const size_t INSTANCED_OPAQUE_COUNT = 10;
+const size_t QUAD_BATCH_COUNT = 5;
+
+/************************************************************************
+*    desc:  Feeds render packets to the mesh. A friend of the mesh, so it
+*           can make them without sprite groups
+************************************************************************/
+class CInstanceMeshTest2D
+{
+public:
+
+    // Fill the packet the next render draws. The sprites use the components of the mega
+    // texture in turn and the first ones are opaque
+    static void SetPacket( CInstanceMesh2D & mesh, CMegaTexture & megaTexture, size_t count, size_t opaqueCount );
+
+    // Calibrate the quad batch threshold again
+    static void Calibrate( CInstanceMesh2D & mesh )
+    { mesh.CalibrateQuadBatchThreshold(); }
+};
+
+
+/************************************************************************
+*    desc:  Fill the packet the next render draws. The mesh is in render
+*           packet mode, so it draws the packet that isn't written
+************************************************************************/
+void CInstanceMeshTest2D::SetPacket( CInstanceMesh2D & mesh, CMegaTexture & megaTexture, size_t count, size_t opaqueCount )
+{
+    CInstanceMesh2D::CRenderPacket & packet = mesh.renderPacket[mesh.writePacketIndex ^ 1];
+
+    packet.sourceVec.clear();
+    packet.keyVec.clear();
+    packet.opaqueVec.clear();
+    packet.submittedCount = count;
+    packet.occludedCount = 0;
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        const uint componentId = static_cast<uint>(i % megaTexture.GetComponentCount());
+
+        // Spread the sprites out in a row
+        const float matrix[16] = { 1, 0, 0, 0,
+                                   0, 1, 0, 0,
+                                   0, 0, 1, 0,
+                                   static_cast<float>(i) * 10.f, 0, 0, 1 };
+
+        CInstanceMesh2D::CInstanceSource source;
+        source.scaledMatrix = D3DXMATRIX( matrix );
+        source.size.w = 8.f;
+        source.size.h = 8.f;
+        source.projType = CSettings::EPT_ORTHOGRAPHIC;
+        source.pUV = megaTexture.GetUVs( componentId );
+        source.page = megaTexture.GetPage( componentId );
+        source.hull = componentId + 1;
+        source.animation = CInstanceMesh2D::NO_ANIMATION;
+        source.animationPhase = 0;
+        source.animationRate = 0;
+
+        CWorldValue depth;
+        depth.i = static_cast<int>(i);
+
+        packet.keyVec.push_back( CRenderQueue2D::GetDepthKey( depth ) );
+        packet.opaqueVec.push_back( i < opaqueCount );
+        packet.sourceVec.push_back( source );
+    }
+
+}	// SetPacket
+
+
+/************************************************************************
+*    desc:  Get the first logged call of a type. NULL if there's none
+************************************************************************/
+static const CRecordingDevice2D::CCall * FindCall( const CRecordingDevice2D & device, CRecordingDevice2D::ECallType type )
+{
+    for( size_t i = 0; i < device.GetCallVec().size(); ++i )
+        if( device.GetCallVec()[i].type == type )
+            return &device.GetCallVec()[i];
+
+    return NULL;
+
+}	// FindCall
+
+
+/************************************************************************
+*    desc:  Whether every draw is made inside a pass of the effect, and
+*           every pass and effect that's begun is ended
+************************************************************************/
+static bool CheckDrawsInPasses( const CRecordingDevice2D & device )
+{
+    bool inEffect = false;
+    bool inPass = false;
+    bool valid = true;
+
+    for( size_t i = 0; i < device.GetCallVec().size(); ++i )
+    {
+        switch( device.GetCallVec()[i].type )
+        {
+            case CRecordingDevice2D::ECT_BEGIN_EFFECT:      valid = valid && !inEffect; inEffect = true;  break;
+            case CRecordingDevice2D::ECT_BEGIN_EFFECT_PASS: valid = valid && inEffect && !inPass; inPass = true; break;
+            case CRecordingDevice2D::ECT_END_EFFECT_PASS:   valid = valid && inPass; inPass = false;      break;
+            case CRecordingDevice2D::ECT_END_EFFECT:        valid = valid && inEffect && !inPass; inEffect = false; break;
+            case CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE: valid = valid && inPass;                 break;
+            default: break;
+        }
+    }
+
+    return valid && !inEffect && !inPass;
+
+}	// CheckDrawsInPasses
+
+
+/************************************************************************
+*    desc:  Create the textures the mega texture is made from. Every
+*           pixel is opaque and tells its texture and place apart
+************************************************************************/
+static void CreateTextures( boost::ptr_vector<NText::CTextureFor2D> & textureVec, std::vector<NText::CTextureFor2D *> & pTextureVec )
+{
+    for( int t = 0; t < TEXTURE_COUNT; ++t )
+    {
+        NText::CTextureFor2D * pTexture = new NText::CTextureFor2D();
+        textureVec.push_back( pTexture );
+        pTextureVec.push_back( pTexture );
+
+        const int width = TEXTURE_SIZE[t][0];
+        const int height = TEXTURE_SIZE[t][1];
+        pTexture->size.w = width;
+        pTexture->size.h = height;
+
+        CGraphicsDevice2D::Instance().CreateTexture( width, height, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &pTexture->spTexture );
+
+        D3DLOCKED_RECT lockedRect;
+        if( !TEST_CHECK( SUCCEEDED( pTexture->spTexture->LockRect( 0, &lockedRect, NULL, 0 ) ) ) )
+            continue;
+
+        for( int y = 0; y < height; ++y )
+        {
+            DWORD * pRow = reinterpret_cast<DWORD *>( static_cast<BYTE *>(lockedRect.pBits) + (y * lockedRect.Pitch) );
+
+            for( int x = 0; x < width; ++x )
+                pRow[x] = 0xFF000000 | (t << 16) | (y << 8) | x;
+        }
+
+        pTexture->spTexture->UnlockRect( 0 );
+    }
+
+}	// CreateTextures
+
+
+/************************************************************************
+*    desc:  The textures are copied onto the page through the device,
+*           and rendering the page draws it with the page selected
+************************************************************************/
+static void TestMegaTexture( CRecordingDevice2D & device, CMegaTexture & megaTexture, const std::vector<NText::CTextureFor2D *> & pTextureVec )
+{
+    device.Clear();
+    megaTexture.CreateMegaTexture( "test", pTextureVec, MEGA_TEXTURE_WIDTH );
+
+    TEST_CHECK( megaTexture.GetPageCount() == 1 );
+    TEST_CHECK( megaTexture.GetComponentCount() == TEXTURE_COUNT );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_COPY_TEXTURE ) == TEXTURE_COUNT );
+
+    if( megaTexture.GetPageCount() != 1 )
+        return;
+
+    // The copies are made in the order of the textures. Each one's pixels are on the page where it was copied to
+    IDirect3DTexture9 * pPage = megaTexture.GetTexture( 0 )->spTexture;
+    D3DLOCKED_RECT lockedRect;
+
+    if( !TEST_CHECK( SUCCEEDED( pPage->LockRect( 0, &lockedRect, NULL, D3DLOCK_READONLY ) ) ) )
+        return;
+
+    bool copied = true;
+    int copy = 0;
+
+    for( size_t i = 0; i < device.GetCallVec().size(); ++i )
+    {
+        const CRecordingDevice2D::CCall & call = device.GetCallVec()[i];
+
+        if( call.type != CRecordingDevice2D::ECT_COPY_TEXTURE )
+            continue;
+
+        copied = copied && (call.pObject == pPage) && (call.arg[2] > 0) && (call.arg[3] > 0);
+
+        for( UINT y = 0; y < call.arg[3]; ++y )
+        {
+            const DWORD * pRow = reinterpret_cast<const DWORD *>( static_cast<const BYTE *>(lockedRect.pBits) + ((call.arg[1] + y) * lockedRect.Pitch) );
+
+            for( UINT x = 0; x < call.arg[2]; ++x )
+                copied = copied && (pRow[call.arg[0] + x] == (0xFF000000 | (copy << 16) | (y << 8) | x));
+        }
+
+        ++copy;
+    }
+
+    pPage->UnlockRect( 0 );
+
+    TEST_CHECK( copied );
+
+    // Render the page
+    device.Clear();
+    megaTexture.Render( 0 );
+
+    const CRecordingDevice2D::CCall * pTechnique = FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE );
+    const CRecordingDevice2D::CCall * pSelect = FindCall( device, CRecordingDevice2D::ECT_SELECT_TEXTURE );
+
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE ) == 1 );
+    TEST_CHECK( (pTechnique != NULL) && (pTechnique->name == "linearFilter") );
+    TEST_CHECK( (pSelect != NULL) && (pSelect->pObject == static_cast<IDirect3DBaseTexture9 *>(pPage)) );
+    TEST_CHECK( CheckDrawsInPasses( device ) );
+
+}	// TestMegaTexture
+
+
+/************************************************************************
+*    desc:  The first mesh initialized calibrates the quad batch
+*           threshold. It draws both ways in a scene of its own, timed
+*           with timestamps, without counting the sprites. Without
+*           timestamps it's timed on the CPU, and inside the game's
+*           scene no other is begun
+************************************************************************/
+static void TestCalibration( CNullDevice2D & nullDevice, CRecordingDevice2D & device, CMegaTexture & megaTexture )
+{
+    CInstanceStats2D::Instance().ResetCounters();
+    device.Clear();
+
+    CInstanceMesh2D mesh;
+    mesh.Init( &megaTexture );
+
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_BEGIN_SCENE ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_END_SCENE ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_CREATE_QUERY ) == 4 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE ) > 0 );
+    TEST_CHECK( CheckDrawsInPasses( device ) );
+    TEST_CHECK( CInstanceMesh2D::GetQuadBatchThreshold() <= CInstanceMesh2D::MAX_QUAD_BATCH_COUNT );
+    TEST_CHECK( CInstanceStats2D::Instance().GetSubmittedCount() == 0 );
+
+    // Only once
+    device.Clear();
+    CInstanceMesh2D otherMesh;
+    otherMesh.Init( &megaTexture );
+
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_BEGIN_SCENE ) == 0 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE ) == 0 );
+
+    // The first query that can't be made is the only one asked for
+    nullDevice.SetTimestampSupport( false );
+    nullDevice.BeginScene();
+    device.Clear();
+    CInstanceMeshTest2D::Calibrate( mesh );
+
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_CREATE_QUERY ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_END_SCENE ) == 0 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE ) > 0 );
+    TEST_CHECK( CheckDrawsInPasses( device ) );
+
+    // The game's scene is still open
+    TEST_CHECK( nullDevice.EndScene() == D3D_OK );
+    nullDevice.SetTimestampSupport( true );
+
+}	// TestCalibration
+
+
+/************************************************************************
+*    desc:  More sprites than the quad batch takes are instanced as
+*           hulls. The opaque ones take a draw and the translucent ones
+*           another, and the render states are put back after
+************************************************************************/
+static void TestInstancedRender( CNullDevice2D & nullDevice, CRecordingDevice2D & device, CMegaTexture & megaTexture )
+{
+    CInstanceMesh2D::SetQuadBatchThreshold( QUAD_BATCH_COUNT );
+
+    CInstanceMesh2D mesh;
+    mesh.Init( &megaTexture );
+    mesh.SetRenderPacketMode( true );
+    CInstanceMeshTest2D::SetPacket( mesh, megaTexture, INSTANCED_COUNT, INSTANCED_OPAQUE_COUNT );
+
+    // The states the rest of the game left
+    nullDevice.SetRenderState( D3DRS_ZENABLE, D3DZB_FALSE );
+    nullDevice.SetRenderState( D3DRS_ZWRITEENABLE, FALSE );
+    nullDevice.SetRenderState( D3DRS_ALPHABLENDENABLE, TRUE );
+
+    nullDevice.ResetCounters();
+    device.Clear();
+    mesh.Render();
+
+    const CRecordingDevice2D::CCall * pTechnique = FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE );
+    const CRecordingDevice2D::CCall * pHull = FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_TEXTURE );
+
+    TEST_CHECK( nullDevice.GetDrawCount() == 2 );
+    TEST_CHECK( nullDevice.GetInstanceCount() == INSTANCED_COUNT );
+    TEST_CHECK( (pTechnique != NULL) && (pTechnique->name == "instanceHull") );
+    TEST_CHECK( (pHull != NULL) && (pHull->name == "hullTexture") );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_BEGIN_EFFECT ) == 2 );
+    TEST_CHECK( CheckDrawsInPasses( device ) );
+
+    DWORD value;
+    nullDevice.GetRenderState( D3DRS_ZENABLE, &value );
+    TEST_CHECK( value == D3DZB_FALSE );
+    nullDevice.GetRenderState( D3DRS_ZWRITEENABLE, &value );
+    TEST_CHECK( value == FALSE );
+    nullDevice.GetRenderState( D3DRS_ALPHABLENDENABLE, &value );
+    TEST_CHECK( value == TRUE );
+
+    // Without the hulls the quads are instanced
+    mesh.SetHullMode( false );
+    device.Clear();
+    mesh.Render();
+
+    pTechnique = FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE );
+    TEST_CHECK( (pTechnique != NULL) && (pTechnique->name == "instance") );
+    TEST_CHECK( FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_TEXTURE ) == NULL );
+
+}	// TestInstancedRender
+
+
+/************************************************************************
+*    desc:  A few sprites are drawn as one batch of quads, not instanced.
+*           An empty packet draws nothing
+************************************************************************/
+static void TestQuadBatchRender( CNullDevice2D & nullDevice, CRecordingDevice2D & device, CMegaTexture & megaTexture )
+{
+    CInstanceMesh2D::SetQuadBatchThreshold( QUAD_BATCH_COUNT );
+
+    CInstanceMesh2D mesh;
+    mesh.Init( &megaTexture );
+    mesh.SetRenderPacketMode( true );
+    CInstanceMeshTest2D::SetPacket( mesh, megaTexture, QUAD_BATCH_COUNT, 0 );
+
+    nullDevice.ResetCounters();
+    device.Clear();
+    mesh.Render();
+
+    const CRecordingDevice2D::CCall * pTechnique = FindCall( device, CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE );
+    const CRecordingDevice2D::CCall * pDraw = FindCall( device, CRecordingDevice2D::ECT_DRAW_INDEXED_PRIMITIVE );
+
+    // Two triangles a quad, each drawn once
+    TEST_CHECK( nullDevice.GetDrawCount() == 1 );
+    TEST_CHECK( nullDevice.GetInstanceCount() == 1 );
+    TEST_CHECK( (pDraw != NULL) && (pDraw->arg[3] == QUAD_BATCH_COUNT * 2) );
+    TEST_CHECK( (pTechnique != NULL) && (pTechnique->name == "instance") );
+    TEST_CHECK( CheckDrawsInPasses( device ) );
+
+    CInstanceMeshTest2D::SetPacket( mesh, megaTexture, 0, 0 );
+    nullDevice.ResetCounters();
+    device.Clear();
+    mesh.Render();
+
+    TEST_CHECK( nullDevice.GetDrawCount() == 0 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_BEGIN_EFFECT ) == 0 );
+
+}	// TestQuadBatchRender
+
+
+int main()
+{
+    CNullDevice2D nullDevice;
+    CRecordingDevice2D device( nullDevice );
+    CGraphicsDevice2D::SetInstance( &device );
+
+    const uint quadBatchThreshold = CInstanceMesh2D::GetQuadBatchThreshold();
+
+    {
+        boost::ptr_vector<NText::CTextureFor2D> textureVec;
+        std::vector<NText::CTextureFor2D *> pTextureVec;
+        CreateTextures( textureVec, pTextureVec );
+
+        CMegaTexture megaTexture;
+        TestMegaTexture( device, megaTexture, pTextureVec );
+
+        if( megaTexture.GetPageCount() == 1 )
+        {
+            TestCalibration( nullDevice, device, megaTexture );
+            TestInstancedRender( nullDevice, device, megaTexture );
+            TestQuadBatchRender( nullDevice, device, megaTexture );
+        }
+    }
+
+    CInstanceMesh2D::SetQuadBatchThreshold( quadBatchThreshold );
+    CGraphicsDevice2D::SetInstance( NULL );
+
+    return NTestCheck::Finish( "instancemesh2dtest" );
+
+}	// main
@@ -0,0 +1,271 @@
+/************************************************************************
+*    FILE NAME:       instancepack2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the compact instance data. Values are
+*                     packed and unpacked again, and have to come back
+*                     as close as their packed form allows.
+************************************************************************/
+
+// Standard lib dependencies
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Game lib dependencies
+#include <2d/instancepack2d.h>
+#include <test/testcheck.h>
+
+/************************************************************************
+*    desc:  Is the value within the tolerance of the expected one
+************************************************************************/
+static bool IsNear( float value, float expected, float tolerance )
+{
+    return std::fabs( value - expected ) <= tolerance;
+
+}	// IsNear
+
+
+/************************************************************************
+*    desc:  Half floats. Every half float has to survive the trip to a
+*           float and back, and floats have to round to the nearest one
+************************************************************************/
+static void TestHalfFloats()
+{
+    using namespace NInstancePack2D;
+
+    // Every half float that isn't a NaN goes to a float and comes back the same
+    bool allSame = true;
+    for( uint half = 0; half < 0x10000; ++half )
+    {
+        if( ((half & 0x7C00) == 0x7C00) && ((half & 0x3FF) != 0) )
+            continue;
+
+        allSame = allSame && (FloatToHalf( HalfToFloat( static_cast<unsigned short>(half) ) ) == half);
+    }
+
+    TEST_CHECK( allSame );
+
+    // Values half floats hold exactly
+    TEST_CHECK( FloatToHalf( 0.f ) == 0x0000 );
+    TEST_CHECK( FloatToHalf( -0.f ) == 0x8000 );
+    TEST_CHECK( FloatToHalf( 1.f ) == 0x3C00 );
+    TEST_CHECK( FloatToHalf( -2.f ) == 0xC000 );
+    TEST_CHECK( FloatToHalf( 65504.f ) == 0x7BFF );
+    TEST_CHECK( HalfToFloat( 0x3555 ) == 0.333251953125f );
+
+    // Out of range values go to infinity and tiny ones to zero or a denormal
+    TEST_CHECK( FloatToHalf( 1e6f ) == 0x7C00 );
+    TEST_CHECK( FloatToHalf( -1e6f ) == 0xFC00 );
+    TEST_CHECK( FloatToHalf( 1e-10f ) == 0x0000 );
+    TEST_CHECK( FloatToHalf( 5.9604645e-8f ) == 0x0001 );
+    TEST_CHECK( HalfToFloat( 0x0001 ) == 5.9604645e-8f );
+    TEST_CHECK( FloatToHalf( std::numeric_limits<float>::infinity() ) == 0x7C00 );
+
+    // NaN stays a NaN
+    const unsigned short nan = FloatToHalf( std::numeric_limits<float>::quiet_NaN() );
+    TEST_CHECK( ((nan & 0x7C00) == 0x7C00) && ((nan & 0x3FF) != 0) );
+
+    // Rounds to the nearest, ties to even
+    TEST_CHECK( FloatToHalf( 1.f + 1.f / 2048.f ) == 0x3C00 );
+    TEST_CHECK( FloatToHalf( 1.f + 3.f / 2048.f ) == 0x3C02 );
+    TEST_CHECK( FloatToHalf( 1.f + 1.1f / 2048.f ) == 0x3C01 );
+    TEST_CHECK( FloatToHalf( 2047.99f ) == 0x6800 );
+
+    // The error of the axes of a sprite is under half a step of the half float
+    bool allNear = true;
+    for( float value = -4.f; value <= 4.f; value += 0.0137f )
+        allNear = allNear && IsNear( HalfToFloat( FloatToHalf( value ) ), value, std::fabs( value ) / 2048.f + 1e-7f );
+
+    TEST_CHECK( allNear );
+
+}	// TestHalfFloats
+
+
+/************************************************************************
+*    desc:  16 bit normalized values, as USHORT4N reads them
+************************************************************************/
+static void TestUNorm16()
+{
+    using namespace NInstancePack2D;
+
+    TEST_CHECK( FloatToUNorm16( 0.f ) == 0 );
+    TEST_CHECK( FloatToUNorm16( 1.f ) == 0xFFFF );
+    TEST_CHECK( FloatToUNorm16( -0.5f ) == 0 );
+    TEST_CHECK( FloatToUNorm16( 1.5f ) == 0xFFFF );
+    TEST_CHECK( FloatToUNorm16( std::numeric_limits<float>::quiet_NaN() ) == 0 );
+    TEST_CHECK( UNorm16ToFloat( 0 ) == 0.f );
+    TEST_CHECK( UNorm16ToFloat( 0xFFFF ) == 1.f );
+
+    // Every value goes to a float and comes back the same
+    bool allSame = true;
+    for( uint value = 0; value < 0x10000; ++value )
+        allSame = allSame && (FloatToUNorm16( UNorm16ToFloat( static_cast<unsigned short>(value) ) ) == value);
+
+    TEST_CHECK( allSame );
+
+    // UVs come back within half a step
+    const float uv[4] = { 0.f, 0.123456f, 0.5f, 0.999999f };
+    CCompactInstance2D instance;
+    instance.SetUVs( uv );
+
+    float unpacked[4];
+    instance.GetUVs( unpacked );
+
+    bool uvNear = true;
+    for( int i = 0; i < 4; ++i )
+        uvNear = uvNear && IsNear( unpacked[i], uv[i], 0.5f / 65535.f );
+
+    TEST_CHECK( uvNear );
+
+    // The untinted instance packs the UVs the same way
+    CUntintedInstance2D untinted;
+    untinted.SetUVs( uv );
+    TEST_CHECK( std::memcmp( untinted.uv, instance.uv, sizeof(instance.uv) ) == 0 );
+
+}	// TestUNorm16
+
+
+/************************************************************************
+*    desc:  Colors, as D3DDECLTYPE_D3DCOLOR reads them
+************************************************************************/
+static void TestColor()
+{
+    using namespace NInstancePack2D;
+
+    CColor color;
+    color.r = 1.f;
+    color.g = 0.5f;
+    color.b = 0.f;
+    color.a = 0.25f;
+
+    // ARGB with alpha in the top byte. 0.5 and 0.25 round up
+    TEST_CHECK( PackColor( color ) == 0x40FF8000 );
+
+    CCompactInstance2D instance;
+    instance.SetColor( color );
+
+    const CColor unpacked = instance.GetColor();
+    TEST_CHECK( IsNear( unpacked.r, color.r, 0.501f / 255.f ) );
+    TEST_CHECK( IsNear( unpacked.g, color.g, 0.501f / 255.f ) );
+    TEST_CHECK( IsNear( unpacked.b, color.b, 0.501f / 255.f ) );
+    TEST_CHECK( IsNear( unpacked.a, color.a, 0.501f / 255.f ) );
+
+    // Channels out of range are clamped
+    color.r = 2.f;
+    color.g = -1.f;
+    TEST_CHECK( (PackColor( color ) & 0x00FFFF00) == 0x00FF0000 );
+
+    // Every packed color comes back the same
+    bool allSame = true;
+    for( uint value = 0; value < 0x100; ++value )
+    {
+        const uint packed = (value << 24) | ((255 - value) << 16) | (value << 8) | (value ^ 0x5A);
+        allSame = allSame && (PackColor( UnpackColor( packed ) ) == packed);
+    }
+
+    TEST_CHECK( allSame );
+
+}	// TestColor
+
+
+/************************************************************************
+*    desc:  Matrices. The translation is kept as is, the 2x2 matrix as
+*           half floats, and matrices that rotate out of the xy plane
+*           can't be packed
+************************************************************************/
+static void TestMatrix()
+{
+    // A sprite rotated around z, scaled and moved, in clip space
+    const float angle = 0.7f;
+    const float matrix[16] =
+    {
+        std::cos( angle ) * 0.3f,  std::sin( angle ) * 0.2f, 0.f, 0.f,
+        -std::sin( angle ) * 0.3f, std::cos( angle ) * 0.2f, 0.f, 0.f,
+        0.f,                       0.f,                      1.f, 0.f,
+        -123.456f,                 7.891e5f,                 0.25f, 1.5f
+    };
+
+    TEST_CHECK( NInstancePack2D::IsPackable( matrix ) );
+
+    CCompactInstance2D instance;
+    instance.SetMatrix( matrix );
+
+    float unpacked[16];
+    instance.GetMatrix( unpacked );
+
+    // The translation, with z and w, comes back exactly
+    TEST_CHECK( unpacked[12] == matrix[12] );
+    TEST_CHECK( unpacked[13] == matrix[13] );
+    TEST_CHECK( unpacked[14] == matrix[14] );
+    TEST_CHECK( unpacked[15] == matrix[15] );
+
+    // The 2x2 matrix within half a step of a half float
+    const int axisIndex[4] = { 0, 1, 4, 5 };
+    bool axisNear = true;
+    for( int i = 0; i < 4; ++i )
+        axisNear = axisNear && IsNear( unpacked[axisIndex[i]], matrix[axisIndex[i]], std::fabs( matrix[axisIndex[i]] ) / 2048.f );
+
+    TEST_CHECK( axisNear );
+
+    // The rest is what a quad in the xy plane needs
+    TEST_CHECK( (unpacked[2] == 0.f) && (unpacked[3] == 0.f) && (unpacked[6] == 0.f) && (unpacked[7] == 0.f) );
+    TEST_CHECK( (unpacked[8] == 0.f) && (unpacked[9] == 0.f) && (unpacked[10] == 1.f) && (unpacked[11] == 0.f) );
+
+    // The untinted instance packs the matrix the same way
+    CUntintedInstance2D untinted;
+    untinted.SetMatrix( matrix );
+    TEST_CHECK( std::memcmp( untinted.axis, instance.axis, sizeof(instance.axis) ) == 0 );
+    TEST_CHECK( std::memcmp( untinted.pos, instance.pos, sizeof(instance.pos) ) == 0 );
+
+    // Rotated around x or y, the axes get a z or w the packed matrix has no room for
+    float tilted[16];
+    std::memcpy( tilted, matrix, sizeof(tilted) );
+    tilted[2] = 0.1f;
+    TEST_CHECK( !NInstancePack2D::IsPackable( tilted ) );
+
+    std::memcpy( tilted, matrix, sizeof(tilted) );
+    tilted[7] = -0.1f;
+    TEST_CHECK( !NInstancePack2D::IsPackable( tilted ) );
+
+}	// TestMatrix
+
+
+/************************************************************************
+*    desc:  The animation in place of the UVs, and the misc value
+************************************************************************/
+static void TestAnimationAndMisc()
+{
+    const float rate = CCompactInstance2D::QuantizeAnimationRate( 24.f );
+    TEST_CHECK( IsNear( rate, 24.f, MAX_ANIMATION_RATE / 65535.f ) );
+    TEST_CHECK( CCompactInstance2D::QuantizeAnimationRate( rate ) == rate );
+
+    CCompactInstance2D instance;
+    instance.SetAnimation( 1234, 0.75f, rate );
+
+    TEST_CHECK( instance.uv[0] == 1234 );
+    TEST_CHECK( IsNear( NInstancePack2D::UNorm16ToFloat( instance.uv[1] ), 0.75f, 0.5f / 65535.f ) );
+    TEST_CHECK( NInstancePack2D::UNorm16ToFloat( instance.uv[2] ) * MAX_ANIMATION_RATE == rate );
+    TEST_CHECK( instance.uv[3] == 0 );
+
+    // Page in the first byte, flags in the second, hull in the last two
+    instance.SetMisc( 3, 0x81, 0xBEEF );
+    TEST_CHECK( instance.misc == 0xBEEF8103 );
+
+}	// TestAnimationAndMisc
+
+
+int main()
+{
+    // The vertex declarations are built from these
+    TEST_CHECK( sizeof(CCompactInstance2D) == 40 );
+    TEST_CHECK( sizeof(CUntintedInstance2D) == 36 );
+
+    TestHalfFloats();
+    TestUNorm16();
+    TestColor();
+    TestMatrix();
+    TestAnimationAndMisc();
+
+    return NTestCheck::Finish( "instancepack2dtest" );
+
+}	// main
@@ -0,0 +1,178 @@
+/************************************************************************
+*    FILE NAME:       occlusionbuffer2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the occlusion buffer. Occluders are
+*                     rasterized into a small tile buffer and rectangles
+*                     are checked against it. Only the tiles an occluder
+*                     fully covers may hide anything.
+************************************************************************/
+
+// Game lib dependencies
+#include <2d/occlusionbuffer2d.h>
+#include <test/testcheck.h>
+
+/************************************************************************
+*    desc:  Nothing is hidden until the occluders are rasterized, and
+*           occluders without area are dropped
+************************************************************************/
+static void TestEmpty()
+{
+    COcclusionBuffer2D buffer;
+    buffer.SetResolution( 4, 4 );
+
+    TEST_CHECK( !buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 100.f ) );
+
+    buffer.AddOccluder( 0.5f, -1.f, 0.5f, 1.f, 1.f );
+    buffer.AddOccluder( -1.f, 0.5f, 1.f, -0.5f, 1.f );
+    TEST_CHECK( buffer.GetOccluderCount() == 0 );
+
+    buffer.AddOccluder( -1.f, -1.f, 1.f, 1.f, 1.f );
+    TEST_CHECK( buffer.GetOccluderCount() == 1 );
+    TEST_CHECK( !buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 100.f ) );
+
+    buffer.Rasterize();
+    TEST_CHECK( buffer.GetRasterizedCount() == 1 );
+    TEST_CHECK( buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 100.f ) );
+
+    // Clearing forgets the occluders and the tiles
+    buffer.Clear();
+    TEST_CHECK( buffer.GetOccluderCount() == 0 );
+    TEST_CHECK( buffer.GetRasterizedCount() == 0 );
+    TEST_CHECK( !buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 100.f ) );
+
+}	// TestEmpty
+
+
+/************************************************************************
+*    desc:  An occluder over the whole screen hides what's behind it,
+*           not what's at its depth or in front of it
+************************************************************************/
+static void TestDepth()
+{
+    COcclusionBuffer2D buffer;
+    buffer.SetResolution( 4, 4 );
+    buffer.AddOccluder( -1.f, -1.f, 1.f, 1.f, 5.f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.IsOccluded( -0.2f, -0.2f, 0.2f, 0.2f, 6.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -0.2f, -0.2f, 0.2f, 0.2f, 5.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -0.2f, -0.2f, 0.2f, 0.2f, 4.f ) );
+
+    // The part off the screen isn't drawn, so only the part on it counts
+    TEST_CHECK( buffer.IsOccluded( 0.5f, 0.5f, 3.f, 3.f, 6.f ) );
+
+    // Entirely off the screen it touches no tile, so it's left to the frustum
+    TEST_CHECK( !buffer.IsOccluded( 1.5f, 1.5f, 3.f, 3.f, 6.f ) );
+
+}	// TestDepth
+
+
+/************************************************************************
+*    desc:  Only the tiles an occluder fully covers are written, and a
+*           rectangle is only hidden if every tile it touches is
+************************************************************************/
+static void TestPartialTiles()
+{
+    // Each tile is half a unit of normalized device coordinates
+    COcclusionBuffer2D buffer;
+    buffer.SetResolution( 4, 4 );
+
+    // Covers the middle two by two tiles fully and the ring around them partly
+    buffer.AddOccluder( -0.6f, -0.6f, 0.6f, 0.6f, 1.f );
+
+    // Smaller than a tile, so it covers none
+    buffer.AddOccluder( 0.55f, 0.55f, 0.95f, 0.95f, 0.5f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.GetRasterizedCount() == 1 );
+
+    // Inside the covered tiles
+    TEST_CHECK( buffer.IsOccluded( -0.4f, -0.4f, 0.4f, 0.4f, 2.f ) );
+    TEST_CHECK( buffer.IsOccluded( 0.1f, 0.1f, 0.2f, 0.2f, 2.f ) );
+
+    // Inside the occluder but reaching a tile it only partly covers
+    TEST_CHECK( !buffer.IsOccluded( -0.55f, -0.4f, 0.4f, 0.4f, 2.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -0.4f, -0.4f, 0.4f, 0.55f, 2.f ) );
+
+    // Under the occluder that covers no tile
+    TEST_CHECK( !buffer.IsOccluded( 0.6f, 0.6f, 0.9f, 0.9f, 2.f ) );
+
+}	// TestPartialTiles
+
+
+/************************************************************************
+*    desc:  The occluders are rasterized front to back whatever order
+*           they were added in. One hidden by a nearer one is skipped,
+*           and a tile keeps the nearest depth
+************************************************************************/
+static void TestFrontToBack()
+{
+    COcclusionBuffer2D buffer;
+    buffer.SetResolution( 4, 4 );
+
+    buffer.AddOccluder( -0.5f, -0.5f, 0.5f, 0.5f, 10.f );
+    buffer.AddOccluder( -1.f, -1.f, 1.f, 1.f, 3.f );
+    buffer.AddOccluder( -1.f, -1.f, 0.f, 0.f, 7.f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.GetOccluderCount() == 3 );
+    TEST_CHECK( buffer.GetRasterizedCount() == 1 );
+
+    // Between the near occluder and the far ones
+    TEST_CHECK( buffer.IsOccluded( -0.4f, -0.4f, 0.4f, 0.4f, 5.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -0.4f, -0.4f, 0.4f, 0.4f, 2.f ) );
+
+    // Side by side occluders at different depths. The farther one decides
+    buffer.Clear();
+    buffer.AddOccluder( -1.f, -1.f, 0.f, 1.f, 2.f );
+    buffer.AddOccluder( 0.f, -1.f, 1.f, 1.f, 4.f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.GetRasterizedCount() == 2 );
+    TEST_CHECK( buffer.IsOccluded( -0.9f, -0.9f, -0.1f, 0.9f, 3.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -0.9f, -0.9f, 0.9f, 0.9f, 3.f ) );
+    TEST_CHECK( buffer.IsOccluded( -0.9f, -0.9f, 0.9f, 0.9f, 5.f ) );
+
+}	// TestFrontToBack
+
+
+/************************************************************************
+*    desc:  Rows that aren't a multiple of four tiles wide. The tiles
+*           past the last group of four are done one at a time
+************************************************************************/
+static void TestOddResolution()
+{
+    COcclusionBuffer2D buffer;
+    buffer.SetResolution( 7, 3 );
+
+    // Every tile but the last column. The edge is moved out a little so rounding can't drop a column
+    const float lastColumn = 1.f - (2.f / 7.f);
+    buffer.AddOccluder( -1.f, -1.f, lastColumn + 0.001f, 1.f, 1.f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.IsOccluded( -1.f, -1.f, lastColumn - 0.01f, 1.f, 2.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -1.f, -1.f, lastColumn + 0.01f, 1.f, 2.f ) );
+    TEST_CHECK( !buffer.IsOccluded( lastColumn + 0.01f, -0.5f, 0.99f, 0.5f, 2.f ) );
+
+    // The last column by itself
+    buffer.AddOccluder( lastColumn - 0.001f, -1.f, 1.f, 1.f, 1.5f );
+    buffer.Rasterize();
+
+    TEST_CHECK( buffer.IsOccluded( lastColumn + 0.01f, -0.5f, 0.99f, 0.5f, 2.f ) );
+    TEST_CHECK( buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 2.f ) );
+    TEST_CHECK( !buffer.IsOccluded( -1.f, -1.f, 1.f, 1.f, 1.25f ) );
+
+}	// TestOddResolution
+
+
+int main()
+{
+    TestEmpty();
+    TestDepth();
+    TestPartialTiles();
+    TestFrontToBack();
+    TestOddResolution();
+
+    return NTestCheck::Finish( "occlusionbuffer2dtest" );
+
+}	// main
@@ -0,0 +1,291 @@
+/************************************************************************
+*    FILE NAME:       renderqueue2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the radix sorted render queue. The
+*                     order it gives is checked against the multimap
+*                     the instance mesh used before it.
+************************************************************************/
+
+// Standard lib dependencies
+#include <map>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <climits>
+
+// Boost lib dependencies
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+// Game lib dependencies
+#include <common/worldpoint.h>
+#include <2d/renderqueue2d.h>
+#include <test/testcheck.h>
+
+// The multimap the instance mesh sorted with before the queue
+typedef std::multimap< CWorldValue, uint, std::greater<CWorldValue> > DepthMultiMap;
+
+// Orders insertion indexes by their depth keys
+class CKeyCompare
+{
+public:
+
+    CKeyCompare( const std::vector<uint> & _keyVec )
+        : keyVec(_keyVec)
+    {}
+
+    bool operator()( uint a, uint b ) const
+    { return keyVec[a] < keyVec[b]; }
+
+private:
+
+    const std::vector<uint> & keyVec;
+};
+
+/************************************************************************
+*    desc:  Make a depth
+************************************************************************/
+static CWorldValue MakeDepth( int i, float f )
+{
+    CWorldValue depth;
+    depth.i = i;
+    depth.f = f;
+
+    return depth;
+
+}	// MakeDepth
+
+
+/************************************************************************
+*    desc:  Fill the queue with the depths and sort it
+************************************************************************/
+static void SortDepths( CRenderQueue2D & queue, const std::vector<CWorldValue> & depthVec )
+{
+    queue.Clear();
+
+    for( size_t i = 0; i < depthVec.size(); ++i )
+        queue.Add( CRenderQueue2D::GetDepthKey( depthVec[i] ) );
+
+    queue.Sort();
+
+}	// SortDepths
+
+
+/************************************************************************
+*    desc:  Get the order the multimap walks the depths in
+************************************************************************/
+static void GetMultiMapOrder( const std::vector<CWorldValue> & depthVec, std::vector<uint> & orderVec )
+{
+    DepthMultiMap depthMultiMap;
+
+    for( size_t i = 0; i < depthVec.size(); ++i )
+        depthMultiMap.insert( std::make_pair( depthVec[i], static_cast<uint>(i) ) );
+
+    orderVec.clear();
+
+    for( DepthMultiMap::const_iterator iter = depthMultiMap.begin(); iter != depthMultiMap.end(); ++iter )
+        orderVec.push_back( iter->second );
+
+}	// GetMultiMapOrder
+
+
+/************************************************************************
+*    desc:  Check the queue against a stable sort of the keys, and against
+*           the multimap where the keys of two depths differ
+************************************************************************/
+static void CheckOrder( CRenderQueue2D & queue, const std::vector<CWorldValue> & depthVec )
+{
+    SortDepths( queue, depthVec );
+
+    if( !TEST_CHECK( queue.GetCount() == depthVec.size() ) )
+        return;
+
+    // A stable sort of the keys is the exact order, equal keys in the order they were added
+    std::vector<uint> keyVec( depthVec.size() );
+    std::vector<uint> expectedVec( depthVec.size() );
+
+    for( size_t i = 0; i < depthVec.size(); ++i )
+    {
+        keyVec[i] = CRenderQueue2D::GetDepthKey( depthVec[i] );
+        expectedVec[i] = static_cast<uint>(i);
+    }
+
+    std::stable_sort( expectedVec.begin(), expectedVec.end(), CKeyCompare( keyVec ) );
+
+    bool stable = true;
+    for( size_t i = 0; i < queue.GetCount(); ++i )
+        stable = stable && (queue.GetIndex( i ) == expectedVec[i]) && (queue.GetKey( i ) == keyVec[expectedVec[i]]);
+
+    TEST_CHECK( stable );
+
+    // Going back to front, no depth may be nearer than the one after it unless both have the same key
+    bool backToFront = true;
+    for( size_t i = 1; i < queue.GetCount(); ++i )
+        backToFront = backToFront && ((queue.GetKey( i ) == queue.GetKey( i - 1 )) ||
+            (depthVec[ queue.GetIndex( i - 1 ) ] > depthVec[ queue.GetIndex( i ) ]));
+
+    TEST_CHECK( backToFront );
+
+}	// CheckOrder
+
+
+/************************************************************************
+*    desc:  Depths that each get a key of their own, so the queue has to
+*           give exactly the multimap's order, equal depths included
+************************************************************************/
+static void TestMatchesMultiMap()
+{
+    boost::random::mt19937 generator( 12345 );
+    boost::random::uniform_int_distribution<int> intDist( -500, 500 );
+    boost::random::uniform_int_distribution<int> fractionDist( 0, 3 );
+
+    CRenderQueue2D queue;
+    std::vector<CWorldValue> depthVec;
+    std::vector<uint> multiMapVec;
+
+    const size_t countVec[] = { 0, 1, 2, 17, 2048, 5000 };
+
+    for( size_t c = 0; c < sizeof(countVec) / sizeof(countVec[0]); ++c )
+    {
+        depthVec.clear();
+
+        for( size_t i = 0; i < countVec[c]; ++i )
+            depthVec.push_back( MakeDepth( intDist( generator ), fractionDist( generator ) * 0.25f ) );
+
+        SortDepths( queue, depthVec );
+        GetMultiMapOrder( depthVec, multiMapVec );
+
+        bool same = (queue.GetCount() == multiMapVec.size());
+        for( size_t i = 0; same && (i < multiMapVec.size()); ++i )
+            same = (queue.GetIndex( i ) == multiMapVec[i]);
+
+        TEST_CHECK( same );
+
+        CheckOrder( queue, depthVec );
+    }
+
+}	// TestMatchesMultiMap
+
+
+/************************************************************************
+*    desc:  Equal keys keep the order they were added in, also when every
+*           key is the same and the passes are skipped
+************************************************************************/
+static void TestStability()
+{
+    CRenderQueue2D queue;
+    std::vector<CWorldValue> depthVec( 3000, MakeDepth( 7, 0.5f ) );
+
+    SortDepths( queue, depthVec );
+
+    bool inOrder = true;
+    for( size_t i = 0; i < queue.GetCount(); ++i )
+        inOrder = inOrder && (queue.GetIndex( i ) == i);
+
+    TEST_CHECK( inOrder );
+
+    // Two depths interleaved. Each one's entries have to stay in the order they were added
+    depthVec.clear();
+    for( int i = 0; i < 3000; ++i )
+        depthVec.push_back( MakeDepth( (i % 2 == 0) ? 10 : -10, 0 ) );
+
+    CheckOrder( queue, depthVec );
+
+    TEST_CHECK( depthVec[ queue.GetIndex( 0 ) ].i == 10 );
+    TEST_CHECK( queue.GetIndex( 0 ) == 0 );
+    TEST_CHECK( queue.GetIndex( 1 ) == 2 );
+    TEST_CHECK( queue.GetIndex( 1500 ) == 1 );
+    TEST_CHECK( queue.GetIndex( 2999 ) == 2999 );
+
+}	// TestStability
+
+
+/************************************************************************
+*    desc:  Negative depths and depths too big for a float to keep apart
+************************************************************************/
+static void TestNegativeAndHugeDepths()
+{
+    boost::random::mt19937 generator( 777 );
+    boost::random::uniform_int_distribution<int> hugeDist( INT_MIN, INT_MAX );
+    boost::random::uniform_int_distribution<int> smallDist( -3, 3 );
+
+    CRenderQueue2D queue;
+    std::vector<CWorldValue> depthVec;
+
+    // The ends of the range, zero and both signs near it
+    depthVec.push_back( MakeDepth( INT_MAX, 0.99f ) );
+    depthVec.push_back( MakeDepth( INT_MIN, 0 ) );
+    depthVec.push_back( MakeDepth( 0, 0 ) );
+    depthVec.push_back( MakeDepth( -1, 0.5f ) );
+    depthVec.push_back( MakeDepth( 0, 0.5f ) );
+    depthVec.push_back( MakeDepth( INT_MAX - 1, 0 ) );
+    depthVec.push_back( MakeDepth( INT_MIN + 1, 0 ) );
+    depthVec.push_back( MakeDepth( -1, 0 ) );
+
+    CheckOrder( queue, depthVec );
+
+    // The furthest depth comes first and the nearest last
+    TEST_CHECK( queue.GetIndex( 0 ) == 0 );
+    TEST_CHECK( depthVec[ queue.GetIndex( queue.GetCount() - 1 ) ].i < -1000 );
+
+    // A mix of huge and small depths of both signs. Most huge ones share keys with their neighbors
+    depthVec.clear();
+    for( int i = 0; i < 20000; ++i )
+    {
+        if( i % 3 == 0 )
+            depthVec.push_back( MakeDepth( smallDist( generator ), 0 ) );
+        else
+            depthVec.push_back( MakeDepth( hugeDist( generator ), 0.5f ) );
+    }
+
+    CheckOrder( queue, depthVec );
+
+}	// TestNegativeAndHugeDepths
+
+
+/************************************************************************
+*    desc:  Entries added with an index of their own give that index back,
+*           and a cleared queue sorts again from scratch
+************************************************************************/
+static void TestIndexesAndReuse()
+{
+    CRenderQueue2D queue;
+
+    queue.Add( 30, 100 );
+    queue.Add( 10, 200 );
+    queue.Add( 20, 300 );
+    queue.Add( 10, 400 );
+    queue.Sort();
+
+    TEST_CHECK( queue.GetCount() == 4 );
+    TEST_CHECK( queue.GetIndex( 0 ) == 200 );
+    TEST_CHECK( queue.GetIndex( 1 ) == 400 );
+    TEST_CHECK( queue.GetIndex( 2 ) == 300 );
+    TEST_CHECK( queue.GetIndex( 3 ) == 100 );
+
+    // Keys that differ only in the top pass
+    queue.Clear();
+    TEST_CHECK( queue.IsEmpty() );
+
+    queue.Add( 0xFFC00000 );
+    queue.Add( 0x00000001 );
+    queue.Add( 0x80000000 );
+    queue.Sort();
+
+    TEST_CHECK( queue.GetIndex( 0 ) == 1 );
+    TEST_CHECK( queue.GetIndex( 1 ) == 2 );
+    TEST_CHECK( queue.GetIndex( 2 ) == 0 );
+
+}	// TestIndexesAndReuse
+
+
+int main()
+{
+    TestMatchesMultiMap();
+    TestStability();
+    TestNegativeAndHugeDepths();
+    TestIndexesAndReuse();
+
+    return NTestCheck::Finish( "renderqueue2dtest" );
+
+}	// main
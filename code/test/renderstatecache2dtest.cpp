@@ -0,0 +1,168 @@
+/************************************************************************
+*    FILE NAME:       renderstatecache2dtest.cpp
+*
+*    DESCRIPTION:     Unit test of the render state cache on the
+*                     recording device. Checks which calls reach the
+*                     device, and that nothing the cache knows outlives
+*                     a render once other code has changed the device.
+************************************************************************/
+
+// Game lib dependencies
+#include <2d/renderstatecache2d.h>
+#include <2d/nulldevice2d.h>
+#include <2d/recordingdevice2d.h>
+#include <test/testcheck.h>
+
+/************************************************************************
+*    desc:  Calls that wouldn't change a binding are dropped, the rest
+*           reach the device
+************************************************************************/
+static void TestFiltering( CRecordingDevice2D & device )
+{
+    CRenderStateCache2D & cache = CRenderStateCache2D::Instance();
+    cache.Invalidate();
+    cache.ResetCounters();
+    device.Clear();
+
+    IDirect3DVertexDeclaration9 * pDeclaration = reinterpret_cast<IDirect3DVertexDeclaration9 *>(0x10);
+    IDirect3DVertexBuffer9 * pBuffer = reinterpret_cast<IDirect3DVertexBuffer9 *>(0x20);
+    IDirect3DIndexBuffer9 * pIndexBuffer = reinterpret_cast<IDirect3DIndexBuffer9 *>(0x30);
+
+    cache.SetVertexDeclaration( pDeclaration );
+    cache.SetVertexDeclaration( pDeclaration );
+    cache.SetStreamSource( 0, pBuffer, 0, 32 );
+    cache.SetStreamSource( 0, pBuffer, 0, 32 );
+    cache.SetStreamSource( 0, pBuffer, 64, 32 );
+    cache.SetStreamSourceFreq( 1, 1 );
+    cache.SetStreamSourceFreq( 1, 1 );
+    cache.SetIndices( pIndexBuffer );
+    cache.SetIndices( pIndexBuffer );
+    cache.SetRenderState( D3DRS_ZENABLE, D3DZB_TRUE );
+    cache.SetRenderState( D3DRS_ZENABLE, D3DZB_TRUE );
+    cache.SetRenderState( D3DRS_ZENABLE, D3DZB_FALSE );
+
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_VERTEX_DECLARATION ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_STREAM_SOURCE ) == 2 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_STREAM_SOURCE_FREQ ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_INDICES ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_RENDER_STATE ) == 2 );
+    TEST_CHECK( cache.GetIssuedCount() == 7 );
+    TEST_CHECK( cache.GetFilteredCount() == 5 );
+
+    // Streams past the tracked ones are always issued
+    cache.SetStreamSource( 9, pBuffer, 0, 32 );
+    cache.SetStreamSource( 9, pBuffer, 0, 32 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_STREAM_SOURCE ) == 4 );
+
+    cache.Invalidate();
+
+}	// TestFiltering
+
+
+/************************************************************************
+*    desc:  Another renderer changes the device between two renders of
+*           a frame and the next frame. The render after it invalidates
+*           the cache, so its calls are issued again and the render
+*           states are read from the device again
+************************************************************************/
+static void TestOtherRenderers( CRecordingDevice2D & device )
+{
+    CRenderStateCache2D & cache = CRenderStateCache2D::Instance();
+    IDirect3DVertexDeclaration9 * pDeclaration = reinterpret_cast<IDirect3DVertexDeclaration9 *>(0x10);
+
+    // The first render
+    cache.Invalidate();
+    cache.SetVertexDeclaration( pDeclaration );
+    cache.SetRenderState( D3DRS_ALPHATESTENABLE, TRUE );
+    TEST_CHECK( cache.GetRenderState( D3DRS_ALPHATESTENABLE ) == TRUE );
+
+    // Known states are answered without the device
+    device.Clear();
+    TEST_CHECK( cache.GetRenderState( D3DRS_ALPHATESTENABLE ) == TRUE );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_GET_RENDER_STATE ) == 0 );
+
+    // A renderer that doesn't use the cache
+    device.SetVertexDeclaration( NULL );
+    device.SetRenderState( D3DRS_ALPHATESTENABLE, FALSE );
+    device.Clear();
+
+    // The next render
+    cache.Invalidate();
+    cache.ResetCounters();
+
+    TEST_CHECK( cache.GetRenderState( D3DRS_ALPHATESTENABLE ) == FALSE );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_GET_RENDER_STATE ) == 1 );
+
+    // Asked once per render
+    TEST_CHECK( cache.GetRenderState( D3DRS_ALPHATESTENABLE ) == FALSE );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_GET_RENDER_STATE ) == 1 );
+
+    // The declaration the cache set before is set again
+    cache.SetVertexDeclaration( pDeclaration );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_VERTEX_DECLARATION ) == 1 );
+
+    // So is a state read back from the device that's set to what the other renderer left
+    cache.SetRenderState( D3DRS_ALPHATESTENABLE, FALSE );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_RENDER_STATE ) == 0 );
+    cache.SetRenderState( D3DRS_ALPHATESTENABLE, TRUE );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_RENDER_STATE ) == 1 );
+
+    // The effect and texture calls are issued again too
+    IDirect3DBaseTexture9 * pTexture = reinterpret_cast<IDirect3DBaseTexture9 *>(0x40);
+    device.Clear();
+    cache.SelectTexture( pTexture );
+    cache.SelectTexture( pTexture );
+    cache.SetEffectAndTechnique( "shader_2d", "instance" );
+    cache.SetEffectAndTechnique( "shader_2d", "instance" );
+    const size_t issuedCount = cache.GetIssuedCount();
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SELECT_TEXTURE ) == 1 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE ) == 1 );
+
+    cache.Invalidate();
+    cache.SelectTexture( pTexture );
+    cache.SetEffectAndTechnique( "shader_2d", "instance" );
+    TEST_CHECK( cache.GetIssuedCount() == issuedCount + 2 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SELECT_TEXTURE ) == 2 );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_EFFECT_AND_TECHNIQUE ) == 2 );
+
+}	// TestOtherRenderers
+
+
+/************************************************************************
+*    desc:  Setting or resetting the device forgets the bindings
+************************************************************************/
+static void TestDeviceChanges( CRecordingDevice2D & device )
+{
+    CRenderStateCache2D & cache = CRenderStateCache2D::Instance();
+    IDirect3DIndexBuffer9 * pIndexBuffer = reinterpret_cast<IDirect3DIndexBuffer9 *>(0x30);
+
+    cache.SetIndices( pIndexBuffer );
+    device.Clear();
+
+    CGraphicsDevice2D::LostDevice();
+    CGraphicsDevice2D::ResetDevice();
+    cache.SetIndices( pIndexBuffer );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_INDICES ) == 1 );
+
+    CGraphicsDevice2D::SetInstance( &device );
+    cache.SetIndices( pIndexBuffer );
+    TEST_CHECK( device.GetCallCount( CRecordingDevice2D::ECT_SET_INDICES ) == 2 );
+
+}	// TestDeviceChanges
+
+
+int main()
+{
+    CNullDevice2D nullDevice;
+    CRecordingDevice2D device( nullDevice );
+    CGraphicsDevice2D::SetInstance( &device );
+
+    TestFiltering( device );
+    TestOtherRenderers( device );
+    TestDeviceChanges( device );
+
+    CGraphicsDevice2D::SetInstance( NULL );
+
+    return NTestCheck::Finish( "renderstatecache2dtest" );
+
+}	// main
@@ -0,0 +1,49 @@
+/************************************************************************
+*    FILE NAME:       testcheck.h
+*
+*    DESCRIPTION:     Checks of the unit tests. Each test is a program
+*                     of its own that needs no device or window, so it
+*                     runs headless. It prints the checks that fail and
+*                     returns nonzero if any did.
+************************************************************************/
+
+#ifndef __test_check_h__
+#define __test_check_h__
+
+// Standard lib dependencies
+#include <cstdio>
+
+// Check a condition. Execution goes on after a failed check so every failure is printed
+#define TEST_CHECK( condition ) NTestCheck::Check( (condition), #condition, __FILE__, __LINE__ )
+
+namespace NTestCheck
+{
+    // Get the number of failed checks
+    inline int & GetFailCount()
+    {
+        static int failCount = 0;
+        return failCount;
+    }
+
+    // Count a check and print it if it failed
+    inline bool Check( bool passed, const char * pCondition, const char * pFile, int line )
+    {
+        if( !passed )
+        {
+            ++GetFailCount();
+            std::printf( "FAILED %s(%d): %s\n", pFile, line, pCondition );
+        }
+
+        return passed;
+    }
+
+    // Print the result of a test. Returns what the test's main returns
+    inline int Finish( const char * pTestName )
+    {
+        std::printf( "%s: %s (%d failed)\n", pTestName, (GetFailCount() == 0) ? "passed" : "FAILED", GetFailCount() );
+
+        return (GetFailCount() == 0) ? 0 : 1;
+    }
+}
+
+#endif  // __test_check_h__
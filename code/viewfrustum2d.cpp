@@ -0,0 +1,165 @@
+/************************************************************************
+*    FILE NAME:       viewfrustum2d.cpp
+*
+*    DESCRIPTION:     View frustum of a 2D projection. Culls the bounding
+*                     spheres of sprites four at a time.
+************************************************************************/
+
+// Physical component dependency
+#include <2d/viewfrustum2d.h>
+
+// Standard lib dependencies
+#include <cmath>
+
+// SIMD lib dependencies
+#include <emmintrin.h>
+
+// Game lib dependencies
+#include <2d/affinebatch2d.h>
+
+/************************************************************************
+*    desc:  Constructor. Every sphere is visible until a projection is set
+************************************************************************/
+CViewFrustum2D::CViewFrustum2D()
+{
+    for( int i = 0; i < PLANE_COUNT; ++i )
+    {
+        a[i] = 0.f;
+        b[i] = 0.f;
+        c[i] = 0.f;
+        d[i] = 1.f;
+    }
+
+}   // Constructor
+
+
+/************************************************************************
+*    desc:  Get the planes out of a row major projection matrix. Points
+*           are row vectors, so each clip space value is a column of the
+*           matrix. Inside is -w <= x <= w, -w <= y <= w and 0 <= z <= w
+*
+*	 param:	const float * pMatrix - 16 floats of a row major matrix
+************************************************************************/
+void CViewFrustum2D::SetProjection( const float * pMatrix )
+{
+    // Plane sign of the x, y and z columns and which column each plane uses
+    const float sign[PLANE_COUNT] = { 1.f, -1.f, 1.f, -1.f, 1.f, -1.f };
+    const int column[PLANE_COUNT] = { 0, 0, 1, 1, 2, 2 };
+
+    for( int i = 0; i < PLANE_COUNT; ++i )
+    {
+        const int col = column[i];
+
+        // The near plane is the z column on its own
+        const float w = (i == 4) ? 0.f : 1.f;
+
+        a[i] = w * pMatrix[3]  + sign[i] * pMatrix[col];
+        b[i] = w * pMatrix[7]  + sign[i] * pMatrix[4 + col];
+        c[i] = w * pMatrix[11] + sign[i] * pMatrix[8 + col];
+        d[i] = w * pMatrix[15] + sign[i] * pMatrix[12 + col];
+
+        // Normalize the plane so the distance can be compared with the radius
+        const float length = std::sqrt( a[i] * a[i] + b[i] * b[i] + c[i] * c[i] );
+
+        if( length > 0.f )
+        {
+            a[i] /= length;
+            b[i] /= length;
+            c[i] /= length;
+            d[i] /= length;
+        }
+    }
+
+}	// SetProjection
+
+
+/************************************************************************
+*    desc:  Check if a sphere is at least partly inside the frustum
+*
+*	 param:	float x, y, z  - center of the sphere
+*			float radius   - radius of the sphere
+*
+*	 ret:	bool - true if the sphere can be seen
+************************************************************************/
+bool CViewFrustum2D::IsVisible( float x, float y, float z, float radius ) const
+{
+    for( int i = 0; i < PLANE_COUNT; ++i )
+    {
+        if( a[i] * x + b[i] * y + c[i] * z + d[i] + radius < 0.f )
+            return false;
+    }
+
+    return true;
+
+}	// IsVisible
+
+
+/************************************************************************
+*    desc:  Check count spheres given in structure of arrays form. Uses
+*           SSE2 unless the affine batch was set to the scalar path
+*
+*	 param:	const float * pX, pY, pZ - centers of the spheres
+*			const float * pRadius    - radii of the spheres
+*			size_t count             - amount of spheres
+*			uint * pVisible          - 1 for visible spheres and 0 for the rest
+*
+*	 ret:	size_t - number of visible spheres
+************************************************************************/
+size_t CViewFrustum2D::CullSpheres( const float * pX, const float * pY, const float * pZ, const float * pRadius,
+                                    size_t count, uint * pVisible ) const
+{
+    size_t visibleCount = 0;
+    size_t i = 0;
+
+    if( CAffineBatch2D::GetSimdPath() != CAffineBatch2D::ESP_SCALAR )
+    {
+        // Hoist the planes into registers
+        __m128 planeA[PLANE_COUNT], planeB[PLANE_COUNT], planeC[PLANE_COUNT], planeD[PLANE_COUNT];
+
+        for( int j = 0; j < PLANE_COUNT; ++j )
+        {
+            planeA[j] = _mm_set1_ps( a[j] );
+            planeB[j] = _mm_set1_ps( b[j] );
+            planeC[j] = _mm_set1_ps( c[j] );
+            planeD[j] = _mm_set1_ps( d[j] );
+        }
+
+        const __m128 zero = _mm_setzero_ps();
+
+        for( ; i + 4 <= count; i += 4 )
+        {
+            const __m128 x = _mm_loadu_ps( &pX[i] );
+            const __m128 y = _mm_loadu_ps( &pY[i] );
+            const __m128 z = _mm_loadu_ps( &pZ[i] );
+            const __m128 radius = _mm_loadu_ps( &pRadius[i] );
+
+            __m128 inside = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+
+            for( int j = 0; j < PLANE_COUNT; ++j )
+            {
+                __m128 dist = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( planeA[j], x ), _mm_mul_ps( planeB[j], y ) ),
+                                                      _mm_mul_ps( planeC[j], z ) ), planeD[j] );
+
+                inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( dist, radius ), zero ) );
+            }
+
+            const int bits = _mm_movemask_ps( inside );
+
+            for( int k = 0; k < 4; ++k )
+            {
+                pVisible[i + k] = (bits >> k) & 1;
+                visibleCount += pVisible[i + k];
+            }
+        }
+    }
+
+    // The remainder
+    for( ; i < count; ++i )
+    {
+        pVisible[i] = IsVisible( pX[i], pY[i], pZ[i], pRadius[i] ) ? 1 : 0;
+        visibleCount += pVisible[i];
+    }
+
+    return visibleCount;
+
+}	// CullSpheres
@@ -0,0 +1,51 @@
+/************************************************************************
+*    FILE NAME:       viewfrustum2d.h
+*
+*    DESCRIPTION:     View frustum of a 2D projection. Culls the bounding
+*                     spheres of sprites four at a time.
+************************************************************************/
+
+#ifndef __view_frustum_2d_h__
+#define __view_frustum_2d_h__
+
+// Standard lib dependencies
+#include <cstddef>
+
+// Game lib dependencies
+#include <common/defs.h>
+
+class CViewFrustum2D
+{
+public:
+
+    // Constructor
+    CViewFrustum2D();
+
+    // Get the planes out of a row major projection matrix. The sprite positions
+    // already have the camera in them, so the view is the identity
+    void SetProjection( const float * pMatrix );
+
+    // Check if a sphere is at least partly inside the frustum
+    bool IsVisible( float x, float y, float z, float radius ) const;
+
+    // Check count spheres given in structure of arrays form. Writes 1 to pVisible for
+    // the spheres that are at least partly inside and 0 for the rest
+    size_t CullSpheres( const float * pX, const float * pY, const float * pZ, const float * pRadius,
+                        size_t count, uint * pVisible ) const;
+
+private:
+
+    // Left, right, bottom, top, near and far
+    enum
+    {
+        PLANE_COUNT = 6
+    };
+
+    // The planes as a * x + b * y + c * z + d. The normals point inside and are unit length
+    float a[PLANE_COUNT];
+    float b[PLANE_COUNT];
+    float c[PLANE_COUNT];
+    float d[PLANE_COUNT];
+};
+
+#endif  // __view_frustum_2d_h__